@@ -46,4 +46,16 @@ void FFTmodarg_to_reim(float *** re_mod, float *** im_arg, int l);
 float ***FFTinv_quarter(float *** vect, int dimension);
 void FFTreim_to_modarg (float *** re_mod, float *** im_arg, int l);
 
+/* A complex FFT of one power of 2 length, with its bit reversal and
+   twiddle factors computed once. Unlike the functions above it keeps no
+   global state, so a plan can be shared by threads transforming different
+   lines. The backward transform is not scaled by 1/length. */
+typedef struct FFT_PLAN FFT_PLAN;
+
+FFT_PLAN *FFTallocPlan(int length);
+void FFTfreePlan(FFT_PLAN **pplan);
+int FFTplanLength(const FFT_PLAN *plan);
+void FFTplanForward(const FFT_PLAN *plan, float *re, float *im);
+void FFTplanBackward(const FFT_PLAN *plan, float *re, float *im);
+
 #endif
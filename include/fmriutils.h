@@ -101,6 +101,9 @@ int MRIfromSymMatrix(MRI *mri, int c, int r, int s, MATRIX *M);
 MRI *MRInormWeights(MRI *w, int sqrtFlag, int invFlag, MRI *mask, MRI *wn);
 
 int MRIglmFitAndTest(MRIGLM *mriglm);
+int MRIglmFitAndTestStream(MRIGLM *mriglm, MRI_STREAM *ystream, size_t slab_bytes);
+MRIGLM *MRIglmCopyDesign(MRIGLM *mriglm);
+int MRIglmFreeCopy(MRIGLM **pcopy);
 int MRIglmFit(MRIGLM *glmmri);
 int MRIglmTest(MRIGLM *mriglm);
 int MRIglmLoadVox(MRIGLM *mriglm, int c, int r, int s, int LoadBeta);
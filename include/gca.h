@@ -155,6 +155,9 @@ typedef struct
   short   n_just_priors ;
   int     ntraining ;
   char    regularized ;
+  float   *gauss_cache ;  /* covars and their inverse when the cache was built,
+                             see GCAbuildGaussianCache() */
+  double  gauss_det ;     /* determinant of covars when the cache was built */
 }
 GC1D, GAUSSIAN_CLASSIFIER_1D ;
 
@@ -191,6 +194,9 @@ typedef struct
 }
 GCA_TISSUE_PARMS ;
 
+/* memory of an atlas read with GCAreadFlat() */
+typedef struct GCA_FLAT GCA_FLAT ;
+
 typedef struct
 {
   float     node_spacing ;    /* inter-node spacing */
@@ -234,6 +240,7 @@ typedef struct
   int          total_training ;
   int          max_label ;
   COLOR_TABLE  *ct ;
+  GCA_FLAT     *flat ;    /* mapped file the nodes and priors point into, or NULL */
 }
 GAUSSIAN_CLASSIFIER_ARRAY, GCA ;
 
@@ -289,6 +296,10 @@ int  GCAtrain(GCA *gca, MRI *mri_inputs, MRI *mri_labels, TRANSFORM *transform,
 int  GCAtrainCovariances(GCA *gca, MRI *mri_inputs, MRI *mri_labels, TRANSFORM *transform) ;
 int  GCAwrite(GCA *gca,const char *fname) ;
 GCA  *GCAread(const char *fname) ;
+/* flat atlases (.gcaf), mapped rather than read; GCAread()/GCAwrite() use them as needed */
+int  GCAisFlat(const char *fname) ;
+GCA  *GCAreadFlat(const char *fname) ;
+int  GCAwriteFlat(GCA *gca, const char *fname) ;
 int  GCAcompleteMeanTraining(GCA *gca) ;
 int  GCAcompleteCovarianceTraining(GCA *gca) ;
 MRI  *GCAlabel(MRI *mri_src, GCA *gca, MRI *mri_dst, TRANSFORM *transform) ;
@@ -510,6 +521,7 @@ MATRIX *load_covariance_matrix( const GC1D *gc,
 				MATRIX *m_cov, const int ninputs);
 MATRIX *load_inverse_covariance_matrix(GC1D *gc, MATRIX *m_cov, int ninputs) ;
 double covariance_determinant( const GC1D *gc, const int ninputs );
+int GCAbuildGaussianCache(GCA *gca) ;
 void load_vals( const MRI *mri_inputs,
 		float x, float y, float z,
 		float *vals, int ninputs ) ;
@@ -567,6 +579,7 @@ int free_gcs(GC1D *gcs, int nlabels, int ninputs) ;
 int GCAmapRenormalizeByClass(GCA *gca, MRI *mri, TRANSFORM *transform) ;
 extern int Ggca_x, Ggca_y, Ggca_z, Ggca_label, Ggca_nbr_label, Gxp, Gyp, Gzp ;
 extern char *G_write_probs ;
+extern int gca_icm_checkerboard ;  // GCAreclassifyUsingGibbsPriors() relabels a checkerboard color at a time, in parallel
 MRI *GCAmarkImpossible(GCA *gca, MRI *mri_labeled, MRI *mri_dst, TRANSFORM *transform) ;
 int GCAclassMode(GCA *gca, int the_class, float *modes) ;
 int GCAcomputeLabelMeansAndCovariances(GCA *gca, int target_label, MATRIX **p_mcov, VECTOR **p_vmeans) ;
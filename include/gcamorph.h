@@ -50,27 +50,40 @@ extern "C" {
 #define GCAM_RAS         1
 #define GCAM_VOX         2
 
+/*
+  node positions and their saved copies are double unless
+  GCAM_SINGLE_PRECISION is defined (configure --enable-gcam-single-precision,
+  cmake -DGCAM_SINGLE_PRECISION=ON), which stores them in float as the GPU
+  code does and takes a node from 264 to 192 bytes. The results then
+  differ from the double build in the low digits.
+*/
+#ifdef GCAM_SINGLE_PRECISION
+typedef float GCAM_REAL ;
+#else
+typedef double GCAM_REAL ;
+#endif
+
 typedef struct
 {
   // gcamorph uses these fields in its hottest function so put them together to reduce cache misses
   char   invalid;       /* if invalid = 1, then don't use this structure */
   int    label ;
-  double x ;          //  updated original src voxel position
-  double y ;
-  double z ;
-  double origx ;      //  mri original src voxel position (using lta)
-  double origy ;
-  double origz ;
+  GCAM_REAL x ;          //  updated original src voxel position
+  GCAM_REAL y ;
+  GCAM_REAL z ;
+  GCAM_REAL origx ;      //  mri original src voxel position (using lta)
+  GCAM_REAL origy ;
+  GCAM_REAL origz ;
   //
-  double saved_origx ;      //  mri original src voxel position (using lta)
-  double saved_origy ;
-  double saved_origz ;
-  double xs ;         //  not saved
-  double ys ;
-  double zs ;
-  double xs2 ;         //  more tmp storage
-  double ys2 ;
-  double zs2 ;
+  GCAM_REAL saved_origx ;      //  mri original src voxel position (using lta)
+  GCAM_REAL saved_origy ;
+  GCAM_REAL saved_origz ;
+  GCAM_REAL xs ;         //  not saved
+  GCAM_REAL ys ;
+  GCAM_REAL zs ;
+  GCAM_REAL xs2 ;         //  more tmp storage
+  GCAM_REAL ys2 ;
+  GCAM_REAL zs2 ;
   int    xn ;         /* node coordinates */
   int    yn ;         //  prior voxel position
   int    zn ;
@@ -92,8 +105,8 @@ typedef struct
   float  last_se ;
   float  predicted_val ; /* weighted average of all class 
                             means in a ball around this node */
-  double sum_ci_vi_ui ;
-  double sum_ci_vi ;
+  GCAM_REAL sum_ci_vi_ui ;
+  GCAM_REAL sum_ci_vi ;
   float  target_dist ;   /* target distance to move towards for 
                             label matching with distance xform */
 }
@@ -104,6 +117,7 @@ typedef struct
   int  width, height ,depth ;
   GCA  *gca ;          // using a separate GCA data (not saved)
   GMN  ***nodes ;
+  GMN  *node_data ;    // all of the nodes in one block, z fastest, that nodes[x][y] point into
   int  neg ;
   double exp_k ;
   int  spacing ;
@@ -121,6 +135,19 @@ typedef struct
 }
 GCA_MORPH, GCAM ;
 
+/*
+  the nodes of a morph are contiguous, so loops that treat each node on its
+  own can run over them linearly:
+    for (i = 0 ; i < GCAM_NNODES(gcam) ; i++) { gcamn = GCAM_NODE(gcam, i) ; ... }
+  and the 6-connected neighbors of node i are at i +/- 1 (z), i +/- depth (y)
+  and i +/- height*depth (x). The x/y/z loops (the energy terms, which sum
+  per x plane so that the result does not depend on the thread count) run
+  z fastest, so they visit the block in this same order.
+*/
+#define GCAM_NNODES(gcam)               ((gcam)->width * (gcam)->height * (gcam)->depth)
+#define GCAM_NODE(gcam, i)              (&(gcam)->node_data[i])
+#define GCAM_NODE_INDEX(gcam, x, y, z)  ((((x) * (gcam)->height) + (y)) * (gcam)->depth + (z))
+
 typedef struct
 {
   GCAM   *gcam ;
@@ -567,6 +594,10 @@ double MRIlabelMorphSSE(MRI *mri_source, MRI *mri_atlas, MRI *mri_morph) ;
   
   int gcamApplyGradient( GCA_MORPH *gcam, GCA_MORPH_PARMS *parms );
   int gcamUndoGradient( GCA_MORPH *gcam );
+  //! Line search for the time step along the current gradient
+  double gcamFindOptimalTimeStep( GCA_MORPH *gcam,
+				  GCA_MORPH_PARMS *parms,
+				  MRI *mri );
 
   int gcamClearGradient( GCA_MORPH *gcam );
   int gcamClearMomentum( GCA_MORPH *gcam ) ;
@@ -627,6 +658,24 @@ double MRIlabelMorphSSE(MRI *mri_source, MRI *mri_atlas, MRI *mri_morph) ;
   int gcamComputeGradient( GCA_MORPH *gcam, MRI *mri, MRI *mri_smooth,
 			   GCA_MORPH_PARMS *parms );
 
+  //! The log-likelihood, smoothness and Jacobian terms in one pass
+  int gcamFusedTerms( GCA_MORPH *gcam,
+		      const MRI *mri,
+		      const MRI *mri_smooth,
+		      GCA_MORPH_PARMS *parms );
+  //! The log-likelihood, smoothness and Jacobian energies in one pass
+  int gcamFusedEnergies( const GCA_MORPH *gcam,
+			 MRI *mri,
+			 double *pll_sse,
+			 double *ps_sse,
+			 double *pj_sse );
+  //! Use gcamFusedTerms and gcamFusedEnergies in gcamComputeGradient and gcamComputeSSE
+  extern int gcam_fused_terms ;
+  //! Try each time step in gcamFindOptimalTimeStep on saved positions instead of applying and undoing it
+  extern int gcam_timestep_overlay ;
+  //! Sweep several time steps in one pass when only the fused energies are on
+  extern int gcam_timestep_sweep ;
+
 
   int gcamSmoothGradient( GCA_MORPH *gcam, int navgs );
 
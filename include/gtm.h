@@ -69,6 +69,20 @@ typedef struct
   MATRIX *p;
 } GTM_CONTRAST, GTMCON;
 
+/* A GTM design matrix (nmask-by-nsegs) in compressed sparse column
+   form. Column n is val[colptr[n]] ... val[colptr[n+1]-1] at rows
+   rowind[] (0-based, increasing, in the order of GTMvol2mat()). A seg
+   only spills into the bounding box around it, so X takes a small
+   fraction of the memory of the dense matrix. */
+typedef struct 
+{
+  int rows, cols;
+  long nnz;
+  long *colptr; // cols+1
+  int *rowind;  // nnz
+  float *val;   // nnz
+} GTM_SPARSE;
+
 typedef struct 
 {
   int nrad;
@@ -111,6 +125,7 @@ typedef struct
   int nmask; // number of voxels in the mask
 
   int nsegs,*segidlist; // number of segments in segmentation, list of segids
+  int *nthseglut, nnthseglut; // nthseg of each segid (or -1), from GTMsegidlist()
   int *nperseg; // number of voxels per seg measured in pet space
   MATRIX *nvox; // same as nperseg, doh
   MRI *volperseg; // volume of each segment (nperseg * voxsize) measure in anat seg space
@@ -121,7 +136,8 @@ typedef struct
   MATRIX *ttpct; // percent of the signal in each seg from each tt
 
   // GLM stuff for GTM
-  MATRIX *X,*X0;
+  GTM_SPARSE *X,*X0; // with and without PSF
+  int SolveCG; // solve for beta with conjugate gradients instead of inv(XtX)
   MATRIX *y, *XtX, *iXtX, *Xty, *beta, *res, *yhat,*betavar;
   MATRIX *rvar,*rvargm,*rvarbrain,*rvarUnscaled; // residual variance, all vox and only GM
   MATRIX *som; // spillover matrix
@@ -234,5 +250,14 @@ MRI **GTMlocal(GTM *gtm, MRI **pvc);
 int GTMttPercent(GTM *gtm);
 int GTMsom(GTM *gtm);
 int GTMsegid2nthseg(GTM *gtm, int segid);
+int *GTMnthsegPerRow(GTM *gtm);
+
+GTM_SPARSE *GTMsparseAlloc(int rows, int cols, long nnz);
+int GTMsparseFree(GTM_SPARSE **pX);
+MATRIX *GTMsparseToMatrix(GTM_SPARSE *X, MATRIX *m);
+MATRIX *GTMsparseMultiply(GTM_SPARSE *X, MATRIX *B, MATRIX *C);
+MATRIX *GTMsparseAtB(GTM_SPARSE *X, MATRIX *B, MATRIX *C);
+MATRIX *GTMsparseMtN(GTM_SPARSE *M, GTM_SPARSE *N, MATRIX *MtN);
+int GTMsolveCG(MATRIX *A, MATRIX *B, MATRIX *X, double tol, int maxiter);
 
 #endif
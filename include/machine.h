@@ -27,6 +27,7 @@
 #ifndef MACHINE_H
 #define MACHINE_H
 
+#include <stddef.h>
 #include "mghendian.h"
 
 /* this is the unix version */
@@ -53,6 +54,7 @@ int ByteSwapBuf(void *Buf, long int nItems, int nBytesPerItem);
 int ByteSwap2(void *buf2, long int nitems);
 int ByteSwap4(void *buf4, long int nitems);
 int ByteSwap8(void *buf8, long int nitems);
+int ByteSwapItems(void *buf, size_t nitems, int nbytes);
 
 #if (BYTE_ORDER == LITTLE_ENDIAN)
 
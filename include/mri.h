@@ -265,6 +265,8 @@ typedef struct
   ELTT( size_t, bytes_per_slice ) SEP    /* # bytes per slice */    \
   ELTT( size_t, bytes_per_vol ) SEP      /* # bytes per volume/timepoint */    \
   ELTT( size_t, bytes_total ) SEP        /* # total number of pixel bytes in the struct */    \
+  ELTP( void, mapped ) SEP             /* base of the file mapping chunk points into (MRIreadMapped) */    \
+  ELTX( size_t, mapped_bytes ) SEP     /* length of that mapping */    \
   ELTP( COLOR_TABLE, ct ) SEP    \
   ELTP( MRI_FRAME, frames )    \
 
@@ -426,6 +428,31 @@ int   MRIsetResolution(MRI *mri, float xres, float yres, float zres) ;
 int   MRIsetTransform(MRI *mri,   General_transform *transform) ;
 MRI * MRIallocChunk(int width, int height, int depth, int type, int nframes);
 int   MRIchunk(MRI **pmri);
+int   MRIsetMappedChunk(MRI *mri, void *map, size_t map_bytes, size_t offset);
+MRI * MRIreadMapped(const char *fname);
+
+/* Streaming access to 4D .mgh/.mgz/.nii/.nii.gz files that are too big
+   to read at once. Either a range of voxels (in column, row, slice
+   order) across all frames, or a range of frames across all voxels, is
+   read into a small MRI. See MRIstreamOpen() in mriio.c. */
+typedef struct
+{
+  char   fname[STRLEN];
+  MRI    *mri;          // header of the file (no voxels)
+  MRI    *loaded;       // whole file, when it cannot be streamed
+  struct znzptr *fp;    // open file, positioned anywhere
+  long   offset;        // byte offset of the first voxel
+  int    swapped;       // voxels need byte swapping
+  int    bytes_per_vox;
+  long   nvox;          // voxels per frame
+}
+MRI_STREAM;
+
+MRI_STREAM *MRIstreamOpen(const char *fname);
+int   MRIstreamClose(MRI_STREAM **pst);
+long  MRIstreamSlabVoxels(MRI_STREAM *st, size_t max_bytes);
+MRI   *MRIstreamReadVoxels(MRI_STREAM *st, long v0, long nv, MRI *dst);
+MRI   *MRIstreamReadFrames(MRI_STREAM *st, int f0, int nf, MRI *dst);
 
 
 /* correlation routines */
@@ -724,6 +751,7 @@ MRI   *MRImin(MRI *mri1, MRI *mri2, MRI *mri_min);
 MRI   *MRIminmax(MRI *mri_src, MRI *mri_dst, MRI *mri_dir, int wsize) ;
 MRI   *MRIgaussian1d(float sigma, int max_len) ;
 MRI   *MRIconvolveGaussian(MRI *mri_src, MRI *mri_dst, MRI *mri_gaussian) ;
+MRI   *MRIconvolveGaussianRecursive(MRI *mri_src, MRI *mri_dst, float sigma) ;
 MRI   *MRIgaussianSmooth(MRI *src, double std, int norm, MRI *targ);
 MRI   *MRImaskedGaussianSmooth(MRI *src, MRI *binmask, double std, MRI *targ);
 MRI   *MRIconvolveGaussianMeanAndStdByte(MRI *mri_src, MRI *mri_dst,
@@ -731,6 +759,13 @@ MRI   *MRIconvolveGaussianMeanAndStdByte(MRI *mri_src, MRI *mri_dst,
 MRI *MRIgaussianSmoothNI(MRI *src, double cstd, double rstd, double sstd,
 			 MRI *targ);
 
+/* precomputed FFT Gaussian smoothing for one geometry (mrifilter.c) */
+typedef struct MRI_GAUSSIAN_FFT MRI_GAUSSIAN_FFT;
+MRI_GAUSSIAN_FFT *MRIallocGaussianFFT(MRI *mri, double cstd, double rstd,
+                                      double sstd, MRI *binmask);
+int MRIfreeGaussianFFT(MRI_GAUSSIAN_FFT **pgf);
+MRI *MRIgaussianFFTsmooth(MRI_GAUSSIAN_FFT *gf, MRI *src, MRI *targ);
+
 /* frequency filtering*/
 MRI* MRI_fft(MRI *mri_src, MRI* dst);
 MRI *MRI_ifft(MRI *src, MRI *dst, int w, int h, int d);
@@ -1127,6 +1162,7 @@ MRI *MRImaskInvert(MRI *mask, MRI *outmask);
 
 int MRInMask(MRI *mask);
 MRI *MRIframeBinarize(MRI *mri, double thresh, MRI *mask);
+MRI *MRIstreamFrameBinarize(MRI_STREAM *st, double thresh, MRI *mask);
 
 
 MRI   *MRImeanMask(MRI *mri_src, MRI *mri_mask, MRI *mri_dst,
@@ -1497,10 +1533,13 @@ MRI *MRIconformSliceOrder(MRI *mri);
 #define DTRANS_MODE_OUTSIDE  3
 #define DTRANS_MODE_INSIDE   4
 
-/** This is deprecated.
-    Please use MRIextractDistanceMap in fastmarching.h instead */
+/* exact Euclidean distance (mm) to the boundary of label, clamped
+   to max_dist voxels */
 MRI *MRIdistanceTransform(MRI *mri_src, MRI *mri_dist,
                           int label, float max_dist, int mode, MRI *mri_mask);
+/* the same for nlabels labels at once, labels[n] into frame n */
+MRI *MRIdistanceTransformLabels(MRI *mri_src, MRI *mri_dist, int *labels, int nlabels,
+                                float max_dist, int mode, MRI *mri_mask);
 int MRIaddCommandLine(MRI *mri, char *cmdline) ;
 MRI *MRInonMaxSuppress(MRI *mri_src, MRI *mri_sup,
                        float thresh, int thresh_dir) ;
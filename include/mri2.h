@@ -123,6 +123,18 @@ int MRIsegStatsRobust(MRI *seg, int segid, MRI *mri,int frame,
 		      float *min, float *max, float *range,
 		      float *mean, float *std, float Pct);
 
+// Stats of one segmentation id, as returned by MRIsegStats()
+typedef struct
+{
+  int segid;
+  int nvoxels;
+  float min, max, range, mean, std;
+} MRI_SEG_STATS;
+int MRIsegStatsAll(MRI *seg, MRI *mri, int frame, int UseRobust, float RobustPct,
+                   int nsegs, MRI_SEG_STATS *stats);
+int MRIsegFrameAvgAll(MRI *seg, MRI *mri, int nsegs, const int *segids,
+                      double **favg, int *nvoxels);
+
 MRI *MRImask_with_T2_and_aparc_aseg(MRI *mri_src, MRI *mri_dst, MRI *mri_T2, MRI *mri_aparc_aseg, float T2_thresh, int mm_from_exterior) ;
 int *MRIsegmentationList(MRI *seg, int *pListLength);
 
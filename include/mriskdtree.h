@@ -0,0 +1,71 @@
+/**
+ * @file  mriskdtree.h
+ * @brief kd-tree of surface vertex positions for closest-vertex queries
+ *
+ * An MRIS_KDTREE is a static snapshot of one coordinate set (CURRENT_VERTICES,
+ * ORIGINAL_VERTICES, WHITE_VERTICES, PIAL_VERTICES, CANONICAL_VERTICES, ...)
+ * of the unripped vertices of a surface. A query costs O(log N) instead of
+ * the O(N) scan of MRISfindClosestVertex(), and gives the same answer: the
+ * lowest numbered vertex at the smallest distance, or -1 if none is closer
+ * than 10000 mm. The tree does not follow later changes to the surface;
+ * build a new one after moving, ripping or renumbering vertices.
+ *
+ * A tree attached to a surface with MRISattachVertexIndex() is used by
+ * MRISfindClosestVertex() and friends for its coordinate set until it is
+ * detached (or the surface is freed):
+ *
+ *   MRISattachVertexIndex(mris, CANONICAL_VERTICES);
+ *   for (n = 0; n < label->n_points; n++)
+ *     vno = MRISfindClosestCanonicalVertex(mris, ...);
+ *   MRISdetachVertexIndex(mris, CANONICAL_VERTICES);
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef MRISKDTREE_H
+#define MRISKDTREE_H
+
+#include "mrisurf.h"
+
+/* the typedef is in mrisurf.h, which keeps the attached trees in mris->kdtree */
+struct MRIS_KDTREE
+{
+  int which;                 /* coordinate set, e.g. CURRENT_VERTICES */
+  int npoints;               /* number of unripped vertices in the tree */
+  int *vno;                  /* vertex number of each point, in tree order */
+  float *x, *y, *z;          /* coordinates of each point, in tree order */
+  unsigned char *axis;       /* split axis (0,1,2) of the node at each point */
+  struct MRIS_KDTREE *next;  /* next tree attached to the same surface */
+};
+
+MRIS_KDTREE *MRISkdtreeCreate(MRI_SURFACE *mris, int which);
+void MRISkdtreeFree(MRIS_KDTREE **pkdt);
+
+/* closest vertex to (x,y,z), -1 if none; *dmin (if not NULL) gets its distance */
+int MRISkdtreeFindClosest(MRIS_KDTREE const *kdt, float x, float y, float z, float *dmin);
+
+/* closest vertices to n points, queried in parallel; dmin may be NULL */
+int MRISkdtreeFindClosestBatch(
+    MRIS_KDTREE const *kdt, int n, float const *x, float const *y, float const *z, int *vno, float *dmin);
+
+/* builds a tree of the given coordinates and attaches it to the surface,
+   replacing an attached tree of the same coordinates */
+MRIS_KDTREE *MRISattachVertexIndex(MRI_SURFACE *mris, int which);
+/* frees the attached tree of the given coordinates, or all of them if which < 0 */
+int MRISdetachVertexIndex(MRI_SURFACE *mris, int which);
+/* the attached tree of the given coordinates, or NULL */
+MRIS_KDTREE *MRISgetVertexIndex(MRI_SURFACE const *mris, int which);
+
+#endif
@@ -402,6 +402,31 @@ typedef char   *MRIS_cmdlines_t[MAX_CMDS] ;
 typedef char    MRIS_subject_name_t[STRLEN] ;
 typedef char    MRIS_fname_t[STRLEN] ;
 
+// Contiguous storage for the v, dist and dist_orig arrays of all the
+// vertices. mrisFindNeighbors(), MRISsetNeighborhoodSize() and
+// MRISsampleDistances() carve each vertex's arrays out of these blocks
+// instead of allocating them one by one, and reuse a vertex's slot when
+// it is big enough. Slots that are given up are reclaimed when the blocks
+// are full. Code that frees or reallocates those arrays itself must call
+// MRISdetachNeighborArena() first, which gives every vertex its own
+// heap copies again.
+typedef struct MRIS_NBHD_ARENA
+{
+  size_t size ;                 /* entries in each of v, dist, dist_orig */
+  size_t used ;                 /* entries handed out so far */
+  int    *v ;
+  float  *dist ;
+  float  *dist_orig ;
+  int    nvertices ;            /* length of start and room */
+  long   *start ;               /* slot of each vertex, -1 if none */
+  int    *room ;                /* entries in the slot of each vertex */
+}
+MRIS_NBHD_ARENA ;
+
+// kd-trees of vertex positions used by MRISfindClosestVertex() and
+// friends, see mriskdtree.h
+typedef struct MRIS_KDTREE MRIS_KDTREE ;
+
 typedef struct MRIS
 {
 // The LIST_OF_MRIS_ELTS macro used here enables the the mris_hash
@@ -512,7 +537,9 @@ typedef struct MRIS
   ELTP(void,user_parms) SEP             /* for whatever the user wants to hang here  */    \
   ELTP(MATRIX,m_sras2vox) SEP             /* for converting surface ras to voxel       */    \
   ELTP(MRI,mri_sras2vox) SEP           /* volume that the above matrix is for       */    \
-  ELTP(void,mht)     \
+  ELTP(void,mht) SEP    \
+  ELTP(MRIS_NBHD_ARENA,nbhd_arena) SEP  /* storage of the vertex v/dist/dist_orig arrays */    \
+  ELTP(MRIS_KDTREE,kdtree)        /* attached closest-vertex indices, see mriskdtree.h */    \
   // end of macro
   
 #define LIST_OF_MRIS_ELTS       \
@@ -1081,6 +1108,7 @@ MRI_SURFACE* MRISalloc                  (
 void         MRISreallocVerticesAndFaces(MRI_SURFACE *mris,                                  int nvertices, int nfaces) ;
     
 int          MRISfreeDists(MRI_SURFACE *mris) ;
+int          MRISdetachNeighborArena(MRI_SURFACE *mris) ;
 int          MRISfree(MRI_SURFACE **pmris) ;
 int   MRISintegrate(MRI_SURFACE *mris, INTEGRATION_PARMS *parms, int n_avgs);
 int   mrisLogIntegrationParms(FILE *fp, MRI_SURFACE *mris,
@@ -1943,6 +1971,20 @@ MRI *MRISsmoothMRIFastD(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask,  M
 int MRISsmoothMRIFastCheck(int nSmoothSteps);
 int MRISsmoothMRIFastFrame(MRIS *Surf, MRI *Src, int frame, int nSmoothSteps, MRI *IncMask);
 
+/* one nearest neighbor averaging step as a sparse matrix (CSR): the
+   neighbors of vertex vno are nbr[row[vno]] ... nbr[row[vno+1]-1],
+   starting with vno itself, and none if vno is out of the mask */
+typedef struct
+{
+  int nvertices;
+  int *row;
+  int *nbr;
+} MRIS_SMOOTH_OP;
+
+MRIS_SMOOTH_OP *MRISsmoothOpAlloc(MRIS *Surf, MRI *IncMask);
+int MRISsmoothOpFree(MRIS_SMOOTH_OP **pop);
+int MRISsmoothOpApply(MRIS_SMOOTH_OP *op, MRI *mri, int frame0, int nframes, int nSmoothSteps);
+
 
 int  MRISclearFlags(MRI_SURFACE *mris, int flags) ;
 int  MRISsetCurvature(MRI_SURFACE *mris, float val) ;
@@ -0,0 +1,100 @@
+/**
+ * @file  mriview.h
+ * @brief typed access to MRI voxels, so that loops switch on the type once
+ *
+ * MRIgetVoxVal() and MRIsetVoxVal() switch on mri->type and convert to
+ * float for every voxel. With these macros a loop is written once with
+ * a placeholder type and MRI_TYPE_SWITCH() compiles it for every voxel
+ * type, then walks whole rows through plain pointers:
+ *
+ *   MRI_TYPE_SWITCH(mri->type, T,
+ *     for (f = 0; f < mri->nframes; f++)
+ *       for (s = 0; s < mri->depth; s++)
+ *         for (r = 0; r < mri->height; r++) {
+ *           T *p = MRI_ROW(mri, T, r, s, f);
+ *           for (c = 0; c < mri->width; c++) MRI_STORE(T, p + c, 2 * p[c]);
+ *         }
+ *   );
+ *
+ * MRI_LOAD()/MRI_STORE() convert exactly like MRIgetVoxVal()/
+ * MRIsetVoxVal() (through float, clipping and rounding to the nearest
+ * integer), so a ported loop gives the same voxels as before. C++ code
+ * can use MRIview<T> from mriview.hpp instead.
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef MRIVIEW_H
+#define MRIVIEW_H
+
+#include <float.h>
+#include <limits.h>
+
+#include "mri.h"
+
+/* Pointer to the first voxel of row r of slice s of frame f. Rows are
+   always contiguous; for chunked MRIs (mri->ischunked) the whole volume
+   is, with mri->bytes_per_row/slice/vol between rows, slices, frames. */
+#define MRI_ROW(mri, T, r, s, f) ((T *)((mri)->slices[(f) * (mri)->depth + (s)][(r)]))
+
+/* Runs the statements with T typedef'd to the C type of an MRI type, and
+   with T_min/T_max/T_isint (named after T) describing its range. Unknown
+   types fall through without running anything. */
+#define MRI_TYPE_CASE(mritype, ctype, T, lo, hi, isint, ...) \
+  case mritype: {                                           \
+    typedef ctype T;                                        \
+    const float T##_min = (lo), T##_max = (hi);             \
+    const int T##_isint = (isint);                          \
+    (void)T##_min;                                          \
+    (void)T##_max;                                          \
+    (void)T##_isint;                                        \
+    __VA_ARGS__;                                            \
+  } break;
+
+#define MRI_TYPE_SWITCH(type, T, ...)                                               \
+  switch (type) {                                                                   \
+    MRI_TYPE_CASE(MRI_UCHAR, unsigned char, T, 0, 255, 1, __VA_ARGS__)               \
+    MRI_TYPE_CASE(MRI_SHORT, short, T, -32768, 32767, 1, __VA_ARGS__)               \
+    MRI_TYPE_CASE(MRI_INT, int, T, INT_MIN, INT_MAX, 1, __VA_ARGS__)                 \
+    MRI_TYPE_CASE(MRI_LONG, long, T, LONG_MIN, LONG_MAX, 1, __VA_ARGS__)             \
+    MRI_TYPE_CASE(MRI_FLOAT, float, T, -FLT_MAX, FLT_MAX, 0, __VA_ARGS__)            \
+    default:                                                                        \
+      break;                                                                        \
+  }
+
+/* Nonzero for the MRI types MRI_TYPE_SWITCH() runs its statements for;
+   callers fall back to MRIgetVoxVal()/MRIsetVoxVal() for the others */
+#define MRI_TYPE_VIEWABLE(type)                                                 \
+  ((type) == MRI_UCHAR || (type) == MRI_SHORT || (type) == MRI_INT || (type) == MRI_LONG || \
+   (type) == MRI_FLOAT)
+
+/* Value of the voxel p points to, as MRIgetVoxVal() returns it */
+#define MRI_LOAD(T, p) ((float)*(p))
+
+/* Stores v at p the way MRIsetVoxVal() would: clipped to the range of T
+   and, for integer types, rounded half away from zero (see nint()) */
+#define MRI_STORE(T, p, v)                                                        \
+  do {                                                                            \
+    float mri_store_v_ = (v);                                                     \
+    if (T##_isint) {                                                              \
+      if (mri_store_v_ < T##_min) mri_store_v_ = T##_min;                         \
+      if (mri_store_v_ > T##_max) mri_store_v_ = T##_max;                         \
+      *(p) = (T)(mri_store_v_ < 0 ? (int)(mri_store_v_ - 0.5) : (int)(mri_store_v_ + 0.5)); \
+    }                                                                             \
+    else                                                                          \
+      *(p) = (T)mri_store_v_;                                                     \
+  } while (0)
+
+#endif
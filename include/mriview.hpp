@@ -0,0 +1,137 @@
+/**
+ * @file  mriview.hpp
+ * @brief typed view of the voxels of an MRI
+ *
+ * MRIview<T> gives typed access to an MRI whose type matches T, without
+ * the per-voxel type switch of MRIgetVoxVal(). Rows are contiguous; for
+ * chunked MRIs the whole volume is, and plane()/rowStride() walk it
+ * with strides. MRIvisit() picks the view type once from mri->type:
+ *
+ *   MRIvisit(mri, [&](auto v) { ... v(c, r, s, f) ... });
+ *
+ * (a generic lambda needs C++14; with C++11 pass a functor with a
+ * templated operator()). The C equivalent is in mriview.h.
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef MRIVIEW_HPP
+#define MRIVIEW_HPP
+
+#include <cstddef>
+#include <stdexcept>
+
+#include "mri.h"
+
+namespace Freesurfer
+{
+// MRI type code of each voxel type
+template <typename T>
+struct MRItypeOf;
+template <>
+struct MRItypeOf<unsigned char> {
+  static const int value = MRI_UCHAR;
+};
+template <>
+struct MRItypeOf<short> {
+  static const int value = MRI_SHORT;
+};
+template <>
+struct MRItypeOf<int> {
+  static const int value = MRI_INT;
+};
+template <>
+struct MRItypeOf<long> {
+  static const int value = MRI_LONG;
+};
+template <>
+struct MRItypeOf<float> {
+  static const int value = MRI_FLOAT;
+};
+
+template <typename T>
+class MRIview
+{
+ public:
+  typedef T value_type;
+
+  explicit MRIview(MRI *mri) : mri_(mri)
+  {
+    if (mri == NULL || mri->type != MRItypeOf<T>::value || mri->slices == NULL)
+      throw std::invalid_argument("MRIview: MRI has no voxels or another type");
+  }
+
+  MRI *mri() const { return mri_; }
+  int width() const { return mri_->width; }
+  int height() const { return mri_->height; }
+  int depth() const { return mri_->depth; }
+  int nframes() const { return mri_->nframes; }
+
+  // first voxel of a row; rows are always contiguous
+  T *row(int r, int s, int f = 0) const { return (T *)mri_->slices[f * mri_->depth + s][r]; }
+  T &operator()(int c, int r, int s, int f = 0) const { return row(r, s, f)[c]; }
+
+  // true if all voxels are in one block (chunked MRI), so that plane()
+  // and the strides below can be used and data() spans the volume
+  bool contiguous() const { return mri_->ischunked != 0; }
+  T *data() const { return contiguous() ? (T *)mri_->chunk : NULL; }
+  size_t size() const { return (size_t)mri_->width * mri_->height * mri_->depth * mri_->nframes; }
+  ptrdiff_t rowStride() const { return contiguous() ? mri_->bytes_per_row / sizeof(T) : 0; }
+  ptrdiff_t sliceStride() const { return contiguous() ? mri_->bytes_per_slice / sizeof(T) : 0; }
+  ptrdiff_t frameStride() const { return contiguous() ? mri_->bytes_per_vol / sizeof(T) : 0; }
+
+  // first voxel of a slice; its rows are rowStride() apart (contiguous only)
+  T *plane(int s, int f = 0) const { return contiguous() ? row(0, s, f) : NULL; }
+
+  // calls fn(T *row, int width) for every row of every slice and frame
+  template <typename Fn>
+  void forEachRow(Fn fn) const
+  {
+    for (int f = 0; f < mri_->nframes; f++)
+      for (int s = 0; s < mri_->depth; s++)
+        for (int r = 0; r < mri_->height; r++) fn(row(r, s, f), mri_->width);
+  }
+
+ private:
+  MRI *mri_;
+};
+
+// Calls fn(MRIview<T>(mri)) with T matching mri->type; returns false if
+// the type has no view
+template <typename Fn>
+bool MRIvisit(MRI *mri, Fn fn)
+{
+  switch (mri->type) {
+    case MRI_UCHAR:
+      fn(MRIview<unsigned char>(mri));
+      return true;
+    case MRI_SHORT:
+      fn(MRIview<short>(mri));
+      return true;
+    case MRI_INT:
+      fn(MRIview<int>(mri));
+      return true;
+    case MRI_LONG:
+      fn(MRIview<long>(mri));
+      return true;
+    case MRI_FLOAT:
+      fn(MRIview<float>(mri));
+      return true;
+  }
+  return false;
+}
+}  // namespace Freesurfer
+
+#endif
@@ -115,6 +115,28 @@ MRI *vol2surf_linear(MRI *SrcVol,
 
 MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs,
 		  int ReverseMapFlag, int DoJac, int UseHash);
+
+/* the resampling done by MRISapplyReg() as a sparse matrix (CSR): target
+   vertex t is the sum of w[k] times source vertex col[k] for k = row[t]
+   to row[t+1]-1. hash[] identifies the reg surfaces it was built from. */
+typedef struct
+{
+  int nsurfs;
+  MRIS_HASH *hash;
+  int ReverseMapFlag, DoJac, UseHash;
+  int ntrg, nsrc, nnz;
+  int *row, *col;
+  float *w;
+} MRIS_REG_MAP;
+
+MRIS_REG_MAP *MRISregMap(MRI_SURFACE **SurfReg, int nsurfs,
+                         int ReverseMapFlag, int DoJac, int UseHash);
+int MRISregMapMatches(MRIS_REG_MAP *map, MRI_SURFACE **SurfReg, int nsurfs,
+                      int ReverseMapFlag, int DoJac, int UseHash);
+MRI *MRISregMapApply(MRIS_REG_MAP *map, MRI *SrcSurfVals, MRI *TrgSurfVals);
+MRIS_REG_MAP *MRISregMapRead(const char *fname);
+int MRISregMapWrite(MRIS_REG_MAP *map, const char *fname);
+int MRISregMapFree(MRIS_REG_MAP **pmap);
 MRI *surf2surf_nnfr(MRI *SrcSurfVals, MRI_SURFACE *SrcSurfReg,
                     MRI_SURFACE *TrgSurfReg, MRI **SrcHits,
                     MRI **SrcDist, MRI **TrgHits, MRI **TrgDist,
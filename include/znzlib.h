@@ -78,12 +78,16 @@ extern "C"
 #endif
 
 
+  /* state of a block-indexed gzip container (see znzlib.c) */
+  struct znzblock;
+
   struct znzptr
   {
     int withz;
     FILE* nzfptr;
 #ifdef HAVE_ZLIB
     gzFile zfptr;
+    struct znzblock *blk;
 #endif
   } ;
 
@@ -99,7 +103,17 @@ extern "C"
   /* Note extra argument (use_compression) where
      use_compression==0 is no compression
      use_compression!=0 uses zlib (gzip) compression
+     use_compression==ZNZ_BLOCKED writes a block-indexed gzip container:
+       a series of independently deflated gzip members (one per
+       ZNZ_BLOCK_SIZE bytes of data) followed by an empty gzip member
+       whose header carries the block index. Plain gzip readers see an
+       ordinary multi-member gzip file. When reading, block-indexed files
+       are detected automatically and support random-access seeks.
+       Setting FS_PLAIN_GZIP in the environment writes a single gzip
+       stream instead.
   */
+#define ZNZ_BLOCKED     2
+#define ZNZ_BLOCK_SIZE  (1 << 18)
 
   znzFile znzopen(const char *path, const char *mode, int use_compression);
 
@@ -127,6 +141,12 @@ extern "C"
 
   int znzeof(znzFile file);
 
+  int znzflush(znzFile file);
+
+  /* returns 1 if seeks on this file are cheap (uncompressed or
+     block-indexed), 0 if a seek has to decompress everything before it */
+  int znzcanseek(znzFile file);
+
 #if !defined(WIN32)
   int znzprintf(znzFile stream, const char *format, ...);
 #endif
@@ -42,6 +42,7 @@
 #include <math.h>
 #include "macros.h"
 #include "mrisurf.h"
+#include "mriskdtree.h"
 #include "mrisutils.h"
 #include "error.h"
 #include "diag.h"
@@ -233,6 +234,9 @@ int main(int argc, char **argv)
     printf("\n");
     printf("Building hash of lh pial\n");
     lhpial_hash = MHTcreateVertexTable_Resolution(lhpial, CURRENT_VERTICES,hashres);
+    // kd-trees for the closest vertex searches that do not use the hash
+    MRISattachVertexIndex(lhwhite, CURRENT_VERTICES);
+    MRISattachVertexIndex(lhpial, CURRENT_VERTICES);
   }
 
   if(DoRH){
@@ -297,6 +301,9 @@ int main(int argc, char **argv)
     printf("\n");
     printf("Building hash of rh pial\n");
     rhpial_hash = MHTcreateVertexTable_Resolution(rhpial, CURRENT_VERTICES,hashres);
+    // kd-trees for the closest vertex searches that do not use the hash
+    MRISattachVertexIndex(rhwhite, CURRENT_VERTICES);
+    MRISattachVertexIndex(rhpial, CURRENT_VERTICES);
   }
 
   if(UseNewRibbon){
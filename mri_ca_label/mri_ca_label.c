@@ -1617,6 +1617,11 @@ get_option(int argc, char *argv[])
     handle_expanded_ventricles = 0 ;
     printf("not handling expanded ventricles...\n") ;
   }
+  else if (!stricmp(option, "checkerboard"))
+  {
+    gca_icm_checkerboard = 1 ;
+    printf("relabeling with the Gibbs priors a checkerboard color at a time\n") ;
+  }
   else if (!stricmp(option, "write_probs"))
   {
     G_write_probs = argv[2] ;
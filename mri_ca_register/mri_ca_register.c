@@ -1719,6 +1719,11 @@ get_option(int argc, char *argv[])
     Gdiag |= DIAG_WRITE ;
     printf("writing gradients each iteration\n") ;
   }
+  else if (!stricmp(option, "fused"))
+  {
+    gcam_fused_terms = 1 ;
+    printf("computing the likelihood, smoothness and jacobian terms in one pass\n") ;
+  }
   else if (!stricmp(option, "RH"))
   {
     remove_lh = 1  ;
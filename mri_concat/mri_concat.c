@@ -132,6 +132,9 @@ MRI *PruneMask = NULL;
 int DoRMS = 0; // compute root-mean-square on multi-frame input
 int DoCumSum = 0;
 int DoFNorm = 0;
+int DoStream = 1;
+static int StreamableStat(void);
+static MRI *StreamFrameStat(void);
 char *rusage_file=NULL;
 
 /*--------------------------------------------------*/
@@ -144,6 +147,7 @@ int main(int argc, char **argv)
   MATRIX *Upca=NULL,*Spca=NULL;
   MRI *Vpca=NULL;
   char *stem;
+  int Streamed = 0;
 
   /* rkt: check for and handle version tag */
   nargs = handle_version_option (argc, argv, vcid, "$Name:  $");
@@ -282,32 +286,49 @@ int main(int argc, char **argv)
     }
   }
 
-  printf("Allocing output\n");
-  fflush(stdout);
-  int datatype=MRI_FLOAT;
-  if (DoKeepDatatype)
+  if(DoStream && StreamableStat())
   {
-    datatype = inputDatatype;
-  }
-  if (DoRMS)
-  {
-    // RMS always has single frame output
-    mriout = MRIallocSequence(nc,nr,ns,datatype,1);
+    // Single statistic across frames: read a few frames at a time
+    // instead of concatenating all the inputs in memory
+    printf("Computing statistic across frames, streaming inputs\n");
+    mriout = StreamFrameStat();
+    if (mriout == NULL)
+    {
+      exit(1);
+    }
+    DoMean = DoSum = DoMeanDivN = DoStd = DoVar = DoMax = DoMin = 0;
+    Streamed = 1;
   }
   else
   {
-    mriout = MRIallocSequence(nc,nr,ns,datatype,nframestot);
-  }
-  if (mriout == NULL)
-  {
-    exit(1);
+    printf("Allocing output\n");
+    fflush(stdout);
+    int datatype=MRI_FLOAT;
+    if (DoKeepDatatype)
+    {
+      datatype = inputDatatype;
+    }
+    if (DoRMS)
+    {
+      // RMS always has single frame output
+      mriout = MRIallocSequence(nc,nr,ns,datatype,1);
+    }
+    else
+    {
+      mriout = MRIallocSequence(nc,nr,ns,datatype,nframestot);
+    }
+    if (mriout == NULL)
+    {
+      exit(1);
+    }
+    printf("Done allocing\n");
   }
-  printf("Done allocing\n");
 
   fout = 0;
   for (nthin = 0; nthin < ninputs; nthin++)
   {
     if (DoRMS) break; // MRIrms reads the input frames
+    if (Streamed) break; // stat computed above
     if(Gdiag_no > 0 || debug)
     {
       printf("Loading %dth input %s\n",
@@ -802,6 +823,10 @@ static int parse_commandline(int argc, char **argv)
     {
       DoCheck = 0;
     }
+    else if (!strcasecmp(option, "--no-stream"))
+    {
+      DoStream = 0;
+    }
     else if (!strcasecmp(option, "--mean"))
     {
       DoMean = 1;
@@ -1184,6 +1209,8 @@ static void print_usage(void)
   printf("   --rms : root mean square (eg. combine memprage)\n");
   printf("           (square, sum, div-by-nframes, square root)\n");
   printf("   --no-check : do not check inputs (faster)\n");
+  printf("   --no-stream : load all inputs for --mean, --sum, --std, etc\n");
+  printf("                 (default is to read a few frames at a time)\n");
   printf("   --help      print out information on how to use this program\n");
   printf("   --version   print out version and exit\n");
   printf("\n");
@@ -1321,6 +1348,133 @@ MATRIX *GroupedMeanMatrix(int ngroups, int ntotal)
   }
   return(M);
 }
+/* --------------------------------------------- */
+/* StreamableStat() - returns 1 if the only thing asked for is one of
+   the frame statistics that StreamFrameStat() can compute on the fly */
+static int StreamableStat(void)
+{
+  int nstats;
+  nstats = DoMean + DoSum + DoMeanDivN + (DoStd || DoVar) + DoMax + DoMin;
+  if (nstats != 1) return(0);
+  if (DoCombine || DoPrune || DoNormMean || DoNorm1 || DoASL || M != NULL ||
+      ngroups || DoPaired || DoMedian || DoFNorm || DoTAR1 || DoMaxIndex ||
+      DoConjunction || DoSort || DoVote || DoSCM || DoPCA || NReplications ||
+      DoRMS || DoKeepDatatype || DoCumSum || DoBonfCor)
+    return(0);
+  return(1);
+}
+/* --------------------------------------------- */
+/* StreamFrameStat() - computes the mean, sum, mean/n, std, var, max, or
+   min across all frames of all inputs. The inputs are read a few frames
+   at a time (MRIstreamReadFrames), so memory does not grow with the
+   number of inputs. The variance uses Welford's running update so that
+   only one pass is needed. */
+static MRI *StreamFrameStat(void)
+{
+  MRI_STREAM *st;
+  MRI *frames = NULL, *out = NULL;
+  double *acc = NULL, *m2 = NULL, v, delta;
+  long nvox = 0, n = 0, k;
+  int nthin, c, r, s, f, f0, nf;
 
+  for (nthin = 0; nthin < ninputs; nthin++)
+  {
+    if(Gdiag_no > 0 || debug)
+    {
+      printf("Streaming %dth input %s\n",
+             nthin+1,fio_basename(inlist[nthin],NULL));
+      fflush(stdout);
+    }
+    st = MRIstreamOpen(inlist[nthin]);
+    if (st == NULL)
+    {
+      printf("ERROR: loading %s\n",inlist[nthin]);
+      return(NULL);
+    }
+    if (nthin == 0)
+    {
+      nvox = st->nvox;
+      out = MRIallocSequence(st->mri->width,st->mri->height,st->mri->depth,MRI_FLOAT,1);
+      if (out == NULL) return(NULL);
+      MRIcopyHeader(st->mri, out);
+      acc = (double *) calloc(nvox,sizeof(double));
+      if (DoStd || DoVar) m2 = (double *) calloc(nvox,sizeof(double));
+    }
+    if (st->nvox != nvox)
+    {
+      printf("ERROR: dimension mismatch between %s and %s\n",
+             inlist[0],inlist[nthin]);
+      return(NULL);
+    }
+    // about 256MB of frames at a time
+    nf = MAX(1, (int)((256L*1024*1024)/(nvox*sizeof(float))));
+    for (f0 = 0; f0 < st->mri->nframes; f0 += nf)
+    {
+      frames = MRIstreamReadFrames(st, f0, MIN(nf, st->mri->nframes - f0), frames);
+      if (frames == NULL) return(NULL);
+      if (DoAbs) MRIabs(frames,frames);
+      if (DoPos) MRIpos(frames,frames);
+      if (DoNeg) MRIneg(frames,frames);
+      for (f = 0; f < frames->nframes; f++)
+      {
+        n++;
+        k = 0;
+        for (s=0; s < frames->depth; s++)
+        {
+          for (r=0; r < frames->height; r++)
+          {
+            for (c=0; c < frames->width; c++)
+            {
+              v = MRIgetVoxVal(frames,c,r,s,f);
+              if (DoStd || DoVar)
+              {
+                delta = v - acc[k];
+                acc[k] += delta/n;
+                m2[k] += delta*(v - acc[k]);
+              }
+              else if (DoMax)
+              {
+                if (n == 1 || v > acc[k]) acc[k] = v;
+              }
+              else if (DoMin)
+              {
+                if (n == 1 || v < acc[k]) acc[k] = v;
+              }
+              else acc[k] += v;
+              k++;
+            }
+          }
+        }
+      }
+    }
+    MRIstreamClose(&st);
+  }
+  if (frames) MRIfree(&frames);
 
-
+  if ((DoStd || DoVar) && n < 2)
+  {
+    printf("ERROR: cannot compute std from one frame\n");
+    return(NULL);
+  }
+  printf("nframes = %ld\n",n);
+  k = 0;
+  for (s=0; s < out->depth; s++)
+  {
+    for (r=0; r < out->height; r++)
+    {
+      for (c=0; c < out->width; c++)
+      {
+        v = acc[k];
+        if (DoMean) v = v/n;
+        if (DoMeanDivN) v = v/((double)n*n);
+        if (DoVar || DoStd) v = m2[k]/(n-1);
+        if (DoStd) v = sqrt(v);
+        MRIsetVoxVal(out,c,r,s,0,v);
+        k++;
+      }
+    }
+  }
+  free(acc);
+  if (m2) free(m2);
+  return(out);
+}
@@ -0,0 +1,106 @@
+/**
+ * @file  mri_gca_convert.c
+ * @brief convert a gca atlas between the .gca/.gcz and flat .gcaf formats
+ *
+ * The flat format is mapped into memory by GCAread() rather than read,
+ * which loads faster and lets processes using the same atlas share it.
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "diag.h"
+#include "error.h"
+#include "gca.h"
+#include "macros.h"
+#include "timer.h"
+#include "utils.h"
+#include "version.h"
+
+int main(int argc, char *argv[]);
+static int get_option(int argc, char *argv[]);
+static void usage_exit(int code);
+
+const char *Progname;
+
+int main(int argc, char *argv[])
+{
+  int nargs, msec;
+  struct timeb start;
+  GCA *gca;
+
+  nargs = handle_version_option(argc, argv, "$Id$", "$Name:  $");
+  if (nargs && argc - nargs == 1) exit(0);
+  argc -= nargs;
+
+  Progname = argv[0];
+  ErrorInit(NULL, NULL, NULL);
+  DiagInit(NULL, NULL, NULL);
+
+  for (; argc > 1 && ISOPTION(*argv[1]); argc--, argv++) {
+    nargs = get_option(argc, argv);
+    argc -= nargs;
+    argv += nargs;
+  }
+  if (argc != 3) usage_exit(1);
+
+  TimerStart(&start);
+  gca = GCAread(argv[1]);
+  if (gca == NULL) ErrorExit(ERROR_NOFILE, "%s: could not read atlas %s", Progname, argv[1]);
+  msec = TimerStop(&start);
+  printf("read %s (%s) in %2.2f sec\n", argv[1], GCAisFlat(argv[1]) ? "flat" : "gca", msec / 1000.0);
+
+  printf("writing %s...\n", argv[2]);
+  if (GCAwrite(gca, argv[2]) != NO_ERROR) ErrorExit(Gerror, "%s: could not write atlas %s", Progname, argv[2]);
+  GCAfree(&gca);
+  exit(0);
+  return (0);
+}
+
+static int get_option(int argc, char *argv[])
+{
+  int nargs = 0;
+  char *option;
+
+  option = argv[1] + 1; /* past '-' */
+  switch (toupper(*option)) {
+    case '?':
+    case 'U':
+      usage_exit(0);
+      break;
+    default:
+      fprintf(stderr, "unknown option %s\n", argv[1]);
+      exit(1);
+      break;
+  }
+
+  return (nargs);
+}
+
+static void usage_exit(int code)
+{
+  printf("usage: %s <input atlas> <output atlas>\n", Progname);
+  printf("\n");
+  printf("Converts an atlas between the .gca (or gzipped .gcz) format and the\n");
+  printf("flat .gcaf format, chosen by the extension of the output. The input\n");
+  printf("format is recognized from the file. Flat atlases are mapped into\n");
+  printf("memory instead of being read, so they load faster and concurrent\n");
+  printf("jobs share them. They are in the byte order of the machine that\n");
+  printf("wrote them.\n");
+  exit(code);
+}
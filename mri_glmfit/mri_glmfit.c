@@ -118,6 +118,8 @@ USAGE: ./mri_glmfit
    --allow-zero-dof : mostly for very special purposes
    --illcond : allow ill-conditioned design matrices
    --sim-done SimDoneFile : create DoneFile when simulation finished 
+   --sim-resume : continue a simulation from the CSD files already in csdbase
+   --threads nthreads : number of threads for the simulation
 
 ENDUSAGE --------------------------------------------------------------
 
@@ -477,10 +479,18 @@ csdbasename - base name of the file to store the CSD data in. Each
 
 Multiple simulations can be run in parallel by specifying different
 csdbasenames. Then pass the multiple CSD files to mri_surfcluster
-and mri_volcluster. The Full CSD file is written on each iteration,
+and mri_volcluster. The Full CSD file is written every few iterations,
 which means that the CSD file will be valid if the simulation
 is aborted or crashes.
 
+Iterations are also run in parallel on as many threads as OpenMP
+allows (set with --threads). Each iteration draws its noise or
+permutation from its own random stream, computed from the seed and
+the iteration number, so the CSD files are the same for a given seed
+however many threads are used. To continue a simulation that was
+stopped, run the same command with --sim-resume; the iterations
+already in the CSD files are kept and the rest are run.
+
 In the cases where the design matrix is a single columns of ones
 (ie, one-sample group mean), it makes no sense to permute the
 rows of the design matrix. mri_glmfit automatically checks
@@ -553,6 +563,7 @@ double round(double x);
 #include "dti.h"
 #include "image.h"
 #include "stats.h"
+#include "romp_support.h"
 
 int MRISmaskByLabel(MRI *y, MRIS *surf, LABEL *lb, int invflag);
 
@@ -652,7 +663,7 @@ SURFCLUSTERSUM *SurfClustList;
 int nClusters;
 char *subject=NULL, *hemi=NULL, *simbase=NULL;
 MRI_SURFACE *surf=NULL;
-int nsim,nthsim;
+int nsim;
 double csize;
 
 VOLCLUSTER **VolClustList;
@@ -663,10 +674,9 @@ double InterVertexDistAvg, InterVertexDistStdDev, avgvtxarea;
 double ar1mn, ar1std, ar1max;
 double eresgstd, eresfwhm, searchspace;
 double car1mn, rar1mn,sar1mn,cfwhm,rfwhm,sfwhm;
-MRI *ar1=NULL, *tar1=NULL, *z=NULL, *zabs=NULL, *cnr=NULL;
+MRI *ar1=NULL, *tar1=NULL, *cnr=NULL;
 
 CSD *csd;
-RFS *rfs;
 int weightinv=0, weightsqrt=0;
 
 int OneSamplePerm=0;
@@ -707,10 +717,15 @@ int NoContrastsOK = 0;
 int ComputeFWHM = 1;
 
 int UseStatTable = 0;
+int UseMappedY = 0;
+int UseStreamY = 0;
+double StreamSlabMB = 256;
+MRI_STREAM *ystream = NULL;
 STAT_TABLE *StatTable=NULL, *OutStatTable=NULL, *GammaStatTable=NULL;
 int  UseCortexLabel = 1;
 
 char *SimDoneFile = NULL;
+int SimResume = 0;
 int tSimSign = 0;
 int FWHMSet = 0;
 int DoKurtosis = 0;
@@ -730,6 +745,19 @@ int  nSignList = 3, nthSign;
 int SignList[3] = {-1,0,1};
 CSD *csdList[5][3][20];
 
+// What one simulation iteration works on. Each thread has its own.
+typedef struct {
+  MRIGLM *mriglm; // own design and outputs (and y for mc-full)
+  MRIS *surf;     // own copy for clustering, which marks the vertices
+  RFS *rfs;       // reseeded for each iteration
+  MRI *z, *zabs, *sig;
+} GLMSIM;
+static GLMSIM *SimAlloc(void);
+static int SimFree(GLMSIM **psim);
+static int SimIteration(GLMSIM *sim, int nthsim);
+static int SimWriteCSD(int nreps, int msecTime);
+static int SimResumeCSD(void);
+
 MATRIX *RTM_Cr, *RTM_intCr, *RTM_TimeSec, *RTM_TimeMin;
 int DoMRTM1=0;
 int DoMRTM2=0;
@@ -761,11 +789,12 @@ MRI *MRIremoveSpatialMean(MRI *vol, MRI *mask, MRI *out);
 int main(int argc, char **argv) {
   int nargs, n,m;
   int msecFitTime;
+  int nthreads, nsimdone, nsimchunk, nthsim;
+  GLMSIM **simthread;
   MATRIX *wvect=NULL, *Mtmp=NULL, *Xselfreg=NULL, *Ex=NULL, *XgNew=NULL;
   MATRIX *Ct, *CCt;
   FILE *fp;
-  double Ccond, dtmp, threshadj, eff;
-  char *tmpstr2=NULL;
+  double Ccond, dtmp, eff;
 
   eresfwhm = -1;
   csd = CSDalloc();
@@ -858,7 +887,17 @@ int main(int argc, char **argv) {
   // Load input--------------------------------------
   printf("Loading y from %s\n",yFile);fflush(stdout);
   if(! UseStatTable){
-    mriglm->y = MRIread(yFile);
+    if(UseStreamY){
+      // Only the header is read; the fit reads y a slab at a time
+      ystream = MRIstreamOpen(yFile);
+      if(ystream){
+        mriglm->y = MRIallocHeader(ystream->mri->width,ystream->mri->height,
+                                   ystream->mri->depth,MRI_FLOAT,ystream->mri->nframes);
+        MRIcopyHeader(ystream->mri,mriglm->y);
+      }
+    }
+    else if(UseMappedY) mriglm->y = MRIreadMapped(yFile);
+    else                mriglm->y = MRIread(yFile);
     printf("   ... done reading.\n"); fflush(stdout);
     if (mriglm->y == NULL) {
       printf("ERROR: loading y %s\n",yFile);
@@ -869,7 +908,15 @@ int main(int argc, char **argv) {
       printf("ERROR: you must use '--surface subject hemi' with surface data\n");
       exit(1);
     }
-    if(DoReshape && surf != NULL){
+    if(DoReshape && surf != NULL && ystream){
+      // voxel order does not change, so the stream needs no reshaping
+      printf("Forcing reshape to 1d\n");
+      mritmp = MRIallocHeader(nvoxels,1,1,MRI_FLOAT,mriglm->y->nframes);
+      MRIcopyHeader(mriglm->y,mritmp);
+      MRIfree(&mriglm->y);
+      mriglm->y = mritmp;
+    }
+    else if(DoReshape && surf != NULL){
       printf("Forcing reshape to 1d\n");
       mritmp = mri_reshape(mriglm->y,nvoxels,1, 1, mriglm->y->nframes);
       MRIfree(&mriglm->y);
@@ -1264,6 +1311,14 @@ int main(int argc, char **argv) {
       mriglm->mask = MRIframeBinarize(firstFrameVol,prune_thr,mriglm->mask);
       MRIfree(&firstFrameVol);
     }
+    else if(ystream){
+      if(mriglm->mask == NULL){
+	mriglm->mask = MRIconst(mriglm->y->width,mriglm->y->height,mriglm->y->depth,1,1,NULL);
+	MRIcopyHeader(mriglm->y,mriglm->mask);
+      }
+      mriglm->mask = MRIstreamFrameBinarize(ystream,prune_thr,mriglm->mask);
+      if(mriglm->mask == NULL) exit(1);
+    }
     else{
       mriglm->mask = MRIframeBinarize(mriglm->y,prune_thr,mriglm->mask);
     }
@@ -1610,6 +1665,11 @@ int main(int argc, char **argv) {
       SmoothSurfOrVol(surf, mriglm->rvar, mriglm->mask, VarSmoothLevel);
       printf("Starting test\n");   fflush(stdout);
       MRIglmTest(mriglm);
+    } else if (ystream) {
+      printf("Starting fit and test streaming y in %g MB slabs\n",StreamSlabMB);   fflush(stdout);
+      err = MRIglmFitAndTestStream(mriglm, ystream, (size_t)(StreamSlabMB*1024*1024));
+      if(err) exit(1);
+      MRIstreamClose(&ystream);
     } else {
       printf("Starting fit and test\n");   fflush(stdout);
       MRIglmFitAndTest(mriglm);
@@ -1632,22 +1692,6 @@ int main(int argc, char **argv) {
     csd->searchspace = searchspace;
     csd->nreps = nsim;
     CSDallocData(csd);
-    if (!strcmp(csd->simtype,"mc-z")) {
-      rfs = RFspecInit(SynthSeed,NULL);
-      rfs->name = strcpyalloc("gaussian");
-      rfs->params[0] = 0;
-      rfs->params[1] = 1;
-      //z = MRIalloc(mriglm->y->width,mriglm->y->height,mriglm->y->depth,MRI_FLOAT);
-      z = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
-      zabs = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
-    }
-    if (!strcmp(csd->simtype,"mc-t")) {
-      rfs = RFspecInit(SynthSeed,NULL);
-      rfs->name = strcpyalloc("t");
-      rfs->params[0] = mriglm->glm->dof;
-      z = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
-      zabs = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
-    }
     printf("thresh = %g, threshadj = %g \n",csd->thresh,csd->thresh-log10(2.0));
 
     if(!DoSimThreshLoop){
@@ -1665,209 +1709,61 @@ int main(int argc, char **argv) {
 	    csdList[nthThresh][nthSign][n] = CSDcopy(csd,NULL);
 	    csdList[nthThresh][nthSign][n]->thresh = ThreshList[nthThresh];
 	    csdList[nthThresh][nthSign][n]->threshsign = SignList[nthSign];
+	    // Change sign to abs for F-tests
+	    if(mriglm->glm->C[n]->rows > 1) csdList[nthThresh][nthSign][n]->threshsign = 0;
 	    csdList[nthThresh][nthSign][n]->seed = csd->seed;
+	    strcpy(csdList[nthThresh][nthSign][n]->contrast,mriglm->glm->Cname[n]);
 	  }
 	}
       }
     }
 
-    printf("\n\nStarting simulation sim over %d trials\n",nsim);
+    nsimdone = 0;
+    if(SimResume) nsimdone = SimResumeCSD();
+
+    // Each thread has its own copy of everything that an iteration
+    // changes. Iterations only depend on their number (and the seed),
+    // so the results are the same however many threads there are.
+    nthreads = 1;
+#ifdef HAVE_OPENMP
+    nthreads = omp_get_max_threads();
+#endif
+    if(DiagCluster) nthreads = 1;
+    simthread = (GLMSIM **) calloc(nthreads,sizeof(GLMSIM *));
+    for(n=0; n < nthreads; n++) simthread[n] = SimAlloc();
+
+    printf("\n\nStarting simulation sim over %d trials (%d threads)\n",nsim,nthreads);
     TimerStart(&mytimer) ;
-    for (nthsim=0; nthsim < nsim; nthsim++) {
-      msecFitTime = TimerStop(&mytimer) ;
-      if(debug) printf("%d/%d t=%g ---------------------------------\n",
-             nthsim+1,nsim,msecFitTime/(1000*60.0));
-
-      if (!strcmp(csd->simtype,"mc-full")) {
-	if(! UseUniform)
-	  MRIrandn(mriglm->y->width,mriglm->y->height,mriglm->y->depth,
-		   mriglm->y->nframes,0,1,mriglm->y);
-	else
-	  MRIdrand48(mriglm->y->width,mriglm->y->height,mriglm->y->depth,
-		  mriglm->y->nframes,UniformMin,UniformMax,mriglm->y);
-        if(logflag) MRIlog(mriglm->y,mriglm->mask,-1,1,mriglm->y);
-        if(FWHM > 0)
-          SmoothSurfOrVol(surf, mriglm->y, mriglm->mask, SmoothLevel);
-      }
-      if (!strcmp(csd->simtype,"perm")) {
-        if (!OneSamplePerm) MatrixRandPermRows(mriglm->Xg);
-        else {
-          for (n=0; n < mriglm->y->nframes; n++) {
-            if (drand48() > 0.5) m = +1;
-            else                m = -1;
-            mriglm->Xg->rptr[n+1][1] = m;
-          }
-          //MatrixPrint(stdout,mriglm->Xg);
-        }
+    while(nsimdone < nsim) {
+      // A few iterations per thread between writes of the CSD files
+      nsimchunk = MIN(4*nthreads,nsim-nsimdone);
+      ROMP_PF_begin
+#ifdef HAVE_OPENMP
+      #pragma omp parallel for if_ROMP2(nthreads > 1, shown_reproducible) schedule(dynamic,1)
+#endif
+      for(nthsim=0; nthsim < nsimchunk; nthsim++) {
+	ROMP_PFLB_begin
+	int tid = 0;
+#ifdef HAVE_OPENMP
+	tid = omp_get_thread_num();
+#endif
+	SimIteration(simthread[tid],nsimdone+nthsim);
+	ROMP_PFLB_end
       }
+      ROMP_PF_end
+      nsimdone += nsimchunk;
 
-      // Variance smoothing
-      if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
-        // If variance smoothing, then need to test and fit separately
-        if (VarFWHM > 0) {
-          if(!DoSim) printf("Starting fit\n");
-          MRIglmFit(mriglm);
-          if(!DoSim) printf("Variance smoothing\n");
-          SmoothSurfOrVol(surf, mriglm->rvar, mriglm->mask, VarSmoothLevel);
-          if(!DoSim) printf("Starting test\n");
-          MRIglmTest(mriglm);
-        }
-	else {
-          if(!DoSim) printf("Starting fit and test\n");
-          MRIglmFitAndTest(mriglm);
-        }
-      }
-
-      for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
-	for(nthSign = 0; nthSign < nSignList; nthSign++){
-	  // Go through each contrast.
-	  for (n=0; n < mriglm->glm->ncontrasts; n++) {
-	    if(DoSimThreshLoop) {
-	      csd = csdList[nthThresh][nthSign][n];
-	      tSimSign = SignList[nthSign];
-	    }
-	    if(debug) printf("%2d %d %5.1f  %d %2d %5.1f\n",nthsim,nthThresh,
-			     csd->thresh,nthSign,tSimSign,TimerStop(&mytimer)/1000.0);
-
-	    // Change sign to abs for F-tests
-	    csd->threshsign = tSimSign;
-	    if(mriglm->glm->C[n]->rows > 1) csd->threshsign = 0;
-	    
-	    // Adjust threshold for one- or two-sided
-	    if(csd->threshsign == 0) threshadj = csd->thresh;
-	    else threshadj = csd->thresh - log10(2.0); // one-sided test
-
-	    if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
-	      sig = MRIlog10(mriglm->p[n],NULL,sig,1);
-	      // If test is not ABS then apply the sign
-	      if(csd->threshsign != 0) MRIsetSign(sig,mriglm->gamma[n],0);
-	      sigmax = MRIframeMax(sig,0,mriglm->mask,csd->threshsign,
-				   &cmax,&rmax,&smax);
-	      // Get Fmax at sig max 
-	      Fmax = MRIgetVoxVal(mriglm->F[n],cmax,rmax,smax,0);
-	      if(csd->threshsign != 0) Fmax = Fmax*SIGN(sigmax);
-	    } 
-	    else {
-	      // mc-z or mc-t: synth z-field, smooth, rescale,
-	      // compute p, compute sig
-	      // This should do the same thing as AFNI's AlphaSim
-	      // Synth and rescale without the mask, otherwise smoothing
-	      // smears the 0s into the mask area. Also, the stuff outisde
-	      // the mask area wont get zeroed.
-	      if(nthThresh == 0 && nthSign == 0) {
-		RFsynth(z,rfs,mriglm->mask); // z or t, as needed
-		if (SmoothLevel > 0) {
-		  SmoothSurfOrVol(surf, z, mriglm->mask, SmoothLevel);
-		  if(DiagCluster) {
-		    sprintf(tmpstr,"./%s-zsm0.%s",mriglm->glm->Cname[n],format);
-		    printf("Saving z into %s\n",tmpstr);
-		    MRIwrite(z,tmpstr);
-		    // Exits below
-		  }
-		  RFrescale(z,rfs,mriglm->mask,z);
-		}
-	      }
-	      if(DiagCluster) {
-		sprintf(tmpstr,"./%s-zsm1.%s",mriglm->glm->Cname[n],format);
-		printf("Saving z into %s\n",tmpstr);
-		MRIwrite(z,tmpstr);
-		// Exits below
-	      }
-	      // Slightly tortured way to get the right p-values because
-	      //   RFstat2P() computes one-sided, but I handle sidedness
-	      //   during thresholding.
-	      // First, use zabs to get a two-sided pval bet 0 and 0.5
-	      zabs = MRIabs(z,zabs);
-	      mriglm->p[n] = RFstat2P(zabs,rfs,mriglm->mask,0,mriglm->p[n]);
-	      // Next, mult pvals by 2 to get two-sided bet 0 and 1
-	      MRIscalarMul(mriglm->p[n],mriglm->p[n],2);
-	      // sig = -log10(p)
-	      sig = MRIlog10(mriglm->p[n],NULL,sig,1);
-	      // If test is not ABS then apply the sign
-	      if(csd->threshsign != 0) MRIsetSign(sig,z,0);
-
-	      sigmax = MRIframeMax(sig,0,mriglm->mask,csd->threshsign,
-				   &cmax,&rmax,&smax);
-	      Fmax = MRIgetVoxVal(z,cmax,rmax,smax,0);
-	      if(csd->threshsign == 0) Fmax = fabs(Fmax);
-	    }
-	    if(mriglm->mask) MRImask(sig,mriglm->mask,sig,0.0,0.0);
-
-	    if(surf) {
-	      // surface clustering -------------
-	      MRIScopyMRI(surf, sig, 0, "val");
-	      if(debug || Gdiag_no > 0) printf("Clustering on surface %lf\n",
-					       TimerStop(&mytimer)/1000.0);
-	      SurfClustList = sclustMapSurfClusters(surf,threshadj,-1,csd->threshsign,
-						    0,&nClusters,NULL);
-	      csize = sclustMaxClusterArea(SurfClustList, nClusters);
-	    } 
-	    else {
-	      // volume clustering -------------
-	      if (debug) printf("Clustering on volume\n");
-	      VolClustList = clustGetClusters(sig, 0, threshadj,-1,csd->threshsign,0,
-					      mriglm->mask, &nClusters, NULL);
-	      csize = voxelsize*clustMaxClusterCount(VolClustList,nClusters);
-	      if (Gdiag_no > 0) clustDumpSummary(stdout,VolClustList,nClusters);
-	      clustFreeClusterList(&VolClustList,nClusters);
-	    }
-	    if(debug) printf("%s %d nc=%d  maxcsize=%g  sigmax=%g  Fmax=%g\n",
-			     mriglm->glm->Cname[n],nthsim,nClusters,csize,sigmax,Fmax);
-
-	    // Re-write the full CSD file each time. Should not take that
-	    // long and assures output can be used immediately regardless
-	    // of whether the job terminated properly or not
-	    strcpy(csd->contrast,mriglm->glm->Cname[n]);
-	    if(DoSimThreshLoop && (nThreshList > 1 || nSignList > 1) ){
-	      if(round(csd->threshsign) ==  0) tmpstr2 = "abs"; 
-	      if(round(csd->threshsign) == +1) tmpstr2 = "pos"; 
-	      if(round(csd->threshsign) == -1) tmpstr2 = "neg"; 
-	      //sprintf(tmpstr,"%s-%s.th%04d.%s.csd",simbase,mriglm->glm->Cname[n],
-	      //      (int)round(csd->thresh*100),tmpstr2);
-	      sprintf(tmpstr,"%s.th%02d.%s.j001-%s.csd",simbase,
-		      (int)round(csd->thresh*10),tmpstr2,mriglm->glm->Cname[n]);
-	    }
-	    else
-	      sprintf(tmpstr,"%s-%s.csd",simbase,mriglm->glm->Cname[n]);
-	    if(debug) printf("csd %s \n",tmpstr);
-	    fflush(stdout);
-	    fp = fopen(tmpstr,"w");
-	    if (fp == NULL) {
-	      printf("ERROR: opening %s\n",tmpstr);
-	      exit(1);
-	    }
-	    fprintf(fp,"# ClusterSimulationData 2\n");
-	    fprintf(fp,"# mri_glmfit simulation sim\n");
-	    fprintf(fp,"# hostname %s\n",uts.nodename);
-	    fprintf(fp,"# machine  %s\n",uts.machine);
-	    fprintf(fp,"# runtime_min %g\n",msecFitTime/(1000*60.0));
-	    fprintf(fp,"# FixVertexAreaFlag %d\n",MRISgetFixVertexAreaValue());
-	    if (mriglm->mask) fprintf(fp,"# masking 1\n");
-	    else             fprintf(fp,"# masking 0\n");
-	    fprintf(fp,"# num_dof %d\n",mriglm->glm->C[n]->rows);
-	    fprintf(fp,"# den_dof %g\n",mriglm->glm->dof);
-	    fprintf(fp,"# SmoothLevel %g\n",SmoothLevel);
-	    csd->nreps = nthsim+1;
-	    csd->nClusters[nthsim] = nClusters;
-	    csd->MaxClusterSize[nthsim] = csize;
-	    csd->MaxSig[nthsim] = sigmax;
-	    csd->MaxStat[nthsim] = Fmax;
-	    CSDprint(fp, csd);
-	    fclose(fp);
-	    if(debug) CSDprint(stdout, csd);
-
-	    if(DiagCluster) {
-	      sprintf(tmpstr,"./%s-sig.%s",mriglm->glm->Cname[n],format);
-	      printf("Saving sig into %s and exiting ... \n",tmpstr);
-	      MRIwrite(sig,tmpstr);
-	      exit(1);
-	    }
-	    free(SurfClustList);
-	  } // contrasts
-	} // sign list
-      } // thresh list
-      //MRIfree(&sig);
+      // Re-write the full CSD files each time. Should not take that
+      // long and assures output can be used immediately (or resumed
+      // with --sim-resume) regardless of whether the job terminated
+      // properly or not
+      msecFitTime = TimerStop(&mytimer) ;
+      if(debug) printf("%d/%d t=%g ---------------------------------\n",
+		       nsimdone,nsim,msecFitTime/(1000*60.0));
+      SimWriteCSD(nsimdone,msecFitTime);
     }// simulation loop
+    for(n=0; n < nthreads; n++) SimFree(&simthread[n]);
+    free(simthread);
     if(SimDoneFile){
       fp = fopen(SimDoneFile,"w");
       fclose(fp);
@@ -2331,7 +2227,7 @@ int main(int argc, char **argv) {
 
 /* --------------------------------------------- */
 static int parse_commandline(int argc, char **argv) {
-  int  nargc , nargsused, msec, niters, frameno,k;
+  int  nargc , nargsused, msec, niters, frameno,k,nthreads;
   char **pargv, *option ;
   double rvartmp;
   FILE *fp;
@@ -2627,6 +2523,14 @@ static int parse_commandline(int argc, char **argv) {
       yFile = fio_fullpath(pargv[0]);
       nargsused = 1;
     } 
+    else if (!strcmp(option, "--y-mmap")) UseMappedY = 1;
+    else if (!strcmp(option, "--y-stream")) UseStreamY = 1;
+    else if (!strcmp(option, "--y-stream-mb")) {
+      if (nargc < 1) CMDargNErr(option,1);
+      sscanf(pargv[0],"%lf",&StreamSlabMB);
+      UseStreamY = 1;
+      nargsused = 1;
+    }
     else if (!strcmp(option, "--y-out")) {
       if (nargc < 1) CMDargNErr(option,1);
       yOutFile = fio_fullpath(pargv[0]);
@@ -2869,6 +2773,15 @@ static int parse_commandline(int argc, char **argv) {
       SimDoneFile = pargv[0];
       nargsused = 1;
     } 
+    else if (!strcmp(option, "--sim-resume")) SimResume = 1;
+    else if(!strcasecmp(option, "--threads") || !strcasecmp(option, "--nthreads") ){
+      if(nargc < 1) CMDargNErr(option,1);
+      sscanf(pargv[0],"%d",&nthreads);
+      #ifdef HAVE_OPENMP
+      omp_set_num_threads(nthreads);
+      #endif
+      nargsused = 1;
+    } 
     else {
       fprintf(stderr,"ERROR: Option %s unknown\n",option);
       if (CMDsingleDash(option))
@@ -2891,6 +2804,9 @@ printf("\n");
 printf("   --glmdir dir : save outputs to dir\n");
 printf("\n");
 printf("   --y inputfile\n");
+printf("   --y-mmap : map uncompressed y instead of reading it\n");
+printf("   --y-stream : read y a slab at a time during the fit\n");
+printf("   --y-stream-mb MB : slab size with --y-stream (default 256)\n");
 printf("   --table stats-table : as output by asegstats2table or aparcstats2table \n");
 printf("   --fsgd FSGDF <gd2mtx> : freesurfer descriptor file\n");
 printf("   --X design matrix file\n");
@@ -2970,6 +2886,8 @@ printf("                  before --fsgd)\n");
 printf("   --allow-zero-dof : mostly for very special purposes\n");
 printf("   --illcond : allow ill-conditioned design matrices\n");
 printf("   --sim-done SimDoneFile : create DoneFile when simulation finished \n");
+printf("   --sim-resume : continue a simulation from the CSD files already in csdbase\n");
+printf("   --threads nthreads : number of threads for the simulation\n");
 printf("\n");
 printf("\n");
 }
@@ -3079,6 +2997,25 @@ printf("formats (eg, mgh, img, nii, etc) accepted by mri_convert. See\n");
 printf("mris_preproc for an easy way to generate this file for surface data.\n");
 printf("Not with --table.\n");
 printf("\n");
+printf("--y-mmap\n");
+printf("\n");
+printf("Map the input file into memory instead of reading it. Pages are loaded\n");
+printf("as they are used and are shared by all processes mapping the same\n");
+printf("file, which helps when many jobs analyze the same large stack. Only\n");
+printf("works for uncompressed nii (or uchar mgh) in the native byte order;\n");
+printf("otherwise y is read as usual. NaNs in y are not removed.\n");
+printf("\n");
+printf("--y-stream\n");
+printf("--y-stream-mb MB\n");
+printf("\n");
+printf("Do not load y. Only its header is read, then the fit reads a slab\n");
+printf("of voxels (all frames, about MB megabytes, default 256) at a time,\n");
+printf("so memory stays bounded however big y is. Works best with .mgh, .nii\n");
+printf("or block-indexed .mgz/.nii.gz (the default when written by FreeSurfer).\n");
+printf("Only a plain fit is supported: no simulation, smoothing, weights,\n");
+printf("per-voxel regressors, frame exclusion, or outputs that need the\n");
+printf("residual of every voxel (eres, yhat, FWHM estimate, PCA, ...).\n");
+printf("\n");
 printf("--table stats-table\n");
 printf("\n");
 printf("Use text table as input instead of --y. The stats-table is that of\n");
@@ -3333,10 +3270,18 @@ printf("  name to the base name). A '.csd' is appended to each file name.\n");
 printf("\n");
 printf("Multiple simulations can be run in parallel by specifying different\n");
 printf("csdbasenames. Then pass the multiple CSD files to mri_surfcluster\n");
-printf("and mri_volcluster. The Full CSD file is written on each iteration,\n");
+printf("and mri_volcluster. The Full CSD file is written every few iterations,\n");
 printf("which means that the CSD file will be valid if the simulation\n");
 printf("is aborted or crashes.\n");
 printf("\n");
+printf("Iterations are also run in parallel on as many threads as OpenMP\n");
+printf("allows (set with --threads). Each iteration draws its noise or\n");
+printf("permutation from its own random stream, computed from the seed and\n");
+printf("the iteration number, so the CSD files are the same for a given seed\n");
+printf("however many threads are used. To continue a simulation that was\n");
+printf("stopped, run the same command with --sim-resume; the iterations\n");
+printf("already in the CSD files are kept and the rest are run.\n");
+printf("\n");
 printf("In the cases where the design matrix is a single columns of ones\n");
 printf("(ie, one-sample group mean), it makes no sense to permute the\n");
 printf("rows of the design matrix. mri_glmfit automatically checks\n");
@@ -3461,6 +3406,22 @@ static void check_options(void) {
     printf("ERROR: do not use --prune with --sim\n");
     exit(1);
   }
+  if(UseStreamY){
+    if(DoSim || synth || UseStatTable || DoFisher || SubSample || DoDistance ||
+       ExcludeFrames || nRandExclude || NSplits || frameMaskFile ||
+       DoMRTM1 || DoMRTM2 || npvr || wFile || DoFFx || usedti || logflag ||
+       FWHM > 0 || VarFWHM > 0 || RmSpatialMean || nSelfReg || voxdumpflag ||
+       yhatSave || eresSave || eresSCMSave || yOutFile || pcaSave ||
+       DoKurtosis || DoSkew || DoTemporalAR1 || useqa){
+      printf("ERROR: --y-stream only supports a plain fit of y. Simulation,\n");
+      printf("  smoothing, weights, per-voxel regressors, frame exclusion, and\n");
+      printf("  outputs that need the residual of every voxel cannot be used.\n");
+      exit(1);
+    }
+    // The FWHM is estimated from the residual, which is never all in memory
+    if(ComputeFWHM) printf("INFO: --y-stream, not estimating the residual FWHM\n");
+    ComputeFWHM = 0;
+  }
   if(DoSim && VarFWHM > 0 &&
       (!strcmp(csd->simtype,"mc-z") || !strcmp(csd->simtype,"mc-t"))) {
     printf("ERROR: cannot use variance smoothing with mc-z or "
@@ -3594,6 +3555,11 @@ static int SmoothSurfOrVol(MRIS *surf, MRI *mri, MRI *mask, double SmthLevel) {
   extern int DoSim;
   extern struct timeb  mytimer;
   extern int UseMaskWithSmoothing;
+  // FFT smoothing plans for the (at most two, data and variance) FWHMs,
+  // built on first use and kept across simulation iterations
+  static MRI_GAUSSIAN_FFT *gfft[2] = {NULL,NULL};
+  static double gfftstd[2];
+  int nthplan;
   double gstd;
 
   if (surf == NULL) {
@@ -3601,10 +3567,22 @@ static int SmoothSurfOrVol(MRIS *surf, MRI *mri, MRI *mask, double SmthLevel) {
     if (!DoSim || debug || Gdiag_no > 0)
       printf("  Volume Smoothing by FWHM=%lf, Gstd=%lf, t=%lf\n",
              SmthLevel,gstd,TimerStop(&mytimer)/1000.0);
-    if(UseMaskWithSmoothing)
-      MRImaskedGaussianSmooth(mri, mask, gstd, mri);
-    else
-      MRImaskedGaussianSmooth(mri, NULL, gstd, mri);
+    // Simulation threads share the plans, which are only read once built
+#ifdef HAVE_OPENMP
+    #pragma omp critical(SmoothSurfOrVolPlan)
+#endif
+    {
+      for(nthplan=0; nthplan < 2; nthplan++)
+        if(gfft[nthplan] && gfftstd[nthplan] == gstd) break;
+      if(nthplan == 2){
+        nthplan = (gfft[0] != NULL && gfft[1] == NULL);
+        MRIfreeGaussianFFT(&gfft[nthplan]);
+        gfft[nthplan] = MRIallocGaussianFFT(mri, gstd, gstd, gstd,
+                                            UseMaskWithSmoothing ? mask : NULL);
+        gfftstd[nthplan] = gstd;
+      }
+    }
+    MRIgaussianFFTsmooth(gfft[nthplan], mri, mri);
     if (!DoSim || debug || Gdiag_no > 0)
       printf("  Done Volume Smoothing t=%lf\n",TimerStop(&mytimer)/1000.0);
   }
@@ -3623,6 +3601,375 @@ static int SmoothSurfOrVol(MRIS *surf, MRI *mri, MRI *mask, double SmthLevel) {
 }
 
 
+/*--------------------------------------------------------------------
+  SimSeed() - the seed of the random numbers of simulation iteration
+  nthsim. It is mixed from the base seed and the iteration number so
+  that each iteration draws from a stream of its own, whichever thread
+  runs it and whenever (eg, after --sim-resume).
+  --------------------------------------------------------------------*/
+static unsigned long SimSeed(int seed, int nthsim) {
+  unsigned long long x;
+
+  x = ((unsigned long long)(unsigned int)seed << 32) + (unsigned int)nthsim;
+  x += 0x9E3779B97F4A7C15ULL; // splitmix64
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  x = x ^ (x >> 31);
+  // A seed of 0 would be taken from the time of day
+  x &= 0x7fffffff;
+  if(x == 0) x = 1;
+  return((unsigned long)x);
+}
+
+/*--------------------------------------------------------------------
+  SimAlloc() - the working copies for one simulation thread. The
+  random field draws the noise for mc-full, z or t for mc-z and mc-t,
+  and uniform numbers to permute with for perm.
+  --------------------------------------------------------------------*/
+static GLMSIM *SimAlloc(void) {
+  GLMSIM *sim;
+  int vno;
+
+  sim = (GLMSIM *) calloc(1,sizeof(GLMSIM));
+  sim->mriglm = MRIglmCopyDesign(mriglm);
+  if (!strcmp(csd->simtype,"mc-full"))
+    sim->mriglm->y = MRIcopy(mriglm->y,NULL);
+
+  sim->rfs = RFspecInit(SynthSeed,NULL);
+  if (!strcmp(csd->simtype,"mc-t")) {
+    sim->rfs->name = strcpyalloc("t");
+    sim->rfs->params[0] = mriglm->glm->dof;
+  }
+  else if (!strcmp(csd->simtype,"perm") || UseUniform) {
+    sim->rfs->name = strcpyalloc("uniform");
+    sim->rfs->params[0] = 0;
+    sim->rfs->params[1] = 1;
+    if(UseUniform && !strcmp(csd->simtype,"mc-full")){
+      sim->rfs->params[0] = UniformMin;
+      sim->rfs->params[1] = UniformMax;
+    }
+  }
+  else {
+    sim->rfs->name = strcpyalloc("gaussian");
+    sim->rfs->params[0] = 0;
+    sim->rfs->params[1] = 1;
+  }
+  if (!strcmp(csd->simtype,"mc-z") || !strcmp(csd->simtype,"mc-t")) {
+    sim->z    = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
+    sim->zabs = MRIcloneBySpace(mriglm->y,MRI_FLOAT,1);
+  }
+
+  if (surf) {
+    sim->surf = MRISclone(surf);
+    sim->surf->group_avg_surface_area = surf->group_avg_surface_area;
+    sim->surf->group_avg_vtxarea_loaded = surf->group_avg_vtxarea_loaded;
+    for (vno=0; vno < surf->nvertices; vno++)
+      sim->surf->vertices[vno].group_avg_area = surf->vertices[vno].group_avg_area;
+  }
+  return(sim);
+}
+
+/*--------------------------------------------------------------------*/
+static int SimFree(GLMSIM **psim) {
+  GLMSIM *sim = *psim;
+
+  if (!strcmp(csd->simtype,"mc-full")) MRIfree(&sim->mriglm->y);
+  MRIglmFreeCopy(&sim->mriglm);
+  if (sim->surf) MRISfree(&sim->surf);
+  RFspecFree(&sim->rfs);
+  if (sim->z)    MRIfree(&sim->z);
+  if (sim->zabs) MRIfree(&sim->zabs);
+  if (sim->sig)  MRIfree(&sim->sig);
+  free(sim);
+  *psim = NULL;
+  return(0);
+}
+
+/*--------------------------------------------------------------------
+  SimIteration() - simulation iteration nthsim: synthesizes (mc-*) or
+  permutes (perm), fits, thresholds and clusters, and puts the max
+  cluster size, sig and stat of each threshold, sign and contrast in
+  item nthsim of its CSD. Only the copies in sim are changed, so
+  different iterations can run at the same time.
+  --------------------------------------------------------------------*/
+static int SimIteration(GLMSIM *sim, int nthsim) {
+  MRIGLM *simglm = sim->mriglm;
+  SURFCLUSTERSUM *SurfClustList = NULL;
+  VOLCLUSTER **VolClustList;
+  CSD *csdn;
+  int n, f, k, tmp, *order, nthThresh, nthSign, nClusters, cmax, rmax, smax;
+  double threshadj, sigmax, Fmax, csize;
+  char tmpstr[2000];
+
+  RFspecSetSeed(sim->rfs, SimSeed(SynthSeed,nthsim));
+
+  if (!strcmp(csd->simtype,"mc-full")) {
+    RFsynth(simglm->y,sim->rfs,NULL);
+    if(logflag) MRIlog(simglm->y,simglm->mask,-1,1,simglm->y);
+    if(FWHM > 0)
+      SmoothSurfOrVol(surf, simglm->y, simglm->mask, SmoothLevel);
+  }
+  if (!strcmp(csd->simtype,"perm")) {
+    if (!OneSamplePerm) {
+      // The rows of the original design in a random order
+      order = (int *) calloc(mriglm->Xg->rows,sizeof(int));
+      for (f=0; f < mriglm->Xg->rows; f++) order[f] = f;
+      for (f=mriglm->Xg->rows-1; f > 0; f--) {
+        k = MIN((int)(RFdrawVal(sim->rfs)*(f+1)),f);
+        tmp = order[f];
+        order[f] = order[k];
+        order[k] = tmp;
+      }
+      for (f=0; f < mriglm->Xg->rows; f++)
+        for (k=1; k <= mriglm->Xg->cols; k++)
+          simglm->Xg->rptr[f+1][k] = mriglm->Xg->rptr[order[f]+1][k];
+      free(order);
+    }
+    else {
+      for (f=0; f < mriglm->Xg->rows; f++) {
+        if (RFdrawVal(sim->rfs) > 0.5) simglm->Xg->rptr[f+1][1] = +1;
+        else                           simglm->Xg->rptr[f+1][1] = -1;
+      }
+    }
+  }
+
+  if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
+    // If variance smoothing, then need to test and fit separately
+    if (VarFWHM > 0) {
+      MRIglmFit(simglm);
+      SmoothSurfOrVol(surf, simglm->rvar, simglm->mask, VarSmoothLevel);
+      MRIglmTest(simglm);
+    }
+    else MRIglmFitAndTest(simglm);
+  }
+
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+    for(nthSign = 0; nthSign < nSignList; nthSign++){
+      // Go through each contrast.
+      for (n=0; n < mriglm->glm->ncontrasts; n++) {
+	csdn = csdList[nthThresh][nthSign][n];
+	if(debug) printf("%2d %d %5.1f  %d %2d %5.1f\n",nthsim,nthThresh,
+			 csdn->thresh,nthSign,(int)csdn->threshsign,TimerStop(&mytimer)/1000.0);
+
+	// Adjust threshold for one- or two-sided
+	if(csdn->threshsign == 0) threshadj = csdn->thresh;
+	else threshadj = csdn->thresh - log10(2.0); // one-sided test
+
+	if (!strcmp(csd->simtype,"mc-full") || !strcmp(csd->simtype,"perm")) {
+	  sim->sig = MRIlog10(simglm->p[n],NULL,sim->sig,1);
+	  // If test is not ABS then apply the sign
+	  if(csdn->threshsign != 0) MRIsetSign(sim->sig,simglm->gamma[n],0);
+	  sigmax = MRIframeMax(sim->sig,0,simglm->mask,csdn->threshsign,
+			       &cmax,&rmax,&smax);
+	  // Get Fmax at sig max 
+	  Fmax = MRIgetVoxVal(simglm->F[n],cmax,rmax,smax,0);
+	  if(csdn->threshsign != 0) Fmax = Fmax*SIGN(sigmax);
+	} 
+	else {
+	  // mc-z or mc-t: synth z-field, smooth, rescale,
+	  // compute p, compute sig
+	  // This should do the same thing as AFNI's AlphaSim
+	  // Synth and rescale without the mask, otherwise smoothing
+	  // smears the 0s into the mask area. Also, the stuff outisde
+	  // the mask area wont get zeroed.
+	  if(nthThresh == 0 && nthSign == 0) {
+	    RFsynth(sim->z,sim->rfs,simglm->mask); // z or t, as needed
+	    if (SmoothLevel > 0) {
+	      SmoothSurfOrVol(surf, sim->z, simglm->mask, SmoothLevel);
+	      if(DiagCluster) {
+		sprintf(tmpstr,"./%s-zsm0.%s",mriglm->glm->Cname[n],format);
+		printf("Saving z into %s\n",tmpstr);
+		MRIwrite(sim->z,tmpstr);
+		// Exits below
+	      }
+	      RFrescale(sim->z,sim->rfs,simglm->mask,sim->z);
+	    }
+	  }
+	  if(DiagCluster) {
+	    sprintf(tmpstr,"./%s-zsm1.%s",mriglm->glm->Cname[n],format);
+	    printf("Saving z into %s\n",tmpstr);
+	    MRIwrite(sim->z,tmpstr);
+	    // Exits below
+	  }
+	  // Slightly tortured way to get the right p-values because
+	  //   RFstat2P() computes one-sided, but I handle sidedness
+	  //   during thresholding.
+	  // First, use zabs to get a two-sided pval bet 0 and 0.5
+	  sim->zabs = MRIabs(sim->z,sim->zabs);
+	  simglm->p[n] = RFstat2P(sim->zabs,sim->rfs,simglm->mask,0,simglm->p[n]);
+	  // Next, mult pvals by 2 to get two-sided bet 0 and 1
+	  MRIscalarMul(simglm->p[n],simglm->p[n],2);
+	  // sig = -log10(p)
+	  sim->sig = MRIlog10(simglm->p[n],NULL,sim->sig,1);
+	  // If test is not ABS then apply the sign
+	  if(csdn->threshsign != 0) MRIsetSign(sim->sig,sim->z,0);
+
+	  sigmax = MRIframeMax(sim->sig,0,simglm->mask,csdn->threshsign,
+			       &cmax,&rmax,&smax);
+	  Fmax = MRIgetVoxVal(sim->z,cmax,rmax,smax,0);
+	  if(csdn->threshsign == 0) Fmax = fabs(Fmax);
+	}
+	if(simglm->mask) MRImask(sim->sig,simglm->mask,sim->sig,0.0,0.0);
+
+	if(sim->surf) {
+	  // surface clustering -------------
+	  MRIScopyMRI(sim->surf, sim->sig, 0, "val");
+	  if(debug || Gdiag_no > 0) printf("Clustering on surface %lf\n",
+					   TimerStop(&mytimer)/1000.0);
+	  SurfClustList = sclustMapSurfClusters(sim->surf,threshadj,-1,csdn->threshsign,
+						0,&nClusters,NULL);
+	  csize = sclustMaxClusterArea(SurfClustList, nClusters);
+	} 
+	else {
+	  // volume clustering -------------
+	  if (debug) printf("Clustering on volume\n");
+	  VolClustList = clustGetClusters(sim->sig, 0, threshadj,-1,csdn->threshsign,0,
+					  simglm->mask, &nClusters, NULL);
+	  csize = voxelsize*clustMaxClusterCount(VolClustList,nClusters);
+	  if (Gdiag_no > 0) clustDumpSummary(stdout,VolClustList,nClusters);
+	  clustFreeClusterList(&VolClustList,nClusters);
+	}
+	if(debug) printf("%s %d nc=%d  maxcsize=%g  sigmax=%g  Fmax=%g\n",
+			 mriglm->glm->Cname[n],nthsim,nClusters,csize,sigmax,Fmax);
+
+	// Each iteration has its own item, so the order they are
+	// done in does not matter
+	csdn->nClusters[nthsim] = nClusters;
+	csdn->MaxClusterSize[nthsim] = csize;
+	csdn->MaxSig[nthsim] = sigmax;
+	csdn->MaxStat[nthsim] = Fmax;
+
+	if(DiagCluster) {
+	  sprintf(tmpstr,"./%s-sig.%s",mriglm->glm->Cname[n],format);
+	  printf("Saving sig into %s and exiting ... \n",tmpstr);
+	  MRIwrite(sim->sig,tmpstr);
+	  exit(1);
+	}
+	free(SurfClustList);
+	SurfClustList = NULL;
+      } // contrasts
+    } // sign list
+  } // thresh list
+  return(0);
+}
+
+/*--------------------------------------------------------------------
+  SimCSDFileName() - the CSD file of the given threshold, sign and
+  contrast.
+  --------------------------------------------------------------------*/
+static char *SimCSDFileName(char *fname, int nthThresh, int nthSign, int n) {
+  CSD *csdn = csdList[nthThresh][nthSign][n];
+  const char *signstr = "abs";
+
+  if(DoSimThreshLoop && (nThreshList > 1 || nSignList > 1) ){
+    if(round(csdn->threshsign) == +1) signstr = "pos"; 
+    if(round(csdn->threshsign) == -1) signstr = "neg"; 
+    sprintf(fname,"%s.th%02d.%s.j001-%s.csd",simbase,
+	    (int)round(csdn->thresh*10),signstr,mriglm->glm->Cname[n]);
+  }
+  else
+    sprintf(fname,"%s-%s.csd",simbase,mriglm->glm->Cname[n]);
+  return(fname);
+}
+
+/*--------------------------------------------------------------------
+  SimWriteCSD() - writes the first nreps iterations of every CSD.
+  --------------------------------------------------------------------*/
+static int SimWriteCSD(int nreps, int msecTime) {
+  extern struct utsname uts;
+  CSD *csdn;
+  FILE *fp;
+  int n, nthThresh, nthSign;
+  char fname[2000];
+
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+    for(nthSign = 0; nthSign < nSignList; nthSign++){
+      for (n=0; n < mriglm->glm->ncontrasts; n++) {
+	csdn = csdList[nthThresh][nthSign][n];
+	SimCSDFileName(fname,nthThresh,nthSign,n);
+	if(debug) printf("csd %s \n",fname);
+	fflush(stdout);
+	fp = fopen(fname,"w");
+	if (fp == NULL) {
+	  printf("ERROR: opening %s\n",fname);
+	  exit(1);
+	}
+	fprintf(fp,"# ClusterSimulationData 2\n");
+	fprintf(fp,"# mri_glmfit simulation sim\n");
+	fprintf(fp,"# hostname %s\n",uts.nodename);
+	fprintf(fp,"# machine  %s\n",uts.machine);
+	fprintf(fp,"# runtime_min %g\n",msecTime/(1000*60.0));
+	fprintf(fp,"# FixVertexAreaFlag %d\n",MRISgetFixVertexAreaValue());
+	if (mriglm->mask) fprintf(fp,"# masking 1\n");
+	else             fprintf(fp,"# masking 0\n");
+	fprintf(fp,"# num_dof %d\n",mriglm->glm->C[n]->rows);
+	fprintf(fp,"# den_dof %g\n",mriglm->glm->dof);
+	fprintf(fp,"# SmoothLevel %g\n",SmoothLevel);
+	csdn->nreps = nreps;
+	CSDprint(fp, csdn);
+	fclose(fp);
+	if(debug) CSDprint(stdout, csdn);
+      }
+    }
+  }
+  return(0);
+}
+
+/*--------------------------------------------------------------------
+  SimResumeCSD() - loads the iterations already in the CSD files of an
+  interrupted simulation and returns how many all of them have. The
+  seed is taken from the files so that the iterations still to do are
+  the ones the interrupted run would have done. Returns 0 (start over)
+  if any file is missing.
+  --------------------------------------------------------------------*/
+static int SimResumeCSD(void) {
+  CSD *csdn, *csdold;
+  int n, nthThresh, nthSign, nthrep, nreps = nsim;
+  long seed = -1;
+  char fname[2000];
+
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++){
+    for(nthSign = 0; nthSign < nSignList; nthSign++){
+      for (n=0; n < mriglm->glm->ncontrasts; n++) {
+	csdn = csdList[nthThresh][nthSign][n];
+	SimCSDFileName(fname,nthThresh,nthSign,n);
+	if(!fio_FileExistsReadable(fname)){
+	  printf("No %s to resume from, starting the simulation over\n",fname);
+	  return(0);
+	}
+	csdold = CSDread(fname);
+	if(csdold == NULL) exit(1);
+	if(strcmp(csdold->simtype,csdn->simtype) || fabs(csdold->thresh-csdn->thresh) > 1e-4 ||
+	   csdold->threshsign != csdn->threshsign || (seed >= 0 && csdold->seed != seed)) {
+	  printf("ERROR: %s is from a different simulation (%s, thresh %g, sign %g, seed %ld)\n",
+		 fname,csdold->simtype,csdold->thresh,csdold->threshsign,csdold->seed);
+	  exit(1);
+	}
+	seed = csdold->seed;
+	nreps = MIN(nreps,csdold->nreps);
+	for(nthrep = 0; nthrep < MIN(csdold->nreps,nsim); nthrep++){
+	  csdn->nClusters[nthrep]      = csdold->nClusters[nthrep];
+	  csdn->MaxClusterSize[nthrep] = csdold->MaxClusterSize[nthrep];
+	  csdn->MaxSig[nthrep]         = csdold->MaxSig[nthrep];
+	  csdn->MaxStat[nthrep]        = csdold->MaxStat[nthrep];
+	}
+	CSDfreeData(csdold);
+	free(csdold);
+      }
+    }
+  }
+
+  if(seed != SynthSeed) printf("Resuming with the seed of the CSD files, %ld\n",seed);
+  SynthSeed = seed;
+  csd->seed = seed;
+  for(nthThresh = 0; nthThresh < nThreshList; nthThresh++)
+    for(nthSign = 0; nthSign < nSignList; nthSign++)
+      for (n=0; n < mriglm->glm->ncontrasts; n++)
+	csdList[nthThresh][nthSign][n]->seed = seed;
+  printf("Resuming simulation after %d of %d iterations\n",nreps,nsim);
+  return(nreps);
+}
+
 /*--------------------------------------------------------------------*/
 int MRISmaskByLabel(MRI *y, MRIS *surf, LABEL *lb, int invflag) {
   int **crslut, *lbmask, vtxno, n, c, r, s, f;
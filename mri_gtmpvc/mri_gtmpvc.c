@@ -682,8 +682,8 @@ int main(int argc, char *argv[])
       if(Gdiag_no > 0) PrintMemUsage(stdout);
       PrintMemUsage(logfp);
       TimerStart(&mytimer);
-      MatrixFree(&gtm->X);
-      MatrixFree(&gtm->X0);
+      GTMsparseFree(&gtm->X);
+      GTMsparseFree(&gtm->X0);
       GTMbuildX(gtm);
       if(gtm->X==NULL) exit(1);
       printf(" gtm build time %4.1f sec\n",TimerStop(&mytimer)/1000.0);fflush(stdout);
@@ -701,12 +701,18 @@ int main(int argc, char *argv[])
   //printf("Freeing segpvf\n"); fflush(stdout);
   //MRIfree(&gtm->segpvf);
   if(SaveX0) {
+    MATRIX *Xdense;
     printf("Writing X0 to %s\n",Xfile);
-    MatlabWrite(gtm->X0, X0file,"X0");
+    Xdense = GTMsparseToMatrix(gtm->X0,NULL);
+    MatlabWrite(Xdense, X0file,"X0");
+    MatrixFree(&Xdense);
   }
   if(SaveX) {
+    MATRIX *Xdense;
     printf("Writing X to %s\n",Xfile);
-    MatlabWrite(gtm->X, Xfile,"X");
+    Xdense = GTMsparseToMatrix(gtm->X,NULL);
+    MatlabWrite(Xdense, Xfile,"X");
+    MatrixFree(&Xdense);
   }
 
   printf("Solving ...\n");
@@ -722,13 +728,12 @@ int main(int argc, char *argv[])
   PrintMemUsage(logfp);
 
   if(gtm->X0 && DoGTMMat){
-    MATRIX *X0tX0, *X0t,*X0tX,*iX0tX0,*gtmmat;
+    MATRIX *X0tX0, *X0tX,*iX0tX0,*gtmmat;
     printf("Computing actual GTM Matrix\n"); fflush(stdout);
-    X0tX0 = MatrixMtM(gtm->X0,NULL);
+    X0tX0 = GTMsparseMtN(gtm->X0,gtm->X0,NULL);
     iX0tX0 = MatrixInverse(X0tX0,NULL);
 
-    X0t = MatrixTranspose(gtm->X0,NULL);
-    X0tX = MatrixMultiplyD(X0t,gtm->X,NULL);
+    X0tX = GTMsparseMtN(gtm->X0,gtm->X,NULL);
     gtmmat = MatrixMultiplyD(iX0tX0,X0tX,NULL);
     sprintf(tmpstr,"%s/gtm.mat",AuxDir);
     MatrixWriteTxt(tmpstr,gtmmat);
@@ -736,7 +741,6 @@ int main(int argc, char *argv[])
     sprintf(tmpstr,"%s/gtm.inv.mat",AuxDir);
     MatrixWriteTxt(tmpstr,gtmmat);
     printf("done computing gtm matrix\n"); fflush(stdout);
-    MatrixFree(&X0t);
     MatrixFree(&X0tX0);
     MatrixFree(&X0tX);
     MatrixFree(&gtmmat);
@@ -827,7 +831,7 @@ int main(int argc, char *argv[])
   MRIfree(&mritmp);
 
   printf("Freeing X\n");
-  MatrixFree(&gtm->X);
+  GTMsparseFree(&gtm->X);
 
   nopvc = GTMnoPVC(gtm);
   sprintf(tmpstr,"%s/nopvc.nii.gz",OutDir);
@@ -906,7 +910,7 @@ int main(int argc, char *argv[])
   if(yhat0File) MRIwrite(gtm->ysynth,yhat0File);
   
   printf("Freeing X0\n");
-  MatrixFree(&gtm->X0);
+  GTMsparseFree(&gtm->X0);
 
 
   if(yhatFile|| yhatFullFoVFile){
@@ -1316,6 +1320,7 @@ static int parse_commandline(int argc, char **argv) {
     } 
     else if(!strcasecmp(option, "--rbv")) DoRBV = 1;
     else if(!strcasecmp(option, "--no-rescale")) gtm->rescale = 0;
+    else if(!strcasecmp(option, "--cg")) gtm->SolveCG = 1;
     else if(!strcasecmp(option, "--scale-refval")) {
       if(nargc < 1) CMDargNErr(option,1);
       sscanf(pargv[0],"%lf",&gtm->scale_refval);
@@ -1588,6 +1593,7 @@ static void print_usage(void) {
   printf("   --reg-identity : assume that input is in anatomical space \n");
   printf("   --rescale Id1 <Id2...>  : specify reference region(s) used to rescale (default is pons)\n");
   printf("   --no-rescale   : do not global rescale such that mean of reference region is scaleref\n");
+  printf("   --cg : solve for the GTM with conjugate gradients instead of inverting XtX (faster with many segs)\n");
   printf("   --scale-refval refval : scale such that mean in reference region is refval\n");
   printf("\n");
   printf("   --no-tfe : do not correction for tissue fraction effect (with --psf 0 turns off PVC entirely)\n");
@@ -2291,30 +2297,25 @@ MRI *GTMsimAnatSeg(GTM *gtm)
  */
 int GTMsom(GTM *gtm)
 {
-  int rthseg, cthseg, k, f, c,r,s,segid;
+  int rthseg, cthseg, f, *rowseg;
+  long n;
   double val,cbeta,sum;
 
   gtm->som = MatrixAlloc(gtm->nsegs,gtm->nsegs,MATRIX_REAL);
 
+  // Only the nonzeros of X contribute, in the same order as the voxels
+  rowseg = GTMnthsegPerRow(gtm);
   f = 0; // only one frame with the matrix
   for(cthseg=0; cthseg < gtm->nsegs; cthseg++){
-    k = 0;
     cbeta = gtm->beta->rptr[cthseg+1][f+1];
-    for(s=0; s < gtm->yvol->depth; s++){ // crs order is important here!
-      for(c=0; c < gtm->yvol->width; c++){
-	for(r=0; r < gtm->yvol->height; r++){
-	  if(gtm->mask && MRIgetVoxVal(gtm->mask,c,r,s,0) < 0.5) continue;
-	  val = cbeta*gtm->X->rptr[k+1][cthseg+1];
-	  segid = MRIgetVoxVal(gtm->gtmseg,c,r,s,0);
-	  if(segid != 0) {
-	    rthseg = GTMsegid2nthseg(gtm,segid);
-	    gtm->som->rptr[rthseg+1][cthseg+1] += val;
-	  }
-	  k++;
-	}
-      }
+    for(n = gtm->X->colptr[cthseg]; n < gtm->X->colptr[cthseg+1]; n++){
+      rthseg = rowseg[gtm->X->rowind[n]];
+      if(rthseg < 0) continue;
+      val = cbeta*gtm->X->val[n];
+      gtm->som->rptr[rthseg+1][cthseg+1] += val;
     }
   } // cthseg
+  free(rowseg);
     
   /* Normalize SOM(rNoPVC,cGTM) is the proportion that cGTM
      contributes to rNoPVC, ie, it is the amount of spill-out of
@@ -400,6 +400,7 @@ int mrisFindNeighbors2(MRI_SURFACE *mris) {
   if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON)
     fprintf(stdout, "finding surface neighbors...") ;
 
+  MRISdetachNeighborArena(mris) ;  /* v->v and dists are reallocated below */
   for (k=0;k<mris->nvertices;k++) {
     if (k == Gdiag_no)
       DiagBreak() ;
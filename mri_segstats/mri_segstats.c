@@ -210,6 +210,8 @@ int main(int argc, char **argv)
   float min, max, range, mean, std, snr;
   FILE *fp;
   double  **favg, *favgmn;
+  int *segnvox, *avgsegids;
+  MRI_SEG_STATS *segstats;
   char tmpstr[1000];
   double atlas_icv=0;
   int ntotalsegid=0;
@@ -781,6 +783,14 @@ int main(int argc, char **argv)
 
   DoContinue=0;nx=0;skip=0;n0=0;vol=0;nhits=0;c=0;min=0.0;max=0.0;range=0.0;mean=0.0;std=0.0;snr=0.0;
 
+  // Count the voxels of, and get the stats within, all the
+  // segmentations in one pass over the volume
+  segstats = (MRI_SEG_STATS *) calloc(sizeof(MRI_SEG_STATS),nsegid);
+  for (n=0; n < nsegid; n++) segstats[n].segid = StatSumTable[n].id;
+  if (!dontrun)
+    MRIsegStatsAll(seg, (InVolFile != NULL) ? invol : NULL, frame,
+                   UseRobust, RobustPct, nsegid, segstats);
+
   ROMP_PF_begin
 #ifdef HAVE_OPENMP
   #pragma omp parallel for if_ROMP(assume_reproducible) firstprivate(DoContinue,nx,skip,n0,vol,nhits,c,min,max,range,mean,std,snr)  schedule(guided)
@@ -823,13 +833,13 @@ int main(int argc, char **argv)
       {
         if (pvvol == NULL)
         {
-          nhits = MRIsegCount(seg, StatSumTable[n].id, 0);
+          nhits = segstats[n].nvoxels;
           vol = nhits*voxelvolume;
         }
         else
         {
           vol = MRIvoxelsInLabelWithPartialVolumeEffects(seg, pvvol, StatSumTable[n].id, NULL, NULL);
-          nhits = MRIsegCount(seg, StatSumTable[n].id, 0);
+          nhits = segstats[n].nvoxels;
 //          nhits = nint(vol/voxelvolume);
         }
       }
@@ -866,13 +876,11 @@ int main(int argc, char **argv)
     {
       if (nhits > 0)
       {
-        if(UseRobust == 0)
-          MRIsegStats(seg, StatSumTable[n].id, invol, frame,
-            &min, &max, &range, &mean, &std);
-        else
-          MRIsegStatsRobust(seg, StatSumTable[n].id, invol, frame,
-            &min, &max, &range, &mean, &std, RobustPct);
-
+        min   = segstats[n].min;
+        max   = segstats[n].max;
+        range = segstats[n].range;
+        mean  = segstats[n].mean;
+        std   = segstats[n].std;
         snr = mean/std;
       }
       else
@@ -895,6 +903,7 @@ int main(int argc, char **argv)
     ROMP_PFLB_end
   }
   ROMP_PF_end
+  free(segstats);
   
   /* print results ordered */
   for (n=0; n < nsegid; n++)
@@ -1371,11 +1380,13 @@ int main(int argc, char **argv)
     for (n=0; n < nsegid; n++)
       favg[n] = (double *) calloc(sizeof(double),invol->nframes);
     favgmn = (double *) calloc(sizeof(double *),nsegid);
+    avgsegids = (int *) calloc(sizeof(int),nsegid);
+    segnvox = (int *) calloc(sizeof(int),nsegid);
+    for (n=0; n < nsegid; n++) avgsegids[n] = StatSumTable[n].id;
+    MRIsegFrameAvgAll(seg, invol, nsegid, avgsegids, favg, segnvox);
+    free(avgsegids);
     for (n=0; n < nsegid; n++) {
-      printf("%3d",n);
-      if (n%20 == 19) printf("\n");
-      fflush(stdout);
-      nvox = MRIsegFrameAvg(seg, StatSumTable[n].id, invol, favg[n]);
+      nvox = segnvox[n];
       favgmn[n] = 0.0;
       for(f=0; f < invol->nframes; f++) {
 	if(DoFrameSum) favg[n][f] *= nvox; // Undo spatial average
@@ -1384,7 +1395,7 @@ int main(int argc, char **argv)
       favgmn[n] /= invol->nframes;
       if(RmFrameAvgMn) for(f=0; f < invol->nframes; f++) favg[n][f] -= favgmn[n];
     }
-    printf("\n");
+    free(segnvox);
 
     // Save mean over space and frames in simple text file
     // Each seg on a separate line
@@ -1288,6 +1288,10 @@ static int parse_commandline(int argc, char **argv)
       SynthPDF = 1;
     } else if (!strcasecmp(option, "--ones")) {
       SynthOnes = 1;
+    } else if (!strcasecmp(option, "--reg-cache")) {
+      if (nargc < 1) CMDargNErr(option,1);
+      setenv("FS_SURFREG_CACHE",pargv[0],1);
+      nargsused = 1;
     } else if (!strcasecmp(option, "--jac")) {
       jac = 1;
     } else if (!strcasecmp(option, "--norm-var")) {
@@ -1776,6 +1780,7 @@ static void print_usage(void)
   printf("   --srcsurfreg source surface registration (sphere.reg)  \n");
   printf("   --trgsurfreg target surface registration (sphere.reg)  \n");
   printf("   --mapmethod  nnfr or nnf\n");
+  printf("   --reg-cache dir : save and reuse the vertex map in dir\n");
   printf("   --frame      save only nth frame (with --trg_type paint)\n");
   printf("   --fwhm-src fwhmsrc: smooth the source to fwhmsrc\n");
   printf("   --fwhm-trg fwhmtrg: smooth the target to fwhmtrg\n");
@@ -1934,6 +1939,15 @@ printf("    'holes'). If nnfr is chosen, then each hole is assigned to the close
 printf("    target vertex. If a target vertex has multiple source vertices, then the\n");
 printf("    source values are averaged together. It does not seem to make much difference.\n");
 printf("\n");
+printf("  --reg-cache dir\n");
+printf("\n");
+printf("    Save the vertex map from source to target in dir, and read it from there\n");
+printf("    the next time the same registration surfaces are used instead of\n");
+printf("    searching for the closest vertices again (same as setting the\n");
+printf("    FS_SURFREG_CACHE environment variable). Used by both nnf and nnfr, but\n");
+printf("    only with --new (MRISapplyReg); --old searches the vertices every time.\n");
+printf("    Maps made with and without --nohash are kept apart.\n");
+printf("\n");
 printf("  --fwhm-src fwhmsrc\n");
 printf("  --fwhm-trg fwhmtrg (can also use --fwhm)\n");
 printf("\n");
@@ -269,6 +269,11 @@ static int parse_commandline(int argc, char **argv) {
     else if (!strcasecmp(option, "--nnfr")) ReverseMapFlag = 1;
     else if (!strcasecmp(option, "--no-hash")) UseHash = 0;
     else if (!strcasecmp(option, "--jac")) DoJac = 1;
+    else if (!strcasecmp(option, "--reg-cache")) {
+      if (nargc < 1) CMDargNErr(option,1);
+      setenv("FS_SURFREG_CACHE",pargv[0],1);
+      nargsused = 1;
+    }
     else if (!strcasecmp(option, "--no-jac")) DoJac = 0;
     else if (!strcasecmp(option, "--randn")) DoSynthRand = 1;
     else if (!strcasecmp(option, "--ones")) DoSynthOnes = 1;
@@ -361,6 +366,7 @@ static void print_usage(void) {
   printf("\n");
   printf("   --jac : use jacobian correction\n");
   printf("   --no-rev : do not do reverse mapping\n");
+  printf("   --reg-cache dir : save and reuse the vertex map in dir (or set FS_SURFREG_CACHE)\n");
   printf("   --randn : replace input with WGN\n");
   printf("   --ones  : replace input with ones\n");
   printf("\n");
@@ -571,6 +571,7 @@ MRIScomputeNeighbors(MRI_SURFACE *mris, float max_mm)
 
 
   MRISresetNeighborhoodSize(mris, -1) ;  /* back to max */
+  MRISdetachNeighborArena(mris) ;  /* v->v is reallocated below */
   for (vno = 0 ; vno < mris->nvertices ; vno++)
   {
     v = &mris->vertices[vno] ;
@@ -311,6 +311,7 @@ int decimateSurface(MRI_SURFACE **pmris,
                        fold);
 
   // Free the vertex and face buffers
+  MRISdetachNeighborArena(mris); // v and the dists are freed below
   for (int vno = 0 ; vno < mris->nvertices ; vno++)
   {
     if (mris->vertices[vno].f)
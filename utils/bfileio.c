@@ -47,76 +47,29 @@
 #include <unistd.h>
 
 #include "bfileio.h"
+#include "machine.h"
 
 extern int errno;
 
-/* ------------------------- */
+/* -------------------------
+   A partial item at the end is swapped as a whole one, as callers
+   such as znzreadFloat() pass an item count of 1 rather than bytes.
+   ------------------------- */
 int byteswapbufdouble(void *buf, long int nbufbytes)
 {
-  register char *cbuf, c;
-  register long int n, nmax;
-
-  nmax = nbufbytes;
-  cbuf = (char *)buf;
-  for (n = 0; n < nmax; n += 8) {
-    c = *cbuf;
-    *cbuf = *(cbuf + 7);
-    *(cbuf + 7) = c;
-
-    c = *(cbuf + 1);
-    *(cbuf + 1) = *(cbuf + 6);
-    *(cbuf + 6) = c;
-
-    c = *(cbuf + 2);
-    *(cbuf + 2) = *(cbuf + 5);
-    *(cbuf + 5) = c;
-
-    c = *(cbuf + 3);
-    *(cbuf + 3) = *(cbuf + 4);
-    *(cbuf + 4) = c;
-
-    cbuf += 8;
-  }
-  return (0);
+  return (ByteSwapItems(buf, (nbufbytes + 7) / 8, 8));
 }
 
 /* ------------------------- */
 int byteswapbuffloat(void *buf, long int nbufbytes)
 {
-  register char *cbuf, c;
-  register long int n, nmax;
-
-  nmax = nbufbytes;
-  cbuf = (char *)buf;
-  for (n = 0; n < nmax; n += 4) {
-    c = *cbuf;
-    *cbuf = *(cbuf + 3);
-    *(cbuf + 3) = c;
-
-    c = *(cbuf + 1);
-    *(cbuf + 1) = *(cbuf + 2);
-    *(cbuf + 2) = c;
-
-    cbuf += 4;
-  }
-  return (0);
+  return (ByteSwapItems(buf, (nbufbytes + 3) / 4, 4));
 }
 
 /* ------------------------- */
 int byteswapbufshort(void *buf, long int nbufbytes)
 {
-  register char *cbuf, c;
-  register long int n, nmax;
-
-  nmax = nbufbytes;
-  cbuf = (char *)buf;
-  for (n = 0; n < nmax; n += 2) {
-    c = *cbuf;
-    *cbuf = *(cbuf + 1);
-    *(cbuf + 1) = c;
-    cbuf += 2;
-  }
-  return (0);
+  return (ByteSwapItems(buf, (nbufbytes + 1) / 2, 2));
 }
 /*---------------------------------------------------------
   Name: bf_getarchendian()
@@ -625,3 +625,105 @@ float FFTdist(int x, int y, int z, int len)
   return ((x - (float)len / 2) * (x - (float)len / 2) + (y - (float)len / 2) * (y - (float)len / 2) +
           (z - (float)len / 2) * (z - (float)len / 2));
 }
+
+/*-----------------------------------------------------
+ FFT_PLAN: an in-place radix 2 complex FFT on separate real and
+ imaginary arrays. The tables only depend on the length and are
+ read-only once built.
+ ------------------------------------------------------*/
+struct FFT_PLAN
+{
+  int length;
+  int *rev;                 /* bit reversed index of each element */
+  float *cos_tab, *sin_tab; /* cos and sin of 2 pi k / length, k <= length/2 */
+};
+
+typedef struct FFT_PLAN FFT_PLAN;
+
+void FFTfreePlan(FFT_PLAN **pplan)
+{
+  FFT_PLAN *plan = *pplan;
+
+  if (plan == NULL) return;
+  free(plan->rev);
+  free(plan->cos_tab);
+  free(plan->sin_tab);
+  free(plan);
+  *pplan = NULL;
+}
+
+FFT_PLAN *FFTallocPlan(int length)
+{
+  FFT_PLAN *plan;
+  int i, bits = FFTlog2(length);
+
+  if (length < 1 || !FFTisPowerOf2(length)) {
+    fprintf(stderr, "FFTallocPlan: length %d is not a power of 2\n", length);
+    return (NULL);
+  }
+  plan = (FFT_PLAN *)calloc(1, sizeof(FFT_PLAN));
+  plan->length = length;
+  plan->rev = (int *)malloc(length * sizeof(int));
+  plan->cos_tab = (float *)malloc((length / 2 + 1) * sizeof(float));
+  plan->sin_tab = (float *)malloc((length / 2 + 1) * sizeof(float));
+  if (!plan->rev || !plan->cos_tab || !plan->sin_tab) {
+    fprintf(stderr, "FFTallocPlan: could not allocate tables for length %d\n", length);
+    FFTfreePlan(&plan);
+    return (NULL);
+  }
+  for (i = 0; i < length; i++) plan->rev[i] = _ReverseBits(i, bits);
+  for (i = 0; i <= length / 2; i++) {
+    plan->cos_tab[i] = (float)cos(2 * M_PI * i / length);
+    plan->sin_tab[i] = (float)sin(2 * M_PI * i / length);
+  }
+  return (plan);
+}
+
+int FFTplanLength(const FFT_PLAN *plan) { return (plan->length); }
+
+static void FFTplanTransform(const FFT_PLAN *plan, float *re, float *im, int direction)
+{
+  int n = plan->length, size, half, step, i, j, k;
+  float t;
+
+  for (i = 0; i < n; i++) {
+    j = plan->rev[i];
+    if (j > i) {
+      t = re[i];
+      re[i] = re[j];
+      re[j] = t;
+      t = im[i];
+      im[i] = im[j];
+      im[j] = t;
+    }
+  }
+
+  // successive doubling, w = exp(-+ 2 pi i k / size)
+  for (size = 2; size <= n; size <<= 1) {
+    half = size >> 1;
+    step = n / size;
+    for (k = 0; k < half; k++) {
+      float wr = plan->cos_tab[k * step];
+      float wi = direction == FourierForward ? -plan->sin_tab[k * step] : plan->sin_tab[k * step];
+      for (i = k; i < n; i += size) {
+        int b = i + half;
+        float tr = re[b] * wr - im[b] * wi;
+        float ti = re[b] * wi + im[b] * wr;
+        re[b] = re[i] - tr;
+        im[b] = im[i] - ti;
+        re[i] += tr;
+        im[i] += ti;
+      }
+    }
+  }
+}
+
+void FFTplanForward(const FFT_PLAN *plan, float *re, float *im)
+{
+  FFTplanTransform(plan, re, im, FourierForward);
+}
+
+void FFTplanBackward(const FFT_PLAN *plan, float *re, float *im)
+{
+  FFTplanTransform(plan, re, im, FourierBackward);
+}
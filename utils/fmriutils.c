@@ -40,6 +40,7 @@
 double round(double x);
 #include "MRIio_old.h"
 #include "diag.h"
+#include "error.h"
 #include "float.h"
 #include "fmriutils.h"
 #include "fsglm.h"
@@ -49,6 +50,7 @@ double round(double x);
 #include "numerics.h"
 #include "pdf.h"
 #include "randomfields.h"
+#include "romp_support.h"
 #include "sig.h"
 #include "utils.h"
 #include "volcluster.h"
@@ -905,6 +907,194 @@ MRI *MRInormWeights(MRI *w, int sqrtFlag, int invFlag, MRI *mask, MRI *wn)
   return (wn);
 }
 
+/*---------------------------------------------------------------------
+  MRIglmFitAndTestBlock() - fits and tests nv voxels (indices into y,
+  column fastest) that share the design with a few matrix-matrix
+  products, one column per voxel. Each value is summed in the same
+  order and precision as in GLMfit() and GLMtest(), so the outputs are
+  the same as fitting the voxels one at a time. iCiXtXCt[n] is
+  inv(C*inv(X'*X)*C') or NULL if that is singular.
+  --------------------------------------------------------------------*/
+static void MRIglmFitAndTestBlock(MRIGLM *mriglm, MATRIX **iCiXtXCt, RFS *rfs, float Xcond, long *vox, int nv)
+{
+  GLMMAT *glm = mriglm->glm;
+  MATRIX *Y, *Xty, *beta, *yhat, *eres, *gamma, *yhatd, *Xcdyhatd, *sumyhatd, *sumyhatd2, *ypmf;
+  double *rvar, dtmp, val, F, p, z, pcc;
+  float gtigCVM[GLMMAT_NCONTRASTS_MAX], igCVM, sx, sx2, sy, sy2, xy;
+  int nc, nr, nf, v, f, i, k, n, J, *c, *r, *s;
+
+  nc = mriglm->y->width;
+  nr = mriglm->y->height;
+  nf = mriglm->y->nframes;
+  c = (int *)calloc(nv, sizeof(int));
+  r = (int *)calloc(nv, sizeof(int));
+  s = (int *)calloc(nv, sizeof(int));
+  rvar = (double *)calloc(nv, sizeof(double));
+  Y = MatrixAlloc(nf, nv, MATRIX_REAL);
+  if (c == NULL || r == NULL || s == NULL || rvar == NULL || Y == NULL)
+    ErrorExit(ERROR_NOMEMORY, "MRIglmFitAndTestBlock(): could not alloc %d voxels", nv);
+  for (v = 0; v < nv; v++) {
+    c[v] = vox[v] % nc;
+    r[v] = (vox[v] / nc) % nr;
+    s[v] = vox[v] / ((long)nc * nr);
+    for (f = 0; f < nf; f++) Y->rptr[f + 1][v + 1] = MRIgetVoxVal(mriglm->y, c[v], r[v], s[v], f);
+  }
+
+  // beta = inv(X'*X)*X'*y, yhat = X*beta, eres = y - yhat
+  Xty = MatrixMultiplyD(glm->Xt, Y, NULL);
+  beta = MatrixMultiplyD(glm->iXtX, Xty, NULL);
+  yhat = MatrixMultiplyD(glm->X, beta, NULL);
+  eres = MatrixSubtract(Y, yhat, NULL);
+  for (v = 0; v < nv; v++) {
+    for (f = 1; f <= nf; f++) rvar[v] += (eres->rptr[f][v + 1] * eres->rptr[f][v + 1]);
+    rvar[v] /= glm->dof;
+    if (rvar[v] < FLT_MIN) rvar[v] = FLT_MIN;
+
+    MRIsetVoxVal(mriglm->rvar, c[v], r[v], s[v], 0, rvar[v]);
+    if (mriglm->condsave) MRIsetVoxVal(mriglm->cond, c[v], r[v], s[v], 0, Xcond);
+    for (i = 0; i < beta->rows; i++) MRIsetVoxVal(mriglm->beta, c[v], r[v], s[v], i, beta->rptr[i + 1][v + 1]);
+    for (f = 0; f < nf; f++) {
+      MRIsetVoxVal(mriglm->eres, c[v], r[v], s[v], f, eres->rptr[f + 1][v + 1]);
+      if (mriglm->yhatsave) MRIsetVoxVal(mriglm->yhat, c[v], r[v], s[v], f, yhat->rptr[f + 1][v + 1]);
+    }
+  }
+
+  for (n = 0; n < glm->ncontrasts; n++) {
+    J = glm->C[n]->rows;
+    gamma = MatrixMultiplyD(glm->C[n], beta, NULL);
+    if (glm->UseGamma0[n])
+      for (i = 1; i <= J; i++)
+        for (v = 1; v <= nv; v++) gamma->rptr[i][v] = gamma->rptr[i][v] - glm->gamma0[n]->rptr[i][1];
+    yhatd = Xcdyhatd = sumyhatd = sumyhatd2 = ypmf = NULL;
+    if (glm->Dt[n] != NULL) {
+      yhatd = MatrixMultiplyD(glm->RD[n], yhat, NULL);
+      Xcdyhatd = MatrixMultiplyD(glm->Xcdt[n], yhatd, NULL);
+      sumyhatd = MatrixSum(yhatd, 1, NULL);
+      sumyhatd2 = MatrixSumSquare(yhatd, 1, NULL);
+    }
+    // MRIfromMatrix() only takes the partial model fit when it has a value per frame
+    if (glm->ypmfflag[n] && glm->Mpmf[n]->rows == nf) ypmf = MatrixMultiplyD(glm->Mpmf[n], beta, NULL);
+
+    for (v = 0; v < nv; v++) {
+      // gCVM = rvar*J*C*inv(X'*X)*C', F = gamma'*inv(gCVM)*gamma
+      if (rvar[v] < 2 * FLT_MIN)
+        dtmp = 1e10 * J;
+      else
+        dtmp = rvar[v] * J;
+      F = z = pcc = 0;
+      p = 1;
+      if (iCiXtXCt[n] != NULL && rvar[v] > FLT_MIN) {
+        for (k = 1; k <= J; k++) {
+          for (val = 0, i = 1; i <= J; i++) {
+            igCVM = iCiXtXCt[n]->rptr[i][k] * (float)(1.0 / dtmp);
+            val += (double)gamma->rptr[i][v + 1] * igCVM;
+          }
+          gtigCVM[k - 1] = val;
+        }
+        for (val = 0, k = 1; k <= J; k++) val += (double)gtigCVM[k - 1] * gamma->rptr[k][v + 1];
+        F = (float)val;
+        p = sc_cdf_fdist_Q(F, J, glm->dof);
+        z = RFp2StatVal(rfs, p / 2.0);
+        if (J == 1 && gamma->rptr[1][v + 1] < 0) z *= -1;
+        if (glm->Dt[n] != NULL) {
+          xy = Xcdyhatd->rptr[1][v + 1];
+          sy = sumyhatd->rptr[1][v + 1];
+          sy2 = sumyhatd2->rptr[1][v + 1];
+          sx = glm->sumXcd[n]->rptr[1][1];
+          sx2 = glm->sumXcd2[n]->rptr[1][1];
+          sy2 += (glm->dof * rvar[v]);
+          pcc = (xy - sx * sy) / sqrt((sx2 - sx * sx) * (sy2 - sy * sy));
+        }
+      }
+
+      for (i = 0; i < J; i++) MRIsetVoxVal(mriglm->gamma[n], c[v], r[v], s[v], i, gamma->rptr[i + 1][v + 1]);
+      if (J == 1) MRIsetVoxVal(mriglm->gammaVar[n], c[v], r[v], s[v], 0, glm->CiXtXCt[n]->rptr[1][1] * (float)dtmp);
+      MRIsetVoxVal(mriglm->F[n], c[v], r[v], s[v], 0, F);
+      MRIsetVoxVal(mriglm->p[n], c[v], r[v], s[v], 0, p);
+      MRIsetVoxVal(mriglm->z[n], c[v], r[v], s[v], 0, z);
+      if (J == 1 && glm->DoPCC) MRIsetVoxVal(mriglm->pcc[n], c[v], r[v], s[v], 0, pcc);
+      if (ypmf)
+        for (f = 0; f < nf; f++) MRIsetVoxVal(mriglm->ypmf[n], c[v], r[v], s[v], f, ypmf->rptr[f + 1][v + 1]);
+    }
+
+    MatrixFree(&gamma);
+    if (yhatd) {
+      MatrixFree(&yhatd);
+      MatrixFree(&Xcdyhatd);
+      MatrixFree(&sumyhatd);
+      MatrixFree(&sumyhatd2);
+    }
+    if (ypmf) MatrixFree(&ypmf);
+  }
+
+  MatrixFree(&Y);
+  MatrixFree(&Xty);
+  MatrixFree(&beta);
+  MatrixFree(&yhat);
+  MatrixFree(&eres);
+  free(rvar);
+  free(c);
+  free(r);
+  free(s);
+}
+
+/*---------------------------------------------------------------------
+  MRIglmFitAndTestBatch() - MRIglmFitAndTest() for when every voxel has
+  the same well conditioned design (no per-voxel regressors, weights or
+  frame masks, and no fixed effects). The in-mask voxels are taken in
+  blocks of about 256KB of y, each fit with MRIglmFitAndTestBlock(), in
+  parallel across blocks.
+  --------------------------------------------------------------------*/
+static int MRIglmFitAndTestBatch(MRIGLM *mriglm)
+{
+  GLMMAT *glm = mriglm->glm;
+  MATRIX *iCiXtXCt[GLMMAT_NCONTRASTS_MAX];
+  RFS *rfs;
+  long nvox, nvmask, v, b, nblocks, *vox;
+  int n, nc, nr, nb;
+  float Xcond = 0;
+
+  nc = mriglm->y->width;
+  nr = mriglm->y->height;
+  nvox = (long)nc * nr * mriglm->y->depth;
+
+  // The in-mask voxels, in memory order
+  vox = (long *)calloc(nvox, sizeof(long));
+  if (vox == NULL) ErrorExit(ERROR_NOMEMORY, "MRIglmFitAndTestBatch(): could not alloc %ld voxels", nvox);
+  for (nvmask = 0, v = 0; v < nvox; v++) {
+    if (mriglm->mask != NULL && MRIgetVoxVal(mriglm->mask, v % nc, (v / nc) % nr, v / ((long)nc * nr), 0) < 0.5)
+      continue;
+    vox[nvmask++] = v;
+  }
+
+  // Everything that only depends on the design
+  if (mriglm->condsave) Xcond = MatrixConditionNumber(glm->XtX);
+  for (n = 0; n < glm->ncontrasts; n++) iCiXtXCt[n] = MatrixInverse(glm->CiXtXCt[n], NULL);
+  rfs = RFspecInit(0, NULL);
+  rfs->name = strcpyalloc("z");
+
+  nb = MAX(16, (64 * 1024) / mriglm->y->nframes);
+  nblocks = (nvmask + nb - 1) / nb;
+  mriglm->n_ill_cond = 0;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic)
+#endif
+  for (b = 0; b < nblocks; b++) {
+    ROMP_PFLB_begin
+    MRIglmFitAndTestBlock(mriglm, iCiXtXCt, rfs, Xcond, &vox[b * nb], MIN(nb, nvmask - b * nb));
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  for (n = 0; n < glm->ncontrasts; n++)
+    if (iCiXtXCt[n]) MatrixFree(&iCiXtXCt[n]);
+  RFspecFree(&rfs);
+  free(vox);
+  return (0);
+}
+
 /*---------------------------------------------------------------------
   MRIglmFitAndTest() - fits and tests glm on a voxel-by-voxel basis.
   There are also two other related functions, MRIglmFit() and
@@ -986,6 +1176,10 @@ int MRIglmFitAndTest(MRIGLM *mriglm)
     }
   }
 
+  // The same design everywhere can be done many voxels at a time
+  if (!mriglm->pervoxflag && mriglm->wg == NULL && mriglm->yffxvar == NULL && !mriglm->glm->ill_cond_flag)
+    return (MRIglmFitAndTestBatch(mriglm));
+
   //--------------------------------------------
   pctdone = 0;
   nthvox = 0;
@@ -1060,6 +1254,241 @@ int MRIglmFitAndTest(MRIGLM *mriglm)
   return (0);
 }
 
+/*---------------------------------------------------------------------
+  MRIglmFreeOutputs() - frees the per-voxel outputs of an MRIGLM so that
+  the next MRIglmFitAndTest() allocates them again.
+  --------------------------------------------------------------------*/
+static void MRIglmFreeOutputs(MRIGLM *mriglm)
+{
+  int n;
+
+  if (mriglm->beta) MRIfree(&mriglm->beta);
+  if (mriglm->eres) MRIfree(&mriglm->eres);
+  if (mriglm->rvar) MRIfree(&mriglm->rvar);
+  if (mriglm->yhat) MRIfree(&mriglm->yhat);
+  if (mriglm->cond) MRIfree(&mriglm->cond);
+  for (n = 0; n < mriglm->glm->ncontrasts; n++) {
+    if (mriglm->gamma[n]) MRIfree(&mriglm->gamma[n]);
+    if (mriglm->gammaVar[n]) MRIfree(&mriglm->gammaVar[n]);
+    if (mriglm->pcc[n]) MRIfree(&mriglm->pcc[n]);
+    if (mriglm->F[n]) MRIfree(&mriglm->F[n]);
+    if (mriglm->p[n]) MRIfree(&mriglm->p[n]);
+    if (mriglm->z[n]) MRIfree(&mriglm->z[n]);
+    if (mriglm->ypmf[n]) MRIfree(&mriglm->ypmf[n]);
+  }
+}
+
+/*---------------------------------------------------------------------
+  MRIglmSlabToVol() - copies all frames of voxel v of a slab (an
+  nv x 1 x 1 volume holding voxels v0 to v0+nv-1) into vol.
+  --------------------------------------------------------------------*/
+static void MRIglmSlabToVol(MRI *slab, MRI *vol, long v0)
+{
+  long v, nv;
+  int c, r, s, f;
+
+  if (slab == NULL || vol == NULL) return;
+  nv = slab->width;
+  for (v = 0; v < nv; v++) {
+    c = (v0 + v) % vol->width;
+    r = ((v0 + v) / vol->width) % vol->height;
+    s = (v0 + v) / ((long)vol->width * vol->height);
+    for (f = 0; f < vol->nframes; f++) MRIFseq_vox(vol, c, r, s, f) = MRIFseq_vox(slab, v, 0, 0, f);
+  }
+}
+
+/*---------------------------------------------------------------------
+  MRIglmFitAndTestStream() - same as MRIglmFitAndTest() except that y is
+  not in memory. It is read from ystream one slab of voxels (all
+  frames, about slab_bytes as float) at a time, and each slab is fit
+  and tested with MRIglmFitAndTest(). mriglm->y only supplies the
+  geometry (eg, from MRIallocHeader()) and must have as many voxels and
+  frames as the file. Only the outputs that have one value per
+  regressor or contrast are kept (beta, rvar, cond, gamma, gammaVar,
+  pcc, F, p, z); eres, yhat and ypmf are as big as y and are dropped
+  after each slab. Per-voxel regressors and weights, frame masks, and
+  fixed effects are not supported.
+  --------------------------------------------------------------------*/
+int MRIglmFitAndTestStream(MRIGLM *mriglm, MRI_STREAM *ystream, size_t slab_bytes)
+{
+  MRIGLM *slab;
+  MRI *yslab = NULL, *y;
+  long v0, v, nv, nvslab;
+  int n, nc, nr, ns, nslabs;
+
+  nc = mriglm->y->width;
+  nr = mriglm->y->height;
+  ns = mriglm->y->depth;
+  if ((long)nc * nr * ns != ystream->nvox || mriglm->y->nframes != ystream->mri->nframes) {
+    printf("ERROR: MRIglmFitAndTestStream(): y and %s differ in size\n", ystream->fname);
+    return (1);
+  }
+  if (mriglm->w != NULL || mriglm->npvr != 0 || mriglm->FrameMask != NULL || mriglm->yffxvar != NULL) {
+    printf("ERROR: MRIglmFitAndTestStream(): per-voxel weights and regressors, frame masks,\n");
+    printf("       and fixed effects are not supported\n");
+    return (1);
+  }
+
+  mriglm->nregtot = MRIglmNRegTot(mriglm);
+  mriglm->pervoxflag = 0;
+  mriglm->n_ill_cond = 0;
+
+  if (mriglm->beta == NULL) {
+    mriglm->beta = MRIallocSequence(nc, nr, ns, MRI_FLOAT, mriglm->nregtot);
+    MRIcopyHeader(mriglm->y, mriglm->beta);
+    mriglm->rvar = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
+    MRIcopyHeader(mriglm->y, mriglm->rvar);
+    if (mriglm->condsave) {
+      mriglm->cond = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
+      MRIcopyHeader(mriglm->y, mriglm->cond);
+    }
+    for (n = 0; n < mriglm->glm->ncontrasts; n++) {
+      mriglm->gamma[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, mriglm->glm->C[n]->rows);
+      MRIcopyHeader(mriglm->y, mriglm->gamma[n]);
+      if (mriglm->glm->C[n]->rows == 1) {
+        mriglm->gammaVar[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
+        MRIcopyHeader(mriglm->y, mriglm->gammaVar[n]);
+        if (mriglm->glm->DoPCC) {
+          mriglm->pcc[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
+          MRIcopyHeader(mriglm->y, mriglm->pcc[n]);
+        }
+      }
+      mriglm->F[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
+      MRIcopyHeader(mriglm->y, mriglm->F[n]);
+      mriglm->p[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
+      MRIcopyHeader(mriglm->y, mriglm->p[n]);
+      mriglm->z[n] = MRIallocSequence(nc, nr, ns, MRI_FLOAT, 1);
+      MRIcopyHeader(mriglm->y, mriglm->z[n]);
+    }
+  }
+
+  // Each slab is an MRIGLM of its own that shares the design
+  slab = (MRIGLM *)calloc(sizeof(MRIGLM), 1);
+  slab->glm = mriglm->glm;
+  slab->Xg = mriglm->Xg;
+  slab->wg = mriglm->wg;
+  slab->skipweight = mriglm->skipweight;
+  slab->condsave = mriglm->condsave;
+
+  nvslab = MRIstreamSlabVoxels(ystream, slab_bytes);
+  nslabs = 0;
+  for (v0 = 0; v0 < ystream->nvox; v0 += nvslab) {
+    nv = MIN(nvslab, ystream->nvox - v0);
+    yslab = MRIstreamReadVoxels(ystream, v0, nv, yslab);
+    if (yslab == NULL) return (1);
+    y = yslab;
+    if (y->type != MRI_FLOAT) y = MRISeqchangeType(yslab, MRI_FLOAT, 0, 0, 0);
+    slab->y = y;
+
+    if (mriglm->mask) {
+      if (slab->mask && slab->mask->width != nv) MRIfree(&slab->mask);
+      if (slab->mask == NULL) slab->mask = MRIalloc(nv, 1, 1, MRI_FLOAT);
+      MRIcopyHeader(y, slab->mask);
+      for (v = 0; v < nv; v++)
+        MRIFvox(slab->mask, v, 0, 0) = MRIgetVoxVal(
+            mriglm->mask, (v0 + v) % nc, ((v0 + v) / nc) % nr, (v0 + v) / ((long)nc * nr), 0);
+    }
+
+    MRIglmFitAndTest(slab);
+    mriglm->n_ill_cond += slab->n_ill_cond;
+
+    MRIglmSlabToVol(slab->beta, mriglm->beta, v0);
+    MRIglmSlabToVol(slab->rvar, mriglm->rvar, v0);
+    MRIglmSlabToVol(slab->cond, mriglm->cond, v0);
+    for (n = 0; n < mriglm->glm->ncontrasts; n++) {
+      MRIglmSlabToVol(slab->gamma[n], mriglm->gamma[n], v0);
+      MRIglmSlabToVol(slab->gammaVar[n], mriglm->gammaVar[n], v0);
+      MRIglmSlabToVol(slab->pcc[n], mriglm->pcc[n], v0);
+      MRIglmSlabToVol(slab->F[n], mriglm->F[n], v0);
+      MRIglmSlabToVol(slab->p[n], mriglm->p[n], v0);
+      MRIglmSlabToVol(slab->z[n], mriglm->z[n], v0);
+    }
+    MRIglmFreeOutputs(slab);
+    if (y != yslab) MRIfree(&y);
+    nslabs++;
+    if (Gdiag_no > 0) {
+      printf("slab %d  voxels %ld-%ld\n", nslabs, v0, v0 + nv - 1);
+      fflush(stdout);
+    }
+  }
+
+  if (slab->mask) MRIfree(&slab->mask);
+  if (yslab) MRIfree(&yslab);
+  free(slab);
+  return (0);
+}
+
+/*---------------------------------------------------------------------
+  MRIglmCopyDesign() - returns a new MRIGLM that can be fit and tested
+  independently of mriglm, eg, in another thread. It has its own copy
+  of Xg and its own GLMMAT with copies of the contrasts (but not their
+  names), and no outputs yet. y, mask, weights, per-voxel regressors,
+  the frame mask and the fixed effects variances are shared with
+  mriglm, so anything that changes one of them (eg, a new y for each
+  iteration of a simulation) must point the copy at its own. Free with
+  MRIglmFreeCopy().
+  --------------------------------------------------------------------*/
+MRIGLM *MRIglmCopyDesign(MRIGLM *mriglm)
+{
+  MRIGLM *copy;
+  GLMMAT *glm;
+  int n;
+
+  copy = (MRIGLM *)calloc(sizeof(MRIGLM), 1);
+  if (copy == NULL) ErrorExit(ERROR_NOMEMORY, "MRIglmCopyDesign(): could not alloc");
+  copy->y = mriglm->y;
+  copy->Xg = MatrixCopy(mriglm->Xg, NULL);
+  copy->npvr = mriglm->npvr;
+  for (n = 0; n < mriglm->npvr; n++) copy->pvr[n] = mriglm->pvr[n];
+  copy->nregtot = mriglm->nregtot;
+  copy->w = mriglm->w;
+  copy->wg = mriglm->wg;
+  copy->skipweight = mriglm->skipweight;
+  copy->mask = mriglm->mask;
+  copy->yffxvar = mriglm->yffxvar;
+  copy->ffxdof = mriglm->ffxdof;
+  copy->condsave = mriglm->condsave;
+  copy->yhatsave = mriglm->yhatsave;
+  copy->FrameMask = mriglm->FrameMask;
+
+  glm = copy->glm = GLMalloc();
+  glm->AllowZeroDOF = mriglm->glm->AllowZeroDOF;
+  glm->ReScaleX = mriglm->glm->ReScaleX;
+  glm->ffxdof = mriglm->glm->ffxdof;
+  glm->DoPCC = mriglm->glm->DoPCC;
+  glm->ncontrasts = mriglm->glm->ncontrasts;
+  for (n = 0; n < glm->ncontrasts; n++) {
+    glm->C[n] = MatrixCopy(mriglm->glm->C[n], NULL);
+    glm->UseGamma0[n] = mriglm->glm->UseGamma0[n];
+    if (mriglm->glm->gamma0[n]) glm->gamma0[n] = MatrixCopy(mriglm->glm->gamma0[n], NULL);
+    glm->ypmfflag[n] = mriglm->glm->ypmfflag[n];
+  }
+  GLMallocX(glm, mriglm->y->nframes, MRIglmNRegTot(copy));
+  GLMallocY(glm);
+  glm->dof = mriglm->glm->dof;
+  // The partial correlation matrices are computed from X
+  if (glm->DoPCC) MatrixCopy(copy->Xg, glm->X);
+  GLMcMatrices(glm);
+  return (copy);
+}
+
+/*---------------------------------------------------------------------
+  MRIglmFreeCopy() - frees an MRIGLM from MRIglmCopyDesign() with its
+  outputs, but not what it shares with the original.
+  --------------------------------------------------------------------*/
+int MRIglmFreeCopy(MRIGLM **pcopy)
+{
+  MRIGLM *copy = *pcopy;
+
+  if (copy == NULL) return (0);
+  MRIglmFreeOutputs(copy);
+  GLMfree(&copy->glm);
+  MatrixFree(&copy->Xg);
+  free(copy);
+  *pcopy = NULL;
+  return (0);
+}
+
 /*---------------------------------------------------------------------
   MRIglmFit() - fits glm (beta and rvar) on a voxel-by-voxel basis.
   Made to be followed by MRIglmTest(). See notes on MRIglmFitandTest()
@@ -1276,7 +1705,6 @@ int MRIglmLoadVox(MRIGLM *mriglm, int c, int r, int s, int LoadBeta)
 {
   int f, n, nthreg, nthf, nf;
   double v;
-  static int nfprev = -1;
 
   nf = mriglm->y->nframes;
   // Count the number of frames in frame mask
@@ -1285,10 +1713,9 @@ int MRIglmLoadVox(MRIGLM *mriglm, int c, int r, int s, int LoadBeta)
     for (f = 1; f <= mriglm->y->nframes; f++)
       if (MRIgetVoxVal(mriglm->FrameMask, c, r, s, f - 1) > 0.5) nf++;
     if (nf == 0) printf("MRIglmLoadVox(): %d,%d,%d nf=0\n", c, r, s);
-    // Free matrices if needed
-    if (mriglm->glm->X != NULL && nfprev != nf) MatrixFree(&(mriglm->glm->X));
-    if (mriglm->glm->y != NULL && nfprev != nf) MatrixFree(&(mriglm->glm->y));
-    nfprev = nf;
+    // Free matrices if needed (sized from the last voxel loaded into this glm)
+    if (mriglm->glm->X != NULL && mriglm->glm->X->rows != nf) MatrixFree(&(mriglm->glm->X));
+    if (mriglm->glm->y != NULL && mriglm->glm->y->rows != nf) MatrixFree(&(mriglm->glm->y));
   }
 
   // Alloc matrices if needed
@@ -354,15 +354,31 @@ int GLMfree(GLMMAT **pglm)
   computes condition number of each C as well as it's PMF.  This
   includes the allocation of Ct[n] and PMF. It would be possible to do
   this within GLMtest(), but GLMtest() may be run many times whereas
-  Ct only needs to be computed once.
+  Ct only needs to be computed once. When called again (eg, for each
+  permutation of X), the matrices that only depend on C are computed
+  into the ones already there, and those that also depend on X are
+  freed and recomputed.
   ----------------------------------------------------------------*/
 int GLMcMatrices(GLMMAT *glm)
 {
   int n, err;
 
   for (n = 0; n < glm->ncontrasts; n++) {
-    glm->Ct[n] = MatrixTranspose(glm->C[n], NULL);
-    glm->Mpmf[n] = GLMpmfMatrix(glm->C[n], &glm->Ccond[n], NULL);
+    if (glm->Ct[n] && (glm->Ct[n]->rows != glm->C[n]->cols || glm->Ct[n]->cols != glm->C[n]->rows)) {
+      MatrixFree(&glm->Ct[n]);
+      MatrixFree(&glm->Mpmf[n]);
+    }
+    glm->Ct[n] = MatrixTranspose(glm->C[n], glm->Ct[n]);
+    glm->Mpmf[n] = GLMpmfMatrix(glm->C[n], &glm->Ccond[n], glm->Mpmf[n]);
+
+    if (glm->Dt[n]) MatrixFree(&glm->Dt[n]);
+    if (glm->XCt[n]) MatrixFree(&glm->XCt[n]);
+    if (glm->XDt[n]) MatrixFree(&glm->XDt[n]);
+    if (glm->RD[n]) MatrixFree(&glm->RD[n]);
+    if (glm->Xcd[n]) MatrixFree(&glm->Xcd[n]);
+    if (glm->Xcdt[n]) MatrixFree(&glm->Xcdt[n]);
+    if (glm->sumXcd[n]) MatrixFree(&glm->sumXcd[n]);
+    if (glm->sumXcd2[n]) MatrixFree(&glm->sumXcd2[n]);
 
     if (glm->C[n]->rows == 1 && glm->DoPCC) {
       // These are for the computation of partial correlation coef
@@ -499,18 +515,13 @@ int GLMfit(GLMMAT *glm)
 /*------------------------------------------------------------------------
   GLMtest() - tests all the contrasts for the given GLM. Must have already
   run GLMcMatrices(), GLMxMatrices(), and GLMfit(). See also GLMtestFFX().
+  Keeps no state between calls so that GLMs can be tested in parallel.
   ------------------------------------------------------------------------*/
 int GLMtest(GLMMAT *glm)
 {
   int n;
   double dtmp;
-  static MATRIX *F = NULL, *mtmp = NULL;
-  static RFS *rfs = NULL;
-
-  if (rfs == NULL) {
-    rfs = RFspecInit(0, NULL);
-    rfs->name = strcpyalloc("z");
-  }
+  MATRIX *F = NULL, *mtmp = NULL;
 
   if (glm->ill_cond_flag) {
     // If it's ill cond, just return F=0
@@ -552,7 +563,8 @@ int GLMtest(GLMMAT *glm)
       F = MatrixMultiplyD(glm->gtigCVM[n], glm->gamma[n], F);
       glm->F[n] = F->rptr[1][1];
       glm->p[n] = sc_cdf_fdist_Q(glm->F[n], glm->C[n]->rows, glm->dof);
-      glm->z[n] = RFp2StatVal(rfs, glm->p[n] / 2.0);
+      // same as RFp2StatVal() for a z field
+      glm->z[n] = sc_cdf_gaussian_Qinv(glm->p[n] / 2.0, 1);
       if (glm->C[n]->rows == 1 && glm->gamma[n]->rptr[1][1] < 0) glm->z[n] *= -1;
 
       if (glm->Dt[n] != NULL) {
@@ -580,6 +592,7 @@ int GLMtest(GLMMAT *glm)
     }
     if (glm->ypmfflag[n]) glm->ypmf[n] = MatrixMultiplyD(glm->Mpmf[n], glm->beta, glm->ypmf[n]);
   }
+  MatrixFree(&F);
   return (0);
 }
 
@@ -591,7 +604,7 @@ int GLMtestFFx(GLMMAT *glm)
 {
   double val;
   int n, r, c;
-  static MATRIX *F = NULL, *mtmp = NULL;
+  MATRIX *F = NULL, *mtmp = NULL;
   MATRIX *Xs = NULL, *Xst = NULL, *CiXtXXs = NULL, *CiXtXXst = NULL;
 
   if (glm->ill_cond_flag) {
@@ -640,6 +653,7 @@ int GLMtestFFx(GLMMAT *glm)
   MatrixFree(&Xst);
   MatrixFree(&CiXtXXs);
   MatrixFree(&CiXtXXst);
+  MatrixFree(&F);
 
   return (0);
 }
@@ -29,9 +29,14 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "faster_variants.h"
 #include "romp_support.h"
@@ -155,6 +160,17 @@ static double sample_covariance_determinant(GCA_SAMPLE *gcas, int ninputs);
 static GC1D *gcanGetGC(GCA_NODE *gcan, int label);
 static GC1D *findGCInWindow(GCA *gca, int x, int y, int z, int label, int wsize);
 
+/* number of entries of a packed covariance matrix */
+#define GCA_NCOVARS(ninputs) (((ninputs) * ((ninputs) + 1)) / 2)
+
+/* gc->gauss_cache holds, each packed like gc->covars, the covars the
+   cache was built from, their MatrixInverse() and their MatrixSVDInverse() */
+#define GCA_CACHE_INV 1
+#define GCA_CACHE_SVD_INV 2
+
+static inline const float *gcaCachedInverseCovariance(const GC1D *gc, int ninputs, int which);
+static inline double gcaPackedMahDist(const float *inv, const float *d, const int ninputs);
+
 
 static int gcaCheck(GCA *gca);
 double gcaVoxelLogPosterior(GCA *gca, MRI *mri_labels, MRI *mri_inputs, int x, int y, int z, TRANSFORM *transform);
@@ -224,6 +240,8 @@ float getPrior(GCA_PRIOR *gcap, int label);
 GCA_PRIOR *getGCAP(GCA *gca, MRI *mri, TRANSFORM *transform, int xv, int yv, int zv);
 GCA_PRIOR *getGCAPfloat(GCA *gca, MRI *mri, TRANSFORM *transform, float xv, float yv, float zv);
 static int gcaNodeToPrior(const GCA *gca, int xn, int yn, int zn, int *pxp, int *pyp, int *pzp);
+static void gcaFree(void *p);
+static void gcaFlatRelease(GCA_FLAT *flat);
 static HISTOGRAM *gcaHistogramSamples(
     GCA *gca, GCA_SAMPLE *gcas, MRI *mri, TRANSFORM *transform, int nsamples, HISTOGRAM *histo, int frame);
 int GCApriorToNode(const GCA *gca, int xp, int yp, int zp, int *pxn, int *pyn, int *pzn);
@@ -233,6 +251,18 @@ static int xnbr_offset[] = {1, -1, 0, 0, 0, 0};
 static int ynbr_offset[] = {0, 0, 1, -1, 0, 0};
 static int znbr_offset[] = {0, 0, 0, 0, 1, -1};
 int check_finite(char *where, double what);
+static double gcaGibbsLogPosteriorOfLabel(GCA *gca,
+                                          MRI *mri_labels,
+                                          int x,
+                                          int y,
+                                          int z,
+                                          int xn,
+                                          int yn,
+                                          int zn,
+                                          GCA_PRIOR *gcap,
+                                          float *vals,
+                                          int label,
+                                          double gibbs_coef);
 static int boundsCheck(int *pix, int *piy, int *piz, MRI *mri);
 
 static void set_equilavent_classes(int *equivalent_classes);
@@ -1892,8 +1922,8 @@ int GCAfree(GCA **pgca)
   for (x = 0; x < gca->prior_width; x++) {
     for (y = 0; y < gca->prior_height; y++) {
       for (z = 0; z < gca->prior_depth; z++) {
-        free(gca->priors[x][y][z].labels);
-        free(gca->priors[x][y][z].priors);
+        gcaFree(gca->priors[x][y][z].labels);
+        gcaFree(gca->priors[x][y][z].priors);
       }
       free(gca->priors[x][y]);
     }
@@ -1902,6 +1932,9 @@ int GCAfree(GCA **pgca)
 
   free(gca->priors);
   GCAcleanup(gca);
+  if (gca->flat) {
+    gcaFlatRelease(gca->flat);
+  }
 
   free(gca);
 
@@ -1911,7 +1944,7 @@ int GCAfree(GCA **pgca)
 int GCANfree(GCA_NODE *gcan, int ninputs)
 {
   if (gcan->nlabels) {
-    free(gcan->labels);
+    gcaFree(gcan->labels);
     free_gcs(gcan->gcs, gcan->nlabels, ninputs);
   }
   return (NO_ERROR);
@@ -1920,8 +1953,8 @@ int GCANfree(GCA_NODE *gcan, int ninputs)
 int GCAPfree(GCA_PRIOR *gcap)
 {
   if (gcap->nlabels) {
-    free(gcap->labels);
-    free(gcap->priors);
+    gcaFree(gcap->labels);
+    gcaFree(gcap->priors);
   }
   return (NO_ERROR);
 }
@@ -2383,6 +2416,9 @@ int GCAwrite(GCA *gca, const char *fname)
   if (strstr(fname, ".gcz")) {
     gzipped = 1;
   }
+  else if (strlen(fname) > 5 && !strcmp(fname + strlen(fname) - 5, ".gcaf")) {
+    return (GCAwriteFlat(gca, fname));
+  }
 
   file = znzopen(fname, "wb", gzipped);
   if (znz_isnull(file)) {
@@ -2519,6 +2555,38 @@ int GCAwrite(GCA *gca, const char *fname)
   return (NO_ERROR);
 }
 
+/* sets the ntraining of the gcs from the training counts of the nodes and the priors */
+static void gcaSetNodeTraining(GCA *gca)
+{
+  int x, y, z, n;
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+  GC1D *gc;
+
+  for (x = 0; x < gca->node_width; x++) {
+    for (y = 0; y < gca->node_height; y++) {
+      for (z = 0; z < gca->node_depth; z++) {
+        int xp, yp, zp;
+
+        if (x == Ggca_x && y == Ggca_y && z == Ggca_z) {
+          DiagBreak();
+        }
+        gcan = &gca->nodes[x][y][z];
+        if (gcaNodeToPrior(gca, x, y, z, &xp, &yp, &zp) == NO_ERROR) {
+          gcap = &gca->priors[xp][yp][zp];
+          if (gcap == NULL) {
+            continue;
+          }
+          for (n = 0; n < gcan->nlabels; n++) {
+            gc = &gcan->gcs[n];
+            gc->ntraining = gcan->total_training * getPrior(gcap, gcan->labels[n]);
+          }
+        }
+      }
+    }
+  }
+}
+
 GCA *GCAread(const char *fname)
 {
   znzFile file;
@@ -2537,6 +2605,9 @@ GCA *GCAread(const char *fname)
   if (strstr(fname, ".gcz")) {
     gzipped = 1;
   }
+  else if (GCAisFlat(fname)) {
+    return (GCAreadFlat(fname));
+  }
 
   file = znzopen(fname, "rb", gzipped);
   if (znz_isnull(file)) {
@@ -2841,28 +2912,7 @@ GCA *GCAread(const char *fname)
     }
   }
 
-  for (x = 0; x < gca->node_width; x++) {
-    for (y = 0; y < gca->node_height; y++) {
-      for (z = 0; z < gca->node_depth; z++) {
-        int xp, yp, zp;
-
-        if (x == Ggca_x && y == Ggca_y && z == Ggca_z) {
-          DiagBreak();
-        }
-        gcan = &gca->nodes[x][y][z];
-        if (gcaNodeToPrior(gca, x, y, z, &xp, &yp, &zp) == NO_ERROR) {
-          gcap = &gca->priors[xp][yp][zp];
-          if (gcap == NULL) {
-            continue;
-          }
-          for (n = 0; n < gcan->nlabels; n++) {
-            gc = &gcan->gcs[n];
-            gc->ntraining = gcan->total_training * getPrior(gcap, gcan->labels[n]);
-          }
-        }
-      }
-    }
-  }
+  gcaSetNodeTraining(gca);
 
   while (znzreadIntEx(&tag, file)) {
     int n, nparms;
@@ -2954,12 +3004,536 @@ GCA *GCAread(const char *fname)
   }
 
   GCAsetup(gca);
+  GCAbuildGaussianCache(gca);
 
   znzclose(file);
 
   return (gca);
 }
 
+/*
+  Flat atlas files (.gcaf) hold the same atlas as a .gca in a few
+  contiguous arrays, in native byte order, so that GCAreadFlat() can map
+  the file and point the nodes and priors of the GCA into it instead of
+  reading and allocating every label, Gaussian and Gibbs table
+  separately. The mapping is private: the pages are shared with other
+  processes that map the same atlas until they are written to. The
+  arrays are indexed in x, y, z order of the nodes (priors) and in
+  label order within a node (prior):
+
+    node_first[nnodes+1]    index of the first gc of each node
+    node_training[nnodes]   total_training of each node
+    gc_labels[ngcs]         label of each gc
+    gc_means[ngcs*ninputs]
+    gc_covars[ngcs*ncovars]
+    gc_nbr_nlabels[ngcs*GIBBS_NEIGHBORS]   (none if GCA_NO_MRF)
+    gc_nbr_labels[nnbrs]    Gibbs labels and priors of each gc and
+    gc_nbr_priors[nnbrs]    neighbor in turn
+    prior_first[npriors+1]  index of the first label of each prior
+    prior_training[npriors]
+    prior_labels[nprior_labels]
+    prior_priors[nprior_labels]
+
+  followed by the color table, if any, as written by CTABwriteIntoBinary().
+*/
+#define GCA_FLAT_MAGIC "GCAFLAT1"
+#define GCA_FLAT_BYTEORDER 0x01020304
+#define GCA_FLAT_ALIGN 64
+
+typedef struct
+{
+  char magic[8];
+  int byteorder;
+  int header_size;
+  float node_spacing, prior_spacing;
+  int node_width, node_height, node_depth;
+  int prior_width, prior_height, prior_depth;
+  int ninputs, flags, type;
+  int width, height, depth;
+  float xsize, ysize, zsize;
+  float x_r, x_a, x_s, y_r, y_a, y_s, z_r, z_a, z_s, c_r, c_a, c_s;
+  double TRs[MAX_GCA_INPUTS], FAs[MAX_GCA_INPUTS], TEs[MAX_GCA_INPUTS];
+  long long ngcs, nnbrs, nprior_labels;
+  long long off_node_first, off_node_training, off_gc_labels, off_gc_means, off_gc_covars;
+  long long off_gc_nbr_nlabels, off_gc_nbr_labels, off_gc_nbr_priors;
+  long long off_prior_first, off_prior_training, off_prior_labels, off_prior_priors;
+  long long off_ctab, file_size;
+} GCA_FLAT_HEADER;
+
+/* the memory of a GCA read with GCAreadFlat() that is not individually allocated */
+struct GCA_FLAT
+{
+  char *map;                   /* the mapped file */
+  size_t map_size;
+  GC1D *gcs;                   /* all the gcs of all the nodes */
+  long long ngcs;
+  unsigned short **nbr_labels; /* gc->labels of all the gcs */
+  float **nbr_priors;          /* gc->label_priors of all the gcs */
+  struct GCA_FLAT *next;
+};
+
+/* the flat atlases in memory. Only changed by GCAreadFlat() and GCAfree(),
+   which are not called from parallel code */
+static GCA_FLAT *gca_flat_list = NULL;
+
+#define GCA_FLAT_IN(p, base, n) ((const char *)(p) >= (const char *)(base) && (const char *)(p) < (const char *)((base) + (n)))
+
+static int gcaFlatOwns(const void *p)
+{
+  GCA_FLAT *flat;
+
+  for (flat = gca_flat_list; flat; flat = flat->next)
+    if (GCA_FLAT_IN(p, flat->map, flat->map_size) || GCA_FLAT_IN(p, flat->gcs, flat->ngcs) ||
+        (flat->nbr_labels && GCA_FLAT_IN(p, flat->nbr_labels, flat->ngcs * GIBBS_NEIGHBORS)) ||
+        (flat->nbr_priors && GCA_FLAT_IN(p, flat->nbr_priors, flat->ngcs * GIBBS_NEIGHBORS)))
+      return (1);
+  return (0);
+}
+
+/* frees memory of the nodes and priors, which belongs to the flat atlas
+   for a GCA read with GCAreadFlat() until it has been replaced */
+static void gcaFree(void *p)
+{
+  if (p && (gca_flat_list == NULL || !gcaFlatOwns(p))) free(p);
+}
+
+static void gcaFlatRelease(GCA_FLAT *flat)
+{
+  GCA_FLAT **pflat;
+
+  for (pflat = &gca_flat_list; *pflat; pflat = &(*pflat)->next)
+    if (*pflat == flat) {
+      *pflat = flat->next;
+      break;
+    }
+  munmap(flat->map, flat->map_size);
+  free(flat->gcs);
+  free(flat->nbr_labels);
+  free(flat->nbr_priors);
+  free(flat);
+}
+
+/* is fname a flat atlas (by contents, not by name) */
+int GCAisFlat(const char *fname)
+{
+  char magic[sizeof(GCA_FLAT_MAGIC) - 1];
+  FILE *fp;
+  int flat;
+
+  fp = fopen(fname, "rb");
+  if (fp == NULL) return (0);
+  flat = fread(magic, sizeof(magic), 1, fp) == 1 && !memcmp(magic, GCA_FLAT_MAGIC, sizeof(magic));
+  fclose(fp);
+  return (flat);
+}
+
+static long long gcaFlatSection(long long *poffset, long long nbytes)
+{
+  long long offset = *poffset;
+
+  *poffset = offset + ((nbytes + GCA_FLAT_ALIGN - 1) / GCA_FLAT_ALIGN) * GCA_FLAT_ALIGN;
+  return (offset);
+}
+
+static int gcaFlatWriteSection(FILE *fp, long long offset, const void *buf, size_t size, size_t n)
+{
+  if (n == 0) return (1);
+  return (fseek(fp, offset, SEEK_SET) == 0 && fwrite(buf, size, n, fp) == n);
+}
+
+/*-----------------------------------------------------
+  GCAwriteFlat() - writes gca as a flat atlas for GCAreadFlat().
+  GCAwrite() calls this for file names ending in .gcaf.
+  ------------------------------------------------------*/
+int GCAwriteFlat(GCA *gca, const char *fname)
+{
+  GCA_FLAT_HEADER hdr;
+  FILE *fp;
+  long long offset, nnodes, npriors, g, b, k, p;
+  int x, y, z, n, i, ok, ncovars = (gca->ninputs * (gca->ninputs + 1)) / 2;
+  int mrf = !(gca->flags & GCA_NO_MRF);
+  long long *node_first, *prior_first;
+  int *node_training, *prior_training;
+  unsigned short *gc_labels, *nbr_labels, *prior_labels;
+  float *means, *covars, *nbr_priors, *prior_priors;
+  short *nbr_nlabels;
+
+  memset(&hdr, 0, sizeof(hdr));
+  memmove(hdr.magic, GCA_FLAT_MAGIC, sizeof(hdr.magic));
+  hdr.byteorder = GCA_FLAT_BYTEORDER;
+  hdr.header_size = sizeof(hdr);
+  hdr.node_spacing = gca->node_spacing;
+  hdr.prior_spacing = gca->prior_spacing;
+  hdr.node_width = gca->node_width;
+  hdr.node_height = gca->node_height;
+  hdr.node_depth = gca->node_depth;
+  hdr.prior_width = gca->prior_width;
+  hdr.prior_height = gca->prior_height;
+  hdr.prior_depth = gca->prior_depth;
+  hdr.ninputs = gca->ninputs;
+  hdr.flags = gca->flags;
+  hdr.type = gca->type;
+  hdr.width = gca->width;
+  hdr.height = gca->height;
+  hdr.depth = gca->depth;
+  hdr.xsize = gca->xsize;
+  hdr.ysize = gca->ysize;
+  hdr.zsize = gca->zsize;
+  hdr.x_r = gca->x_r;
+  hdr.x_a = gca->x_a;
+  hdr.x_s = gca->x_s;
+  hdr.y_r = gca->y_r;
+  hdr.y_a = gca->y_a;
+  hdr.y_s = gca->y_s;
+  hdr.z_r = gca->z_r;
+  hdr.z_a = gca->z_a;
+  hdr.z_s = gca->z_s;
+  hdr.c_r = gca->c_r;
+  hdr.c_a = gca->c_a;
+  hdr.c_s = gca->c_s;
+  memmove(hdr.TRs, gca->TRs, sizeof(hdr.TRs));
+  memmove(hdr.FAs, gca->FAs, sizeof(hdr.FAs));
+  memmove(hdr.TEs, gca->TEs, sizeof(hdr.TEs));
+
+  nnodes = (long long)gca->node_width * gca->node_height * gca->node_depth;
+  npriors = (long long)gca->prior_width * gca->prior_height * gca->prior_depth;
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        GCA_NODE *gcan = &gca->nodes[x][y][z];
+        hdr.ngcs += gcan->nlabels;
+        if (mrf)
+          for (n = 0; n < gcan->nlabels; n++)
+            for (i = 0; i < GIBBS_NEIGHBORS; i++) hdr.nnbrs += gcan->gcs[n].nlabels[i];
+      }
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++) hdr.nprior_labels += gca->priors[x][y][z].nlabels;
+
+  offset = 0;
+  gcaFlatSection(&offset, sizeof(hdr));
+  hdr.off_node_first = gcaFlatSection(&offset, (nnodes + 1) * sizeof(long long));
+  hdr.off_node_training = gcaFlatSection(&offset, nnodes * sizeof(int));
+  hdr.off_gc_labels = gcaFlatSection(&offset, hdr.ngcs * sizeof(unsigned short));
+  hdr.off_gc_means = gcaFlatSection(&offset, hdr.ngcs * gca->ninputs * sizeof(float));
+  hdr.off_gc_covars = gcaFlatSection(&offset, hdr.ngcs * ncovars * sizeof(float));
+  hdr.off_gc_nbr_nlabels = gcaFlatSection(&offset, mrf ? hdr.ngcs * GIBBS_NEIGHBORS * sizeof(short) : 0);
+  hdr.off_gc_nbr_labels = gcaFlatSection(&offset, hdr.nnbrs * sizeof(unsigned short));
+  hdr.off_gc_nbr_priors = gcaFlatSection(&offset, hdr.nnbrs * sizeof(float));
+  hdr.off_prior_first = gcaFlatSection(&offset, (npriors + 1) * sizeof(long long));
+  hdr.off_prior_training = gcaFlatSection(&offset, npriors * sizeof(int));
+  hdr.off_prior_labels = gcaFlatSection(&offset, hdr.nprior_labels * sizeof(unsigned short));
+  hdr.off_prior_priors = gcaFlatSection(&offset, hdr.nprior_labels * sizeof(float));
+  hdr.off_ctab = offset;
+
+  node_first = (long long *)calloc(nnodes + 1, sizeof(long long));
+  node_training = (int *)calloc(MAX(nnodes, 1), sizeof(int));
+  gc_labels = (unsigned short *)calloc(MAX(hdr.ngcs, 1), sizeof(unsigned short));
+  means = (float *)calloc(MAX(hdr.ngcs * gca->ninputs, 1), sizeof(float));
+  covars = (float *)calloc(MAX(hdr.ngcs * ncovars, 1), sizeof(float));
+  nbr_nlabels = (short *)calloc(mrf ? MAX(hdr.ngcs * GIBBS_NEIGHBORS, 1) : 1, sizeof(short));
+  nbr_labels = (unsigned short *)calloc(MAX(hdr.nnbrs, 1), sizeof(unsigned short));
+  nbr_priors = (float *)calloc(MAX(hdr.nnbrs, 1), sizeof(float));
+  prior_first = (long long *)calloc(npriors + 1, sizeof(long long));
+  prior_training = (int *)calloc(MAX(npriors, 1), sizeof(int));
+  prior_labels = (unsigned short *)calloc(MAX(hdr.nprior_labels, 1), sizeof(unsigned short));
+  prior_priors = (float *)calloc(MAX(hdr.nprior_labels, 1), sizeof(float));
+  if (!node_first || !node_training || !gc_labels || !means || !covars || !nbr_nlabels || !nbr_labels || !nbr_priors ||
+      !prior_first || !prior_training || !prior_labels || !prior_priors)
+    ErrorExit(ERROR_NOMEMORY, "GCAwriteFlat(%s): could not allocate %lld gcs", fname, hdr.ngcs);
+
+  for (k = g = b = x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++, k++) {
+        GCA_NODE *gcan = &gca->nodes[x][y][z];
+        node_first[k] = g;
+        node_training[k] = gcan->total_training;
+        for (n = 0; n < gcan->nlabels; n++, g++) {
+          GC1D *gc = &gcan->gcs[n];
+          gc_labels[g] = gcan->labels[n];
+          memmove(means + g * gca->ninputs, gc->means, gca->ninputs * sizeof(float));
+          memmove(covars + g * ncovars, gc->covars, ncovars * sizeof(float));
+          if (!mrf) continue;
+          for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+            nbr_nlabels[g * GIBBS_NEIGHBORS + i] = gc->nlabels[i];
+            memmove(nbr_labels + b, gc->labels[i], gc->nlabels[i] * sizeof(unsigned short));
+            memmove(nbr_priors + b, gc->label_priors[i], gc->nlabels[i] * sizeof(float));
+            b += gc->nlabels[i];
+          }
+        }
+      }
+  node_first[k] = g;
+  for (k = p = x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++, k++) {
+        GCA_PRIOR *gcap = &gca->priors[x][y][z];
+        prior_first[k] = p;
+        prior_training[k] = gcap->total_training;
+        memmove(prior_labels + p, gcap->labels, gcap->nlabels * sizeof(unsigned short));
+        memmove(prior_priors + p, gcap->priors, gcap->nlabels * sizeof(float));
+        p += gcap->nlabels;
+      }
+  prior_first[k] = p;
+
+  fp = fopen(fname, "wb");
+  if (fp == NULL) {
+    errno = 0;
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAwriteFlat(%s): could not open file", fname));
+  }
+  ok = gcaFlatWriteSection(fp, hdr.off_node_first, node_first, sizeof(long long), nnodes + 1) &&
+       gcaFlatWriteSection(fp, hdr.off_node_training, node_training, sizeof(int), nnodes) &&
+       gcaFlatWriteSection(fp, hdr.off_gc_labels, gc_labels, sizeof(unsigned short), hdr.ngcs) &&
+       gcaFlatWriteSection(fp, hdr.off_gc_means, means, sizeof(float), hdr.ngcs * gca->ninputs) &&
+       gcaFlatWriteSection(fp, hdr.off_gc_covars, covars, sizeof(float), hdr.ngcs * ncovars) &&
+       gcaFlatWriteSection(fp, hdr.off_gc_nbr_nlabels, nbr_nlabels, sizeof(short), mrf ? hdr.ngcs * GIBBS_NEIGHBORS : 0) &&
+       gcaFlatWriteSection(fp, hdr.off_gc_nbr_labels, nbr_labels, sizeof(unsigned short), hdr.nnbrs) &&
+       gcaFlatWriteSection(fp, hdr.off_gc_nbr_priors, nbr_priors, sizeof(float), hdr.nnbrs) &&
+       gcaFlatWriteSection(fp, hdr.off_prior_first, prior_first, sizeof(long long), npriors + 1) &&
+       gcaFlatWriteSection(fp, hdr.off_prior_training, prior_training, sizeof(int), npriors) &&
+       gcaFlatWriteSection(fp, hdr.off_prior_labels, prior_labels, sizeof(unsigned short), hdr.nprior_labels) &&
+       gcaFlatWriteSection(fp, hdr.off_prior_priors, prior_priors, sizeof(float), hdr.nprior_labels);
+  if (ok && gca->ct)
+    ok = fseek(fp, hdr.off_ctab, SEEK_SET) == 0 && CTABwriteIntoBinary(gca->ct, fp) == NO_ERROR;
+  else
+    hdr.off_ctab = 0;
+  if (ok) {
+    hdr.file_size = ftell(fp);
+    ok = gcaFlatWriteSection(fp, 0, &hdr, sizeof(hdr), 1);
+  }
+  if (fclose(fp) != 0) ok = 0;
+
+  free(node_first);
+  free(node_training);
+  free(gc_labels);
+  free(means);
+  free(covars);
+  free(nbr_nlabels);
+  free(nbr_labels);
+  free(nbr_priors);
+  free(prior_first);
+  free(prior_training);
+  free(prior_labels);
+  free(prior_priors);
+
+  if (!ok) ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "GCAwriteFlat(%s): write failed", fname));
+  return (NO_ERROR);
+}
+
+static int gcaFlatCheckSection(const GCA_FLAT_HEADER *hdr, long long offset, long long nbytes)
+{
+  if (nbytes == 0) return (1);
+  return (offset >= (long long)sizeof(*hdr) && nbytes > 0 && offset + nbytes <= hdr->file_size &&
+          offset % sizeof(long long) == 0);
+}
+
+/*-----------------------------------------------------
+  GCAreadFlat() - maps a flat atlas written by GCAwriteFlat(). The
+  nodes and priors point into the mapping, so reading costs a few
+  large allocations; the atlas is otherwise a GCA like any other.
+  GCAread() calls this for flat atlases.
+  ------------------------------------------------------*/
+GCA *GCAreadFlat(const char *fname)
+{
+  struct stat stat_buf;
+  GCA_FLAT_HEADER *hdr;
+  GCA_FLAT *flat;
+  GCA *gca;
+  char *map;
+  int fd, x, y, z, n, i, ncovars, bad;
+  long long k, g, b, nnodes, npriors;
+  long long *node_first, *prior_first;
+  int *node_training, *prior_training;
+  unsigned short *gc_labels, *nbr_labels, *prior_labels;
+  float *means, *covars, *nbr_priors, *prior_priors;
+  short *nbr_nlabels;
+
+  if (stat(fname, &stat_buf) < 0) ErrorReturn(NULL, (ERROR_NOFILE, "GCAreadFlat(%s): could not stat file", fname));
+  if (stat_buf.st_size < (off_t)sizeof(GCA_FLAT_HEADER))
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadFlat(%s): file too short", fname));
+  fd = open(fname, O_RDONLY);
+  if (fd < 0) ErrorReturn(NULL, (ERROR_NOFILE, "GCAreadFlat(%s): could not open file", fname));
+  map = (char *)mmap(NULL, stat_buf.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadFlat(%s): could not map file", fname));
+
+  hdr = (GCA_FLAT_HEADER *)map;
+  if (memcmp(hdr->magic, GCA_FLAT_MAGIC, sizeof(hdr->magic)) || hdr->header_size != (int)sizeof(*hdr)) {
+    munmap(map, stat_buf.st_size);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadFlat(%s): not a flat atlas of this version", fname));
+  }
+  if (hdr->byteorder != GCA_FLAT_BYTEORDER) {
+    munmap(map, stat_buf.st_size);
+    ErrorReturn(NULL,
+                (ERROR_BADFILE,
+                 "GCAreadFlat(%s): written on a machine of different byte order, convert the .gca again",
+                 fname));
+  }
+
+  ncovars = (hdr->ninputs * (hdr->ninputs + 1)) / 2;
+  nnodes = (long long)hdr->node_width * hdr->node_height * hdr->node_depth;
+  npriors = (long long)hdr->prior_width * hdr->prior_height * hdr->prior_depth;
+  if (hdr->file_size != (long long)stat_buf.st_size || hdr->ninputs < 1 || hdr->ninputs > MAX_GCA_INPUTS ||
+      nnodes <= 0 || npriors <= 0 || hdr->ngcs < 0 || hdr->nnbrs < 0 || hdr->nprior_labels < 0 ||
+      !gcaFlatCheckSection(hdr, hdr->off_node_first, (nnodes + 1) * sizeof(long long)) ||
+      !gcaFlatCheckSection(hdr, hdr->off_node_training, nnodes * sizeof(int)) ||
+      !gcaFlatCheckSection(hdr, hdr->off_gc_labels, hdr->ngcs * sizeof(unsigned short)) ||
+      !gcaFlatCheckSection(hdr, hdr->off_gc_means, hdr->ngcs * hdr->ninputs * sizeof(float)) ||
+      !gcaFlatCheckSection(hdr, hdr->off_gc_covars, hdr->ngcs * ncovars * sizeof(float)) ||
+      !gcaFlatCheckSection(hdr,
+                           hdr->off_gc_nbr_nlabels,
+                           (hdr->flags & GCA_NO_MRF) ? 0 : hdr->ngcs * GIBBS_NEIGHBORS * sizeof(short)) ||
+      !gcaFlatCheckSection(hdr, hdr->off_gc_nbr_labels, hdr->nnbrs * sizeof(unsigned short)) ||
+      !gcaFlatCheckSection(hdr, hdr->off_gc_nbr_priors, hdr->nnbrs * sizeof(float)) ||
+      !gcaFlatCheckSection(hdr, hdr->off_prior_first, (npriors + 1) * sizeof(long long)) ||
+      !gcaFlatCheckSection(hdr, hdr->off_prior_training, npriors * sizeof(int)) ||
+      !gcaFlatCheckSection(hdr, hdr->off_prior_labels, hdr->nprior_labels * sizeof(unsigned short)) ||
+      !gcaFlatCheckSection(hdr, hdr->off_prior_priors, hdr->nprior_labels * sizeof(float))) {
+    munmap(map, stat_buf.st_size);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadFlat(%s): corrupt header", fname));
+  }
+  node_first = (long long *)(map + hdr->off_node_first);
+  node_training = (int *)(map + hdr->off_node_training);
+  gc_labels = (unsigned short *)(map + hdr->off_gc_labels);
+  means = (float *)(map + hdr->off_gc_means);
+  covars = (float *)(map + hdr->off_gc_covars);
+  nbr_nlabels = (short *)(map + hdr->off_gc_nbr_nlabels);
+  nbr_labels = (unsigned short *)(map + hdr->off_gc_nbr_labels);
+  nbr_priors = (float *)(map + hdr->off_gc_nbr_priors);
+  prior_first = (long long *)(map + hdr->off_prior_first);
+  prior_training = (int *)(map + hdr->off_prior_training);
+  prior_labels = (unsigned short *)(map + hdr->off_prior_labels);
+  prior_priors = (float *)(map + hdr->off_prior_priors);
+
+  gca = gcaAllocMax(hdr->ninputs,
+                    hdr->prior_spacing,
+                    hdr->node_spacing,
+                    hdr->node_spacing * hdr->node_width,
+                    hdr->node_spacing * hdr->node_height,
+                    hdr->node_spacing * hdr->node_depth,
+                    0,
+                    hdr->flags);
+  if (gca->node_width != hdr->node_width || gca->node_height != hdr->node_height ||
+      gca->node_depth != hdr->node_depth || gca->prior_width != hdr->prior_width ||
+      gca->prior_height != hdr->prior_height || gca->prior_depth != hdr->prior_depth) {
+    GCAfree(&gca);
+    munmap(map, stat_buf.st_size);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadFlat(%s): inconsistent dimensions", fname));
+  }
+
+  flat = (GCA_FLAT *)calloc(1, sizeof(GCA_FLAT));
+  if (flat) flat->gcs = (GC1D *)calloc(MAX(hdr->ngcs, 1), sizeof(GC1D));
+  if (flat && !(hdr->flags & GCA_NO_MRF)) {
+    flat->nbr_labels = (unsigned short **)calloc(MAX(hdr->ngcs, 1) * GIBBS_NEIGHBORS, sizeof(unsigned short *));
+    flat->nbr_priors = (float **)calloc(MAX(hdr->ngcs, 1) * GIBBS_NEIGHBORS, sizeof(float *));
+  }
+  if (!flat || !flat->gcs || (!(hdr->flags & GCA_NO_MRF) && (!flat->nbr_labels || !flat->nbr_priors)))
+    ErrorExit(ERROR_NOMEMORY, "GCAreadFlat(%s): could not allocate %lld gcs", fname, hdr->ngcs);
+  flat->map = map;
+  flat->map_size = stat_buf.st_size;
+  flat->ngcs = hdr->ngcs;
+  /* from here on GCAfree() leaves the mapped memory to gcaFlatRelease() */
+  flat->next = gca_flat_list;
+  gca_flat_list = flat;
+  gca->flat = flat;
+
+  bad = (node_first[nnodes] != hdr->ngcs);
+  for (k = b = x = 0; !bad && x < gca->node_width; x++)
+    for (y = 0; !bad && y < gca->node_height; y++)
+      for (z = 0; !bad && z < gca->node_depth; z++, k++) {
+        GCA_NODE *gcan = &gca->nodes[x][y][z];
+        g = node_first[k];
+        if (g < 0 || node_first[k + 1] < g || node_first[k + 1] > hdr->ngcs) {
+          bad = 1;
+          break;
+        }
+        gcan->nlabels = node_first[k + 1] - g;
+        gcan->total_training = node_training[k];
+        if (gcan->nlabels == 0) continue;
+        gcan->labels = gc_labels + g;
+        gcan->gcs = flat->gcs + g;
+        for (n = 0; !bad && n < gcan->nlabels; n++, g++) {
+          GC1D *gc = &gcan->gcs[n];
+          if (gcan->labels[n] > gca->max_label) gca->max_label = gcan->labels[n];
+          gc->means = means + g * gca->ninputs;
+          gc->covars = covars + g * ncovars;
+          if (gca->flags & GCA_NO_MRF) continue;
+          gc->nlabels = nbr_nlabels + g * GIBBS_NEIGHBORS;
+          gc->labels = flat->nbr_labels + g * GIBBS_NEIGHBORS;
+          gc->label_priors = flat->nbr_priors + g * GIBBS_NEIGHBORS;
+          for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+            if (gc->nlabels[i] < 0 || b + gc->nlabels[i] > hdr->nnbrs) {
+              bad = 1;
+              break;
+            }
+            if (gc->nlabels[i] == 0) continue;
+            gc->labels[i] = nbr_labels + b;
+            gc->label_priors[i] = nbr_priors + b;
+            b += gc->nlabels[i];
+          }
+        }
+      }
+  if (!bad && !(gca->flags & GCA_NO_MRF) && b != hdr->nnbrs) bad = 1;
+
+  if (!bad) bad = (prior_first[npriors] != hdr->nprior_labels);
+  for (k = x = 0; !bad && x < gca->prior_width; x++)
+    for (y = 0; !bad && y < gca->prior_height; y++)
+      for (z = 0; !bad && z < gca->prior_depth; z++, k++) {
+        GCA_PRIOR *gcap = &gca->priors[x][y][z];
+        g = prior_first[k];
+        if (g < 0 || prior_first[k + 1] < g || prior_first[k + 1] > hdr->nprior_labels) {
+          bad = 1;
+          break;
+        }
+        gcap->nlabels = prior_first[k + 1] - g;
+        gcap->total_training = prior_training[k];
+        if (gcap->nlabels == 0) continue;
+        gcap->labels = prior_labels + g;
+        gcap->priors = prior_priors + g;
+        for (n = 0; n < gcap->nlabels; n++)
+          if (gcap->labels[n] > gca->max_label) gca->max_label = gcap->labels[n];
+      }
+  if (bad) {
+    GCAfree(&gca);
+    ErrorReturn(NULL, (ERROR_BADFILE, "GCAreadFlat(%s): corrupt node or prior tables", fname));
+  }
+
+  gca->type = hdr->type;
+  gca->width = hdr->width;
+  gca->height = hdr->height;
+  gca->depth = hdr->depth;
+  gca->xsize = hdr->xsize;
+  gca->ysize = hdr->ysize;
+  gca->zsize = hdr->zsize;
+  gca->x_r = hdr->x_r;
+  gca->x_a = hdr->x_a;
+  gca->x_s = hdr->x_s;
+  gca->y_r = hdr->y_r;
+  gca->y_a = hdr->y_a;
+  gca->y_s = hdr->y_s;
+  gca->z_r = hdr->z_r;
+  gca->z_a = hdr->z_a;
+  gca->z_s = hdr->z_s;
+  gca->c_r = hdr->c_r;
+  gca->c_a = hdr->c_a;
+  gca->c_s = hdr->c_s;
+  memmove(gca->TRs, hdr->TRs, sizeof(gca->TRs));
+  memmove(gca->FAs, hdr->FAs, sizeof(gca->FAs));
+  memmove(gca->TEs, hdr->TEs, sizeof(gca->TEs));
+
+  if (hdr->off_ctab > 0) {
+    FILE *fp = fopen(fname, "rb");
+    if (fp && fseek(fp, hdr->off_ctab, SEEK_SET) == 0) gca->ct = CTABreadFromBinary(fp);
+    if (fp) fclose(fp);
+    if (gca->ct == NULL) ErrorPrintf(ERROR_BADFILE, "GCAreadFlat(%s): could not read color table", fname);
+  }
+
+  gcaSetNodeTraining(gca);
+  GCAsetup(gca);
+  GCAbuildGaussianCache(gca);
+
+  return (gca);
+}
+
 static int GCAupdatePrior(GCA *gca, MRI *mri, int xn, int yn, int zn, int label)
 {
   int n;
@@ -3008,8 +3582,8 @@ static int GCAupdatePrior(GCA *gca, MRI *mri, int xn, int yn, int zn, int label)
       memmove(gcap->labels, old_labels, old_max_labels * sizeof(unsigned short));
 
       /* free the old ones */
-      free(old_priors);
-      free(old_labels);
+      gcaFree(old_priors);
+      gcaFree(old_labels);
     }
     // add one
     gcap->nlabels++;
@@ -3174,8 +3748,8 @@ static int GCAupdateNode(GCA *gca, MRI *mri, int xn, int yn, int zn, float *vals
       memmove(gcan->labels, old_labels, old_max_labels * sizeof(unsigned short));
 
       /* free the old ones */
-      free(old_gcs);
-      free(old_labels);
+      gcaFree(old_gcs);
+      gcaFree(old_labels);
     }
     gcan->nlabels++;
   }
@@ -3522,15 +4096,161 @@ int GCAcompleteCovarianceTraining(GCA *gca)
     printf("%d samples pruned during training\n", total_pruned);
     total_pruned = 0;
   }
+  GCAbuildGaussianCache(gca);
   return (NO_ERROR);
 }
 
+/* The Gaussians of every label that a prior allows at a node, packed
+   so that GCAlabel() scores all of a voxel's candidate labels in one pass
+   over contiguous means and inverse covariances instead of searching the
+   node and reloading the covariance of each label. Consecutive voxels
+   mostly map to the same node and prior, so the set is only rebuilt when
+   they change. The scores are computed exactly as gcaComputeLogDensity()
+   computes them. */
+typedef struct
+{
+  GCA_NODE *gcan;
+  GCA_PRIOR *gcap;
+  int ncand, nalloc;
+  int *labels;
+  GC1D **gcs;       /* NULL if there is no usable Gaussian for the label */
+  int *cached;      /* means, inv and log_det below are valid */
+  float *means;     /* ninputs per label */
+  float *inv;       /* packed inverse covariance (the variance for 1 input) */
+  double *log_det;  /* -log(sqrt(det)) */
+  double *log_prior;
+} GCA_LABEL_CANDIDATES;
+
+static void gcaFreeLabelCandidates(GCA_LABEL_CANDIDATES *cand)
+{
+  if (cand->nalloc > 0) {
+    free(cand->labels);
+    free(cand->gcs);
+    free(cand->cached);
+    free(cand->means);
+    free(cand->inv);
+    free(cand->log_det);
+    free(cand->log_prior);
+  }
+  memset(cand, 0, sizeof(*cand));
+}
+
+static void gcaLoadLabelCandidates(GCA *gca, GCA_LABEL_CANDIDATES *cand, int xn, int yn, int zn, GCA_PRIOR *gcap)
+{
+  int n, i, ninputs = gca->ninputs, ncovars = GCA_NCOVARS(gca->ninputs);
+  const float *inv;
+  GC1D *gc;
+
+  cand->gcan = &gca->nodes[xn][yn][zn];
+  cand->gcap = gcap;
+  cand->ncand = gcap->nlabels;
+  if (cand->ncand > cand->nalloc) {
+    int nalloc = cand->ncand;
+    gcaFreeLabelCandidates(cand);
+    cand->gcan = &gca->nodes[xn][yn][zn];
+    cand->gcap = gcap;
+    cand->ncand = cand->nalloc = nalloc;
+    cand->labels = (int *)calloc(nalloc, sizeof(int));
+    cand->gcs = (GC1D **)calloc(nalloc, sizeof(GC1D *));
+    cand->cached = (int *)calloc(nalloc, sizeof(int));
+    cand->means = (float *)calloc(nalloc * ninputs, sizeof(float));
+    cand->inv = (float *)calloc(nalloc * ncovars, sizeof(float));
+    cand->log_det = (double *)calloc(nalloc, sizeof(double));
+    cand->log_prior = (double *)calloc(nalloc, sizeof(double));
+    if (!cand->labels || !cand->gcs || !cand->cached || !cand->means || !cand->inv || !cand->log_det ||
+        !cand->log_prior)
+      ErrorExit(ERROR_NOMEMORY, "GCAlabel: could not allocate %d candidate labels", nalloc);
+  }
+
+  for (n = 0; n < cand->ncand; n++) {
+    cand->labels[n] = gcap->labels[n];
+    gc = GCAfindGC(gca, xn, yn, zn, gcap->labels[n]);
+    if (gc == NULL) {
+      gc = GCAfindClosestValidGC(gca, xn, yn, zn, gcap->labels[n], 0);
+    }
+    cand->gcs[n] = gc;
+    cand->log_prior[n] = log(gcap->priors[n]);
+    cand->cached[n] = 0;
+    if (gc == NULL) {
+      continue;
+    }
+    if (ninputs == 1) {
+      cand->means[n] = gc->means[0];
+      cand->inv[n] = gc->covars[0];
+      cand->log_det[n] = -log(sqrt((double)gc->covars[0]));
+      cand->cached[n] = 1;
+    }
+    else if ((inv = gcaCachedInverseCovariance(gc, ninputs, GCA_CACHE_SVD_INV)) != NULL) {
+      for (i = 0; i < ninputs; i++) cand->means[n * ninputs + i] = gc->means[i];
+      for (i = 0; i < ncovars; i++) cand->inv[n * ncovars + i] = inv[i];
+      cand->log_det[n] = -log(sqrt(gc->gauss_det));
+      cand->cached[n] = 1;
+    }
+  }
+}
+
+/* the most likely of the candidate labels (0 if none has a Gaussian) and its log density */
+static int gcaMaxLikelihoodLabel(GCA *gca, GCA_LABEL_CANDIDATES *cand, float *vals, float *pmax_p)
+{
+  int n, i, label, ninputs = gca->ninputs, ncovars = GCA_NCOVARS(gca->ninputs);
+  float max_p, p, d[MAX_GCA_INPUTS];
+  double dsq;
+
+  label = 0;
+  max_p = 2 * GIBBS_NEIGHBORS * BIG_AND_NEGATIVE;
+  for (n = 0; n < cand->ncand; n++) {
+    if (cand->gcs[n] == NULL) {
+      continue;
+    }
+    if (!cand->cached[n]) {
+      // no cached inverse, so go through the matrices
+      p = GCAcomputeConditionalLogDensity(cand->gcs[n], vals, ninputs, cand->labels[n]) + cand->log_prior[n];
+    }
+    else {
+      if (ninputs == 1) {
+        float v;
+        v = vals[0] - cand->means[n];
+        dsq = v * v / cand->inv[n];
+      }
+      else {
+        for (i = 0; i < ninputs; i++) d[i] = vals[i] - cand->means[n * ninputs + i];
+        switch (ninputs) {
+          case 2:
+            dsq = gcaPackedMahDist(cand->inv + n * ncovars, d, 2);
+            break;
+          case 3:
+            dsq = gcaPackedMahDist(cand->inv + n * ncovars, d, 3);
+            break;
+          case 4:
+            dsq = gcaPackedMahDist(cand->inv + n * ncovars, d, 4);
+            break;
+          default:
+            dsq = gcaPackedMahDist(cand->inv + n * ncovars, d, ninputs);
+            break;
+        }
+      }
+      p = cand->log_det[n] - .5 * dsq + cand->log_prior[n];
+    }
+    // look for largest p
+    if (p > max_p) {
+      max_p = p;
+      label = cand->labels[n];
+    }
+  }
+  *pmax_p = max_p;
+  return (label);
+}
+
+/*-----------------------------------------------------
+  GCAlabel() - the maximum likelihood label of each voxel (without
+  the MRF). Slabs of constant x are labeled in parallel, and all of the
+  candidate labels of a voxel are scored in one pass (see
+  GCA_LABEL_CANDIDATES), giving the same labels as one voxel and one
+  label at a time.
+  ------------------------------------------------------*/
 MRI *GCAlabel(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
 {
   int x, width, height, depth, num_pv, use_partial_volume_stuff;
-#if INTERP_PRIOR
-  float prior;
-#endif
 
   use_partial_volume_stuff = (getenv("USE_PARTIAL_VOLUME_STUFF") != NULL);
   if (use_partial_volume_stuff) {
@@ -3554,19 +4274,20 @@ MRI *GCAlabel(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
   height = mri_inputs->height;
   depth = mri_inputs->depth;
   num_pv = 0;
-  // if 0
-  // ifdef HAVE_OPENMP
-  // pragma omp parallel for if_ROMP(experimental) reduction(+: num_pv)
-  // endif
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) reduction(+ : num_pv) schedule(dynamic, 1)
+#endif
   for (x = 0; x < width; x++) {
+    ROMP_PFLB_begin
     int y, z, n, label, xn, yn, zn;
-    // int max_n;
     float vals[MAX_GCA_INPUTS], max_p, p;
     GCA_NODE *gcan;
     GCA_PRIOR *gcap;
     GC1D *gc;
-    // GC1D *max_gc;
+    GCA_LABEL_CANDIDATES cand;
 
+    memset(&cand, 0, sizeof(cand));
     for (y = 0; y < height; y++) {
       for (z = 0; z < depth; z++) {
         if (x == Ggca_x && y == Ggca_y && z == Ggca_z) {
@@ -3585,39 +4306,15 @@ MRI *GCAlabel(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
           if (gcap == NULL) {
             continue;
           }
-          label = 0;
-          // max_n = -1;
-          // max_gc = NULL;
-          max_p = 2 * GIBBS_NEIGHBORS * BIG_AND_NEGATIVE;
-          // going through gcap labels
-          for (n = 0; n < gcap->nlabels; n++) {
-#if 0
-            p = GCAcomputePosteriorDensity(gcap, gcan, -1, n, vals,
-                                           gca->ninputs,xn,yn,zn,gca) ;
-#else
-            gc = GCAfindGC(gca, xn, yn, zn, gcap->labels[n]);
-            if (gc == NULL) {
-              gc = GCAfindClosestValidGC(gca, xn, yn, zn, gcap->labels[n], 0);
-            }
-            if (gc == NULL) {
-              MRIsetVoxVal(mri_dst, x, y, z, 0, 0);  // unknown
-              continue;
-            }
+          if (cand.gcan != gcan || cand.gcap != gcap) {
+            gcaLoadLabelCandidates(gca, &cand, xn, yn, zn, gcap);
+          }
 #if INTERP_PRIOR
-            prior = gcaComputePrior(gca, mri_inputs, transform, x, y, z, gcap->labels[n]);
-            p = gcaComputeLogDensity(gc, vals, gca->ninputs, prior, gcap->labels[n]);
-#else
-            p = gcaComputeLogDensity(gc, vals, gca->ninputs, gcap->priors[n], gcap->labels[n]);
+          for (n = 0; n < gcap->nlabels; n++)
+            cand.log_prior[n] = log(gcaComputePrior(gca, mri_inputs, transform, x, y, z, gcap->labels[n]));
 #endif
-#endif
-            // look for largest p
-            if (p > max_p) {
-              max_p = p;
-              label = gcap->labels[n];
-              // max_n = n;
-              // max_gc = gc;
-            }
-          }
+          // going through gcap labels
+          label = gcaMaxLikelihoodLabel(gca, &cand, vals, &max_p);
 
           if (use_partial_volume_stuff)
           //////////// start of partial volume stuff
@@ -3701,7 +4398,10 @@ MRI *GCAlabel(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform)
         }
       }  // z loop
     }    // y loop
+    gcaFreeLabelCandidates(&cand);
+    ROMP_PFLB_end
   }      // x loop
+  ROMP_PF_end
 
   return (mri_dst);
 }
@@ -4145,8 +4845,8 @@ GCA *GCAreduce(GCA *gca_src)
                       old_max_labels*sizeof(unsigned short)) ;
 
               /* free the old ones */
-              free(old_gcs) ;
-              free(old_labels) ;
+              gcaFree(old_gcs) ;
+              gcaFree(old_labels) ;
             }
             gcan_dst->nlabels++ ;
           }
@@ -7198,8 +7898,8 @@ static int GCAupdateNodeGibbsPriors(GCA *gca, MRI *mri, int xn, int yn, int zn,
         memmove(gc->labels[i], old_labels, gc->nlabels[i] * sizeof(unsigned short));
 
         /* free the old ones */
-        free(old_label_priors);
-        free(old_labels);
+        gcaFree(old_label_priors);
+        gcaFree(old_labels);
       }
       gc->labels[i][gc->nlabels[i]++] = nbr_label;
 #else
@@ -7670,37 +8370,183 @@ MRI *GCAanneal(MRI *mri_inputs, GCA *gca, MRI *mri_dst, TRANSFORM *transform, in
 
 char *gca_write_fname = NULL;
 int gca_write_iterations = 0;
+int gca_icm_checkerboard = 0;
 
-#if 0
-double MAX_PRIOR_FACTOR = 1.0 ;
-double MIN_PRIOR_FACTOR = 1.0 ;
-#endif
+/*
+  a voxel that GCAreclassifyUsingGibbsPriors() may relabel, with the node
+  and prior it maps to looked up once rather than on every pass
+*/
+typedef struct
+{
+  short x, y, z;
+  int xn, yn, zn;
+  GCA_PRIOR *gcap;
+} GCA_ICM_VOXEL;
 
-MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
-                                   GCA *gca,
-                                   MRI *mri_dst,
-                                   TRANSFORM *transform,
-                                   int max_iter,
-                                   MRI *mri_fixed,
-                                   int restart,
-                                   void (*update_func)(MRI *),
-                                   double min_prior_factor,
-                                   double max_prior_factor)
+/*
+  find the voxels that map to a node and to a prior with more than one
+  label, and split them by the parity of x+y+z. Every 6-connected neighbor
+  of a voxel has the other parity, so all of the voxels of one color can be
+  relabeled at the same time.
+*/
+static GCA_ICM_VOXEL *gcaCheckerboardVoxels(GCA *gca, MRI *mri_inputs, TRANSFORM *transform, int *nvoxels)
 {
-  int x, y, z, width, height, depth, iter, nchanged, min_changed, index, nindices, fixed;
-  short *x_indices, *y_indices, *z_indices;
-  double prior_factor, old_posterior, lcma = 0.0;
-  MRI *mri_changed, *mri_probs /*, *mri_zero */;
+  GCA_ICM_VOXEL *voxels[2], *icm_voxels;
+  int x, y, z, xn, yn, zn, color, nalloc[2];
+  GCA_PRIOR *gcap;
 
-  prior_factor = min_prior_factor;
-  // fixed is the label fixed volume, e.g. wm
-  fixed = (mri_fixed != NULL);
+  for (color = 0; color < 2; color++) {
+    nvoxels[color] = 0;
+    nalloc[color] = 1024;
+    voxels[color] = (GCA_ICM_VOXEL *)calloc(nalloc[color], sizeof(GCA_ICM_VOXEL));
+    if (!voxels[color]) ErrorExit(ERROR_NOMEMORY, "gcaCheckerboardVoxels: could not allocate voxel list");
+  }
+  for (x = 0; x < mri_inputs->width; x++)
+    for (y = 0; y < mri_inputs->height; y++)
+      for (z = 0; z < mri_inputs->depth; z++) {
+        if (GCAsourceVoxelToNode(gca, mri_inputs, transform, x, y, z, &xn, &yn, &zn)) continue;
+        gcap = getGCAP(gca, mri_inputs, transform, x, y, z);
+        if (gcap == NULL || gcap->nlabels <= 1) continue;
+        color = (x + y + z) % 2;
+        if (nvoxels[color] >= nalloc[color]) {
+          nalloc[color] *= 2;
+          voxels[color] = (GCA_ICM_VOXEL *)realloc(voxels[color], nalloc[color] * sizeof(GCA_ICM_VOXEL));
+          if (!voxels[color]) ErrorExit(ERROR_NOMEMORY, "gcaCheckerboardVoxels: could not allocate voxel list");
+        }
+        voxels[color][nvoxels[color]].x = x;
+        voxels[color][nvoxels[color]].y = y;
+        voxels[color][nvoxels[color]].z = z;
+        voxels[color][nvoxels[color]].xn = xn;
+        voxels[color][nvoxels[color]].yn = yn;
+        voxels[color][nvoxels[color]].zn = zn;
+        voxels[color][nvoxels[color]].gcap = gcap;
+        nvoxels[color]++;
+      }
+
+  // the red voxels followed by the black ones
+  icm_voxels = (GCA_ICM_VOXEL *)calloc(nvoxels[0] + nvoxels[1] + 1, sizeof(GCA_ICM_VOXEL));
+  if (!icm_voxels) ErrorExit(ERROR_NOMEMORY, "gcaCheckerboardVoxels: could not allocate voxel list");
+  memmove(icm_voxels, voxels[0], nvoxels[0] * sizeof(GCA_ICM_VOXEL));
+  memmove(icm_voxels + nvoxels[0], voxels[1], nvoxels[1] * sizeof(GCA_ICM_VOXEL));
+  free(voxels[0]);
+  free(voxels[1]);
+  return (icm_voxels);
+}
 
-#if 0
-  GCAannealUnlikelyVoxels(mri_inputs, gca, mri_dst, transform, max_iter*100,
-                          mri_fixed) ;
-  {
-    char  fname[STRLEN], *cp ;
+/*
+  one ICM pass over the marked, unfixed voxels, one color at a time. A voxel
+  only reads the labels of the other color, so each color is relabeled in
+  parallel and the result does not depend on the number of threads.
+  Returns the number of labels changed.
+*/
+static int gcaCheckerboardICM(GCA *gca,
+                              MRI *mri_inputs,
+                              MRI *mri_dst,
+                              MRI *mri_fixed,
+                              MRI *mri_changed,
+                              MRI *mri_probs,
+                              GCA_ICM_VOXEL *icm_voxels,
+                              int *nvoxels,
+                              double prior_factor)
+{
+  int color, index, nchanged = 0;
+  GCA_ICM_VOXEL *voxels;
+
+  for (color = 0; color < 2; color++) {
+    voxels = color == 0 ? icm_voxels : icm_voxels + nvoxels[0];
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) reduction(+ : nchanged) schedule(dynamic, 4096)
+#endif
+    for (index = 0; index < nvoxels[color]; index++) {
+      ROMP_PFLB_begin
+      GCA_ICM_VOXEL *v = &voxels[index];
+      int x = v->x, y = v->y, z = v->z, n, label, old_label;
+      double new_posterior, max_posterior;
+      float vals[MAX_GCA_INPUTS];
+
+      if (x == Ggca_x && y == Ggca_y && z == Ggca_z) DiagBreak();
+
+      // if the label is fixed or the voxel is not marked, don't do anything
+      if ((mri_fixed && MRIgetVoxVal(mri_fixed, x, y, z, 0)) || MRIgetVoxVal(mri_changed, x, y, z, 0) == 0) {
+        ROMP_PFLB_continue;
+      }
+
+      load_vals(mri_inputs, x, y, z, vals, gca->ninputs);
+      label = old_label = nint(MRIgetVoxVal(mri_dst, x, y, z, 0));
+      max_posterior = gcaGibbsLogPosteriorOfLabel(
+          gca, mri_dst, x, y, z, v->xn, v->yn, v->zn, v->gcap, vals, old_label, prior_factor);
+      for (n = 0; n < v->gcap->nlabels; n++) {
+        if (v->gcap->labels[n] == old_label) continue;
+        new_posterior = gcaGibbsLogPosteriorOfLabel(
+            gca, mri_dst, x, y, z, v->xn, v->yn, v->zn, v->gcap, vals, v->gcap->labels[n], prior_factor);
+        if (new_posterior > max_posterior) {
+          max_posterior = new_posterior;
+          label = v->gcap->labels[n];
+        }
+      }
+      if (x == Ggca_x && y == Ggca_y && z == Ggca_z &&
+          (label == Ggca_label || old_label == Ggca_label || Ggca_label < 0))
+        printf("(%d, %d, %d): old label %s (%d), new label %s (%d) (log(p)=%2.3f)\n",
+               x,
+               y,
+               z,
+               cma_label_to_name(old_label),
+               old_label,
+               cma_label_to_name(label),
+               label,
+               max_posterior);
+
+      if (label != old_label) {
+        nchanged++;
+        MRIsetVoxVal(mri_changed, x, y, z, 0, 1);
+      }
+      else {
+        MRIsetVoxVal(mri_changed, x, y, z, 0, 0);
+      }
+      MRIsetVoxVal(mri_dst, x, y, z, 0, label);
+      if (mri_probs) {
+        MRIsetVoxVal(mri_probs, x, y, z, 0, -max_posterior);
+      }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
+  return (nchanged);
+}
+
+#if 0
+double MAX_PRIOR_FACTOR = 1.0 ;
+double MIN_PRIOR_FACTOR = 1.0 ;
+#endif
+
+MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
+                                   GCA *gca,
+                                   MRI *mri_dst,
+                                   TRANSFORM *transform,
+                                   int max_iter,
+                                   MRI *mri_fixed,
+                                   int restart,
+                                   void (*update_func)(MRI *),
+                                   double min_prior_factor,
+                                   double max_prior_factor)
+{
+  int x, y, z, width, height, depth, iter, nchanged, min_changed, index, nindices, fixed;
+  short *x_indices, *y_indices, *z_indices;
+  double prior_factor, old_posterior, lcma = 0.0;
+  MRI *mri_changed, *mri_probs /*, *mri_zero */;
+  GCA_ICM_VOXEL *icm_voxels = NULL;
+  int icm_nvoxels[2];
+
+  prior_factor = min_prior_factor;
+  // fixed is the label fixed volume, e.g. wm
+  fixed = (mri_fixed != NULL);
+
+#if 0
+  GCAannealUnlikelyVoxels(mri_inputs, gca, mri_dst, transform, max_iter*100,
+                          mri_fixed) ;
+  {
+    char  fname[STRLEN], *cp ;
 
     strcpy(fname, mri_inputs->fname) ;
     cp = strrchr(fname, '/') ;
@@ -7713,7 +8559,8 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
   }
 #endif
 
-  nindices = mri_dst->width * mri_dst->height * mri_dst->depth;
+  // the checkerboard order has no use for an index set
+  nindices = gca_icm_checkerboard ? 1 : mri_dst->width * mri_dst->height * mri_dst->depth;
   x_indices = (short *)calloc(nindices, sizeof(short));
   y_indices = (short *)calloc(nindices, sizeof(short));
   z_indices = (short *)calloc(nindices, sizeof(short));
@@ -7802,9 +8649,18 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
   }
 #endif
 
+  if (gca_icm_checkerboard) {
+    icm_voxels = gcaCheckerboardVoxels(gca, mri_inputs, transform, icm_nvoxels);
+    printf("relabeling %d + %d voxels in checkerboard order\n", icm_nvoxels[0], icm_nvoxels[1]);
+  }
+
   prior_factor = min_prior_factor;
   do {
-    if (restart) {
+    if (icm_voxels) {
+      // the voxels are visited a color at a time, not in a given order
+      mri_probs = NULL;
+    }
+    else if (restart) {
       for (index = x = 0; x < width; x++)
         for (y = 0; y < height; y++)
           for (z = 0; z < depth; z++) {
@@ -7846,113 +8702,119 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
       MRIcopyHeader(mri_inputs, mri_probs);
     }
 
-    //#ifdef HAVE_OPENMP
-    // pragma omp parallel for if_ROMP(experimental) reduction(+: nchanged)
-    //#endif
-    for (index = 0; index < nindices; index++) {
-      int x, y, z, n, label, old_label;
-      GCA_PRIOR *gcap;
-      double new_posterior, max_posterior;
-      // float val;
-
-      x = x_indices[index];
-      y = y_indices[index];
-      z = z_indices[index];
-      if (x == Ggca_x && y == Ggca_y && z == Ggca_z) DiagBreak();
-
-      // if the label is fixed, don't do anything
-      if (mri_fixed && MRIgetVoxVal(mri_fixed, x, y, z, 0)) continue;
-
-      // if not marked, don't do anything
-      if (MRIgetVoxVal(mri_changed, x, y, z, 0) == 0) continue;
-
-      // get the grey value
-      // val =
-      MRIgetVoxVal(mri_inputs, x, y, z, 0);
+    if (icm_voxels) {
+      nchanged = gcaCheckerboardICM(
+          gca, mri_inputs, mri_dst, mri_fixed, mri_changed, mri_probs, icm_voxels, icm_nvoxels, prior_factor);
+    }
+    else {
+      //#ifdef HAVE_OPENMP
+      // pragma omp parallel for if_ROMP(experimental) reduction(+: nchanged)
+      //#endif
+      for (index = 0; index < nindices; index++) {
+        int x, y, z, n, label, old_label;
+        GCA_PRIOR *gcap;
+        double new_posterior, max_posterior;
+        // float val;
+
+        x = x_indices[index];
+        y = y_indices[index];
+        z = z_indices[index];
+        if (x == Ggca_x && y == Ggca_y && z == Ggca_z) DiagBreak();
+
+        // if the label is fixed, don't do anything
+        if (mri_fixed && MRIgetVoxVal(mri_fixed, x, y, z, 0)) continue;
+
+        // if not marked, don't do anything
+        if (MRIgetVoxVal(mri_changed, x, y, z, 0) == 0) continue;
+
+        // get the grey value
+        // val =
+        MRIgetVoxVal(mri_inputs, x, y, z, 0);
 
-      /* find the node associated with this coordinate and classify */
-      gcap = getGCAP(gca, mri_inputs, transform, x, y, z);
-      // it is not in the right place
-      if (gcap == NULL) continue;
+        /* find the node associated with this coordinate and classify */
+        gcap = getGCAP(gca, mri_inputs, transform, x, y, z);
+        // it is not in the right place
+        if (gcap == NULL) continue;
 
-      // only one label associated, don't do anything
-      if (gcap->nlabels == 1) continue;
+        // only one label associated, don't do anything
+        if (gcap->nlabels == 1) continue;
 
-      // save the current label
-      label = old_label = nint(MRIgetVoxVal(mri_dst, x, y, z, 0));
-      // calculate neighborhood likelihood
-      max_posterior = GCAnbhdGibbsLogPosterior(gca, mri_dst, mri_inputs, x, y, z, transform, prior_factor);
+        // save the current label
+        label = old_label = nint(MRIgetVoxVal(mri_dst, x, y, z, 0));
+        // calculate neighborhood likelihood
+        max_posterior = GCAnbhdGibbsLogPosterior(gca, mri_dst, mri_inputs, x, y, z, transform, prior_factor);
 
-      // go through all labels at this point
-      for (n = 0; n < gcap->nlabels; n++) {
-        // skip the current label
-        if (gcap->labels[n] == old_label) continue;
+        // go through all labels at this point
+        for (n = 0; n < gcap->nlabels; n++) {
+          // skip the current label
+          if (gcap->labels[n] == old_label) continue;
 
-        // assign the new label
-        MRIsetVoxVal(mri_dst, x, y, z, 0, gcap->labels[n]);
-        // calculate neighborhood likelihood
-        new_posterior = GCAnbhdGibbsLogPosterior(gca, mri_dst, mri_inputs, x, y, z, transform, prior_factor);
-        // if it is bigger than the old one, then replace the label
-        // and change max_posterior
-        if (new_posterior > max_posterior) {
-          if (x == Ggca_x && y == Ggca_y && z == Ggca_z &&
-              (label == Ggca_label || old_label == Ggca_label || Ggca_label < 0))
-            fprintf(stdout,
-                    "NbhdGibbsLogLikelihood at (%d, %d, %d):"
-                    " old = %d (ll=%.2f) new = %d (ll=%.2f)\n",
-                    x,
-                    y,
-                    z,
-                    old_label,
-                    max_posterior,
-                    gcap->labels[n],
-                    new_posterior);
+          // assign the new label
+          MRIsetVoxVal(mri_dst, x, y, z, 0, gcap->labels[n]);
+          // calculate neighborhood likelihood
+          new_posterior = GCAnbhdGibbsLogPosterior(gca, mri_dst, mri_inputs, x, y, z, transform, prior_factor);
+          // if it is bigger than the old one, then replace the label
+          // and change max_posterior
+          if (new_posterior > max_posterior) {
+            if (x == Ggca_x && y == Ggca_y && z == Ggca_z &&
+                (label == Ggca_label || old_label == Ggca_label || Ggca_label < 0))
+              fprintf(stdout,
+                      "NbhdGibbsLogLikelihood at (%d, %d, %d):"
+                      " old = %d (ll=%.2f) new = %d (ll=%.2f)\n",
+                      x,
+                      y,
+                      z,
+                      old_label,
+                      max_posterior,
+                      gcap->labels[n],
+                      new_posterior);
 
-          max_posterior = new_posterior;
-          label = gcap->labels[n];
+            max_posterior = new_posterior;
+            label = gcap->labels[n];
+          }
         }
-      }
 
-      /*#ifndef __OPTIMIZE__*/
-      if (x == Ggca_x && y == Ggca_y && z == Ggca_z &&
-          (label == Ggca_label || old_label == Ggca_label || Ggca_label < 0)) {
-        int xn, yn, zn;
-        GCA_NODE *gcan;
+        /*#ifndef __OPTIMIZE__*/
+        if (x == Ggca_x && y == Ggca_y && z == Ggca_z &&
+            (label == Ggca_label || old_label == Ggca_label || Ggca_label < 0)) {
+          int xn, yn, zn;
+          GCA_NODE *gcan;
 
-        if (!GCAsourceVoxelToNode(gca, mri_inputs, transform, x, y, z, &xn, &yn, &zn)) {
-          gcan = &gca->nodes[xn][yn][zn];
-          printf(
-              "(%d, %d, %d): old label %s (%d), "
-              "new label %s (%d) (log(p)=%2.3f)\n",
-              x,
-              y,
-              z,
-              cma_label_to_name(old_label),
-              old_label,
-              cma_label_to_name(label),
-              label,
-              max_posterior);
-          dump_gcan(gca, gcan, stdout, 0, gcap);
-          if (label == Right_Caudate) {
-            DiagBreak();
+          if (!GCAsourceVoxelToNode(gca, mri_inputs, transform, x, y, z, &xn, &yn, &zn)) {
+            gcan = &gca->nodes[xn][yn][zn];
+            printf(
+                "(%d, %d, %d): old label %s (%d), "
+                "new label %s (%d) (log(p)=%2.3f)\n",
+                x,
+                y,
+                z,
+                cma_label_to_name(old_label),
+                old_label,
+                cma_label_to_name(label),
+                label,
+                max_posterior);
+            dump_gcan(gca, gcan, stdout, 0, gcap);
+            if (label == Right_Caudate) {
+              DiagBreak();
+            }
           }
         }
-      }
-      /*#endif*/
+        /*#endif*/
 
-      // if label changed
-      if (label != old_label) {
-        nchanged++;
-        // mark it as changed
-        MRIsetVoxVal(mri_changed, x, y, z, 0, 1);
-      }
-      else {
-        MRIsetVoxVal(mri_changed, x, y, z, 0, 0);
-      }
-      // assign new label
-      MRIsetVoxVal(mri_dst, x, y, z, 0, label);
-      if (mri_probs) {
-        MRIsetVoxVal(mri_probs, x, y, z, 0, -max_posterior);
+        // if label changed
+        if (label != old_label) {
+          nchanged++;
+          // mark it as changed
+          MRIsetVoxVal(mri_changed, x, y, z, 0, 1);
+        }
+        else {
+          MRIsetVoxVal(mri_changed, x, y, z, 0, 0);
+        }
+        // assign new label
+        MRIsetVoxVal(mri_dst, x, y, z, 0, label);
+        if (mri_probs) {
+          MRIsetVoxVal(mri_probs, x, y, z, 0, -max_posterior);
+        }
       }
     }
     if (mri_probs) {
@@ -8183,6 +9045,9 @@ MRI *GCAreclassifyUsingGibbsPriors(MRI *mri_inputs,
   free(x_indices);
   free(y_indices);
   free(z_indices);
+  if (icm_voxels) {
+    free(icm_voxels);
+  }
   MRIfree(&mri_changed);
 
   return (mri_dst);
@@ -8365,19 +9230,9 @@ double GCAwindowPosteriorLogProbability(
 double GCAvoxelGibbsLogPosterior(
     GCA *gca, MRI *mri_labels, MRI *mri_inputs, int x, int y, int z, TRANSFORM *transform, double gibbs_coef)
 {
-  double log_posterior /*, dist*/, nbr_prior;
-  int xn, yn, zn, xnbr, ynbr, znbr, nbr_label, label, i, j, n;
-  GCA_NODE *gcan = 0;
+  int xn, yn, zn, label;
   GCA_PRIOR *gcap = 0;
-  GC1D *gc = 0;
   float vals[MAX_GCA_INPUTS];
-#if INTERP_PRIOR
-  float prior;
-#endif
-  // float     tmp = 0;
-
-  // signify error
-  log_posterior = 0.;
 
   // get the grey value
   load_vals(mri_inputs, x, y, z, vals, gca->ninputs);
@@ -8386,7 +9241,6 @@ double GCAvoxelGibbsLogPosterior(
   // what happens with higher number > CMA_MAX?
   /* find the node associated with this coordinate and classify */
   if (!GCAsourceVoxelToNode(gca, mri_inputs, transform, x, y, z, &xn, &yn, &zn)) {
-    gcan = &gca->nodes[xn][yn][zn];
     gcap = getGCAP(gca, mri_inputs, transform, x, y, z);
     if (gcap == NULL || gcap->nlabels <= 0) {
       if (label == Unknown)  // okay for there to be an
@@ -8398,102 +9252,131 @@ double GCAvoxelGibbsLogPosterior(
         return (10 * BIG_AND_NEGATIVE);
       }
     }
+    return (gcaGibbsLogPosteriorOfLabel(gca, mri_labels, x, y, z, xn, yn, zn, gcap, vals, label, gibbs_coef));
+  }
+  else {
+    return (10 * BIG_AND_NEGATIVE);
+    // return (log(VERY_UNLIKELY)) ;
+  }
+}
 
-    ////////////////// debug code (this should not occur ) /////////
-    if (label > MAX_CMA_LABEL) {
-      printf(
-          "\nGCAvoxelGibbsLogPosterior() is called "
-          "with label %d at (%d, %d, %d)\n",
-          label,
-          x,
-          y,
-          z);
-      printf("gcan = %p, gcap = %p\n", gcan, gcap);
-      if (gcan) {
-        printf("gcan->nlabels = %d, gcan->total_training = %d ", gcan->nlabels, gcan->total_training);
-        printf("log(return) = %.2f\n", log(0.01f / ((float)gcan->total_training * GIBBS_NEIGHBORS)));
-        printf("labels for this location\n");
-        for (n = 0; n < gcan->nlabels; n++)
-          printf("label=%s (%d); ", cma_label_to_name(gcan->labels[n]), gcan->labels[n]);
-      }
-    }
-    /////////////////////////////////////////////////////////////////
-    for (n = 0; n < gcan->nlabels; n++) {
-      if (gcan->labels[n] == label) {
-        break;
-      }
-    }
-    // could not find the label, then
-    if (n >= gcan->nlabels) {
-      gc = GCAfindClosestValidGC(gca, xn, yn, zn, label, 0);
-    }
-    else {
-      gc = &gcan->gcs[n];
+/*
+  the Gibbs log posterior of (x, y, z) having the given label, from its node
+  and prior, without writing the label into mri_labels. A 6-connected
+  neighbor that the volume edge folds back onto (x, y, z) itself is taken to
+  have the label too, so this is what GCAvoxelGibbsLogPosterior() returns
+  after the label has been set.
+*/
+static double gcaGibbsLogPosteriorOfLabel(GCA *gca,
+                                          MRI *mri_labels,
+                                          int x,
+                                          int y,
+                                          int z,
+                                          int xn,
+                                          int yn,
+                                          int zn,
+                                          GCA_PRIOR *gcap,
+                                          float *vals,
+                                          int label,
+                                          double gibbs_coef)
+{
+  double log_posterior /*, dist*/, nbr_prior;
+  int xnbr, ynbr, znbr, nbr_label, i, j, n;
+  GCA_NODE *gcan = 0;
+  GC1D *gc = 0;
+  // float     tmp = 0;
+
+  gcan = &gca->nodes[xn][yn][zn];
+  ////////////////// debug code (this should not occur ) /////////
+  if (label > MAX_CMA_LABEL) {
+    printf(
+        "\nGCAvoxelGibbsLogPosterior() is called "
+        "with label %d at (%d, %d, %d)\n",
+        label,
+        x,
+        y,
+        z);
+    printf("gcan = %p, gcap = %p\n", gcan, gcap);
+    if (gcan) {
+      printf("gcan->nlabels = %d, gcan->total_training = %d ", gcan->nlabels, gcan->total_training);
+      printf("log(return) = %.2f\n", log(0.01f / ((float)gcan->total_training * GIBBS_NEIGHBORS)));
+      printf("labels for this location\n");
+      for (n = 0; n < gcan->nlabels; n++)
+        printf("label=%s (%d); ", cma_label_to_name(gcan->labels[n]), gcan->labels[n]);
     }
-    if (gc == NULL) {
-      // if (gcan->total_training > 0)
-      // return(log(0.01f/((float)gcan->total_training*GIBBS_NEIGHBORS))) ;
-      /* 10*GIBBS_NEIGHBORS*BIG_AND_NEGATIVE*/
-      // else
-      return (10 * BIG_AND_NEGATIVE);
-      // return(log(VERY_UNLIKELY)) ;
+  }
+  /////////////////////////////////////////////////////////////////
+  for (n = 0; n < gcan->nlabels; n++) {
+    if (gcan->labels[n] == label) {
+      break;
     }
+  }
+  // could not find the label, then
+  if (n >= gcan->nlabels) {
+    gc = GCAfindClosestValidGC(gca, xn, yn, zn, label, 0);
+  }
+  else {
+    gc = &gcan->gcs[n];
+  }
+  if (gc == NULL) {
+    // if (gcan->total_training > 0)
+    // return(log(0.01f/((float)gcan->total_training*GIBBS_NEIGHBORS))) ;
+    /* 10*GIBBS_NEIGHBORS*BIG_AND_NEGATIVE*/
+    // else
+    return (10 * BIG_AND_NEGATIVE);
+    // return(log(VERY_UNLIKELY)) ;
+  }
 
-    /* compute 1-d Mahalanobis distance */
-    log_posterior = GCAcomputeConditionalLogDensity(gc, vals, gca->ninputs, label);
-    if (check_finite("GCAvoxelGibbsLogPosterior: conditional log density", log_posterior) == 0) {
-      DiagBreak();
-    }
+  /* compute 1-d Mahalanobis distance */
+  log_posterior = GCAcomputeConditionalLogDensity(gc, vals, gca->ninputs, label);
+  if (check_finite("GCAvoxelGibbsLogPosterior: conditional log density", log_posterior) == 0) {
+    DiagBreak();
+  }
 
-    nbr_prior = 0.0;
-    if (gc->nlabels == NULL) {
-      nbr_prior += log(0.1f / (float)gcan->total_training);
-    }
-    else {
-      for (i = 0; i < GIBBS_NEIGHBORS; i++) {
-        xnbr = mri_labels->xi[x + xnbr_offset[i]];
-        ynbr = mri_labels->yi[y + ynbr_offset[i]];
-        znbr = mri_labels->zi[z + znbr_offset[i]];
+  nbr_prior = 0.0;
+  if (gc->nlabels == NULL) {
+    nbr_prior += log(0.1f / (float)gcan->total_training);
+  }
+  else {
+    for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+      xnbr = mri_labels->xi[x + xnbr_offset[i]];
+      ynbr = mri_labels->yi[y + ynbr_offset[i]];
+      znbr = mri_labels->zi[z + znbr_offset[i]];
+      if (xnbr == x && ynbr == y && znbr == z) {
+        nbr_label = label;
+      }
+      else {
         nbr_label = nint(MRIgetVoxVal(mri_labels, xnbr, ynbr, znbr, 0));
-        for (j = 0; j < gc->nlabels[i]; j++) {
-          if (nbr_label == gc->labels[i][j]) {
-            break;
-          }
+      }
+      for (j = 0; j < gc->nlabels[i]; j++) {
+        if (nbr_label == gc->labels[i][j]) {
+          break;
         }
-        if (j < gc->nlabels[i]) {
-          if (!FZERO(gc->label_priors[i][j])) {
-            nbr_prior += log(gc->label_priors[i][j]);
-          }
-          else {
-            nbr_prior += log(0.1f / (float)gcan->total_training);
-          }
-          /*BIG_AND_NEGATIVE */
-          check_finite("GCAvoxelGibbsLogPosterior: label_priors", nbr_prior);
+      }
+      if (j < gc->nlabels[i]) {
+        if (!FZERO(gc->label_priors[i][j])) {
+          nbr_prior += log(gc->label_priors[i][j]);
         }
-        else /* never occurred - make it unlikely */
-        {
-          if (x == Ggca_x && y == Ggca_y && z == Ggca_z) {
-            DiagBreak();
-          }
+        else {
           nbr_prior += log(0.1f / (float)gcan->total_training);
-          /*BIG_AND_NEGATIVE*/
         }
+        /*BIG_AND_NEGATIVE */
+        check_finite("GCAvoxelGibbsLogPosterior: label_priors", nbr_prior);
+      }
+      else /* never occurred - make it unlikely */
+      {
+        if (x == Ggca_x && y == Ggca_y && z == Ggca_z) {
+          DiagBreak();
+        }
+        nbr_prior += log(0.1f / (float)gcan->total_training);
+        /*BIG_AND_NEGATIVE*/
       }
-    }
-// added to the previous value
-#if INTERP_PRIOR
-    prior = gcaComputePrior(gca, mri_inputs, transform, x, y, z, label);
-    log_posterior += (gibbs_coef * nbr_prior + log(prior));
-#else
-    log_posterior += (gibbs_coef * nbr_prior + log(getPrior(gcap, label)));
-#endif
-    if (check_finite("GCAvoxelGibbsLogPosterior: final", log_posterior) == 0) {
-      DiagBreak();
     }
   }
-  else {
-    return (10 * BIG_AND_NEGATIVE);
-    // return (log(VERY_UNLIKELY)) ;
+  // added to the previous value
+  log_posterior += (gibbs_coef * nbr_prior + log(getPrior(gcap, label)));
+  if (check_finite("GCAvoxelGibbsLogPosterior: final", log_posterior) == 0) {
+    DiagBreak();
   }
 
 // just check
@@ -13082,6 +13965,7 @@ int GCAunifyVariance(GCA *gca)
     }
   }
 
+  GCAbuildGaussianCache(gca);
   return (NO_ERROR);
 }
 
@@ -14226,8 +15110,18 @@ GC1D *GCAfindClosestValidGC(GCA *gca, int x0, int y0, int z0, int label, int che
   int x, y, z, n, wsize;
   double dist, min_dist, det;
   GCA_NODE *gcan;
-  static MATRIX *m_cov_inv = NULL;
+  static MATRIX *m_cov_inv_thread[_MAX_FS_THREADS];
+  MATRIX *m_cov_inv;
+#ifdef HAVE_OPENMP
+  int tid = omp_get_thread_num();
+#else
+  int tid = 0;
+#endif
 
+  if (m_cov_inv_thread[tid] && m_cov_inv_thread[tid]->rows != gca->ninputs) {
+    MatrixFree(&m_cov_inv_thread[tid]);
+  }
+  m_cov_inv = m_cov_inv_thread[tid];
   min_dist = gca->node_width + gca->node_height + gca->node_depth;
   wsize = 1;
   gc_min = NULL;
@@ -14256,7 +15150,7 @@ GC1D *GCAfindClosestValidGC(GCA *gca, int x0, int y0, int z0, int label, int che
             }
             gc = &gcan->gcs[n];
             det = covariance_determinant(gc, gca->ninputs);
-            m_cov_inv = load_inverse_covariance_matrix(gc, m_cov_inv, gca->ninputs);
+            m_cov_inv = m_cov_inv_thread[tid] = load_inverse_covariance_matrix(gc, m_cov_inv, gca->ninputs);
             if (m_cov_inv == NULL) {
               det = -1;
             }
@@ -14814,28 +15708,31 @@ int free_gcs(GC1D *gcs, int nlabels, int ninputs)
 
   for (i = 0; i < nlabels; i++) {
     if (gcs[i].means) {
-      free(gcs[i].means);
+      gcaFree(gcs[i].means);
     }
     if (gcs[i].covars) {
-      free(gcs[i].covars);
+      gcaFree(gcs[i].covars);
+    }
+    if (gcs[i].gauss_cache) {
+      free(gcs[i].gauss_cache);
     }
     if (gcs[i].nlabels) /* gibbs stuff allocated */
     {
       for (j = 0; j < GIBBS_NEIGHBORHOOD; j++) {
         if (gcs[i].labels[j]) {
-          free(gcs[i].labels[j]);
+          gcaFree(gcs[i].labels[j]);
         }
         if (gcs[i].label_priors[j]) {
-          free(gcs[i].label_priors[j]);
+          gcaFree(gcs[i].label_priors[j]);
         }
       }
-      free(gcs[i].nlabels);
-      free(gcs[i].labels);
-      free(gcs[i].label_priors);
+      gcaFree(gcs[i].nlabels);
+      gcaFree(gcs[i].labels);
+      gcaFree(gcs[i].label_priors);
     }
   }
 
-  free(gcs);
+  gcaFree(gcs);
   return (NO_ERROR);
 }
 
@@ -14889,14 +15786,14 @@ int GCAfreeGibbs(GCA *gca)
         for (n = 0; n < gcan->nlabels; n++) {
           gc = &gcan->gcs[n];
           for (i = 0; i < GIBBS_NEIGHBORS; i++) {
-            free(gc->label_priors[i]);
-            free(gc->labels[i]);
+            gcaFree(gc->label_priors[i]);
+            gcaFree(gc->labels[i]);
             gc->label_priors[i] = NULL;
             gc->labels[i] = NULL;
           }
-          free(gc->nlabels);
-          free(gc->labels);
-          free(gc->label_priors);
+          gcaFree(gc->nlabels);
+          gcaFree(gc->labels);
+          gcaFree(gc->label_priors);
           gc->nlabels = NULL;
           gc->labels = NULL;
           gc->label_priors = NULL;
@@ -15021,11 +15918,135 @@ static void load_vals_xyzInt(const MRI *mri_inputs, int x, int y, int z, float *
 }
 #endif
 
-double GCAmahDist(const GC1D *gc, const float *vals, const int ninputs)
+/* the cached inverse covariance of gc if the cache was built from the
+   current covars, NULL otherwise */
+static inline const float *gcaCachedInverseCovariance(const GC1D *gc, int ninputs, int which)
 {
-  static VECTOR *v_means = NULL, *v_vals = NULL;
-  static MATRIX *m_cov = NULL, *m_cov_inv;
+  int i, ncovars = GCA_NCOVARS(ninputs);
+
+  if (gc->gauss_cache == NULL) return (NULL);
+  for (i = 0; i < ncovars; i++)
+    if (gc->gauss_cache[i] != gc->covars[i]) return (NULL);
+  return (gc->gauss_cache + which * ncovars);
+}
+
+/* d' * inv * d for a packed symmetric inv */
+static inline double gcaPackedMahDist(const float *inv, const float *d, const int ninputs)
+{
+  int r, c, i;
+  double dsq = 0;
+
+  for (i = r = 0; r < ninputs; r++) {
+    dsq += inv[i++] * d[r] * d[r];
+    for (c = r + 1; c < ninputs; c++) dsq += 2 * inv[i++] * d[r] * d[c];
+  }
+  return (dsq);
+}
+
+static double gcaCachedMahDist(const float *inv, const GC1D *gc, const float *vals, int ninputs)
+{
+  float d[MAX_GCA_INPUTS];
   int i;
+
+  for (i = 0; i < ninputs; i++) d[i] = vals[i] - gc->means[i];
+  /* constant sizes so that the common cases are unrolled */
+  switch (ninputs) {
+    case 2:
+      return (gcaPackedMahDist(inv, d, 2));
+    case 3:
+      return (gcaPackedMahDist(inv, d, 3));
+    case 4:
+      return (gcaPackedMahDist(inv, d, 4));
+    default:
+      return (gcaPackedMahDist(inv, d, ninputs));
+  }
+}
+
+static void gcaPackMatrix(MATRIX *m, float *packed, int ninputs)
+{
+  int r, c, i;
+
+  for (i = r = 0; r < ninputs; r++)
+    for (c = r; c < ninputs; c++, i++) packed[i] = *MATRIX_RELT(m, r + 1, c + 1);
+}
+
+/* caches the covariance determinant and inverses of one gc; *pm_cov and *pm_inv are scratch */
+static void gcaBuildGaussianCache(GC1D *gc, int ninputs, MATRIX **pm_cov, MATRIX **pm_inv)
+{
+  int ncovars = GCA_NCOVARS(ninputs);
+  float inv[GCA_NCOVARS(MAX_GCA_INPUTS)];
+  MATRIX *m_inv;
+
+  *pm_cov = load_covariance_matrix(gc, *pm_cov, ninputs);
+  m_inv = MatrixInverse(*pm_cov, *pm_inv);
+  if (m_inv) {
+    *pm_inv = m_inv;
+    gcaPackMatrix(m_inv, inv, ninputs);
+    m_inv = MatrixSVDInverse(*pm_cov, m_inv);
+  }
+  if (m_inv == NULL) {
+    /* singular: leave it to the uncached code to complain */
+    if (gc->gauss_cache) free(gc->gauss_cache);
+    gc->gauss_cache = NULL;
+    return;
+  }
+
+  if (gc->gauss_cache == NULL) {
+    gc->gauss_cache = (float *)calloc(3 * ncovars, sizeof(float));
+    if (gc->gauss_cache == NULL) ErrorExit(ERROR_NOMEMORY, "gcaBuildGaussianCache: could not allocate cache");
+  }
+  memmove(gc->gauss_cache, gc->covars, ncovars * sizeof(float));
+  memmove(gc->gauss_cache + GCA_CACHE_INV * ncovars, inv, ncovars * sizeof(float));
+  gcaPackMatrix(m_inv, gc->gauss_cache + GCA_CACHE_SVD_INV * ncovars, ninputs);
+  gc->gauss_det = MatrixDeterminant(*pm_cov);
+}
+
+/*-----------------------------------------------------
+  GCAbuildGaussianCache() - caches the determinant and inverse of
+  the covariance matrix of every class, which covariance_determinant(),
+  GCAmahDist() and load_inverse_covariance_matrix() otherwise compute
+  on every call. A class whose covars have changed since the cache
+  was built falls back to the uncached computation, so the cache
+  only needs to be rebuilt for speed after the covariances change.
+  Not needed for single input atlases.
+  ------------------------------------------------------*/
+int GCAbuildGaussianCache(GCA *gca)
+{
+  int x;
+
+  if (gca->ninputs <= 1) return (NO_ERROR);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (x = 0; x < gca->node_width; x++) {
+    ROMP_PFLB_begin
+    MATRIX *m_cov = NULL, *m_inv = NULL;
+    int y, z, n;
+
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        GCA_NODE *gcan = &gca->nodes[x][y][z];
+        for (n = 0; n < gcan->nlabels; n++) gcaBuildGaussianCache(&gcan->gcs[n], gca->ninputs, &m_cov, &m_inv);
+      }
+    if (m_cov) MatrixFree(&m_cov);
+    if (m_inv) MatrixFree(&m_inv);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (NO_ERROR);
+}
+
+double GCAmahDist(const GC1D *gc, const float *vals, const int ninputs)
+{
+  static VECTOR *v_means_thread[_MAX_FS_THREADS], *v_vals_thread[_MAX_FS_THREADS];
+  static MATRIX *m_cov_thread[_MAX_FS_THREADS], *m_cov_inv_thread[_MAX_FS_THREADS];
+  VECTOR *v_means, *v_vals;
+  MATRIX *m_cov, *m_cov_inv;
+  const float *inv;
+  int i, tid;
   double dsq;
 
   if (ninputs == 1) {
@@ -15034,6 +16055,19 @@ double GCAmahDist(const GC1D *gc, const float *vals, const int ninputs)
     dsq = v * v / gc->covars[0];
     return (dsq);
   }
+  inv = gcaCachedInverseCovariance(gc, ninputs, GCA_CACHE_SVD_INV);
+  if (inv) {
+    return (gcaCachedMahDist(inv, gc, vals, ninputs));
+  }
+#ifdef HAVE_OPENMP
+  tid = omp_get_thread_num();
+#else
+  tid = 0;
+#endif
+  v_means = v_means_thread[tid];
+  v_vals = v_vals_thread[tid];
+  m_cov = m_cov_thread[tid];
+  m_cov_inv = m_cov_inv_thread[tid];
   // printf("In GCAMahDist...ninputs = %d\n", ninputs);
   if (v_vals && ninputs != v_vals->rows) {
     VectorFree(&v_vals);
@@ -15069,6 +16103,10 @@ double GCAmahDist(const GC1D *gc, const float *vals, const int ninputs)
   /* v_means is now inverse(cov) * v_vals */
   dsq = VectorDot(v_vals, v_means);
 
+  v_means_thread[tid] = v_means;
+  v_vals_thread[tid] = v_vals;
+  m_cov_thread[tid] = m_cov;
+  m_cov_inv_thread[tid] = m_cov_inv;
   return (dsq);
 }
 double GCAmahDistIdentityCovariance(GC1D *gc, float *vals, int ninputs)
@@ -15200,12 +16238,28 @@ int set_covariance_matrix(GC1D *gc, MATRIX *m_cov, int ninputs)
 MATRIX *load_inverse_covariance_matrix(GC1D *gc, MATRIX *m_inv_cov, int ninputs)
 {
   static MATRIX *m_cov[_MAX_FS_THREADS] = {NULL};
+  const float *inv;
 #ifdef HAVE_OPENMP
   int tid = omp_get_thread_num();
 #else
   int tid = 0;
 #endif
 
+  inv = ninputs > 1 ? gcaCachedInverseCovariance(gc, ninputs, GCA_CACHE_INV) : NULL;
+  if (inv) {
+    int r, c, i;
+
+    if (m_inv_cov == NULL) {
+      m_inv_cov = MatrixAlloc(ninputs, ninputs, MATRIX_REAL);
+    }
+    for (i = r = 0; r < ninputs; r++)
+      for (c = r; c < ninputs; c++, i++) {
+        *MATRIX_RELT(m_inv_cov, r + 1, c + 1) = inv[i];
+        *MATRIX_RELT(m_inv_cov, c + 1, r + 1) = inv[i];
+      }
+    return (m_inv_cov);
+  }
+
   if (m_cov[tid] && (m_cov[tid]->rows != ninputs || m_cov[tid]->cols != ninputs)) {
     MatrixFree(&m_cov[tid]);
   }
@@ -15229,6 +16283,9 @@ double covariance_determinant(const GC1D *gc, const int ninputs)
   if (ninputs == 1) {
     return (gc->covars[0]);
   }
+  if (gcaCachedInverseCovariance(gc, ninputs, GCA_CACHE_INV)) {
+    return (gc->gauss_det);
+  }
 #ifdef HAVE_OPENMP
   tid = omp_get_thread_num();
 #else
@@ -16108,6 +17165,7 @@ int GCAfixSingularCovarianceMatrices(GCA *gca)
       " matrices regularized\n",
       fixed,
       regularized);
+  GCAbuildGaussianCache(gca);
   return (NO_ERROR);
 }
 int GCAregularizeCovarianceMatrices(GCA *gca, double lambda)
@@ -16201,6 +17259,7 @@ int GCAregularizeCovarianceMatrices(GCA *gca, double lambda)
     }
   }
 
+  GCAbuildGaussianCache(gca);
   return (NO_ERROR);
 }
 int GCAsetFlashParameters(GCA *gca, double *TRs, double *FAs, double *TEs)
@@ -16584,6 +17643,7 @@ int GCAregularizeCovariance(GCA *gca, float regularize)
       }
     }
   }
+  GCAbuildGaussianCache(gca);
   return (NO_ERROR);
 }
 
@@ -22055,7 +23115,7 @@ int GCAfreeRegionalGCAN(GCA_NODE **pgcan)
   gcan = *pgcan;
   *pgcan = NULL;
   free_gcs(gcan->gcs, GCA_NO_MRF, gcan->nlabels);
-  free(gcan->labels);
+  gcaFree(gcan->labels);
   free(gcan);
   return (NO_ERROR);
 }
@@ -22108,8 +23168,8 @@ GCA *GCAcompactify(GCA *gca)
             memmove(gcap->labels, old_labels, n * sizeof(unsigned short));
 
             /* free the old ones */
-            free(old_priors);
-            free(old_labels);
+            gcaFree(old_priors);
+            gcaFree(old_labels);
             gcap->max_labels = gcap->nlabels;
 
             byteSaved += (sizeof(float) + sizeof(unsigned short)) * (nmax - n);
@@ -22152,8 +23212,8 @@ GCA *GCAcompactify(GCA *gca)
             memmove(gcan->labels, old_labels, n * sizeof(unsigned short));
 
             /* free the old ones */
-            free(old_gcs);
-            free(old_labels);
+            gcaFree(old_gcs);
+            gcaFree(old_labels);
             gcan->max_labels = n;
             byteSaved += (sizeof(float) + sizeof(unsigned short)) * (nmax - n);
           }
@@ -25738,7 +26798,7 @@ GCA *GCAsmooth(GCA *gca, double sigma)
           gcan_total->gcs[0].covars[0] = 25;
         }
         if (gcan->max_labels < gcan_total->nlabels) {
-          free(gcan->labels);
+          gcaFree(gcan->labels);
           gcan->labels = (unsigned short *)calloc(gcan_total->nlabels, sizeof(unsigned short));
           if (gcan->labels == NULL)
             ErrorExit(ERROR_NOMEMORY, "GCAsmooth(%2.2f) couldn't allocate %d label node", sigma, gcan_total->nlabels);
@@ -25783,8 +26843,8 @@ GCA *GCAsmooth(GCA *gca, double sigma)
         gcap = &gca_smooth->priors[xp][yp][zp];
         gcap->nlabels = gcap_total->nlabels;
         if (gcap_total->nlabels > gcap->max_labels) {
-          free(gcap->labels);
-          free(gcap->priors);
+          gcaFree(gcap->labels);
+          gcaFree(gcap->priors);
           gcap->labels = (unsigned short *)calloc(gcap->nlabels, sizeof(unsigned short));
           if (!gcap->labels)
             ErrorExit(ERROR_NOMEMORY,
@@ -25870,7 +26930,7 @@ GCA *GCAnodeDownsample2(GCA *gca)
           gcan_total->gcs[0].covars[0] = 25;
         }
         if (gcan->max_labels < gcan_total->nlabels) {
-          free(gcan->labels);
+          gcaFree(gcan->labels);
           gcan->labels = (unsigned short *)calloc(gcan_total->nlabels, sizeof(unsigned short));
           if (gcan->labels == NULL)
             ErrorExit(ERROR_NOMEMORY, "GCAsmooth(%2.2f) couldn't allocate %d label node", sigma, gcan_total->nlabels);
@@ -25915,8 +26975,8 @@ GCA *GCAnodeDownsample2(GCA *gca)
         gcap = &gca_smooth->priors[xp][yp][zp];
         gcap->nlabels = gcap_total->nlabels;
         if (gcap_total->nlabels > gcap->max_labels) {
-          free(gcap->labels);
-          free(gcap->priors);
+          gcaFree(gcap->labels);
+          gcaFree(gcap->priors);
           gcap->labels = (unsigned short *)calloc(gcap->nlabels, sizeof(unsigned short));
           if (!gcap->labels)
             ErrorExit(ERROR_NOMEMORY,
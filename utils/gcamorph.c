@@ -273,6 +273,7 @@ double gcamLSmoothnessEnergy(GCA_MORPH *gcam, MRI *mri);
 
 int gcamSpringTerm(GCA_MORPH *gcam, double l_spring, double ratio_thresh);
 double gcamSpringEnergy(GCA_MORPH *gcam, double ratio_thresh);
+static int gcamCanFuseTerms(const GCA_MORPH_PARMS *parms);
 
 // static int gcamInvalidSpringTerm(GCA_MORPH *gcam, double l_spring) ;
 
@@ -1365,6 +1366,15 @@ GCA_MORPH *GCAMalloc(const int width, const int height, const int depth)
   gcam->depth = depth;
   gcam->spacing = 1;  // may be changed by the user later
 
+  // one block for all of the nodes, so they can also be walked linearly
+  gcam->node_data = (GCA_MORPH_NODE *)calloc((size_t)width * height * depth, sizeof(GCA_MORPH_NODE));
+  if (!gcam->node_data)
+    ErrorExit(ERROR_NOMEMORY,
+              "GCAMalloc(%d, %d, %d): could not allocate %zu bytes for nodes",
+              width,
+              height,
+              depth,
+              (size_t)width * height * depth * sizeof(GCA_MORPH_NODE));
   gcam->nodes = (GCA_MORPH_NODE ***)calloc(width, sizeof(GCA_MORPH_NODE **));
   if (!gcam->nodes) {
     ErrorExit(ERROR_NOMEMORY, "GCAMalloc: could not allocate nodes");
@@ -1376,29 +1386,8 @@ GCA_MORPH *GCAMalloc(const int width, const int height, const int depth)
       ErrorExit(ERROR_NOMEMORY, "GCAMalloc: could not allocate %dth **", x);
     }
 
-#define ELECTRIC_FENCE 0
-#if ELECTRIC_FENCE
-    {
-      GCA_MORPH_NODE *buf;
-
-      buf = (GCA_MORPH_NODE *)calloc(gcam->depth * gcam->height, sizeof(GCA_MORPH_NODE));
-      if (buf == NULL)
-        ErrorExit(ERROR_NO_MEMORY,
-                  "GCAMalloc(%d, %d, %d): could not allocate "
-                  "%d bytes for %dth bslice\n",
-                  height,
-                  width,
-                  depth,
-                  (gcam->depth * gcam->height * sizeof(GCA_MORPH_NODE)),
-                  x);
-      for (y = 0; y < gcam->height; y++) {
-        gcam->nodes[x][y] = buf + (y * gcam->depth);
-      }
-    }
-#else
     for (y = 0; y < gcam->height; y++) {
-      gcam->nodes[x][y] = (GCA_MORPH_NODE *)calloc(gcam->depth, sizeof(GCA_MORPH_NODE));
-      if (!gcam->nodes[x][y]) ErrorExit(ERROR_NOMEMORY, "GCAMalloc: could not allocate %d,%dth *", x, y);
+      gcam->nodes[x][y] = GCAM_NODE(gcam, GCAM_NODE_INDEX(gcam, x, y, 0));
       for (z = 0; z < gcam->depth; z++) {
         gcam->nodes[x][y][z].origx = x;
         gcam->nodes[x][y][z].origy = y;
@@ -1408,7 +1397,6 @@ GCA_MORPH *GCAMalloc(const int width, const int height, const int depth)
         gcam->nodes[x][y][z].z = z;
       }
     }
-#endif
   }
   initVolGeom(&gcam->image);
   initVolGeom(&gcam->atlas);
@@ -1761,25 +1749,23 @@ int GCAMfree(GCA_MORPH **pgcam)
 // the gcam.
 int GCAMfreeContents(GCA_MORPH *gcam)
 {
-  int x, y, z;
+  int x, i;
   GCA_MORPH_NODE *gcamn;
 
   GCAMfreeInverse(gcam);
-  for (x = 0; x < gcam->width; x++) {
-    for (y = 0; y < gcam->height; y++) {
-      for (z = 0; z < gcam->depth; z++) {
-        gcamn = &gcam->nodes[x][y][z];
-        if (gcamn->gc && gcam->gca == NULL)  // don't free the gcs if
-        // they are part of the gca
-        {
-          free_gcs(gcamn->gc, 1, gcam->ninputs);
-        }
-      }
-      free(gcam->nodes[x][y]);
+  for (i = 0; i < GCAM_NNODES(gcam); i++) {
+    gcamn = GCAM_NODE(gcam, i);
+    if (gcamn->gc && gcam->gca == NULL)  // don't free the gcs if
+    // they are part of the gca
+    {
+      free_gcs(gcamn->gc, 1, gcam->ninputs);
     }
+  }
+  for (x = 0; x < gcam->width; x++) {
     free(gcam->nodes[x]);
   }
   free(gcam->nodes);
+  free(gcam->node_data);
   return (NO_ERROR);
 }
 
@@ -1961,6 +1947,142 @@ static int different_neighbor_labels(struct different_neighbor_labels_context *
 
 #define GCAM_LLT_OUTPUT 0
 
+/*
+  the log-likelihood gradient at one node, added to gcamn->dx,dy,dz.
+  m_delI, m_inv_cov, v_means, v_grad and vals are scratch space for
+  the calling thread
+*/
+static void gcamLogLikelihoodTermAtNode(GCA_MORPH *gcam,
+                                        const MRI *mri,
+                                        const MRI *mri_smooth,
+                                        double l_log_likelihood,
+                                        int x,
+                                        int y,
+                                        int z,
+                                        struct different_neighbor_labels_context *ctx,
+                                        float *vals,
+                                        MATRIX *m_delI,
+                                        MATRIX *m_inv_cov,
+                                        VECTOR *v_means,
+                                        VECTOR *v_grad)
+{
+  int n;
+  double dx = 0.0, dy = 0.0, dz = 0.0, norm;
+  GCA_MORPH_NODE *gcamn;
+
+  if (x == Gx && y == Gy && z == Gz) DiagBreak();
+
+  gcamn = &gcam->nodes[x][y][z];
+
+  if (gcamn->invalid == GCAM_POSITION_INVALID) return;
+
+  if (fabs(gcamn->x - Gvx) < 1 && fabs(gcamn->y - Gvy) < 1 && fabs(gcamn->z - Gvz) < 1) DiagBreak();
+
+  if (gcamn->status & (GCAM_IGNORE_LIKELIHOOD | GCAM_NEVER_USE_LIKELIHOOD)) return;
+
+  /* don't use unkown nodes unless they border
+     something that's not unknown */
+  if (IS_UNKNOWN(gcamn->label) && different_neighbor_labels(ctx, gcamn->label, gcam, x, y, z) == 0) return;
+
+  load_vals(mri, gcamn->x, gcamn->y, gcamn->z, vals, gcam->ninputs);
+
+  if (!gcamn->gc) {
+    MatrixClear(v_means);
+    MatrixIdentity(gcam->ninputs, m_inv_cov);
+    MatrixScalarMul(m_inv_cov, 1.0 / (MIN_VAR), m_inv_cov); /* variance=4 is min */
+  }
+  else {
+#if 0
+    if (parms->relabel)
+    {
+      label =
+        GCAcomputeMAPlabelAtLocation
+        (gcam->gca, x,y,z,vals,&n,&gcamn->log_p);
+      if (label == gcamn->label)  /* already correct label -
+                                     don't move anywhere */
+      {
+        continue ;
+      }
+    }
+#endif
+    load_mean_vector(gcamn->gc, v_means, gcam->ninputs);
+    load_inverse_covariance_matrix(gcamn->gc, m_inv_cov, gcam->ninputs);
+  }
+
+  for (n = 0; n < gcam->ninputs; n++) {
+    MRIsampleVolumeGradientFrame(mri_smooth, gcamn->x, gcamn->y, gcamn->z, &dx, &dy, &dz, n);
+    norm = sqrt(dx * dx + dy * dy + dz * dz);
+    if (!FZERO(norm)) /* don't worry about magnitude of gradient */
+    {
+      dx /= norm;
+      dy /= norm;
+      dz /= norm;
+    }
+    *MATRIX_RELT(m_delI, 1, n + 1) = dx;
+    *MATRIX_RELT(m_delI, 2, n + 1) = dy;
+    *MATRIX_RELT(m_delI, 3, n + 1) = dz;
+    VECTOR_ELT(v_means, n + 1) -= vals[n];
+#define MAX_ERROR 1000
+    if (fabs(VECTOR_ELT(v_means, n + 1)) > MAX_ERROR)
+      VECTOR_ELT(v_means, n + 1) = MAX_ERROR * FSIGN(VECTOR_ELT(v_means, n + 1));
+  }
+
+  MatrixMultiply(m_inv_cov, v_means, v_means);
+
+  if (IS_UNKNOWN(gcamn->label)) {
+    if (zero_vals(vals, gcam->ninputs)) {
+      if (Gx == x && Gy == y && Gz == z)
+        printf(
+            "discounting unknown label at (%d, %d, %d) "
+            "due to skull strip difference\n",
+            x,
+            y,
+            z);
+      /* probably difference in skull stripping (vessels present or
+         absent) - don't let it dominate */
+      if (VECTOR_ELT(v_means, 1) > .5) /* don't let it be more
+                                          than 1/2 stds away */
+      {
+        VECTOR_ELT(v_means, 1) = .5;
+      }
+    }
+#if 0
+    else if (VECTOR_ELT(v_means,1) > 2)  /* don't let it be more
+                                         than 2 stds away */
+    {
+      VECTOR_ELT(v_means,1) = 2 ;
+    }
+#endif
+  }
+  MatrixMultiply(m_delI, v_means, v_grad);
+
+  gcamn->dx += l_log_likelihood * V3_X(v_grad);
+  gcamn->dy += l_log_likelihood * V3_Y(v_grad);
+  gcamn->dz += l_log_likelihood * V3_Z(v_grad);
+
+  if (x == Gx && y == Gy && z == Gz) {
+    printf(
+        "ll_like: node(%d,%d,%d)-->vox(%2.0f,%2.0f,%2.0F): dI=(%2.1f,%2.1f,%2.1f), "
+        "grad=(%2.2f,%2.2f,%2.2f), "
+        "node %2.2f+-%2.2f, MRI=%2.1f\n",
+        x,
+        y,
+        z,
+        dx,
+        dy,
+        dz,
+        gcamn->x,
+        gcamn->y,
+        gcamn->z,
+        gcamn->dx,
+        gcamn->dy,
+        gcamn->dz,
+        gcamn->gc ? gcamn->gc->means[0] : 0.0,
+        gcamn->gc ? sqrt(covariance_determinant(gcamn->gc, gcam->ninputs)) : 0.0,
+        vals[0]);
+  }
+}
+
 int gcamLogLikelihoodTerm(GCA_MORPH *gcam, const MRI *mri, const MRI *mri_smooth, double l_log_likelihood)
 {
 #ifdef GCAM_LL_TERM_GPU
@@ -1971,12 +2093,10 @@ int gcamLogLikelihoodTerm(GCA_MORPH *gcam, const MRI *mri, const MRI *mri_smooth
   printf("%s: On GPU\n", __FUNCTION__);
   gcamLogLikelihoodTermGPU(gcam, mri, mri_smooth, l_log_likelihood);
 #else
-  int x = 0, y = 0, z = 0, n = 0 /*,label*/;
+  int x = 0, y = 0, z = 0;
   int i;
   int nthreads = 1, tid = 0;
-  double dx = 0.0, dy = 0.0, dz = 0.0, norm = 0.0;
   float vals[_MAX_FS_THREADS][MAX_GCA_INPUTS];
-  GCA_MORPH_NODE *gcamn = NULL;
   MATRIX *m_delI[_MAX_FS_THREADS], *m_inv_cov[_MAX_FS_THREADS];
   VECTOR *v_means[_MAX_FS_THREADS], *v_grad[_MAX_FS_THREADS];
 
@@ -2023,7 +2143,7 @@ int gcamLogLikelihoodTerm(GCA_MORPH *gcam, const MRI *mri, const MRI *mri_smooth
   
   ROMP_PF_begin
 #ifdef HAVE_OPENMP
-  #pragma omp parallel for if_ROMP(assume_reproducible) firstprivate(tid, y, z, gcamn, n, norm, dx, dy, dz, vals, m_delI, m_inv_cov, v_means, v_grad) \
+  #pragma omp parallel for if_ROMP(assume_reproducible) firstprivate(tid, y, z, vals, m_delI, m_inv_cov, v_means, v_grad) \
     shared(gcam, mri, Gx, Gy, Gz, Gvx, Gvy, Gvz) schedule(static, 1)
 #endif
 
@@ -2038,117 +2158,19 @@ int gcamLogLikelihoodTerm(GCA_MORPH *gcam, const MRI *mri, const MRI *mri_smooth
       struct different_neighbor_labels_context different_neighbor_labels_context;
       init_different_neighbor_labels_context(&different_neighbor_labels_context,gcam,x,y);
       for (z = 0; z < gcam->depth; z++) {
-        if (x == Gx && y == Gy && z == Gz) DiagBreak();
-
-        gcamn = &gcam->nodes[x][y][z];
-
-        if (gcamn->invalid == GCAM_POSITION_INVALID) continue;
-
-        if (fabs(gcamn->x - Gvx) < 1 && fabs(gcamn->y - Gvy) < 1 && fabs(gcamn->z - Gvz) < 1) DiagBreak();
-
-        if (gcamn->status & (GCAM_IGNORE_LIKELIHOOD | GCAM_NEVER_USE_LIKELIHOOD)) continue;
-
-        /* don't use unkown nodes unless they border
-           something that's not unknown */
-        if (IS_UNKNOWN(gcamn->label) && different_neighbor_labels(&different_neighbor_labels_context, gcamn->label, gcam, x, y, z) == 0) continue;
-
-        load_vals(mri, gcamn->x, gcamn->y, gcamn->z, vals[tid], gcam->ninputs);
-
-        if (!gcamn->gc) {
-          MatrixClear(v_means[tid]);
-          MatrixIdentity(gcam->ninputs, m_inv_cov[tid]);
-          MatrixScalarMul(m_inv_cov[tid], 1.0 / (MIN_VAR), m_inv_cov[tid]); /* variance=4 is min */
-        }
-        else {
-#if 0
-          if (parms->relabel)
-          {
-            label =
-              GCAcomputeMAPlabelAtLocation
-              (gcam->gca, x,y,z,vals,&n,&gcamn->log_p);
-            if (label == gcamn->label)  /* already correct label -
-                                           don't move anywhere */
-            {
-              continue ;
-            }
-          }
-#endif
-          load_mean_vector(gcamn->gc, v_means[tid], gcam->ninputs);
-          load_inverse_covariance_matrix(gcamn->gc, m_inv_cov[tid], gcam->ninputs);
-        }
-
-        for (n = 0; n < gcam->ninputs; n++) {
-          MRIsampleVolumeGradientFrame(mri_smooth, gcamn->x, gcamn->y, gcamn->z, &dx, &dy, &dz, n);
-          norm = sqrt(dx * dx + dy * dy + dz * dz);
-          if (!FZERO(norm)) /* don't worry about magnitude of gradient */
-          {
-            dx /= norm;
-            dy /= norm;
-            dz /= norm;
-          }
-          *MATRIX_RELT(m_delI[tid], 1, n + 1) = dx;
-          *MATRIX_RELT(m_delI[tid], 2, n + 1) = dy;
-          *MATRIX_RELT(m_delI[tid], 3, n + 1) = dz;
-          VECTOR_ELT(v_means[tid], n + 1) -= vals[tid][n];
-#define MAX_ERROR 1000
-          if (fabs(VECTOR_ELT(v_means[tid], n + 1)) > MAX_ERROR)
-            VECTOR_ELT(v_means[tid], n + 1) = MAX_ERROR * FSIGN(VECTOR_ELT(v_means[tid], n + 1));
-        }
-
-        MatrixMultiply(m_inv_cov[tid], v_means[tid], v_means[tid]);
-
-        if (IS_UNKNOWN(gcamn->label)) {
-          if (zero_vals(vals[tid], gcam->ninputs)) {
-            if (Gx == x && Gy == y && Gz == z)
-              printf(
-                  "discounting unknown label at (%d, %d, %d) "
-                  "due to skull strip difference\n",
-                  x,
-                  y,
-                  z);
-            /* probably difference in skull stripping (vessels present or
-               absent) - don't let it dominate */
-            if (VECTOR_ELT(v_means[tid], 1) > .5) /* don't let it be more
-                                                than 1/2 stds away */
-            {
-              VECTOR_ELT(v_means[tid], 1) = .5;
-            }
-          }
-#if 0
-          else if (VECTOR_ELT(v_means,1) > 2)  /* don't let it be more
-                                               than 2 stds away */
-          {
-            VECTOR_ELT(v_means,1) = 2 ;
-          }
-#endif
-        }
-        MatrixMultiply(m_delI[tid], v_means[tid], v_grad[tid]);
-
-        gcamn->dx += l_log_likelihood * V3_X(v_grad[tid]);
-        gcamn->dy += l_log_likelihood * V3_Y(v_grad[tid]);
-        gcamn->dz += l_log_likelihood * V3_Z(v_grad[tid]);
-
-        if (x == Gx && y == Gy && z == Gz) {
-          printf(
-              "ll_like: node(%d,%d,%d)-->vox(%2.0f,%2.0f,%2.0F): dI=(%2.1f,%2.1f,%2.1f), "
-              "grad=(%2.2f,%2.2f,%2.2f), "
-              "node %2.2f+-%2.2f, MRI=%2.1f\n",
-              x,
-              y,
-              z,
-              dx,
-              dy,
-              dz,
-              gcamn->x,
-              gcamn->y,
-              gcamn->z,
-              gcamn->dx,
-              gcamn->dy,
-              gcamn->dz,
-              gcamn->gc ? gcamn->gc->means[0] : 0.0,
-              gcamn->gc ? sqrt(covariance_determinant(gcamn->gc, gcam->ninputs)) : 0.0,
-              vals[tid][0]);
-        }
+        gcamLogLikelihoodTermAtNode(gcam,
+                                    mri,
+                                    mri_smooth,
+                                    l_log_likelihood,
+                                    x,
+                                    y,
+                                    z,
+                                    &different_neighbor_labels_context,
+                                    vals[tid],
+                                    m_delI[tid],
+                                    m_inv_cov[tid],
+                                    v_means[tid],
+                                    v_grad[tid]);
       }
     }
     ROMP_PFLB_end
@@ -2277,6 +2299,100 @@ static float ***last_sse = NULL;
 
 #define GCAM_LLENERGY_OUTPUT 0
 
+/*
+  whether the node at (x,y,z) contributes to the log-likelihood energy,
+  which does not depend on where it is
+*/
+static int gcamLogLikelihoodNodeUsed(const GCA_MORPH *gcam, int x, int y, int z, struct different_neighbor_labels_context *ctx)
+{
+  const GCA_MORPH_NODE *gcamn = &gcam->nodes[x][y][z];
+
+  // Don't operate on invalid nodes
+  if (gcamn->invalid == GCAM_POSITION_INVALID) {
+    return (0);
+  }
+  check_gcam(gcam);
+
+  // Check for ignore
+  if (gcamn->status & (GCAM_IGNORE_LIKELIHOOD | GCAM_NEVER_USE_LIKELIHOOD)) {
+    return (0);
+  }
+
+  /* don't use unkown nodes unless they border
+     something that's not unknown */
+  if (IS_UNKNOWN(gcamn->label) && (different_neighbor_labels(ctx, gcamn->label, gcam, x, y, z) == 0)) {
+    return (0);
+  }
+  return (1);
+}
+
+/*
+  the log-likelihood error of gcamn if it were at (px,py,pz), with the
+  image values there left in vals
+*/
+static double gcamLogLikelihoodError(
+    const GCA_MORPH *gcam, MRI *mri, const GCA_MORPH_NODE *gcamn, float px, float py, float pz, float *vals)
+{
+  double error;
+  int n;
+
+  // Load up the MRI values (which will do trilinear interpolation)
+  load_vals(mri, px, py, pz, vals, gcam->ninputs);
+
+  // Compute 'error' for this node
+  if (gcamn->gc) {
+    return (GCAmahDist(gcamn->gc, vals, gcam->ninputs) + log(covariance_determinant(gcamn->gc, gcam->ninputs)));
+  }
+  // Note that the for loop sets error=0 on the first iteration
+  for (n = 0, error = 0.0; n < gcam->ninputs; n++) {
+    error += (vals[n] * vals[n] / MIN_VAR);
+  }
+  return (error);
+}
+
+/*
+  the log-likelihood error at one node in *perror. Returns 0 if the node
+  does not contribute to the energy
+*/
+static int gcamLogLikelihoodEnergyAtNode(
+    const GCA_MORPH *gcam, MRI *mri, int x, int y, int z, struct different_neighbor_labels_context *ctx, double *perror)
+{
+  float vals[MAX_GCA_INPUTS];
+
+  // Debugging breakpoint
+  if (x == Gx && y == Gy && z == Gz) {
+    DiagBreak();
+  }
+
+  // Shorthand way of accessing current node
+  const GCA_MORPH_NODE * /* const */ gcamn = &gcam->nodes[x][y][z];
+
+  if (!gcamLogLikelihoodNodeUsed(gcam, x, y, z, ctx)) {
+    return (0);
+  }
+
+  check_gcam(gcam);
+  *perror = gcamLogLikelihoodError(gcam, mri, gcamn, gcamn->x, gcamn->y, gcamn->z, vals);
+  check_gcam(gcam);
+
+  // Random output
+  if (x == Gx && y == Gy && z == Gz)
+    printf(
+        "E_like: node(%d,%d,%d) -> "
+        "(%2.1f,%2.1f,%2.1f), target=%2.1f+-%2.1f, val=%2.1f\n",
+        x,
+        y,
+        z,
+        gcamn->x,
+        gcamn->y,
+        gcamn->z,
+        gcamn->gc ? gcamn->gc->means[0] : 0.0,
+        gcamn->gc ? sqrt(covariance_determinant(gcamn->gc, gcam->ninputs)) : 0.0,
+        vals[0]);
+
+  return (1);
+}
+
 double gcamLogLikelihoodEnergy(const GCA_MORPH *gcam, MRI *mri)
 {
 /*
@@ -2372,71 +2488,14 @@ double gcamLogLikelihoodEnergy(const GCA_MORPH *gcam, MRI *mri)
     for (y = 0; y < gcam->height; y++) {
       struct different_neighbor_labels_context different_neighbor_labels_context;
       init_different_neighbor_labels_context(&different_neighbor_labels_context,gcam,x,y);
-      float vals[MAX_GCA_INPUTS];
       int z;
       for (z = 0; z < gcam->depth; z++) {
-        // Debugging breakpoint
-        if (x == Gx && y == Gy && z == Gz) {
-          DiagBreak();
-        }
-
-        // Shorthand way of accessing current node
-        const GCA_MORPH_NODE * /* const */ gcamn = &gcam->nodes[x][y][z];
-
-        // Don't operate on invalid nodes
-        if (gcamn->invalid == GCAM_POSITION_INVALID) {
-          continue;
-        }
-        check_gcam(gcam);
-
-        // Check for ignore
-        if (gcamn->status & (GCAM_IGNORE_LIKELIHOOD | GCAM_NEVER_USE_LIKELIHOOD)) {
-          continue;
-        }
-
-        /* don't use unkown nodes unless they border
-           something that's not unknown */
-        if (IS_UNKNOWN(gcamn->label) && (different_neighbor_labels(&different_neighbor_labels_context, gcamn->label, gcam, x, y, z) == 0)) {
-          continue;
-        }
-
-        check_gcam(gcam);
-
-        // Load up the MRI values (which will do trilinear interpolation)
-        load_vals(mri, gcamn->x, gcamn->y, gcamn->z, vals, gcam->ninputs);
-        check_gcam(gcam);
-
-        // Compute 'error' for this node
         double error;
-        if (gcamn->gc) {
-          error = GCAmahDist(gcamn->gc, vals, gcam->ninputs) + log(covariance_determinant(gcamn->gc, gcam->ninputs));
-        }
-        else {
-          int n;
-          // Note that the for loop sets error=0 on the first iteration
-          for (n = 0, error = 0.0; n < gcam->ninputs; n++) {
-            error += (vals[n] * vals[n] / MIN_VAR);
-          }
+        if (!gcamLogLikelihoodEnergyAtNode(gcam, mri, x, y, z, &different_neighbor_labels_context, &error)) {
+          continue;
         }
 
         check_gcam(gcam);
-
-        // Random output
-        if (x == Gx && y == Gy && z == Gz)
-          printf(
-              "E_like: node(%d,%d,%d) -> "
-              "(%2.1f,%2.1f,%2.1f), target=%2.1f+-%2.1f, val=%2.1f\n",
-              x,
-              y,
-              z,
-              gcamn->x,
-              gcamn->y,
-              gcamn->z,
-              gcamn->gc ? gcamn->gc->means[0] : 0.0,
-              gcamn->gc ? sqrt(covariance_determinant(gcamn->gc, gcam->ninputs)) : 0.0,
-              vals[0]);
-
-        check_gcam(gcam);
 #if DEBUG_LL_SSE
         if (last_sse[x][y][z] < (.9 * error) && !FZERO(last_sse[x][y][z])) {
           DiagBreak();
@@ -4148,6 +4207,87 @@ int gcamComputeMetricProperties(GCA_MORPH *gcam)
 
 #define GCAM_JACOBENERGY_OUTPUT 0
 
+/*
+  add the Jacobian error at node (i,j,k) to *psse, if its areas were
+  area1 and area2
+*/
+static void gcamJacobianEnergyOfAreas(
+    const GCA_MORPH *gcam, int i, int j, int k, float area1, float area2, double thick, double *psse)
+{
+  GCA_MORPH_NODE const * const gcamn = &gcam->nodes[i][j][k];
+
+  if (gcamn->invalid) {
+    return;
+  }
+
+  /* scale up the area coefficient if the area of the current node is
+    close to 0 or already negative */
+
+  if (!FZERO(gcamn->orig_area1)) {
+    double const ratio = area1 / gcamn->orig_area1;
+    double const exponent = -gcam->exp_k * ratio;
+
+    double delta;
+    if (exponent > MAX_EXP) {
+      delta = 0.0;
+    }
+    else {
+      delta = log(1 + exp(exponent)) /*   / gcam->exp_k */;
+    }
+
+    *psse += delta * thick;
+
+    if (!finitep(delta) || !finitep(*psse)) {
+      DiagBreak();
+    }
+
+    if (i == Gx && j == Gy && k == Gz) {
+      printf("E_jaco: node(%d,%d,%d): area1=%2.4f, error=%2.3f\n", i, j, k, area1, delta);
+    }
+
+    if (!FZERO(delta)) {
+      DiagBreak();
+    }
+  }
+
+  if (!FZERO(gcamn->orig_area2)) {
+    double const ratio = area2 / gcamn->orig_area2;
+    double const exponent = -gcam->exp_k * ratio;
+
+    double delta;
+    if (exponent > MAX_EXP) {
+      delta = MAX_EXP;
+    }
+    else {
+      delta = log(1 + exp(exponent)) /*   / gcam->exp_k */;
+    }
+
+    *psse += delta * thick;
+
+    if (!finitep(delta) || !finitep(*psse)) {
+      DiagBreak();
+    }
+
+    if (i == Gx && j == Gy && k == Gz) {
+      printf("E_jaco: node(%d,%d,%d): area2=%2.4f, error=%2.3f\n", i, j, k, area2, delta);
+    }
+
+    if (!FZERO(delta)) {
+      DiagBreak();
+    }
+  }
+}
+
+/*
+  add the Jacobian error at node (i,j,k) to *psse
+*/
+static void gcamJacobianEnergyAtNode(const GCA_MORPH *gcam, int i, int j, int k, double thick, double *psse)
+{
+  GCA_MORPH_NODE const * const gcamn = &gcam->nodes[i][j][k];
+
+  gcamJacobianEnergyOfAreas(gcam, i, j, k, gcamn->area1, gcamn->area2, thick, psse);
+}
+
 double gcamJacobianEnergy(const GCA_MORPH * const gcam, MRI *mri)
 {
   double sse = 0;
@@ -4220,68 +4360,7 @@ double gcamJacobianEnergy(const GCA_MORPH * const gcam, MRI *mri)
     
     for (j = 0; j < height; j++) {
       for (k = 0; k < depth; k++) {
-        GCA_MORPH_NODE const * const gcamn = &gcam->nodes[i][j][k];
-
-        if (gcamn->invalid) {
-          continue;
-        }
-
-        /* scale up the area coefficient if the area of the current node is
-          close to 0 or already negative */
-
-        if (!FZERO(gcamn->orig_area1)) {
-          double const ratio = gcamn->area1 / gcamn->orig_area1;
-          double const exponent = -gcam->exp_k * ratio;
-
-          double delta;
-          if (exponent > MAX_EXP) {
-            delta = 0.0;
-          }
-          else {
-            delta = log(1 + exp(exponent)) /*   / gcam->exp_k */;
-          }
-
-          sse += delta * thick;
-
-          if (!finitep(delta) || !finitep(sse)) {
-            DiagBreak();
-          }
-
-          if (i == Gx && j == Gy && k == Gz) {
-            printf("E_jaco: node(%d,%d,%d): area1=%2.4f, error=%2.3f\n", i, j, k, gcamn->area1, delta);
-          }
-
-          if (!FZERO(delta)) {
-            DiagBreak();
-          }
-        }
-
-        if (!FZERO(gcamn->orig_area2)) {
-          double const ratio = gcamn->area2 / gcamn->orig_area2;
-          double const exponent = -gcam->exp_k * ratio;
-
-          double delta;
-          if (exponent > MAX_EXP) {
-            delta = MAX_EXP;
-          }
-          else {
-            delta = log(1 + exp(exponent)) /*   / gcam->exp_k */;
-          }
-
-          sse += delta * thick;
-
-          if (!finitep(delta) || !finitep(sse)) {
-            DiagBreak();
-          }
-
-          if (i == Gx && j == Gy && k == Gz) {
-            printf("E_jaco: node(%d,%d,%d): area2=%2.4f, error=%2.3f\n", i, j, k, gcamn->area2, delta);
-          }
-
-          if (!FZERO(delta)) {
-            DiagBreak();
-          }
-        }
+        gcamJacobianEnergyAtNode(gcam, i, j, k, thick, &sse);
       }
     }
 #ifdef BEVIN_GCAMJACOBIANENERGY_REPRODUCIBLE
@@ -6185,6 +6264,7 @@ double gcamComputeSSE(GCA_MORPH *gcam, MRI *mri, GCA_MORPH_PARMS *parms)
   double ms_sse, l_sse, s_sse, ls_sse, j_sse, d_sse, a_sse;
   double nvox, label_sse, map_sse, dtrans_sse;
   double binary_sse, area_intensity_sse, spring_sse, exp_sse;
+  double ll_energy = 0.0, s_energy = 0.0, j_energy = 0.0;
 
   if (!DZERO(parms->l_area_intensity)) {
     parms->nlt = gcamCreateNodeLookupTable(gcam, parms->mri, parms->nlt);
@@ -6197,8 +6277,15 @@ double gcamComputeSSE(GCA_MORPH *gcam, MRI *mri, GCA_MORPH_PARMS *parms)
   check_gcam(gcam);
   gcamComputeMetricProperties(gcam);
   check_gcam(gcam);
+  if (gcam_fused_terms)
+    gcamFusedEnergies(gcam,
+                      mri,
+                      !DZERO(parms->l_log_likelihood) || !DZERO(parms->l_likelihood) ? &ll_energy : NULL,
+                      !DZERO(parms->l_smoothness) ? &s_energy : NULL,
+                      !DZERO(parms->l_jacobian) ? &j_energy : NULL);
   if (!DZERO(parms->l_log_likelihood) || !DZERO(parms->l_likelihood))
-    l_sse = MAX(parms->l_log_likelihood, parms->l_likelihood) * gcamLogLikelihoodEnergy(gcam, mri);
+    l_sse = MAX(parms->l_log_likelihood, parms->l_likelihood) *
+            (gcam_fused_terms ? ll_energy : gcamLogLikelihoodEnergy(gcam, mri));
   if (!DZERO(parms->l_multiscale)) {
     ms_sse = parms->l_multiscale * gcamMultiscaleEnergy(gcam, mri);
   }
@@ -6225,7 +6312,7 @@ double gcamComputeSSE(GCA_MORPH *gcam, MRI *mri, GCA_MORPH_PARMS *parms)
     d_sse = parms->l_distance * gcamDistanceEnergy(gcam, mri);
   }
   if (!DZERO(parms->l_jacobian)) {
-    j_sse = parms->l_jacobian * gcamJacobianEnergy(gcam, mri);
+    j_sse = parms->l_jacobian * (gcam_fused_terms ? j_energy : gcamJacobianEnergy(gcam, mri));
   }
   if (!DZERO(parms->l_area)) {
     a_sse = parms->l_area * gcamAreaEnergy(gcam);
@@ -6234,7 +6321,7 @@ double gcamComputeSSE(GCA_MORPH *gcam, MRI *mri, GCA_MORPH_PARMS *parms)
     a_sse = parms->l_area_smoothness * gcamAreaEnergy(gcam);
   }
   if (!DZERO(parms->l_smoothness)) {
-    s_sse = parms->l_smoothness * gcamSmoothnessEnergy(gcam, mri);
+    s_sse = parms->l_smoothness * (gcam_fused_terms ? s_energy : gcamSmoothnessEnergy(gcam, mri));
   }
   if (!DZERO(parms->l_lsmoothness)) {
     ls_sse = parms->l_lsmoothness * gcamLSmoothnessEnergy(gcam, mri);
@@ -6312,18 +6399,23 @@ int gcamComputeGradient(GCA_MORPH *gcam, MRI *mri, MRI *mri_smooth, GCA_MORPH_PA
   gcamExpansionTerm(gcam, mri, parms->l_expansion);
   gcamLikelihoodTerm(gcam, mri, mri_smooth, parms->l_likelihood, parms);
   gcamDistanceTransformTerm(gcam, mri, parms->mri_dist_map, parms->l_dtrans, parms);
-  gcamLogLikelihoodTerm(gcam, mri, mri_smooth, parms->l_log_likelihood);
-  gcamMultiscaleTerm(gcam, mri, mri_smooth, parms->l_multiscale);
-  gcamDistanceTerm(gcam, mri, parms->l_distance);
-  gcamElasticTerm(gcam, parms);
-  gcamAreaSmoothnessTerm(gcam, mri_smooth, parms->l_area_smoothness);
-  gcamAreaTerm(gcam, parms->l_area);
-  gcamSmoothnessTerm(gcam, mri, parms->l_smoothness);
-  gcamLSmoothnessTerm(gcam, mri, parms->l_lsmoothness);
-  gcamSpringTerm(gcam, parms->l_spring, parms->ratio_thresh);
-  //  gcamInvalidSpringTerm(gcam, 1.0)  ;
-  //
-  gcamJacobianTerm(gcam, mri, parms->l_jacobian, parms->ratio_thresh);
+  if (gcam_fused_terms && gcamCanFuseTerms(parms)) {
+    gcamFusedTerms(gcam, mri, mri_smooth, parms);
+  }
+  else {
+    gcamLogLikelihoodTerm(gcam, mri, mri_smooth, parms->l_log_likelihood);
+    gcamMultiscaleTerm(gcam, mri, mri_smooth, parms->l_multiscale);
+    gcamDistanceTerm(gcam, mri, parms->l_distance);
+    gcamElasticTerm(gcam, parms);
+    gcamAreaSmoothnessTerm(gcam, mri_smooth, parms->l_area_smoothness);
+    gcamAreaTerm(gcam, parms->l_area);
+    gcamSmoothnessTerm(gcam, mri, parms->l_smoothness);
+    gcamLSmoothnessTerm(gcam, mri, parms->l_lsmoothness);
+    gcamSpringTerm(gcam, parms->l_spring, parms->ratio_thresh);
+    //  gcamInvalidSpringTerm(gcam, 1.0)  ;
+    //
+    gcamJacobianTerm(gcam, mri, parms->l_jacobian, parms->ratio_thresh);
+  }
   // The following appears to be a null operation, based on current #ifdefs
   gcamLimitGradientMagnitude(gcam, parms, mri);
 
@@ -6582,125 +6674,129 @@ int gcamLimitGradientMagnitude(GCA_MORPH *gcam, GCA_MORPH_PARMS *parms, MRI *mri
   return (NO_ERROR);
 }
 
-int gcamSmoothnessTerm(GCA_MORPH *gcam, const MRI *mri, const double l_smoothness)
+/*
+  the smoothness gradient at node (x,y,z), added to gcamn->dx,dy,dz
+*/
+static void gcamSmoothnessTermAtNode(GCA_MORPH *gcam, int x, int y, int z, double l_smoothness)
 {
-#ifdef GCAM_SMOOTH_TERM_GPU
-  printf("%s: On GPU\n", __FUNCTION__);
-  gcamSmoothnessTermGPU(gcam, l_smoothness);
-#else
-  double vx = 0.0, vy = 0.0, vz = 0.0, vnx = 0.0, vny = 0.0, vnz = 0.0;
-  double dx = 0.0, dy = 0.0, dz = 0.0;
-  int x = 0, y = 0, z = 0, xk = 0, yk = 0, zk = 0, xn = 0, yn = 0, zn = 0;
-  int width, height, depth, num = 0;
-  GCA_MORPH_NODE *gcamn = NULL, *gcamn_nbr = NULL;
+  double vx, vy, vz, vnx, vny, vnz, dx, dy, dz;
+  int xk, yk, zk, xn, yn, zn, num;
+  int width = gcam->width, height = gcam->height, depth = gcam->depth;
+  GCA_MORPH_NODE *gcamn, *gcamn_nbr;
 
-  if (DZERO(l_smoothness)) {
-    return (NO_ERROR);
+  if (x == Gx && y == Gy && z == Gz) {
+    DiagBreak();
   }
-  width = gcam->width;
-  height = gcam->height;
-  depth = gcam->depth;
-  ROMP_PF_begin
-#ifdef HAVE_OPENMP
-  #pragma omp parallel for if_ROMP(assume_reproducible) firstprivate(                                                          \
-    y, z, gcamn, vx, vy, vz, dx, dy, dz, num, xk, xn, yk, yn, zk, zn, gcamn_nbr, vnx, vny, vnz) \
-    shared(gcam, Gx, Gy, Gz) schedule(static, 1)
-#endif
-  for (x = 0; x < gcam->width; x++) {
-    ROMP_PFLB_begin
-    
-    for (y = 0; y < gcam->height; y++) {
-      for (z = 0; z < gcam->depth; z++) {
-        if (x == Gx && y == Gy && z == Gz) {
-          DiagBreak();
-        }
-        gcamn = &gcam->nodes[x][y][z];
+  gcamn = &gcam->nodes[x][y][z];
 
-        if (gcamn->invalid == GCAM_POSITION_INVALID) {
-          continue;
-        }
+  if (gcamn->invalid == GCAM_POSITION_INVALID) {
+    return;
+  }
 
-        vx = gcamn->x - gcamn->origx;
-        vy = gcamn->y - gcamn->origy;
-        vz = gcamn->z - gcamn->origz;
-        dx = dy = dz = 0.0f;
-        if (x == Gx && y == Gy && z == Gz)
-          printf("l_smoo: node(%d,%d,%d): V=(%2.2f,%2.2f,%2.2f)\n", x, y, z, vx, vy, vz);
-        num = 0;
+  vx = gcamn->x - gcamn->origx;
+  vy = gcamn->y - gcamn->origy;
+  vz = gcamn->z - gcamn->origz;
+  dx = dy = dz = 0.0f;
+  if (x == Gx && y == Gy && z == Gz)
+    printf("l_smoo: node(%d,%d,%d): V=(%2.2f,%2.2f,%2.2f)\n", x, y, z, vx, vy, vz);
+  num = 0;
 
-        for (xk = -1; xk <= 1; xk++) {
-          xn = x + xk;
-          xn = MAX(0, xn);
-          xn = MIN(width - 1, xn);
+  for (xk = -1; xk <= 1; xk++) {
+    xn = x + xk;
+    xn = MAX(0, xn);
+    xn = MIN(width - 1, xn);
 
-          for (yk = -1; yk <= 1; yk++) {
-            yn = y + yk;
-            yn = MAX(0, yn);
-            yn = MIN(height - 1, yn);
+    for (yk = -1; yk <= 1; yk++) {
+      yn = y + yk;
+      yn = MAX(0, yn);
+      yn = MIN(height - 1, yn);
 
-            for (zk = -1; zk <= 1; zk++) {
-              if (!zk && !yk && !xk) {
-                continue;
-              }
+      for (zk = -1; zk <= 1; zk++) {
+        if (!zk && !yk && !xk) {
+          continue;
+        }
 
-              zn = z + zk;
-              zn = MAX(0, zn);
-              zn = MIN(depth - 1, zn);
+        zn = z + zk;
+        zn = MAX(0, zn);
+        zn = MIN(depth - 1, zn);
 
-              gcamn_nbr = &gcam->nodes[xn][yn][zn];
+        gcamn_nbr = &gcam->nodes[xn][yn][zn];
 
-              if (gcamn_nbr->invalid == GCAM_POSITION_INVALID) {
-                continue;
-              }
+        if (gcamn_nbr->invalid == GCAM_POSITION_INVALID) {
+          continue;
+        }
 
 #if 0
-              if (gcamn_nbr->label != gcamn->label)
-              {
-                continue ;
-              }
+        if (gcamn_nbr->label != gcamn->label)
+        {
+          continue ;
+        }
 #endif
 
-              vnx = gcamn_nbr->x - gcamn_nbr->origx;
-              vny = gcamn_nbr->y - gcamn_nbr->origy;
-              vnz = gcamn_nbr->z - gcamn_nbr->origz;
-
-              dx += (vnx - vx);
-              dy += (vny - vy);
-              dz += (vnz - vz);
+        vnx = gcamn_nbr->x - gcamn_nbr->origx;
+        vny = gcamn_nbr->y - gcamn_nbr->origy;
+        vnz = gcamn_nbr->z - gcamn_nbr->origz;
 
-              if ((x == Gx && y == Gy && z == Gz) && (Gdiag & DIAG_SHOW) && DIAG_VERBOSE_ON) {
-                printf(
-                    "\tnode(%d,%d,%d): V=(%2.2f,%2.2f,%2.2f), "
-                    "DX=(%2.2f,%2.2f,%2.2f)\n",
-                    xn,
-                    yn,
-                    zn,
-                    vnx,
-                    vny,
-                    vnz,
-                    vnx - vx,
-                    vny - vy,
-                    vnz - vz);
-              }
+        dx += (vnx - vx);
+        dy += (vny - vy);
+        dz += (vnz - vz);
 
-              num++;
-            }
-          }
-        }
-        /*        num = 1 ;*/
-        if (num) {
-          dx = dx * l_smoothness / num;
-          dy = dy * l_smoothness / num;
-          dz = dz * l_smoothness / num;
+        if ((x == Gx && y == Gy && z == Gz) && (Gdiag & DIAG_SHOW) && DIAG_VERBOSE_ON) {
+          printf(
+              "\tnode(%d,%d,%d): V=(%2.2f,%2.2f,%2.2f), "
+              "DX=(%2.2f,%2.2f,%2.2f)\n",
+              xn,
+              yn,
+              zn,
+              vnx,
+              vny,
+              vnz,
+              vnx - vx,
+              vny - vy,
+              vnz - vz);
         }
 
-        if (x == Gx && y == Gy && z == Gz) {
-          printf("l_smoo: node(%d,%d,%d): DX=(%2.2f,%2.2f,%2.2f)\n", x, y, z, dx, dy, dz);
-        }
+        num++;
+      }
+    }
+  }
+  /*        num = 1 ;*/
+  if (num) {
+    dx = dx * l_smoothness / num;
+    dy = dy * l_smoothness / num;
+    dz = dz * l_smoothness / num;
+  }
 
-        gcamn->dx += dx;
-        gcamn->dy += dy;
-        gcamn->dz += dz;
+  if (x == Gx && y == Gy && z == Gz) {
+    printf("l_smoo: node(%d,%d,%d): DX=(%2.2f,%2.2f,%2.2f)\n", x, y, z, dx, dy, dz);
+  }
+
+  gcamn->dx += dx;
+  gcamn->dy += dy;
+  gcamn->dz += dz;
+}
+
+int gcamSmoothnessTerm(GCA_MORPH *gcam, const MRI *mri, const double l_smoothness)
+{
+#ifdef GCAM_SMOOTH_TERM_GPU
+  printf("%s: On GPU\n", __FUNCTION__);
+  gcamSmoothnessTermGPU(gcam, l_smoothness);
+#else
+  int x = 0, y = 0, z = 0;
+
+  if (DZERO(l_smoothness)) {
+    return (NO_ERROR);
+  }
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) firstprivate(y, z) shared(gcam, Gx, Gy, Gz) schedule(static, 1)
+#endif
+  for (x = 0; x < gcam->width; x++) {
+    ROMP_PFLB_begin
+    
+    for (y = 0; y < gcam->height; y++) {
+      for (z = 0; z < gcam->depth; z++) {
+        gcamSmoothnessTermAtNode(gcam, x, y, z, l_smoothness);
       }
     }
     
@@ -7300,84 +7396,366 @@ static double gcamSmoothnessEnergy_new(const GCA_MORPH *gcam, const MRI *mri)
 }
 #endif
 
-int gcamLSmoothnessTerm(GCA_MORPH *gcam, MRI *mri, double l_smoothness)
+/*
+  the smoothness error at node (x,y,z) as gcamSmoothnessEnergy_new()
+  computes it, with the displacements rounded to float. When it fills its
+  buffer, gcamSmoothnessEnergy_new() skips the whole (x,y) row if the z=0
+  node is invalid (the continue in its z=-1 frontier block), so a node
+  only counts if the first node of its row is valid too.
+*/
+#define GCAM_SMOOTHNESS_NODE_VALID(gcam, xn, yn, zn)                  \
+  ((gcam)->nodes[xn][yn][zn].invalid != GCAM_POSITION_INVALID && \
+   (gcam)->nodes[xn][yn][0].invalid != GCAM_POSITION_INVALID)
+
+static double gcamSmoothnessEnergyAtNode(const GCA_MORPH *gcam, int x, int y, int z)
 {
-  double vx, vy, vz, vnx, vny, vnz, dx, dy, dz;
-  int x, y, z, xk, yk, zk, xn, yn, zn, width, height, depth, num;
-  GCA_MORPH_NODE *gcamn, *gcamn_nbr;
+  int xm, ym, zm, xn, yn, zn, num;
+  float vx, vy, vz, vnx, vny, vnz;
+  double dx, dy, dz, node_sse;
+  const GCA_MORPH_NODE *gcamn, *gcamn_nbr;
 
-  if (DZERO(l_smoothness)) {
-    return (NO_ERROR);
+  if (!GCAM_SMOOTHNESS_NODE_VALID(gcam, x, y, z)) {
+    return (0.0);
   }
-  width = gcam->width;
-  height = gcam->height;
-  depth = gcam->depth;
-  for (x = 0; x < gcam->width; x++)
-    for (y = 0; y < gcam->height; y++)
-      for (z = 0; z < gcam->depth; z++) {
-        if (x == Gx && y == Gy && z == Gz) {
-          DiagBreak();
-        }
-        gcamn = &gcam->nodes[x][y][z];
+  gcamn = &gcam->nodes[x][y][z];
 
-        if (gcamn->invalid == GCAM_POSITION_INVALID) {
+  vx = gcamn->x - gcamn->origx;
+  vy = gcamn->y - gcamn->origy;
+  vz = gcamn->z - gcamn->origz;
+  num = -1;  // the node itself is counted below, and adds no error
+  node_sse = 0.0;
+  for (xm = x - 1; xm < x + 2; xm++) {
+    xn = MIN(gcam->width - 1, MAX(0, xm));
+    for (ym = y - 1; ym < y + 2; ym++) {
+      yn = MIN(gcam->height - 1, MAX(0, ym));
+      for (zm = z - 1; zm < z + 2; zm++) {
+        zn = MIN(gcam->depth - 1, MAX(0, zm));
+        if (!GCAM_SMOOTHNESS_NODE_VALID(gcam, xn, yn, zn)) {
           continue;
         }
+        gcamn_nbr = &gcam->nodes[xn][yn][zn];
+        vnx = gcamn_nbr->x - gcamn_nbr->origx;
+        vny = gcamn_nbr->y - gcamn_nbr->origy;
+        vnz = gcamn_nbr->z - gcamn_nbr->origz;
+        dx = (double)(vnx - vx);
+        dy = (double)(vny - vy);
+        dz = (double)(vnz - vz);
+        num++;
+        node_sse += dx * dx + dy * dy + dz * dz;
+      }
+    }
+  }
 
-        vx = gcamn->x - gcamn->origx;
-        vy = gcamn->y - gcamn->origy;
-        vz = gcamn->z - gcamn->origz;
-        dx = dy = dz = 0.0f;
-        if (x == Gx && y == Gy && z == Gz)
-          printf("l_smoo: node(%d,%d,%d): V=(%2.2f,%2.2f,%2.2f)\n", x, y, z, vx, vy, vz);
-        num = 0;
-        for (xk = -1; xk <= 1; xk++) {
-          xn = x + xk;
-          xn = MAX(0, xn);
-          xn = MIN(width - 1, xn);
-          for (yk = -1; yk <= 1; yk++) {
-            yn = y + yk;
-            yn = MAX(0, yn);
-            yn = MIN(height - 1, yn);
-            for (zk = -1; zk <= 1; zk++) {
-              if (!zk && !yk && !xk) {
-                continue;
-              }
-              zn = z + zk;
-              zn = MAX(0, zn);
-              zn = MIN(depth - 1, zn);
-              gcamn_nbr = &gcam->nodes[xn][yn][zn];
+  if (x == Gx && y == Gy && z == Gz) {
+    printf("E_smoo: node(%d,%d,%d) smoothness sse %2.3f (%d nbrs)\n", x, y, z, node_sse / num, num);
+  }
+  return (num > 0 ? node_sse / num : 0.0);
+}
 
-              if (gcamn_nbr->invalid /* == GCAM_POSITION_INVALID*/) {
-                continue;
-              }
+/*
+  gcamFusedTerms() and gcamFusedEnergies() compute the log-likelihood,
+  smoothness and Jacobian terms in one pass over the nodes instead of one
+  pass per term. Each pass visits the nodes in tiles of GCAM_FUSED_TILE_X
+  planes by GCAM_FUSED_TILE_Y rows. Within a tile the planes are the inner
+  loop, so the rows holding a node's neighbors are still in cache for the
+  next plane. Each node gets the same arithmetic as the separate terms
+  give it, in the same order. gcamComputeGradient() and gcamComputeSSE()
+  use them when gcam_fused_terms is set.
+*/
+int gcam_fused_terms = 0;
 
-              if (gcamn_nbr->label != gcamn->label) {
-                continue;
-              }
-              vnx = gcamn_nbr->x - gcamn_nbr->origx;
-              vny = gcamn_nbr->y - gcamn_nbr->origy;
-              vnz = gcamn_nbr->z - gcamn_nbr->origz;
-              dx += (vnx - vx);
-              dy += (vny - vy);
-              dz += (vnz - vz);
-              if ((x == Gx && y == Gy && z == Gz) && (Gdiag & DIAG_SHOW) && DIAG_VERBOSE_ON)
-                printf(
-                    "\tnode(%d,%d,%d): V=(%2.2f,%2.2f,%2.2f), "
-                    "DX=(%2.2f,%2.2f,%2.2f)\n",
-                    xn,
-                    yn,
-                    zn,
-                    vnx,
-                    vny,
-                    vnz,
-                    vnx - vx,
-                    vny - vy,
-                    vnz - vz);
-              num++;
-            }
-          }
-        }
+#define GCAM_FUSED_TILE_X 4
+#define GCAM_FUSED_TILE_Y 4
+
+/*
+  gcamComputeGradient() adds these terms between the log-likelihood and
+  Jacobian terms. The fused pass can only stand in for that stretch if
+  smoothness is the only one of them that is on
+*/
+static int gcamCanFuseTerms(const GCA_MORPH_PARMS *parms)
+{
+  return (DZERO(parms->l_multiscale) && DZERO(parms->l_distance) && DZERO(parms->l_elastic) &&
+          DZERO(parms->l_area_smoothness) && DZERO(parms->l_area) && DZERO(parms->l_lsmoothness) &&
+          DZERO(parms->l_spring));
+}
+
+/*
+  add the log-likelihood, smoothness and Jacobian terms to the gradient,
+  as gcamLogLikelihoodTerm(), gcamSmoothnessTerm() and gcamJacobianTerm()
+  would one after another. gcamComputeMetricProperties() must be current.
+*/
+int gcamFusedTerms(GCA_MORPH *gcam, const MRI *mri, const MRI *mri_smooth, GCA_MORPH_PARMS *parms)
+{
+  int i, tile, ntiles, nthreads, num, fuse_jacobian;
+  double l_log_likelihood, l_smoothness, l_jacobian;
+  float vals[_MAX_FS_THREADS][MAX_GCA_INPUTS];
+  MATRIX *m_delI[_MAX_FS_THREADS], *m_inv_cov[_MAX_FS_THREADS];
+  VECTOR *v_means[_MAX_FS_THREADS], *v_grad[_MAX_FS_THREADS];
+
+  l_log_likelihood = parms->l_log_likelihood;
+  l_smoothness = parms->l_smoothness;
+  l_jacobian = parms->l_jacobian;
+
+#ifdef HAVE_OPENMP
+  nthreads = omp_get_max_threads();
+  // gcamJacobianTerm() keeps its maximum gradient norm in firstprivate
+  // copies, so with OpenMP it never scales the term down and each node
+  // can be done on its own
+  fuse_jacobian = !DZERO(l_jacobian);
+#else
+  nthreads = 1;
+  fuse_jacobian = 0;
+#endif
+
+  for (i = 0; i < nthreads; i++) {
+    m_delI[i] = MatrixAlloc(3, gcam->ninputs, MATRIX_REAL);
+    m_inv_cov[i] = MatrixAlloc(gcam->ninputs, gcam->ninputs, MATRIX_REAL);
+    v_means[i] = VectorAlloc(gcam->ninputs, 1);
+    v_grad[i] = VectorAlloc(3, MATRIX_REAL);
+  }
+
+  num = 0;
+  ntiles = (gcam->width + GCAM_FUSED_TILE_X - 1) / GCAM_FUSED_TILE_X;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) reduction(+ : num) schedule(dynamic, 1)
+#endif
+  for (tile = 0; tile < ntiles; tile++) {
+    ROMP_PFLB_begin
+    int x, y, z, y0, x0, x1;
+    double dx, dy, dz;
+    GCA_MORPH_NODE *gcamn;
+#ifdef HAVE_OPENMP
+    int tid = omp_get_thread_num();
+#else
+    int tid = 0;
+#endif
+
+    x0 = tile * GCAM_FUSED_TILE_X;
+    x1 = MIN(x0 + GCAM_FUSED_TILE_X, gcam->width);
+    for (y0 = 0; y0 < gcam->height; y0 += GCAM_FUSED_TILE_Y) {
+      for (x = x0; x < x1; x++) {
+        for (y = y0; y < MIN(y0 + GCAM_FUSED_TILE_Y, gcam->height); y++) {
+          struct different_neighbor_labels_context different_neighbor_labels_context;
+          init_different_neighbor_labels_context(&different_neighbor_labels_context, gcam, x, y);
+          for (z = 0; z < gcam->depth; z++) {
+            gcamn = &gcam->nodes[x][y][z];
+            if (gcamn->invalid == GCAM_POSITION_INVALID) {
+              continue;
+            }
+
+            if (!DZERO(l_log_likelihood))
+              gcamLogLikelihoodTermAtNode(gcam,
+                                          mri,
+                                          mri_smooth,
+                                          l_log_likelihood,
+                                          x,
+                                          y,
+                                          z,
+                                          &different_neighbor_labels_context,
+                                          vals[tid],
+                                          m_delI[tid],
+                                          m_inv_cov[tid],
+                                          v_means[tid],
+                                          v_grad[tid]);
+            if (!DZERO(l_smoothness)) {
+              gcamSmoothnessTermAtNode(gcam, x, y, z, l_smoothness);
+            }
+            if (fuse_jacobian) {
+              double orig_area = gcamn->orig_area;
+              if (!FZERO(orig_area) && gcamn->area / orig_area < parms->ratio_thresh) {
+                num++;
+              }
+              gcamJacobianTermAtNode(gcam, mri, l_jacobian, x, y, z, &dx, &dy, &dz);
+              gcamn->dx += dx;
+              gcamn->dy += dy;
+              gcamn->dz += dz;
+            }
+          }
+        }
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  for (i = 0; i < nthreads; i++) {
+    MatrixFree(&m_delI[i]);
+    MatrixFree(&m_inv_cov[i]);
+    VectorFree(&v_means[i]);
+    VectorFree(&v_grad[i]);
+  }
+
+  if (fuse_jacobian && DIAG_VERBOSE_ON) {
+    printf("  %d nodes compressed more than %2.2f\n", num, parms->ratio_thresh);
+  }
+  if (!fuse_jacobian) {
+    gcamJacobianTerm(gcam, mri, l_jacobian, parms->ratio_thresh);
+  }
+  return (NO_ERROR);
+}
+
+/*
+  the log-likelihood, smoothness and Jacobian energies, unweighted, for
+  each of pll_sse, ps_sse and pj_sse that is not NULL.
+  gcamComputeMetricProperties() must be current. Each plane is summed on
+  its own and the planes are added in order, as gcamLogLikelihoodEnergy()
+  and gcamJacobianEnergy() do for morphs up to
+  ROMP_DISTRIBUTOR_PARTIAL_CAPACITY planes wide, so the results do not
+  depend on the number of threads
+*/
+int gcamFusedEnergies(const GCA_MORPH *gcam, MRI *mri, double *pll_sse, double *ps_sse, double *pj_sse)
+{
+  int x, tile, ntiles;
+  double *plane_sse, thick;
+
+  thick = mri ? mri->thick : 1.0;
+  plane_sse = (double *)calloc(3 * gcam->width, sizeof(double));
+  if (!plane_sse) {
+    ErrorExit(ERROR_NOMEMORY, "gcamFusedEnergies: could not allocate %d plane sums", 3 * gcam->width);
+  }
+
+  ntiles = (gcam->width + GCAM_FUSED_TILE_X - 1) / GCAM_FUSED_TILE_X;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
+#endif
+  for (tile = 0; tile < ntiles; tile++) {
+    ROMP_PFLB_begin
+    int x, y, z, y0, x0, x1;
+    double error;
+
+    x0 = tile * GCAM_FUSED_TILE_X;
+    x1 = MIN(x0 + GCAM_FUSED_TILE_X, gcam->width);
+    for (y0 = 0; y0 < gcam->height; y0 += GCAM_FUSED_TILE_Y) {
+      for (x = x0; x < x1; x++) {
+        double *sse = &plane_sse[3 * x];
+        for (y = y0; y < MIN(y0 + GCAM_FUSED_TILE_Y, gcam->height); y++) {
+          struct different_neighbor_labels_context different_neighbor_labels_context;
+          init_different_neighbor_labels_context(&different_neighbor_labels_context, gcam, x, y);
+          for (z = 0; z < gcam->depth; z++) {
+            if (gcam->nodes[x][y][z].invalid == GCAM_POSITION_INVALID) {
+              continue;
+            }
+            if (pll_sse && gcamLogLikelihoodEnergyAtNode(gcam, mri, x, y, z, &different_neighbor_labels_context, &error)) {
+              sse[0] += error;
+            }
+            if (ps_sse) {
+              sse[1] += gcamSmoothnessEnergyAtNode(gcam, x, y, z);
+            }
+            if (pj_sse) {
+              gcamJacobianEnergyAtNode(gcam, x, y, z, thick, &sse[2]);
+            }
+          }
+        }
+      }
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  if (pll_sse) {
+    *pll_sse = 0.0;
+  }
+  if (ps_sse) {
+    *ps_sse = 0.0;
+  }
+  if (pj_sse) {
+    *pj_sse = 0.0;
+  }
+  for (x = 0; x < gcam->width; x++) {
+    if (pll_sse) {
+      *pll_sse += plane_sse[3 * x];
+    }
+    if (ps_sse) {
+      *ps_sse += plane_sse[3 * x + 1];
+    }
+    if (pj_sse) {
+      *pj_sse += plane_sse[3 * x + 2];
+    }
+  }
+  free(plane_sse);
+  return (NO_ERROR);
+}
+
+int gcamLSmoothnessTerm(GCA_MORPH *gcam, MRI *mri, double l_smoothness)
+{
+  double vx, vy, vz, vnx, vny, vnz, dx, dy, dz;
+  int x, y, z, xk, yk, zk, xn, yn, zn, width, height, depth, num;
+  GCA_MORPH_NODE *gcamn, *gcamn_nbr;
+
+  if (DZERO(l_smoothness)) {
+    return (NO_ERROR);
+  }
+  width = gcam->width;
+  height = gcam->height;
+  depth = gcam->depth;
+  for (x = 0; x < gcam->width; x++)
+    for (y = 0; y < gcam->height; y++)
+      for (z = 0; z < gcam->depth; z++) {
+        if (x == Gx && y == Gy && z == Gz) {
+          DiagBreak();
+        }
+        gcamn = &gcam->nodes[x][y][z];
+
+        if (gcamn->invalid == GCAM_POSITION_INVALID) {
+          continue;
+        }
+
+        vx = gcamn->x - gcamn->origx;
+        vy = gcamn->y - gcamn->origy;
+        vz = gcamn->z - gcamn->origz;
+        dx = dy = dz = 0.0f;
+        if (x == Gx && y == Gy && z == Gz)
+          printf("l_smoo: node(%d,%d,%d): V=(%2.2f,%2.2f,%2.2f)\n", x, y, z, vx, vy, vz);
+        num = 0;
+        for (xk = -1; xk <= 1; xk++) {
+          xn = x + xk;
+          xn = MAX(0, xn);
+          xn = MIN(width - 1, xn);
+          for (yk = -1; yk <= 1; yk++) {
+            yn = y + yk;
+            yn = MAX(0, yn);
+            yn = MIN(height - 1, yn);
+            for (zk = -1; zk <= 1; zk++) {
+              if (!zk && !yk && !xk) {
+                continue;
+              }
+              zn = z + zk;
+              zn = MAX(0, zn);
+              zn = MIN(depth - 1, zn);
+              gcamn_nbr = &gcam->nodes[xn][yn][zn];
+
+              if (gcamn_nbr->invalid /* == GCAM_POSITION_INVALID*/) {
+                continue;
+              }
+
+              if (gcamn_nbr->label != gcamn->label) {
+                continue;
+              }
+              vnx = gcamn_nbr->x - gcamn_nbr->origx;
+              vny = gcamn_nbr->y - gcamn_nbr->origy;
+              vnz = gcamn_nbr->z - gcamn_nbr->origz;
+              dx += (vnx - vx);
+              dy += (vny - vy);
+              dz += (vnz - vz);
+              if ((x == Gx && y == Gy && z == Gz) && (Gdiag & DIAG_SHOW) && DIAG_VERBOSE_ON)
+                printf(
+                    "\tnode(%d,%d,%d): V=(%2.2f,%2.2f,%2.2f), "
+                    "DX=(%2.2f,%2.2f,%2.2f)\n",
+                    xn,
+                    yn,
+                    zn,
+                    vnx,
+                    vny,
+                    vnz,
+                    vnx - vx,
+                    vny - vy,
+                    vnz - vz);
+              num++;
+            }
+          }
+        }
         /*        num = 1 ;*/
         if (num) {
           dx = dx * l_smoothness / num;
@@ -7712,64 +8090,71 @@ double gcamSpringEnergy(GCA_MORPH *gcam, double ratio_thresh)
   return (sse);
 }
 
+/* the index of the Gx, Gy, Gz debugging node, or -1 if it is not in the morph */
+static int gcamDiagNodeIndex(const GCA_MORPH *gcam)
+{
+  if (Gx < 0 || Gy < 0 || Gz < 0 || Gx >= gcam->width || Gy >= gcam->height || Gz >= gcam->depth) {
+    return (-1);
+  }
+  return (GCAM_NODE_INDEX(gcam, Gx, Gy, Gz));
+}
+
 int gcamClearGradient(GCA_MORPH *gcam)
 {
-  int x, y, z;
+  int i;
 
-  for (x = 0; x < gcam->width; x++)
-    for (y = 0; y < gcam->height; y++)
-      for (z = 0; z < gcam->depth; z++)
-        gcam->nodes[x][y][z].dx = gcam->nodes[x][y][z].dy = gcam->nodes[x][y][z].dz = 0.0;
+  for (i = 0; i < GCAM_NNODES(gcam); i++) {
+    GCAM_NODE(gcam, i)->dx = GCAM_NODE(gcam, i)->dy = GCAM_NODE(gcam, i)->dz = 0.0;
+  }
   return (NO_ERROR);
 }
 
 int gcamApplyGradient(GCA_MORPH *gcam, GCA_MORPH_PARMS *parms)
 {
-  int x, y, z;
+  int i, gi;
   float dx, dy, dz, dt, momentum;
   GCA_MORPH_NODE *gcamn;
 
   dt = parms->dt;
   momentum = parms->momentum;
-  for (x = 0; x < gcam->width; x++)
-    for (y = 0; y < gcam->height; y++)
-      for (z = 0; z < gcam->depth; z++) {
-        if (x == Gx && y == Gy && z == Gz) {
-          DiagBreak();
-        }
-        gcamn = &gcam->nodes[x][y][z];
+  gi = gcamDiagNodeIndex(gcam);
+  for (i = 0; i < GCAM_NNODES(gcam); i++) {
+    if (i == gi) {
+      DiagBreak();
+    }
+    gcamn = GCAM_NODE(gcam, i);
 
-        if (gcamn->invalid == GCAM_POSITION_INVALID) {
-          continue;
-        }
+    if (gcamn->invalid == GCAM_POSITION_INVALID) {
+      continue;
+    }
 
-        dx = gcamn->dx * dt + gcamn->odx * momentum;
-        dy = gcamn->dy * dt + gcamn->ody * momentum;
-        dz = gcamn->dz * dt + gcamn->odz * momentum;
-        gcamn->odx = dx;
-        gcamn->ody = dy;
-        gcamn->odz = dz;
+    dx = gcamn->dx * dt + gcamn->odx * momentum;
+    dy = gcamn->dy * dt + gcamn->ody * momentum;
+    dz = gcamn->dz * dt + gcamn->odz * momentum;
+    gcamn->odx = dx;
+    gcamn->ody = dy;
+    gcamn->odz = dz;
 
-        if (x == Gx && y == Gy && z == Gz)
-          printf(
-              "GRAD: node(%d,%d,%d): moving by (%2.3f, %2.3f, %2.3f) from "
-              "(%2.2f,%2.2f,%2.2f) to ",
-              x,
-              y,
-              z,
-              dx,
-              dy,
-              dz,
-              gcamn->x,
-              gcamn->y,
-              gcamn->z);
-        gcamn->x += dx;
-        gcamn->y += dy;
-        gcamn->z += dz;
-        if (x == Gx && y == Gy && z == Gz) {
-          printf("(%2.2f,%2.2f,%2.2f)\n", gcamn->x, gcamn->y, gcamn->z);
-        }
-      }
+    if (i == gi)
+      printf(
+          "GRAD: node(%d,%d,%d): moving by (%2.3f, %2.3f, %2.3f) from "
+          "(%2.2f,%2.2f,%2.2f) to ",
+          Gx,
+          Gy,
+          Gz,
+          dx,
+          dy,
+          dz,
+          gcamn->x,
+          gcamn->y,
+          gcamn->z);
+    gcamn->x += dx;
+    gcamn->y += dy;
+    gcamn->z += dz;
+    if (i == gi) {
+      printf("(%2.2f,%2.2f,%2.2f)\n", gcamn->x, gcamn->y, gcamn->z);
+    }
+  }
   if (!DZERO(parms->l_area_intensity)) {
     parms->nlt = gcamCreateNodeLookupTable(gcam, parms->mri, parms->nlt);
   }
@@ -7778,18 +8163,13 @@ int gcamApplyGradient(GCA_MORPH *gcam, GCA_MORPH_PARMS *parms)
 
 int gcamClearMomentum(GCA_MORPH *gcam)
 {
-  int x, y, z;
+  int i;
   GCA_MORPH_NODE *gcamn;
 
-  for (x = 0; x < gcam->width; x++)
-    for (y = 0; y < gcam->height; y++)
-      for (z = 0; z < gcam->depth; z++) {
-        if (x == Gx && y == Gy && z == Gz) {
-          DiagBreak();
-        }
-        gcamn = &gcam->nodes[x][y][z];
-        gcamn->odx = gcamn->ody = gcamn->odz = 0;
-      }
+  for (i = 0; i < GCAM_NNODES(gcam); i++) {
+    gcamn = GCAM_NODE(gcam, i);
+    gcamn->odx = gcamn->ody = gcamn->odz = 0;
+  }
   return (NO_ERROR);
 }
 /*-----------------------------------------------------
@@ -8377,48 +8757,47 @@ int GCAMfreeInverse(GCA_MORPH *gcam)
 
 int gcamUndoGradient(GCA_MORPH *gcam)
 {
-  int x, y, z;
+  int i, gi;
   float dx, dy, dz;
   GCA_MORPH_NODE *gcamn;
 
-  for (x = 0; x < gcam->width; x++)
-    for (y = 0; y < gcam->height; y++)
-      for (z = 0; z < gcam->depth; z++) {
-        if (x == Gx && y == Gy && z == Gz) {
-          DiagBreak();
-        }
-        gcamn = &gcam->nodes[x][y][z];
+  gi = gcamDiagNodeIndex(gcam);
+  for (i = 0; i < GCAM_NNODES(gcam); i++) {
+    if (i == gi) {
+      DiagBreak();
+    }
+    gcamn = GCAM_NODE(gcam, i);
 
-        if (gcamn->invalid == GCAM_POSITION_INVALID) {
-          continue;
-        }
+    if (gcamn->invalid == GCAM_POSITION_INVALID) {
+      continue;
+    }
 
-        dx = gcamn->odx;
-        dy = gcamn->ody;
-        dz = gcamn->odz;
-        gcamn->odx = gcamn->ody = gcamn->odz = 0; /* turn off momentum */
+    dx = gcamn->odx;
+    dy = gcamn->ody;
+    dz = gcamn->odz;
+    gcamn->odx = gcamn->ody = gcamn->odz = 0; /* turn off momentum */
 
-        if (x == Gx && y == Gy && z == Gz)
-          printf(
-              "UNGRAD: node(%d,%d,%d): "
-              "moving by (%2.3f, %2.3f, %2.3f) from "
-              "(%2.1f,%2.1f,%2.1f) to ",
-              x,
-              y,
-              z,
-              dx,
-              dy,
-              dz,
-              gcamn->x,
-              gcamn->y,
-              gcamn->z);
-        gcamn->x -= dx;
-        gcamn->y -= dy;
-        gcamn->z -= dz;
-        if (x == Gx && y == Gy && z == Gz) {
-          printf("(%2.1f,%2.1f,%2.1f)\n", gcamn->x, gcamn->y, gcamn->z);
-        }
-      }
+    if (i == gi)
+      printf(
+          "UNGRAD: node(%d,%d,%d): "
+          "moving by (%2.3f, %2.3f, %2.3f) from "
+          "(%2.1f,%2.1f,%2.1f) to ",
+          Gx,
+          Gy,
+          Gz,
+          dx,
+          dy,
+          dz,
+          gcamn->x,
+          gcamn->y,
+          gcamn->z);
+    gcamn->x -= dx;
+    gcamn->y -= dy;
+    gcamn->z -= dz;
+    if (i == gi) {
+      printf("(%2.1f,%2.1f,%2.1f)\n", gcamn->x, gcamn->y, gcamn->z);
+    }
+  }
   return (NO_ERROR);
 }
 
@@ -8749,93 +9128,495 @@ int gcamSmoothGradient(GCA_MORPH *gcam, int navgs)
 
               if (yi >= gcam->height) yi = gcam->height - 1;
 
-              for (zk = -1; zk <= 1; zk++) {
-                zi = z + zk;
-                if (zi < 0) zi = 0;
+              for (zk = -1; zk <= 1; zk++) {
+                zi = z + zk;
+                if (zi < 0) zi = 0;
+
+                if (zi >= gcam->depth) zi = gcam->depth - 1;
+
+                gcamn_nbr = &gcam->nodes[xi][yi][zi];
+
+                if (gcamn_nbr->invalid /* == GCAM_POSITION_INVALID*/) continue;
+#if 1
+                if (gcamn_nbr->label != gcamn->label) continue;
+#endif
+                num++;
+                dx[index] += gcamn_nbr->dx;
+                dy[index] += gcamn_nbr->dy;
+                dz[index] += gcamn_nbr->dz;
+              }
+            }
+          }
+          dx[index] /= (double)num;
+          dy[index] /= (double)num;
+          dz[index] /= (double)num;
+        }
+    for (index = x = 0; x < gcam->width; x++)
+      for (y = 0; y < gcam->height; y++)
+        for (z = 0; z < gcam->depth; z++, index++) {
+          gcamn = &gcam->nodes[x][y][z];
+
+          if (gcamn->invalid == GCAM_POSITION_INVALID) continue;
+
+          gcamn->dx = dx[index];
+          gcamn->dy = dy[index];
+          gcamn->dz = dz[index];
+        }
+  }
+
+#endif
+
+  if ((Gx >= 0 && Gy >= 0 && Gz >= 0) && (Gdiag & DIAG_SHOW))
+    printf("after smoothing %d times: grad = (%2.3f, %2.3f, %2.3f)\n",
+           navgs,
+           gcam->nodes[Gx][Gy][Gz].dx,
+           gcam->nodes[Gx][Gy][Gz].dy,
+           gcam->nodes[Gx][Gy][Gz].dz);
+
+#endif
+
+  return (NO_ERROR);
+}
+
+int GCAMsetStatus(GCA_MORPH *gcam, int status)
+{
+  int i;
+  GCA_MORPH_NODE *gcamn;
+
+  for (i = 0; i < GCAM_NNODES(gcam); i++) {
+    gcamn = GCAM_NODE(gcam, i);
+    gcamn->status = status;
+  }
+  return (NO_ERROR);
+}
+
+int GCAMsetLabelStatus(GCA_MORPH *gcam, int label, int status)
+{
+  int i;
+  GCA_MORPH_NODE *gcamn;
+
+  for (i = 0; i < GCAM_NNODES(gcam); i++) {
+    gcamn = GCAM_NODE(gcam, i);
+    if (gcamn->label == label) {
+      gcamn->status = status;
+    }
+  }
+  return (NO_ERROR);
+}
+/*
+  gcamFindOptimalTimeStep() tries each time step on the positions it
+  started from. With gcam_timestep_overlay set they are saved once, and
+  each candidate is written over them in one parallel pass instead of
+  gcamApplyGradient() followed by gcamUndoGradient(), so the positions do
+  not pick up round-off from undoing each step. The momentum is cleared
+  during the search, so the step is the same one gcamApplyGradient()
+  takes.
+*/
+int gcam_timestep_overlay = 1;
+
+static GCAM_REAL *gcamSavePositions(const GCA_MORPH *gcam)
+{
+  int i;
+  GCAM_REAL *positions;
+  const GCA_MORPH_NODE *gcamn;
+
+  positions = (GCAM_REAL *)malloc(3 * GCAM_NNODES(gcam) * sizeof(GCAM_REAL));
+  if (!positions) {
+    ErrorExit(ERROR_NOMEMORY, "gcamSavePositions: could not allocate %d positions", GCAM_NNODES(gcam));
+  }
+  for (i = 0; i < GCAM_NNODES(gcam); i++) {
+    gcamn = GCAM_NODE(gcam, i);
+    positions[3 * i] = gcamn->x;
+    positions[3 * i + 1] = gcamn->y;
+    positions[3 * i + 2] = gcamn->z;
+  }
+  return (positions);
+}
+
+static void gcamRestorePositions(GCA_MORPH *gcam, const GCAM_REAL *positions)
+{
+  int i;
+  GCA_MORPH_NODE *gcamn;
+
+  for (i = 0; i < GCAM_NNODES(gcam); i++) {
+    gcamn = GCAM_NODE(gcam, i);
+    gcamn->x = positions[3 * i];
+    gcamn->y = positions[3 * i + 1];
+    gcamn->z = positions[3 * i + 2];
+  }
+}
+
+/* where a time step of dt moves gcamn from (x,y,z) */
+static void gcamTimeStepPosition(const GCA_MORPH_NODE *gcamn,
+                                 GCAM_REAL x,
+                                 GCAM_REAL y,
+                                 GCAM_REAL z,
+                                 float dt,
+                                 float momentum,
+                                 GCAM_REAL *px,
+                                 GCAM_REAL *py,
+                                 GCAM_REAL *pz)
+{
+  float dx, dy, dz;
+
+  if (gcamn->invalid == GCAM_POSITION_INVALID) {
+    *px = x;
+    *py = y;
+    *pz = z;
+    return;
+  }
+  dx = gcamn->dx * dt + gcamn->odx * momentum;
+  dy = gcamn->dy * dt + gcamn->ody * momentum;
+  dz = gcamn->dz * dt + gcamn->odz * momentum;
+  *px = x + dx;
+  *py = y + dy;
+  *pz = z + dz;
+}
+
+/* the saved positions moved by parms->dt times the gradient */
+static void gcamSetTimeStepPositions(GCA_MORPH *gcam, const GCAM_REAL *positions, const GCA_MORPH_PARMS *parms)
+{
+  int i, nnodes;
+  float dt, momentum;
+
+  dt = parms->dt;
+  momentum = parms->momentum;
+  nnodes = GCAM_NNODES(gcam);
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static)
+#endif
+  for (i = 0; i < nnodes; i++) {
+    ROMP_PFLB_begin
+    GCA_MORPH_NODE *gcamn = GCAM_NODE(gcam, i);
+
+    if (gcamn->invalid == GCAM_POSITION_INVALID) {
+      ROMP_PFLB_continue;
+    }
+    gcamTimeStepPosition(
+        gcamn, positions[3 * i], positions[3 * i + 1], positions[3 * i + 2], dt, momentum, &gcamn->x, &gcamn->y, &gcamn->z);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+/*
+  When only the fused log-likelihood, smoothness and Jacobian energies are
+  on, gcamSweepTimeSteps() gives the rms of up to GCAM_TIMESTEP_SWEEP_SIZE
+  time steps in one pass over the nodes, reading each node's neighborhood
+  once for all of them instead of moving the whole morph and going over it
+  once per step. Each step's positions are worked out as they are needed,
+  with the same float arithmetic as gcamSetTimeStepPositions(), so each
+  rms and negative node count is the one GCAMcomputeRMS() gives there, and
+  the search picks the same time step. The morph is not moved, and its
+  areas are those of the positions it started from.
+  gcam_timestep_sweep switches back to one step at a time.
+*/
+int gcam_timestep_sweep = 1;
+
+#define GCAM_TIMESTEP_SWEEP_SIZE 4
+
+typedef struct
+{
+  int n;
+  double dt[GCAM_TIMESTEP_SWEEP_SIZE];
+  double rms[GCAM_TIMESTEP_SWEEP_SIZE];
+  int neg[GCAM_TIMESTEP_SWEEP_SIZE];
+} GCAM_TIMESTEP_SWEEP;
+
+/* whether gcamComputeSSE() would only add up the fused energies */
+static int gcamCanSweepTimeSteps(const GCA_MORPH_PARMS *parms)
+{
+  return (gcam_fused_terms && gcamCanFuseTerms(parms) && DZERO(parms->l_dtrans) && DZERO(parms->l_label) &&
+          DZERO(parms->l_binary) && DZERO(parms->l_area_intensity) && DZERO(parms->l_map) &&
+          DZERO(parms->l_expansion) && gcam_write_grad <= 1 && !getenv("SHOW_NEG"));
+}
+
+/*
+  the smoothness error at node (x,y,z), as gcamSmoothnessEnergyAtNode()
+  computes it, after each time step in dts, added to sse[3 * n + 1]
+*/
+static void gcamTimeStepSmoothnessAtNode(
+    const GCA_MORPH *gcam, int x, int y, int z, const float *dts, int ndts, float momentum, double *sse)
+{
+  int xm, ym, zm, xn, yn, zn, num, n;
+  float vx[GCAM_TIMESTEP_SWEEP_SIZE], vy[GCAM_TIMESTEP_SWEEP_SIZE], vz[GCAM_TIMESTEP_SWEEP_SIZE], vnx, vny, vnz;
+  double dx, dy, dz, node_sse[GCAM_TIMESTEP_SWEEP_SIZE];
+  GCAM_REAL px, py, pz;
+  const GCA_MORPH_NODE *gcamn, *gcamn_nbr;
+
+  if (!GCAM_SMOOTHNESS_NODE_VALID(gcam, x, y, z)) {
+    return;
+  }
+  gcamn = &gcam->nodes[x][y][z];
+
+  for (n = 0; n < ndts; n++) {
+    gcamTimeStepPosition(gcamn, gcamn->x, gcamn->y, gcamn->z, dts[n], momentum, &px, &py, &pz);
+    vx[n] = px - gcamn->origx;
+    vy[n] = py - gcamn->origy;
+    vz[n] = pz - gcamn->origz;
+    node_sse[n] = 0.0;
+  }
+  num = -1;  // the node itself is counted below, and adds no error
+  for (xm = x - 1; xm < x + 2; xm++) {
+    xn = MIN(gcam->width - 1, MAX(0, xm));
+    for (ym = y - 1; ym < y + 2; ym++) {
+      yn = MIN(gcam->height - 1, MAX(0, ym));
+      for (zm = z - 1; zm < z + 2; zm++) {
+        zn = MIN(gcam->depth - 1, MAX(0, zm));
+        if (!GCAM_SMOOTHNESS_NODE_VALID(gcam, xn, yn, zn)) {
+          continue;
+        }
+        gcamn_nbr = &gcam->nodes[xn][yn][zn];
+        num++;
+        for (n = 0; n < ndts; n++) {
+          gcamTimeStepPosition(gcamn_nbr, gcamn_nbr->x, gcamn_nbr->y, gcamn_nbr->z, dts[n], momentum, &px, &py, &pz);
+          vnx = px - gcamn_nbr->origx;
+          vny = py - gcamn_nbr->origy;
+          vnz = pz - gcamn_nbr->origz;
+          dx = (double)(vnx - vx[n]);
+          dy = (double)(vny - vy[n]);
+          dz = (double)(vnz - vz[n]);
+          node_sse[n] += dx * dx + dy * dy + dz * dz;
+        }
+      }
+    }
+  }
+  for (n = 0; n < ndts; n++) {
+    sse[3 * n + 1] += num > 0 ? node_sse[n] / num : 0.0;
+  }
+}
+
+/*
+  the right- and left-handed areas of node (i,j,k) after a time step of
+  dt, as gcamComputeMetricProperties() computes them. Returns whether
+  either is not positive.
+*/
+static int gcamTimeStepAreasAtNode(const GCA_MORPH *gcam,
+                                   int i,
+                                   int j,
+                                   int k,
+                                   float dt,
+                                   float momentum,
+                                   VECTOR *v_i,
+                                   VECTOR *v_j,
+                                   VECTOR *v_k,
+                                   float *parea1,
+                                   float *parea2)
+{
+  int neg = 0;
+  GCAM_REAL x, y, z, xi, yi, zi, xj, yj, zj, xk, yk, zk;
+  const GCA_MORPH_NODE *gcamn, *gcamni, *gcamnj, *gcamnk;
+
+  gcamn = &gcam->nodes[i][j][k];
+  gcamTimeStepPosition(gcamn, gcamn->x, gcamn->y, gcamn->z, dt, momentum, &x, &y, &z);
+
+  // an area next to an invalid node is left as it was
+  *parea1 = gcamn->area1;
+  if ((i < gcam->width - 1) && (j < gcam->height - 1) && (k < gcam->depth - 1)) {
+    gcamni = &gcam->nodes[i + 1][j][k];
+    gcamnj = &gcam->nodes[i][j + 1][k];
+    gcamnk = &gcam->nodes[i][j][k + 1];
+    if (gcamni->invalid != GCAM_POSITION_INVALID && gcamnj->invalid != GCAM_POSITION_INVALID &&
+        gcamnk->invalid != GCAM_POSITION_INVALID) {
+      gcamTimeStepPosition(gcamni, gcamni->x, gcamni->y, gcamni->z, dt, momentum, &xi, &yi, &zi);
+      gcamTimeStepPosition(gcamnj, gcamnj->x, gcamnj->y, gcamnj->z, dt, momentum, &xj, &yj, &zj);
+      gcamTimeStepPosition(gcamnk, gcamnk->x, gcamnk->y, gcamnk->z, dt, momentum, &xk, &yk, &zk);
+      V3_LOAD(v_i, xi - x, yi - y, zi - z);
+      V3_LOAD(v_j, xj - x, yj - y, zj - z);
+      V3_LOAD(v_k, xk - x, yk - y, zk - z);
+      *parea1 = VectorTripleProduct(v_j, v_k, v_i);
+      if (*parea1 <= 0) {
+        neg = 1;
+      }
+    }
+  }
+  else {
+    *parea1 = 0;
+  }
+
+  *parea2 = gcamn->area2;
+  if ((i > 0) && (j > 0) && (k > 0)) {
+    gcamni = &gcam->nodes[i - 1][j][k];
+    gcamnj = &gcam->nodes[i][j - 1][k];
+    gcamnk = &gcam->nodes[i][j][k - 1];
+    if (gcamni->invalid != GCAM_POSITION_INVALID && gcamnj->invalid != GCAM_POSITION_INVALID &&
+        gcamnk->invalid != GCAM_POSITION_INVALID) {
+      gcamTimeStepPosition(gcamni, gcamni->x, gcamni->y, gcamni->z, dt, momentum, &xi, &yi, &zi);
+      gcamTimeStepPosition(gcamnj, gcamnj->x, gcamnj->y, gcamnj->z, dt, momentum, &xj, &yj, &zj);
+      gcamTimeStepPosition(gcamnk, gcamnk->x, gcamnk->y, gcamnk->z, dt, momentum, &xk, &yk, &zk);
+      V3_LOAD(v_i, x - xi, y - yi, z - zi);
+      V3_LOAD(v_j, xj - x, yj - y, zj - z);
+      V3_LOAD(v_k, xk - x, yk - y, zk - z);
+      *parea2 = VectorTripleProduct(v_j, v_k, v_i);
+      if (*parea2 <= 0) {
+        neg = 1;
+      }
+    }
+  }
+  else {
+    *parea2 = 0;
+  }
+  return (neg);
+}
 
-                if (zi >= gcam->depth) zi = gcam->depth - 1;
+/*
+  the rms and number of negative nodes GCAMcomputeRMS() would give after
+  each time step in sweep->dt, in one pass over the nodes laid out as
+  gcamFusedEnergies() goes over them. gcamComputeMetricProperties() must
+  have been run at the positions the steps start from, so the nodes it
+  marks invalid are already marked
+*/
+static void gcamSweepTimeSteps(GCA_MORPH *gcam, MRI *mri, GCA_MORPH_PARMS *parms, GCAM_TIMESTEP_SWEEP *sweep)
+{
+  int x, n, ndts, tile, ntiles, use_ll, use_s, use_j, *plane_neg;
+  float dts[GCAM_TIMESTEP_SWEEP_SIZE], momentum, nvoxels;
+  double *plane_sse, thick, ll_sse, s_sse, j_sse;
 
-                gcamn_nbr = &gcam->nodes[xi][yi][zi];
+  ndts = sweep->n;
+  for (n = 0; n < ndts; n++) {
+    dts[n] = sweep->dt[n];
+  }
+  momentum = parms->momentum;
+  thick = mri ? mri->thick : 1.0;
+  use_ll = !DZERO(parms->l_log_likelihood) || !DZERO(parms->l_likelihood);
+  use_s = !DZERO(parms->l_smoothness);
+  use_j = !DZERO(parms->l_jacobian);
+  plane_sse = (double *)calloc(3 * ndts * gcam->width, sizeof(double));
+  plane_neg = (int *)calloc(ndts * gcam->width, sizeof(int));
+  if (!plane_sse || !plane_neg) {
+    ErrorExit(ERROR_NOMEMORY, "gcamSweepTimeSteps: could not allocate %d plane sums", 3 * ndts * gcam->width);
+  }
 
-                if (gcamn_nbr->invalid /* == GCAM_POSITION_INVALID*/) continue;
-#if 1
-                if (gcamn_nbr->label != gcamn->label) continue;
+  ntiles = (gcam->width + GCAM_FUSED_TILE_X - 1) / GCAM_FUSED_TILE_X;
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic, 1)
 #endif
-                num++;
-                dx[index] += gcamn_nbr->dx;
-                dy[index] += gcamn_nbr->dy;
-                dz[index] += gcamn_nbr->dz;
+  for (tile = 0; tile < ntiles; tile++) {
+    ROMP_PFLB_begin
+    int x, y, z, y0, x0, x1, n, used;
+    float vals[MAX_GCA_INPUTS], area1, area2;
+    GCAM_REAL px, py, pz;
+    VECTOR *v_i, *v_j, *v_k;
+    const GCA_MORPH_NODE *gcamn;
+
+    v_i = VectorAlloc(3, MATRIX_REAL);
+    v_j = VectorAlloc(3, MATRIX_REAL);
+    v_k = VectorAlloc(3, MATRIX_REAL);
+    x0 = tile * GCAM_FUSED_TILE_X;
+    x1 = MIN(x0 + GCAM_FUSED_TILE_X, gcam->width);
+    for (y0 = 0; y0 < gcam->height; y0 += GCAM_FUSED_TILE_Y) {
+      for (x = x0; x < x1; x++) {
+        double *sse = &plane_sse[3 * ndts * x];
+        int *neg = &plane_neg[ndts * x];
+        for (y = y0; y < MIN(y0 + GCAM_FUSED_TILE_Y, gcam->height); y++) {
+          struct different_neighbor_labels_context different_neighbor_labels_context;
+          init_different_neighbor_labels_context(&different_neighbor_labels_context, gcam, x, y);
+          for (z = 0; z < gcam->depth; z++) {
+            gcamn = &gcam->nodes[x][y][z];
+            if (gcamn->invalid == GCAM_POSITION_INVALID) {
+              continue;
+            }
+            used = use_ll && gcamLogLikelihoodNodeUsed(gcam, x, y, z, &different_neighbor_labels_context);
+            for (n = 0; n < ndts; n++) {
+              if (used) {
+                gcamTimeStepPosition(gcamn, gcamn->x, gcamn->y, gcamn->z, dts[n], momentum, &px, &py, &pz);
+                sse[3 * n] += gcamLogLikelihoodError(gcam, mri, gcamn, px, py, pz, vals);
+              }
+              if (gcamTimeStepAreasAtNode(gcam, x, y, z, dts[n], momentum, v_i, v_j, v_k, &area1, &area2) &&
+                  gcamn->invalid == GCAM_VALID && gcamn->orig_area > 0) {
+                neg[n]++;
+              }
+              if (use_j) {
+                gcamJacobianEnergyOfAreas(gcam, x, y, z, area1, area2, thick, &sse[3 * n + 2]);
               }
             }
+            if (use_s) {
+              gcamTimeStepSmoothnessAtNode(gcam, x, y, z, dts, ndts, momentum, sse);
+            }
           }
-          dx[index] /= (double)num;
-          dy[index] /= (double)num;
-          dz[index] /= (double)num;
-        }
-    for (index = x = 0; x < gcam->width; x++)
-      for (y = 0; y < gcam->height; y++)
-        for (z = 0; z < gcam->depth; z++, index++) {
-          gcamn = &gcam->nodes[x][y][z];
-
-          if (gcamn->invalid == GCAM_POSITION_INVALID) continue;
-
-          gcamn->dx = dx[index];
-          gcamn->dy = dy[index];
-          gcamn->dz = dz[index];
         }
+      }
+    }
+    VectorFree(&v_i);
+    VectorFree(&v_j);
+    VectorFree(&v_k);
+    ROMP_PFLB_end
   }
+  ROMP_PF_end
 
-#endif
-
-  if ((Gx >= 0 && Gy >= 0 && Gz >= 0) && (Gdiag & DIAG_SHOW))
-    printf("after smoothing %d times: grad = (%2.3f, %2.3f, %2.3f)\n",
-           navgs,
-           gcam->nodes[Gx][Gy][Gz].dx,
-           gcam->nodes[Gx][Gy][Gz].dy,
-           gcam->nodes[Gx][Gy][Gz].dz);
-
-#endif
-
-  return (NO_ERROR);
+  // the planes are added in order and the terms weighted and added as
+  // gcamFusedEnergies() and gcamComputeSSE() do
+  nvoxels = gcam->width * gcam->height * gcam->depth;
+  for (n = 0; n < ndts; n++) {
+    ll_sse = s_sse = j_sse = 0.0;
+    sweep->neg[n] = 0;
+    for (x = 0; x < gcam->width; x++) {
+      ll_sse += plane_sse[3 * (ndts * x + n)];
+      s_sse += plane_sse[3 * (ndts * x + n) + 1];
+      j_sse += plane_sse[3 * (ndts * x + n) + 2];
+      sweep->neg[n] += plane_neg[ndts * x + n];
+    }
+    ll_sse = use_ll ? MAX(parms->l_log_likelihood, parms->l_likelihood) * ll_sse : 0.0;
+    s_sse = use_s ? parms->l_smoothness * s_sse : 0.0;
+    j_sse = use_j ? parms->l_jacobian * j_sse : 0.0;
+    sweep->rms[n] = sqrt((ll_sse + s_sse + j_sse) / nvoxels);
+  }
+  free(plane_neg);
+  free(plane_sse);
 }
 
-int GCAMsetStatus(GCA_MORPH *gcam, int status)
+/* whether parms->dt has been swept, and if so its rms and gcam->neg */
+static int gcamSweptTimeStep(GCA_MORPH *gcam, const GCA_MORPH_PARMS *parms, const GCAM_TIMESTEP_SWEEP *sweep, double *prms)
 {
-  int x, y, z;
-  GCA_MORPH_NODE *gcamn;
-
-  for (x = 0; x < gcam->width; x++)
-    for (y = 0; y < gcam->height; y++)
-      for (z = 0; z < gcam->depth; z++) {
-        if (x == Gx && y == Gy && z == Gz) {
-          DiagBreak();
-        }
-        gcamn = &gcam->nodes[x][y][z];
+  int n;
 
-        gcamn->status = status;
-      }
-  return (NO_ERROR);
+  for (n = 0; n < sweep->n; n++) {
+    if (sweep->dt[n] == parms->dt) {
+      gcam->neg = sweep->neg[n];
+      *prms = sweep->rms[n];
+      return (1);
+    }
+  }
+  return (0);
 }
 
-int GCAMsetLabelStatus(GCA_MORPH *gcam, int label, int status)
+/*
+  the rms with the gradient applied at parms->dt. With a sweep it comes
+  from the sweep, which is redone for parms->dt alone if it is not in it.
+  Without saved positions the step is undone afterwards; with them the
+  gcam is left at the step, and the next candidate or
+  gcamRestorePositions() overwrites it
+*/
+static double gcamTimeStepRMS(
+    GCA_MORPH *gcam, MRI *mri, GCA_MORPH_PARMS *parms, const GCAM_REAL *positions, GCAM_TIMESTEP_SWEEP *sweep)
 {
-  int x, y, z;
-  GCA_MORPH_NODE *gcamn;
-
-  for (x = 0; x < gcam->width; x++)
-    for (y = 0; y < gcam->height; y++)
-      for (z = 0; z < gcam->depth; z++) {
-        if (x == Gx && y == Gy && z == Gz) {
-          DiagBreak();
-        }
-        gcamn = &gcam->nodes[x][y][z];
+  double rms;
 
-        if (gcamn->label == label) {
-          gcamn->status = status;
-        }
-      }
-  return (NO_ERROR);
+  if (sweep) {
+    if (gcamSweptTimeStep(gcam, parms, sweep, &rms)) {
+      return (rms);
+    }
+    sweep->n = 1;
+    sweep->dt[0] = parms->dt;
+    gcamSweepTimeSteps(gcam, mri, parms, sweep);
+    gcam->neg = sweep->neg[0];
+    return (sweep->rms[0]);
+  }
+  if (positions) {
+    gcamSetTimeStepPositions(gcam, positions, parms);
+    if (!DZERO(parms->l_area_intensity)) {
+      parms->nlt = gcamCreateNodeLookupTable(gcam, parms->mri, parms->nlt);
+    }
+    return (GCAMcomputeRMS(gcam, mri, parms));
+  }
+  gcamApplyGradient(gcam, parms);
+  rms = GCAMcomputeRMS(gcam, mri, parms);
+  gcamUndoGradient(gcam);
+  return (rms);
 }
+
 #define MAX_SAMPLES 100
 
 #define GCAM_FOTS_OUTPUT 0
@@ -8854,10 +9635,12 @@ double gcamFindOptimalTimeStep(GCA_MORPH *gcam, GCA_MORPH_PARMS *parms, MRI *mri
 
 #ifndef GCAM_FIND_OPTIMAL_TIMESTEP_GPU
   MATRIX *mX, *m_xTx, *m_xTx_inv, *m_xTy, *mP, *m_xT;
-  double rms, min_rms, dt_in[MAX_SAMPLES], rms_out[MAX_SAMPLES], orig_dt, a, b, c, max_dt, start_dt;
+  double rms, min_rms, dt, dt_in[MAX_SAMPLES], rms_out[MAX_SAMPLES], orig_dt, a, b, c, max_dt, start_dt;
   // double start_rms, pct_change;
   VECTOR *vY;
   int N, i, Gxs, Gys, Gzs, suppressed = 0, prev_neg;
+  GCAM_REAL *positions;
+  GCAM_TIMESTEP_SWEEP sweep_steps, *sweep;
   // int  bad;
   long diag;
 #endif
@@ -8888,6 +9671,11 @@ double gcamFindOptimalTimeStep(GCA_MORPH *gcam, GCA_MORPH_PARMS *parms, MRI *mri
   printf("%s: CPU call\n", __FUNCTION__);
 #endif
   gcamClearMomentum(gcam);
+  positions = gcam_timestep_overlay ? gcamSavePositions(gcam) : NULL;
+  sweep = positions && gcam_timestep_sweep && gcamCanSweepTimeSteps(parms) ? &sweep_steps : NULL;
+  if (sweep) {
+    sweep->n = 0;
+  }
   // disable diagnostics so we don't see every time step sampled
   Gxs = Gx;
   Gys = Gy;
@@ -8922,9 +9710,14 @@ double gcamFindOptimalTimeStep(GCA_MORPH *gcam, GCA_MORPH_PARMS *parms, MRI *mri
     // bad = 0;
     prev_neg = 0;
     for (parms->dt = start_dt; parms->dt <= max_dt; parms->dt *= 4) {
-      gcamApplyGradient(gcam, parms);
-      rms = GCAMcomputeRMS(gcam, mri, parms);
-      gcamUndoGradient(gcam);
+      if (sweep && !gcamSweptTimeStep(gcam, parms, sweep, &rms)) {
+        // the steps this pass goes on to, in one sweep
+        for (sweep->n = 0, dt = parms->dt; sweep->n < GCAM_TIMESTEP_SWEEP_SIZE && dt <= max_dt; dt *= 4) {
+          sweep->dt[sweep->n++] = dt;
+        }
+        gcamSweepTimeSteps(gcam, mri, parms, sweep);
+      }
+      rms = gcamTimeStepRMS(gcam, mri, parms, positions, sweep);
       if ((gcam->neg > 0) && 0) {
         // pct_change = 100.0 * (start_rms - min_rms) / start_rms;
         //    if (pct_change < parms->tol)
@@ -9022,37 +9815,39 @@ double gcamFindOptimalTimeStep(GCA_MORPH *gcam, GCA_MORPH_PARMS *parms, MRI *mri
 
   dt_in[0] = min_dt;
   rms_out[0] = min_rms;
-  parms->dt = dt_in[1] = dt_in[0] - dt_in[0] * .2;
-  gcamApplyGradient(gcam, parms);
-  rms = rms_out[1] = GCAMcomputeRMS(gcam, mri, parms);
-  gcamUndoGradient(gcam);
+  dt_in[1] = dt_in[0] - dt_in[0] * .2;
+  dt_in[2] = dt_in[0] - dt_in[0] * .4;
+  dt_in[3] = dt_in[0] + dt_in[0] * .2;
+  dt_in[4] = dt_in[0] + dt_in[0] * .4;
+  if (sweep) {
+    for (sweep->n = 0; sweep->n < 4; sweep->n++) {
+      sweep->dt[sweep->n] = dt_in[sweep->n + 1];
+    }
+    gcamSweepTimeSteps(gcam, mri, parms, sweep);
+  }
+  parms->dt = dt_in[1];
+  rms = rms_out[1] = gcamTimeStepRMS(gcam, mri, parms, positions, sweep);
   if (rms < min_rms && (gcam->neg == 0 || parms->noneg <= 0)) {
     min_rms = rms;
     min_dt = parms->dt;
   }
 
-  parms->dt = dt_in[2] = dt_in[0] - dt_in[0] * .4;
-  gcamApplyGradient(gcam, parms);
-  rms = rms_out[2] = GCAMcomputeRMS(gcam, mri, parms);
+  parms->dt = dt_in[2];
+  rms = rms_out[2] = gcamTimeStepRMS(gcam, mri, parms, positions, sweep);
   if (rms < min_rms && (gcam->neg == 0 || parms->noneg <= 0)) {
     min_rms = rms;
     min_dt = parms->dt;
   }
-  gcamUndoGradient(gcam);
 
-  parms->dt = dt_in[3] = dt_in[0] + dt_in[0] * .2;
-  gcamApplyGradient(gcam, parms);
-  rms = rms_out[3] = GCAMcomputeRMS(gcam, mri, parms);
-  gcamUndoGradient(gcam);
+  parms->dt = dt_in[3];
+  rms = rms_out[3] = gcamTimeStepRMS(gcam, mri, parms, positions, sweep);
   if (rms < min_rms && (gcam->neg == 0 || parms->noneg <= 0)) {
     min_rms = rms;
     min_dt = parms->dt;
   }
 
-  parms->dt = dt_in[4] = dt_in[0] + dt_in[0] * .4;
-  gcamApplyGradient(gcam, parms);
-  rms = rms_out[4] = GCAMcomputeRMS(gcam, mri, parms);
-  gcamUndoGradient(gcam);
+  parms->dt = dt_in[4];
+  rms = rms_out[4] = gcamTimeStepRMS(gcam, mri, parms, positions, sweep);
   if (rms < min_rms && (gcam->neg == 0 || parms->noneg <= 0)) {
     min_rms = rms;
     min_dt = parms->dt;
@@ -9090,9 +9885,7 @@ double gcamFindOptimalTimeStep(GCA_MORPH *gcam, GCA_MORPH_PARMS *parms, MRI *mri
     MatrixFree(&m_xTy);
     if (finitep(a) && !FZERO(a)) {
       parms->dt = -b / a;
-      gcamApplyGradient(gcam, parms);
-      rms = GCAMcomputeRMS(gcam, mri, parms);
-      gcamUndoGradient(gcam);
+      rms = gcamTimeStepRMS(gcam, mri, parms, positions, sweep);
       if (rms < min_rms && (gcam->neg == 0 || parms->noneg <= 0)) {
         min_rms = rms;
         min_dt = parms->dt;
@@ -9104,6 +9897,10 @@ double gcamFindOptimalTimeStep(GCA_MORPH *gcam, GCA_MORPH_PARMS *parms, MRI *mri
   MatrixFree(&mX);
   VectorFree(&vY);
 
+  if (positions) {
+    gcamRestorePositions(gcam, positions);
+    free(positions);
+  }
   gcamComputeMetricProperties(gcam);
   parms->dt = orig_dt;
   Gx = Gxs;
@@ -10243,24 +11040,22 @@ gcamMLElabelAtLocation(GCA_MORPH *gcam, int x, int y, int z, float *vals)
 
 int GCAMstoreMetricProperties(GCA_MORPH *gcam)
 {
-  int x, y, z;
+  int i;
+  GCA_MORPH_NODE *gcamn;
 
   gcamComputeMetricProperties(gcam);
-  for (x = 0; x < gcam->width; x++)
-    for (y = 0; y < gcam->height; y++)
-      for (z = 0; z < gcam->depth; z++) {
-        if (x == Gx && y == Gy && z == Gz) DiagBreak();
-        if (FZERO(gcam->det))  // only if no linear transform existed
-        {
-          gcam->nodes[x][y][z].orig_area = gcam->nodes[x][y][z].area;
-          gcam->nodes[x][y][z].orig_area1 = gcam->nodes[x][y][z].area1;
-          gcam->nodes[x][y][z].orig_area2 = gcam->nodes[x][y][z].area2;
-        }
-        if ((FZERO(gcam->nodes[x][y][z].orig_area) || (gcam->nodes[x][y][z].orig_area < 0)) &&
-            (gcam->nodes[x][y][z].invalid == 0)) {
-          gcam->nodes[x][y][z].invalid = GCAM_AREA_INVALID;
-        }
-      }
+  for (i = 0; i < GCAM_NNODES(gcam); i++) {
+    gcamn = GCAM_NODE(gcam, i);
+    if (FZERO(gcam->det))  // only if no linear transform existed
+    {
+      gcamn->orig_area = gcamn->area;
+      gcamn->orig_area1 = gcamn->area1;
+      gcamn->orig_area2 = gcamn->area2;
+    }
+    if ((FZERO(gcamn->orig_area) || (gcamn->orig_area < 0)) && (gcamn->invalid == 0)) {
+      gcamn->invalid = GCAM_AREA_INVALID;
+    }
+  }
   return (NO_ERROR);
 }
 
@@ -10281,137 +11076,131 @@ int GCAMcopyNodePositions(GCA_MORPH *gcam, int from, int to)
   printf("%s: On GPU\n", __FUNCTION__);
   GCAMcopyNodePositionsGPU(gcam, from, to);
 #else
-  int x, y, z;
+  int i;
   GCA_MORPH_NODE *gcamn;
 
-  for (x = 0; x < gcam->width; x++)
-    for (y = 0; y < gcam->height; y++)
-      for (z = 0; z < gcam->depth; z++) {
-        if (x == Gx && y == Gy && z == Gz) {
-          DiagBreak();
+  for (i = 0; i < GCAM_NNODES(gcam); i++) {
+    gcamn = GCAM_NODE(gcam, i);
+    switch (from) {
+      default:
+        ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAMcopyNodePositions: unsupported from %d", from));
+      case ORIGINAL_POSITIONS:
+        switch (to) {
+          default:
+            ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAMcopyNodePositions: unsupported to %d", to));
+          case SAVED_ORIGINAL_POSITIONS:
+            gcamn->saved_origx = gcamn->origx;
+            gcamn->saved_origy = gcamn->origy;
+            gcamn->saved_origz = gcamn->origz;
+            break;
+          case SAVED_POSITIONS:
+            gcamn->xs = gcamn->origx;
+            gcamn->ys = gcamn->origy;
+            gcamn->zs = gcamn->origz;
+            break;
+          case CURRENT_POSITIONS:
+            gcamn->x = gcamn->origx;
+            gcamn->y = gcamn->origy;
+            gcamn->z = gcamn->origz;
+            break;
         }
-        gcamn = &gcam->nodes[x][y][z];
+        break;
 
-        switch (from) {
+      case SAVED_ORIGINAL_POSITIONS:
+        switch (to) {
           default:
-            ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAMcopyNodePositions: unsupported from %d", from));
+            ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAMcopyNodePositions: unsupported to %d", to));
+          case SAVED_POSITIONS:
+            gcamn->xs = gcamn->saved_origx;
+            gcamn->ys = gcamn->saved_origy;
+            gcamn->zs = gcamn->saved_origz;
+            break;
+          case CURRENT_POSITIONS:
+            gcamn->x = gcamn->saved_origx;
+            gcamn->y = gcamn->saved_origy;
+            gcamn->z = gcamn->saved_origz;
+            break;
           case ORIGINAL_POSITIONS:
-            switch (to) {
-              default:
-                ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAMcopyNodePositions: unsupported to %d", to));
-              case SAVED_ORIGINAL_POSITIONS:
-                gcamn->saved_origx = gcamn->origx;
-                gcamn->saved_origy = gcamn->origy;
-                gcamn->saved_origz = gcamn->origz;
-                break;
-              case SAVED_POSITIONS:
-                gcamn->xs = gcamn->origx;
-                gcamn->ys = gcamn->origy;
-                gcamn->zs = gcamn->origz;
-                break;
-              case CURRENT_POSITIONS:
-                gcamn->x = gcamn->origx;
-                gcamn->y = gcamn->origy;
-                gcamn->z = gcamn->origz;
-                break;
-            }
+            gcamn->origx = gcamn->saved_origx;
+            gcamn->origy = gcamn->saved_origy;
+            gcamn->origz = gcamn->saved_origz;
             break;
+        }
+        break;
 
+      case SAVED_POSITIONS:
+        switch (to) {
+          default:
+            ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAMcopyNodePositions: unsupported to %d", to));
+          case ORIGINAL_POSITIONS:
+            gcamn->origx = gcamn->xs;
+            gcamn->origy = gcamn->ys;
+            gcamn->origz = gcamn->zs;
+            break;
+          case CURRENT_POSITIONS:
+            gcamn->x = gcamn->xs;
+            gcamn->y = gcamn->ys;
+            gcamn->z = gcamn->zs;
+            break;
           case SAVED_ORIGINAL_POSITIONS:
-            switch (to) {
-              default:
-                ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAMcopyNodePositions: unsupported to %d", to));
-              case SAVED_POSITIONS:
-                gcamn->xs = gcamn->saved_origx;
-                gcamn->ys = gcamn->saved_origy;
-                gcamn->zs = gcamn->saved_origz;
-                break;
-              case CURRENT_POSITIONS:
-                gcamn->x = gcamn->saved_origx;
-                gcamn->y = gcamn->saved_origy;
-                gcamn->z = gcamn->saved_origz;
-                break;
-              case ORIGINAL_POSITIONS:
-                gcamn->origx = gcamn->saved_origx;
-                gcamn->origy = gcamn->saved_origy;
-                gcamn->origz = gcamn->saved_origz;
-                break;
-            }
+            gcamn->saved_origx = gcamn->xs;
+            gcamn->saved_origy = gcamn->ys;
+            gcamn->saved_origz = gcamn->zs;
             break;
+        }
+        break;
 
-          case SAVED_POSITIONS:
-            switch (to) {
-              default:
-                ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAMcopyNodePositions: unsupported to %d", to));
-              case ORIGINAL_POSITIONS:
-                gcamn->origx = gcamn->xs;
-                gcamn->origy = gcamn->ys;
-                gcamn->origz = gcamn->zs;
-                break;
-              case CURRENT_POSITIONS:
-                gcamn->x = gcamn->xs;
-                gcamn->y = gcamn->ys;
-                gcamn->z = gcamn->zs;
-                break;
-              case SAVED_ORIGINAL_POSITIONS:
-                gcamn->saved_origx = gcamn->xs;
-                gcamn->saved_origy = gcamn->ys;
-                gcamn->saved_origz = gcamn->zs;
-                break;
-            }
+      case SAVED2_POSITIONS:
+        switch (to) {
+          default:
+            ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAMcopyNodePositions: unsupported to %d", to));
+          case ORIGINAL_POSITIONS:
+            gcamn->origx = gcamn->xs2;
+            gcamn->origy = gcamn->ys2;
+            gcamn->origz = gcamn->zs2;
+            break;
+          case CURRENT_POSITIONS:
+            gcamn->x = gcamn->xs2;
+            gcamn->y = gcamn->ys2;
+            gcamn->z = gcamn->zs2;
             break;
+          case SAVED_ORIGINAL_POSITIONS:
+            gcamn->saved_origx = gcamn->xs2;
+            gcamn->saved_origy = gcamn->ys2;
+            gcamn->saved_origz = gcamn->zs2;
+            break;
+        }
+        break;
 
+      case CURRENT_POSITIONS:
+        switch (to) {
+          default:
+            ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAMcopyNodePositions: unsupported to %d", to));
+          case ORIGINAL_POSITIONS:
+            gcamn->origx = gcamn->x;
+            gcamn->origy = gcamn->y;
+            gcamn->origz = gcamn->z;
+            break;
+          case SAVED_POSITIONS:
+            gcamn->xs = gcamn->x;
+            gcamn->ys = gcamn->y;
+            gcamn->zs = gcamn->z;
+            break;
           case SAVED2_POSITIONS:
-            switch (to) {
-              default:
-                ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAMcopyNodePositions: unsupported to %d", to));
-              case ORIGINAL_POSITIONS:
-                gcamn->origx = gcamn->xs2;
-                gcamn->origy = gcamn->ys2;
-                gcamn->origz = gcamn->zs2;
-                break;
-              case CURRENT_POSITIONS:
-                gcamn->x = gcamn->xs2;
-                gcamn->y = gcamn->ys2;
-                gcamn->z = gcamn->zs2;
-                break;
-              case SAVED_ORIGINAL_POSITIONS:
-                gcamn->saved_origx = gcamn->xs2;
-                gcamn->saved_origy = gcamn->ys2;
-                gcamn->saved_origz = gcamn->zs2;
-                break;
-            }
+            gcamn->xs2 = gcamn->x;
+            gcamn->ys2 = gcamn->y;
+            gcamn->zs2 = gcamn->z;
             break;
-
-          case CURRENT_POSITIONS:
-            switch (to) {
-              default:
-                ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "GCAMcopyNodePositions: unsupported to %d", to));
-              case ORIGINAL_POSITIONS:
-                gcamn->origx = gcamn->x;
-                gcamn->origy = gcamn->y;
-                gcamn->origz = gcamn->z;
-                break;
-              case SAVED_POSITIONS:
-                gcamn->xs = gcamn->x;
-                gcamn->ys = gcamn->y;
-                gcamn->zs = gcamn->z;
-                break;
-              case SAVED2_POSITIONS:
-                gcamn->xs2 = gcamn->x;
-                gcamn->ys2 = gcamn->y;
-                gcamn->zs2 = gcamn->z;
-                break;
-              case SAVED_ORIGINAL_POSITIONS:
-                gcamn->saved_origx = gcamn->x;
-                gcamn->saved_origy = gcamn->y;
-                gcamn->saved_origz = gcamn->z;
-                break;
-            }
-
+          case SAVED_ORIGINAL_POSITIONS:
+            gcamn->saved_origx = gcamn->x;
+            gcamn->saved_origy = gcamn->y;
+            gcamn->saved_origz = gcamn->z;
             break;
         }
-      }
+
+        break;
+    }
+  }
 
 #endif
   return (NO_ERROR);
@@ -14082,19 +14871,14 @@ int GCAMaddStatus(GCA_MORPH *gcam, int status)
 
 int GCAMremoveStatus(GCA_MORPH *gcam, int status)
 {
-  int x, y, z;
+  int i;
   GCA_MORPH_NODE *gcamn;
 
   status = ~status; /* remove the original status bits */
-  for (x = 0; x < gcam->width; x++)
-    for (y = 0; y < gcam->height; y++)
-      for (z = 0; z < gcam->depth; z++) {
-        if (x == Gx && y == Gy && z == Gz) {
-          DiagBreak();
-        }
-        gcamn = &gcam->nodes[x][y][z];
-        gcamn->status &= status;
-      }
+  for (i = 0; i < GCAM_NNODES(gcam); i++) {
+    gcamn = GCAM_NODE(gcam, i);
+    gcamn->status &= status;
+  }
   return (NO_ERROR);
 }
 
@@ -17325,37 +18109,26 @@ MRI *GCAMcreateDistanceTransforms(
   int frame, label;
   char fname[STRLEN];
 
-  mri_all_dtrans =
-      MRIallocSequence(mri_source->width, mri_source->height, mri_source->depth, MRI_FLOAT, NDTRANS_LABELS);
+  printf("creating distance transforms for %d labels...\n", NDTRANS_LABELS);
+  mri_all_dtrans = MRIdistanceTransformLabels(
+      mri_source, NULL, dtrans_labels, NDTRANS_LABELS, max_dist, DTRANS_MODE_SIGNED, NULL);
   MRIcopyHeader(mri_target, mri_all_dtrans);  // should this be mri_source????
 
-  mri_atlas_dist_map =
-      MRIallocSequence(mri_target->width, mri_target->height, mri_target->depth, MRI_FLOAT, NDTRANS_LABELS);
+  mri_atlas_dist_map = MRIdistanceTransformLabels(
+      mri_target, NULL, dtrans_labels, NDTRANS_LABELS, max_dist, DTRANS_MODE_SIGNED, NULL);
+  MRInormalizeInteriorDistanceTransform(mri_atlas_dist_map, mri_all_dtrans, mri_atlas_dist_map);
 
-  MRIcopyHeader(mri_target, mri_all_dtrans);
-
-  ROMP_PF_begin
-#ifdef HAVE_OPENMP
-  label = 0;
-  mri_atlas_dtrans = mri_dtrans = NULL;
-  #pragma omp parallel for if_ROMP(experimental) firstprivate(                                                                            \
-    label, fname, mri_atlas_dtrans, mri_source, mri_target, mri_all_dtrans, mri_dtrans, max_dist, Gdiag_no, gcam) \
-    schedule(static, 1)
-#endif
+  mri_dtrans = MRIalloc(mri_source->width, mri_source->height, mri_source->depth, MRI_FLOAT);
+  mri_atlas_dtrans = MRIalloc(mri_target->width, mri_target->height, mri_target->depth, MRI_FLOAT);
+  MRIcopyHeader(mri_target, mri_dtrans);
+  MRIcopyHeader(mri_target, mri_atlas_dtrans);
   for (frame = 0; frame < NDTRANS_LABELS; frame++) {
-    ROMP_PFLB_begin
-    
     label = dtrans_labels[frame];
-    printf("creating distance transform for %s, frame %d...\n", cma_label_to_name(label), frame);
-
-    mri_dtrans = MRIdistanceTransform(mri_source, NULL, label, max_dist, DTRANS_MODE_SIGNED, NULL);
-    MRIcopyFrame(mri_dtrans, mri_all_dtrans, 0, frame);
-    mri_atlas_dtrans = MRIdistanceTransform(mri_target, NULL, label, max_dist, DTRANS_MODE_SIGNED, NULL);
-    MRInormalizeInteriorDistanceTransform(mri_atlas_dtrans, mri_dtrans, mri_atlas_dtrans);
-    MRIcopyFrame(mri_atlas_dtrans, mri_atlas_dist_map, 0, frame);
-    GCAMsetTargetDistancesForLabel(gcam, mri_target, mri_atlas_dtrans, dtrans_labels[frame]);
+    MRIcopyFrame(mri_atlas_dist_map, mri_atlas_dtrans, frame, 0);
+    GCAMsetTargetDistancesForLabel(gcam, mri_target, mri_atlas_dtrans, label);
 
     if (Gdiag & DIAG_WRITE && (DIAG_VERBOSE_ON || Gdiag_no == label)) {
+      MRIcopyFrame(mri_all_dtrans, mri_dtrans, frame, 0);
       sprintf(fname, "source.%s.mgz", cma_label_to_name(label));
       printf("writing distance transform to %s\n", fname);
       MRIwrite(mri_dtrans, fname);
@@ -17363,12 +18136,9 @@ MRI *GCAMcreateDistanceTransforms(
       printf("writing distance transform to %s\n", fname);
       MRIwrite(mri_atlas_dtrans, fname);
     }
-    MRIfree(&mri_dtrans);
-    MRIfree(&mri_atlas_dtrans);
-    
-    ROMP_PFLB_end
   }
-  ROMP_PF_end
+  MRIfree(&mri_dtrans);
+  MRIfree(&mri_atlas_dtrans);
 
   mri_all_dtrans->outside_val = max_dist;
   mri_atlas_dist_map->outside_val = max_dist;
@@ -18324,17 +19094,16 @@ MRI *MRIcreateDistanceTransforms(MRI *mri, MRI *mri_all_dtrans, float max_dist,
   if (Gdiag & DIAG_WRITE && DIAG_VERBOSE_ON) {
     MRIwrite(mri, "labels.mgz");
   }
-  for (frame = 0; frame < nlabels; frame++) {
-    printf("creating distance transform for %s, frame %d...\n", cma_label_to_name(labels[frame]), frame);
-    if (dtrans_labels[frame] == Gdiag_no) {
-      DiagBreak();
-    }
-    mri_dtrans = MRIdistanceTransform(mri, NULL, labels[frame], max_dist, DTRANS_MODE_SIGNED, NULL);
-    if (Gdiag & DIAG_WRITE && DIAG_VERBOSE_ON) {
-      sprintf(fname, "%s.mgz", cma_label_to_name(dtrans_labels[frame]));
+  printf("creating distance transforms for %d labels...\n", nlabels);
+  MRIdistanceTransformLabels(mri, mri_all_dtrans, labels, nlabels, max_dist, DTRANS_MODE_SIGNED, NULL);
+  if (Gdiag & DIAG_WRITE && DIAG_VERBOSE_ON) {
+    mri_dtrans = MRIalloc(mri->width, mri->height, mri->depth, MRI_FLOAT);
+    MRIcopyHeader(mri, mri_dtrans);
+    for (frame = 0; frame < nlabels; frame++) {
+      sprintf(fname, "%s.mgz", cma_label_to_name(labels[frame]));
+      MRIcopyFrame(mri_all_dtrans, mri_dtrans, frame, 0);
       MRIwrite(mri_dtrans, fname);
     }
-    MRIcopyFrame(mri_dtrans, mri_all_dtrans, 0, frame);
     MRIfree(&mri_dtrans);
   }
 
@@ -718,7 +718,8 @@ int GTMfree(GTM **pGTM)
   MRIfree(&gtm->yvol);
   // MRIfree(&gtm->gtmseg);
   MRIfree(&gtm->mask);
-  MatrixFree(&gtm->X);
+  GTMsparseFree(&gtm->X);
+  GTMsparseFree(&gtm->X0);
   MatrixFree(&gtm->y);
   MatrixFree(&gtm->XtX);
   MatrixFree(&gtm->iXtX);
@@ -727,6 +728,7 @@ int GTMfree(GTM **pGTM)
   MatrixFree(&gtm->res);
   MatrixFree(&gtm->yhat);
   MRIfree(&gtm->ysynth);
+  if (gtm->nthseglut) free(gtm->nthseglut);
   free(gtm);
   *pGTM = NULL;
   return (0);
@@ -772,11 +774,23 @@ int GTMpsfStd(GTM *gtm)
 /*
   \fn int GTMsegidlist(GTM *gtm)
   \brief Compute a sorted list of segmentation IDs from the segmentation
-  itself (excludes 0). Just runs MRIsegIdListNot0().
+  itself (excludes 0). Just runs MRIsegIdListNot0(). Also builds the
+  segid-to-nthseg lookup table used by GTMsegid2nthseg().
 */
 int GTMsegidlist(GTM *gtm)
 {
+  int nthseg;
+
   gtm->segidlist = MRIsegIdListNot0(gtm->anatseg, &gtm->nsegs, 0);
+
+  if (gtm->nthseglut) free(gtm->nthseglut);
+  gtm->nnthseglut = 0;
+  for (nthseg = 0; nthseg < gtm->nsegs; nthseg++)
+    gtm->nnthseglut = MAX(gtm->nnthseglut, gtm->segidlist[nthseg] + 1);
+  gtm->nthseglut = (int *)calloc(sizeof(int), MAX(gtm->nnthseglut, 1));
+  for (nthseg = 0; nthseg < gtm->nnthseglut; nthseg++) gtm->nthseglut[nthseg] = -1;
+  for (nthseg = 0; nthseg < gtm->nsegs; nthseg++)
+    if (gtm->segidlist[nthseg] >= 0) gtm->nthseglut[gtm->segidlist[nthseg]] = nthseg;
   return (0);
 }
 /*------------------------------------------------------------------*/
@@ -829,7 +843,10 @@ int GTMnPad(GTM *gtm)
 /*
   \fn int GTMsolve(GTM *gtm)
   \brief Solves the GTM using a GLM. X must already have been created.
-  Computes Xt, XtX, iXtX, beta, yhat, res, dof, rvar, kurtosis, and skew.
+  Computes XtX, iXtX, beta, yhat, res, dof, rvar, kurtosis, and skew.
+  XtX and Xty are computed from the sparse X. If gtm->SolveCG, beta is
+  solved for with conjugate gradients, and iXtX (only needed for the
+  VRF, beta variances and contrasts) is skipped while optimizing.
   Also will rescale if rescaling. Returns 1 and computes condition
   number if matrix cannot be inverted. Otherwise returns 0.
 */
@@ -847,24 +864,39 @@ int GTMsolve(GTM *gtm)
   if (!gtm->Optimizing) printf("Computing  XtX ... ");
   fflush(stdout);
   TimerStart(&timer);
-  gtm->XtX = MatrixMtM(gtm->X, gtm->XtX);
+  gtm->XtX = GTMsparseMtN(gtm->X, gtm->X, gtm->XtX);
   if (!gtm->Optimizing) printf(" %4.1f sec\n", TimerStop(&timer) / 1000.0);
   fflush(stdout);
-
-  gtm->iXtX = MatrixInverse(gtm->XtX, gtm->iXtX);
-  if (gtm->iXtX == NULL) {
-    if (gtm->Optimizing) return (1);
-    gtm->XtXcond = MatrixConditionNumber(gtm->XtX);
-    printf("ERROR: matrix cannot be inverted, cond=%g\n", gtm->XtXcond);
-    return (1);
+  gtm->Xty = GTMsparseAtB(gtm->X, gtm->y, gtm->Xty);
+
+  if (!gtm->SolveCG || !gtm->Optimizing) {
+    gtm->iXtX = MatrixInverse(gtm->XtX, gtm->iXtX);
+    if (gtm->iXtX == NULL) {
+      if (gtm->Optimizing) return (1);
+      gtm->XtXcond = MatrixConditionNumber(gtm->XtX);
+      printf("ERROR: matrix cannot be inverted, cond=%g\n", gtm->XtXcond);
+      return (1);
+    }
   }
-  gtm->Xty = MatrixAtB(gtm->X, gtm->y, gtm->Xty);
-  gtm->beta = MatrixMultiplyD(gtm->iXtX, gtm->Xty, gtm->beta);
+  if (gtm->SolveCG) {
+    if (gtm->beta == NULL || gtm->beta->rows != gtm->XtX->rows || gtm->beta->cols != gtm->Xty->cols) {
+      if (gtm->beta) MatrixFree(&gtm->beta);
+      gtm->beta = MatrixAlloc(gtm->XtX->rows, gtm->Xty->cols, MATRIX_REAL);
+    }
+    if (GTMsolveCG(gtm->XtX, gtm->Xty, gtm->beta, 1e-10, 10 * gtm->XtX->rows)) {
+      if (gtm->Optimizing) return (1);
+      gtm->XtXcond = MatrixConditionNumber(gtm->XtX);
+      printf("ERROR: conjugate gradients did not converge, cond=%g\n", gtm->XtXcond);
+      return (1);
+    }
+  }
+  else
+    gtm->beta = MatrixMultiplyD(gtm->iXtX, gtm->Xty, gtm->beta);
   if (gtm->rescale) GTMrescale(gtm);
   GTMrefTAC(gtm);
   if (gtm->DoSteadyState) GTMsteadyState(gtm);
 
-  gtm->yhat = MatrixMultiplyD(gtm->X, gtm->beta, gtm->yhat);
+  gtm->yhat = GTMsparseMultiply(gtm->X, gtm->beta, gtm->yhat);
   gtm->res = MatrixSubtract(gtm->y, gtm->yhat, gtm->res);
   gtm->dof = gtm->X->rows - gtm->X->cols;
   if (gtm->rvar == NULL) gtm->rvar = MatrixAlloc(1, gtm->res->cols, MATRIX_REAL);
@@ -981,14 +1013,12 @@ int GTMsegrvar(GTM *gtm)
       for (r = 0; r < gtm->yvol->height; r++) {
         if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
         segid = MRIgetVoxVal(gtm->gtmseg, c, r, s, 0);
-        if (segid != 0) {
-          for (nthseg = 0; nthseg < gtm->nsegs; nthseg++)
-            if (gtm->segidlist[nthseg] == segid) break;
-          gtm->nperseg[nthseg]++;
-        }
+        nthseg = -1;
+        if (segid != 0) nthseg = GTMsegid2nthseg(gtm, segid);
+        if (nthseg >= 0) gtm->nperseg[nthseg]++;
         for (f = 0; f < gtm->beta->cols; f++) {
           v = gtm->res->rptr[k + 1][f + 1];
-          if (segid != 0) gtm->segrvar->rptr[nthseg + 1][f + 1] += v * v;
+          if (nthseg >= 0) gtm->segrvar->rptr[nthseg + 1][f + 1] += v * v;
         }
         k++;
       }  // r
@@ -1144,8 +1174,8 @@ int GTMrbv(GTM *gtm)
             if (s < region->z || s >= region->z + region->dz) continue;
           }
 
-          for (nthseg = 0; nthseg < gtm->nsegs; nthseg++)
-            if (gtm->segidlist[nthseg] == segid) break;
+          nthseg = GTMsegid2nthseg(gtm, segid);
+          if (nthseg < 0) continue;
           if (f == 0) nhits->rptr[nthseg + 1][1]++;
 
           v = MRIgetVoxVal(yseg, c, r, s, 0);
@@ -1305,8 +1335,8 @@ int GTMrbv0(GTM *gtm)
       for (r = 0; r < gtm->anatseg->height; r++) {
         segid = MRIgetVoxVal(gtm->anatseg, c, r, s, 0);
         if (segid < 0.5) continue;
-        for (nthseg = 0; nthseg < gtm->nsegs; nthseg++)
-          if (gtm->segidlist[nthseg] == segid) break;
+        nthseg = GTMsegid2nthseg(gtm, segid);
+        if (nthseg < 0) continue;
         nhits->rptr[nthseg + 1][1]++;
         for (f = 0; f < gtm->yvol->nframes; f++) {
           v = MRIgetVoxVal(yseg, c, r, s, f);
@@ -1384,7 +1414,8 @@ int GTMmgxpvc(GTM *gtm, int Target)
 {
   int nthseg, segid, r, tt, f;
   MATRIX *betaNotTarg, *yNotTarg, *ydiff;
-  double sum;
+  double sum, *tsum;
+  long n;
 
   // Set beta values to 0 if they are not in the target tissue type(s)
   betaNotTarg = MatrixAlloc(gtm->beta->rows, gtm->beta->cols, MATRIX_REAL);
@@ -1398,21 +1429,24 @@ int GTMmgxpvc(GTM *gtm, int Target)
   }
 
   // Compute the estimate of the image without the target
-  yNotTarg = MatrixMultiplyD(gtm->X, betaNotTarg, NULL);
+  yNotTarg = GTMsparseMultiply(gtm->X, betaNotTarg, NULL);
   // Subtract to resdiualize the PET wrt the non-target tissue
   ydiff = MatrixSubtract(gtm->y, yNotTarg, NULL);
 
+  // Fraction of target tissue type in each voxel, summed a column at a time
+  tsum = (double *)calloc(sizeof(double), gtm->X->rows);
+  for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
+    segid = gtm->segidlist[nthseg];
+    tt = gtm->ctGTMSeg->entries[segid]->TissueType;
+    if (Target == 1 && tt != 1) continue;
+    if (Target == 2 && tt != 2) continue;
+    if (Target == 3 && tt != 1 && tt != 2) continue;
+    for (n = gtm->X->colptr[nthseg]; n < gtm->X->colptr[nthseg + 1]; n++) tsum[gtm->X->rowind[n]] += gtm->X->val[n];
+  }
+
   // Scale by the fraction of target tissue type in voxel
   for (r = 0; r < gtm->X->rows; r++) {
-    sum = 0;
-    for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
-      segid = gtm->segidlist[nthseg];
-      tt = gtm->ctGTMSeg->entries[segid]->TissueType;
-      if (Target == 1 && tt != 1) continue;
-      if (Target == 2 && tt != 2) continue;
-      if (Target == 3 && tt != 1 && tt != 2) continue;
-      sum += gtm->X->rptr[r + 1][nthseg + 1];
-    }
+    sum = tsum[r];
     if (sum < gtm->mgx_gmthresh)
       for (f = 0; f < gtm->nframes; f++) ydiff->rptr[r + 1][f + 1] = 0;
     else
@@ -1426,6 +1460,7 @@ int GTMmgxpvc(GTM *gtm, int Target)
   MatrixFree(&betaNotTarg);
   MatrixFree(&yNotTarg);
   MatrixFree(&ydiff);
+  free(tsum);
 
   return (0);
 }
@@ -1584,11 +1619,10 @@ int GTMmeltzerpvc(GTM *gtm)
       for (s = 0; s < gtm->yvol->depth; s++) {
         if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
         segid = MRIgetVoxVal(gtm->gtmseg, c, r, s, 0);
-        for (k = 0; k < gtm->nsegs; k++)
-          if (segid == gtm->segidlist[k]) break;
+        k = GTMsegid2nthseg(gtm, segid);
         // check if not in list, can happen if PET space>AnatSpace and 0
         // not defined in anatseg
-        if (k == gtm->nsegs) continue;
+        if (k < 0) continue;
         nhits = MRIgetVoxVal(nhitseg, k, 0, 0, 0) + 1;
         vgmwmpsf = MRIgetVoxVal(gmwmpvfpsf, c, r, s, 0);
         if (vgmwmpsf < gtm->MeltzerMaskThresh) continue;
@@ -1644,7 +1678,7 @@ int GTMsynth(GTM *gtm, int NoiseSeed, int nReps)
     MRIcopyHeader(gtm->yvol, gtm->ysynth);
     MRIcopyPulseParameters(gtm->yvol, gtm->ysynth);
   }
-  yhat = MatrixMultiply(gtm->X0, gtm->beta, NULL);
+  yhat = GTMsparseMultiply(gtm->X0, gtm->beta, NULL);
   GTMmat2vol(gtm, yhat, gtm->ysynth);
   MatrixFree(&yhat);
 
@@ -1722,33 +1756,46 @@ int GTMcheckX(MATRIX *X)
 /*
   \fn int GTMbuildX(GTM *gtm)
   \brief Builds the GTM design matrix both with (X) and without (X0) PSF.  If
-  gtm->DoVoxFracCor=1 then corrects for volume fraction effect.
+  gtm->DoVoxFracCor=1 then corrects for volume fraction effect. Both are
+  sparse (see GTM_SPARSE). Each column is filled only from the bounding
+  box of its seg (which is all the smoothing can reach), so neither the
+  dense matrix nor a pass over the whole volume per seg is needed. X0
+  is not rebuilt when optimizing.
 */
 int GTMbuildX(GTM *gtm)
 {
-  int nthseg, err;
+  int nthseg, err, c, r, s, k, *vox2row, **segrows, **segrows0, *segn, *segn0;
+  float **segval, **segval0;
+  long nnz, nnz0;
   struct timeb timer;
 
-  if (gtm->X == NULL || gtm->X->rows != gtm->nmask || gtm->X->cols != gtm->nsegs) {
-    // Alloc or realloc X
-    if (gtm->X) MatrixFree(&gtm->X);
-    gtm->X = MatrixAlloc(gtm->nmask, gtm->nsegs, MATRIX_REAL);
-    if (gtm->X == NULL) {
-      printf("ERROR: GTMbuildX(): could not alloc X %d %d\n", gtm->nmask, gtm->nsegs);
-      return (1);
-    }
+  TimerStart(&timer);
+
+  // Row of X of each voxel (or -1). Must be in the same order as GTMvol2mat()
+  vox2row = (int *)calloc(sizeof(int), (size_t)gtm->yvol->width * gtm->yvol->height * gtm->yvol->depth);
+  if (vox2row == NULL) {
+    printf("ERROR: GTMbuildX(): could not alloc row index\n");
+    return (1);
   }
-  if (gtm->X0 == NULL || gtm->X0->rows != gtm->nmask || gtm->X0->cols != gtm->nsegs) {
-    if (gtm->X0) MatrixFree(&gtm->X0);
-    gtm->X0 = MatrixAlloc(gtm->nmask, gtm->nsegs, MATRIX_REAL);
-    if (gtm->X0 == NULL) {
-      printf("ERROR: GTMbuildX(): could not alloc X0 %d %d\n", gtm->nmask, gtm->nsegs);
-      return (1);
+  k = 0;
+  for (s = 0; s < gtm->yvol->depth; s++) {
+    for (c = 0; c < gtm->yvol->width; c++) {
+      for (r = 0; r < gtm->yvol->height; r++) {
+        if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5)
+          vox2row[c + (size_t)gtm->yvol->width * (r + (size_t)gtm->yvol->height * s)] = -1;
+        else
+          vox2row[c + (size_t)gtm->yvol->width * (r + (size_t)gtm->yvol->height * s)] = k++;
+      }
     }
   }
-  gtm->dof = gtm->X->rows - gtm->X->cols;
 
-  TimerStart(&timer);
+  // The nonzero rows and values of each column
+  segrows = (int **)calloc(sizeof(int *), gtm->nsegs);
+  segrows0 = (int **)calloc(sizeof(int *), gtm->nsegs);
+  segval = (float **)calloc(sizeof(float *), gtm->nsegs);
+  segval0 = (float **)calloc(sizeof(float *), gtm->nsegs);
+  segn = (int *)calloc(sizeof(int), gtm->nsegs);
+  segn0 = (int *)calloc(sizeof(int), gtm->nsegs);
 
   err = 0;
   ROMP_PF_begin
@@ -1758,7 +1805,8 @@ int GTMbuildX(GTM *gtm)
   for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
     ROMP_PFLB_begin
     
-    int segid, k, c, r, s;
+    int segid, k, c, r, s, nbb;
+    float v;
     MRI *nthsegpvf = NULL, *nthsegpvfbb = NULL, *nthsegpvfbbsm = NULL, *nthsegpvfbbsmmb = NULL;
     MRI_REGION *region;
     MB2D *mb;
@@ -1811,40 +1859,407 @@ int GTMbuildX(GTM *gtm)
       nthsegpvfbbsm = nthsegpvfbbsmmb;
       MB2Dfree(&mb);
     }
-    // Fill X, creating X in this order makes it consistent with matlab
-    // Note: y must be ordered in the same way. See GTMvol2mat()
-    k = 0;
-    for (s = 0; s < gtm->yvol->depth; s++) {
-      for (c = 0; c < gtm->yvol->width; c++) {
-        for (r = 0; r < gtm->yvol->height; r++) {
-          if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
-          k++;  // have to incr here in case continue below
-          if (c < region->x || c >= region->x + region->dx) continue;
-          if (r < region->y || r >= region->y + region->dy) continue;
-          if (s < region->z || s >= region->z + region->dz) continue;
-          // do not use k+1 here because it has already been incr above
-          if (!gtm->Optimizing)
-            gtm->X0->rptr[k][nthseg + 1] = MRIgetVoxVal(nthsegpvfbb, c - region->x, r - region->y, s - region->z, 0);
-
-          gtm->X->rptr[k][nthseg + 1] = MRIgetVoxVal(nthsegpvfbbsm, c - region->x, r - region->y, s - region->z, 0);
+    // Fill the column from the bounding box. Going in the same slice,
+    // col, row order as GTMvol2mat() keeps the rows increasing.
+    nbb = region->dx * region->dy * region->dz;
+    segrows[nthseg] = (int *)calloc(sizeof(int), MAX(nbb, 1));
+    segval[nthseg] = (float *)calloc(sizeof(float), MAX(nbb, 1));
+    if (!gtm->Optimizing) {
+      segrows0[nthseg] = (int *)calloc(sizeof(int), MAX(nbb, 1));
+      segval0[nthseg] = (float *)calloc(sizeof(float), MAX(nbb, 1));
+    }
+    for (s = region->z; s < region->z + region->dz; s++) {
+      for (c = region->x; c < region->x + region->dx; c++) {
+        for (r = region->y; r < region->y + region->dy; r++) {
+          k = vox2row[c + (size_t)gtm->yvol->width * (r + (size_t)gtm->yvol->height * s)];
+          if (k < 0) continue;
+          if (!gtm->Optimizing) {
+            v = MRIgetVoxVal(nthsegpvfbb, c - region->x, r - region->y, s - region->z, 0);
+            if (v != 0) {
+              segrows0[nthseg][segn0[nthseg]] = k;
+              segval0[nthseg][segn0[nthseg]++] = v;
+            }
+          }
+          v = MRIgetVoxVal(nthsegpvfbbsm, c - region->x, r - region->y, s - region->z, 0);
+          if (v != 0) {
+            segrows[nthseg][segn[nthseg]] = k;
+            segval[nthseg][segn[nthseg]++] = v;
+          }
         }
       }
     }
     MRIfree(&nthsegpvf);
     MRIfree(&nthsegpvfbb);
     MRIfree(&nthsegpvfbbsm);
+    free(region);
     
     ROMP_PFLB_end
   }
   ROMP_PF_end
-  
-  if (!gtm->Optimizing) printf(" Build time %6.4f, err = %d\n", TimerStop(&timer) / 1000.0, err);
+
+  // Pack the columns
+  GTMsparseFree(&gtm->X);
+  if (!err) {
+    for (nnz = 0, nthseg = 0; nthseg < gtm->nsegs; nthseg++) nnz += segn[nthseg];
+    gtm->X = GTMsparseAlloc(gtm->nmask, gtm->nsegs, nnz);
+    if (gtm->X == NULL) {
+      printf("ERROR: GTMbuildX(): could not alloc X %d %d nnz=%ld\n", gtm->nmask, gtm->nsegs, nnz);
+      err++;
+    }
+  }
+  if (!err && !gtm->Optimizing) {
+    GTMsparseFree(&gtm->X0);
+    for (nnz0 = 0, nthseg = 0; nthseg < gtm->nsegs; nthseg++) nnz0 += segn0[nthseg];
+    gtm->X0 = GTMsparseAlloc(gtm->nmask, gtm->nsegs, nnz0);
+    if (gtm->X0 == NULL) {
+      printf("ERROR: GTMbuildX(): could not alloc X0 %d %d nnz=%ld\n", gtm->nmask, gtm->nsegs, nnz0);
+      err++;
+    }
+  }
+  for (nnz = nnz0 = 0, nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
+    if (!err) {
+      gtm->X->colptr[nthseg] = nnz;
+      memcpy(&gtm->X->rowind[nnz], segrows[nthseg], segn[nthseg] * sizeof(int));
+      memcpy(&gtm->X->val[nnz], segval[nthseg], segn[nthseg] * sizeof(float));
+      nnz += segn[nthseg];
+      if (!gtm->Optimizing) {
+        gtm->X0->colptr[nthseg] = nnz0;
+        memcpy(&gtm->X0->rowind[nnz0], segrows0[nthseg], segn0[nthseg] * sizeof(int));
+        memcpy(&gtm->X0->val[nnz0], segval0[nthseg], segn0[nthseg] * sizeof(float));
+        nnz0 += segn0[nthseg];
+      }
+    }
+    if (segrows[nthseg]) free(segrows[nthseg]);
+    if (segval[nthseg]) free(segval[nthseg]);
+    if (segrows0[nthseg]) free(segrows0[nthseg]);
+    if (segval0[nthseg]) free(segval0[nthseg]);
+  }
+  free(segrows);
+  free(segval);
+  free(segrows0);
+  free(segval0);
+  free(segn);
+  free(segn0);
+  free(vox2row);
+  if (err) GTMsparseFree(&gtm->X);
+  else
+    gtm->dof = gtm->X->rows - gtm->X->cols;
+
+  if (!gtm->Optimizing && gtm->X)
+    printf(" Build time %6.4f, err = %d, nnz = %ld (%4.1f%% of %d x %d)\n",
+           TimerStop(&timer) / 1000.0,
+           err,
+           gtm->X->nnz,
+           100.0 * gtm->X->nnz / ((double)gtm->X->rows * gtm->X->cols),
+           gtm->X->rows,
+           gtm->X->cols);
+  else if (!gtm->Optimizing)
+    printf(" Build time %6.4f, err = %d\n", TimerStop(&timer) / 1000.0, err);
   fflush(stdout);
-  if (err) gtm->X = NULL;
 
   return (0);
 }
 
+/*------------------------------------------------------------------------------*/
+/*
+  \fn GTM_SPARSE *GTMsparseAlloc(int rows, int cols, long nnz)
+  \brief Allocates a sparse GTM matrix with room for nnz values. The
+  colptr is set so that all columns are empty.
+*/
+GTM_SPARSE *GTMsparseAlloc(int rows, int cols, long nnz)
+{
+  GTM_SPARSE *X;
+
+  X = (GTM_SPARSE *)calloc(sizeof(GTM_SPARSE), 1);
+  X->rows = rows;
+  X->cols = cols;
+  X->nnz = nnz;
+  X->colptr = (long *)calloc(sizeof(long), cols + 1);
+  X->rowind = (int *)calloc(sizeof(int), MAX(nnz, 1));
+  X->val = (float *)calloc(sizeof(float), MAX(nnz, 1));
+  if (X->colptr == NULL || X->rowind == NULL || X->val == NULL) {
+    GTMsparseFree(&X);
+    return (NULL);
+  }
+  X->colptr[cols] = nnz;
+  return (X);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+  \fn int GTMsparseFree(GTM_SPARSE **pX)
+*/
+int GTMsparseFree(GTM_SPARSE **pX)
+{
+  GTM_SPARSE *X = *pX;
+
+  if (X == NULL) return (0);
+  if (X->colptr) free(X->colptr);
+  if (X->rowind) free(X->rowind);
+  if (X->val) free(X->val);
+  free(X);
+  *pX = NULL;
+  return (0);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMsparseToMatrix(GTM_SPARSE *X, MATRIX *m)
+  \brief The dense matrix, eg, to save X to a file.
+*/
+MATRIX *GTMsparseToMatrix(GTM_SPARSE *X, MATRIX *m)
+{
+  int c;
+  long n;
+
+  if (m == NULL) m = MatrixAlloc(X->rows, X->cols, MATRIX_REAL);
+  if (m == NULL) {
+    printf("ERROR: GTMsparseToMatrix(): could not alloc %d %d\n", X->rows, X->cols);
+    return (NULL);
+  }
+  MatrixClear(m);
+  for (c = 0; c < X->cols; c++)
+    for (n = X->colptr[c]; n < X->colptr[c + 1]; n++) m->rptr[X->rowind[n] + 1][c + 1] = X->val[n];
+  return (m);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMsparseMultiply(GTM_SPARSE *X, MATRIX *B, MATRIX *C)
+  \brief C = X*B. Sums in double in the same order as MatrixMultiplyD()
+  does with the dense X, so the result is the same.
+*/
+MATRIX *GTMsparseMultiply(GTM_SPARSE *X, MATRIX *B, MATRIX *C)
+{
+  int c, f;
+  long n;
+  double *sum, b;
+
+  if (X->cols != B->rows) {
+    printf("ERROR: GTMsparseMultiply(): X cols %d != B rows %d\n", X->cols, B->rows);
+    return (NULL);
+  }
+  if (C == NULL) C = MatrixAlloc(X->rows, B->cols, MATRIX_REAL);
+  if (C == NULL || C->rows != X->rows || C->cols != B->cols) {
+    printf("ERROR: GTMsparseMultiply(): could not alloc or dimension mismatch\n");
+    return (NULL);
+  }
+
+  sum = (double *)calloc(sizeof(double), X->rows);
+  for (f = 0; f < B->cols; f++) {
+    memset(sum, 0, X->rows * sizeof(double));
+    for (c = 0; c < X->cols; c++) {
+      b = B->rptr[c + 1][f + 1];
+      for (n = X->colptr[c]; n < X->colptr[c + 1]; n++) sum[X->rowind[n]] += (double)X->val[n] * b;
+    }
+    for (c = 0; c < X->rows; c++) C->rptr[c + 1][f + 1] = sum[c];
+  }
+  free(sum);
+  return (C);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMsparseAtB(GTM_SPARSE *X, MATRIX *B, MATRIX *C)
+  \brief C = X'*B, the same as MatrixAtB() with the dense X.
+*/
+MATRIX *GTMsparseAtB(GTM_SPARSE *X, MATRIX *B, MATRIX *C)
+{
+  int c;
+
+  if (X->rows != B->rows) {
+    printf("ERROR: GTMsparseAtB(): X rows %d != B rows %d\n", X->rows, B->rows);
+    return (NULL);
+  }
+  if (C == NULL) C = MatrixAlloc(X->cols, B->cols, MATRIX_REAL);
+  if (C == NULL || C->rows != X->cols || C->cols != B->cols) {
+    printf("ERROR: GTMsparseAtB(): could not alloc or dimension mismatch\n");
+    return (NULL);
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible)
+#endif
+  for (c = 0; c < X->cols; c++) {
+    ROMP_PFLB_begin
+    int f;
+    long n;
+    double sum;
+    for (f = 0; f < B->cols; f++) {
+      sum = 0;
+      for (n = X->colptr[c]; n < X->colptr[c + 1]; n++) sum += (double)X->val[n] * B->rptr[X->rowind[n] + 1][f + 1];
+      C->rptr[c + 1][f + 1] = sum;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  return (C);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+  \fn MATRIX *GTMsparseMtN(GTM_SPARSE *M, GTM_SPARSE *N, MATRIX *MtN)
+  \brief MtN = M'*N, eg, XtX = X'*X. Only pairs of columns whose rows
+  overlap are computed. Column m of M is spread into a dense vector and
+  dotted with the nonzeros of column n of N, which sums in the same
+  order as MatrixMtM() does, so XtX is the same as with the dense X.
+  When M == N, only half is computed.
+*/
+MATRIX *GTMsparseMtN(GTM_SPARSE *M, GTM_SPARSE *N, MATRIX *MtN)
+{
+  int m, nthreads;
+  double **work;
+
+  if (M->rows != N->rows) {
+    printf("ERROR: GTMsparseMtN(): M rows %d != N rows %d\n", M->rows, N->rows);
+    return (NULL);
+  }
+  if (MtN == NULL) MtN = MatrixAlloc(M->cols, N->cols, MATRIX_REAL);
+  if (MtN == NULL || MtN->rows != M->cols || MtN->cols != N->cols) {
+    printf("ERROR: GTMsparseMtN(): could not alloc or dimension mismatch\n");
+    return (NULL);
+  }
+
+  nthreads = 1;
+#ifdef HAVE_OPENMP
+  nthreads = omp_get_max_threads();
+#endif
+  work = (double **)calloc(sizeof(double *), nthreads);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(dynamic)
+#endif
+  for (m = 0; m < M->cols; m++) {
+    ROMP_PFLB_begin
+    int n, tid = 0, mmin, mmax;
+    long k;
+    double sum, *w;
+#ifdef HAVE_OPENMP
+    tid = omp_get_thread_num();
+#endif
+    if (work[tid] == NULL) work[tid] = (double *)calloc(sizeof(double), M->rows);
+    w = work[tid];
+
+    for (k = M->colptr[m]; k < M->colptr[m + 1]; k++) w[M->rowind[k]] = M->val[k];
+    mmin = M->rows;
+    mmax = -1;
+    if (M->colptr[m + 1] > M->colptr[m]) {
+      mmin = M->rowind[M->colptr[m]];
+      mmax = M->rowind[M->colptr[m + 1] - 1];
+    }
+    for (n = (M == N ? m : 0); n < N->cols; n++) {
+      sum = 0;
+      if (N->colptr[n + 1] > N->colptr[n] && N->rowind[N->colptr[n]] <= mmax &&
+          N->rowind[N->colptr[n + 1] - 1] >= mmin) {
+        for (k = N->colptr[n]; k < N->colptr[n + 1]; k++) {
+          if (w[N->rowind[k]] == 0) continue;
+          sum += w[N->rowind[k]] * N->val[k];
+        }
+      }
+      MtN->rptr[m + 1][n + 1] = sum;
+      if (M == N) MtN->rptr[n + 1][m + 1] = sum;
+    }
+    for (k = M->colptr[m]; k < M->colptr[m + 1]; k++) w[M->rowind[k]] = 0;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  for (m = 0; m < nthreads; m++)
+    if (work[m]) free(work[m]);
+  free(work);
+  return (MtN);
+}
+
+/*------------------------------------------------------------------------------*/
+/*
+  \fn int GTMsolveCG(MATRIX *A, MATRIX *B, MATRIX *X, double tol, int maxiter)
+  \brief Solves A*X = B for symmetric positive definite A (eg, XtX) with
+  conjugate gradients preconditioned by the diagonal of A, one column
+  of B at a time. X must be allocated; it is not used as a starting
+  point. Stops when the residual is below tol times the norm of the
+  column of B. Returns 0 if every column converged, 1 otherwise. For
+  large numbers of segs this is much faster than inverting A.
+*/
+int GTMsolveCG(MATRIX *A, MATRIX *B, MATRIX *X, double tol, int maxiter)
+{
+  int f, nfail = 0;
+
+  if (A->rows != A->cols || A->rows != B->rows || X->rows != A->rows || X->cols != B->cols) {
+    printf("ERROR: GTMsolveCG(): dimension mismatch\n");
+    return (1);
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) reduction(+ : nfail)
+#endif
+  for (f = 0; f < B->cols; f++) {
+    ROMP_PFLB_begin
+    int n = A->rows, i, j, iter;
+    double *x, *r, *z, *p, *q, *idiag, rz, rznew, pq, alpha, bnorm, rnorm, v;
+
+    x = (double *)calloc(sizeof(double), n);
+    r = (double *)calloc(sizeof(double), n);
+    z = (double *)calloc(sizeof(double), n);
+    p = (double *)calloc(sizeof(double), n);
+    q = (double *)calloc(sizeof(double), n);
+    idiag = (double *)calloc(sizeof(double), n);
+
+    bnorm = 0;
+    for (i = 0; i < n; i++) {
+      if (A->rptr[i + 1][i + 1] <= 0) nfail++;
+      idiag[i] = A->rptr[i + 1][i + 1] > 0 ? 1.0 / A->rptr[i + 1][i + 1] : 0;
+      r[i] = B->rptr[i + 1][f + 1];
+      z[i] = idiag[i] * r[i];
+      p[i] = z[i];
+      bnorm += r[i] * r[i];
+    }
+    bnorm = sqrt(bnorm);
+    rz = 0;
+    for (i = 0; i < n; i++) rz += r[i] * z[i];
+
+    rnorm = bnorm;
+    for (iter = 0; iter < maxiter && rnorm > tol * bnorm && !nfail; iter++) {
+      pq = 0;
+      for (i = 0; i < n; i++) {
+        v = 0;
+        for (j = 0; j < n; j++) v += (double)A->rptr[i + 1][j + 1] * p[j];
+        q[i] = v;
+        pq += p[i] * v;
+      }
+      if (pq <= 0) break;  // not positive definite
+      alpha = rz / pq;
+      rnorm = 0;
+      rznew = 0;
+      for (i = 0; i < n; i++) {
+        x[i] += alpha * p[i];
+        r[i] -= alpha * q[i];
+        z[i] = idiag[i] * r[i];
+        rnorm += r[i] * r[i];
+        rznew += r[i] * z[i];
+      }
+      rnorm = sqrt(rnorm);
+      for (i = 0; i < n; i++) p[i] = z[i] + (rznew / rz) * p[i];
+      rz = rznew;
+    }
+    if (rnorm > tol * bnorm) nfail++;
+    for (i = 0; i < n; i++) X->rptr[i + 1][f + 1] = x[i];
+
+    free(x);
+    free(r);
+    free(z);
+    free(p);
+    free(q);
+    free(idiag);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (nfail > 0);
+}
+
 /*--------------------------------------------------------------------------*/
 /*
   \fn MRI *GTMsegSynth(GTM *gtm, int frame, MRI *synth)
@@ -1877,9 +2292,8 @@ MRI *GTMsegSynth(GTM *gtm, int frame, MRI *synth)
       for (s = 0; s < gtm->rbvseg->depth; s++) {
         segid = MRIgetVoxVal(gtm->rbvseg, c, r, s, 0);
         if (segid == 0) continue;
-        for (segno = 0; segno < gtm->nsegs; segno++)
-          if (segid == gtm->segidlist[segno]) break;
-        if (segno == gtm->nsegs) {
+        segno = GTMsegid2nthseg(gtm, segid);
+        if (segno < 0) {
           printf("ERROR: GTMsegSynth(): could not find a match for segid=%d\n", segid);
           for (segno = 0; segno < gtm->nsegs; segno++) printf("%3d %5d\n", segno, gtm->segidlist[segno]);
           return (NULL);
@@ -2655,36 +3069,27 @@ MRI **GTMlocal(GTM *gtm, MRI **pvc)
 */
 int GTMttPercent(GTM *gtm)
 {
-  int nTT, k, s, c, r, segid, nthseg, mthseg, mthsegid, tt;
+  int nTT, nthseg, mthseg, mthsegid, tt, *rowseg;
+  long n;
   double sum;
 
   nTT = gtm->ttpvf->nframes;
   if (gtm->ttpct != NULL) MatrixFree(&gtm->ttpct);
   gtm->ttpct = MatrixAlloc(gtm->nsegs, nTT, MATRIX_REAL);
 
-  // Must be done in same order as GTMbuildX()
-  k = 0;
-  for (s = 0; s < gtm->yvol->depth; s++) {
-    for (c = 0; c < gtm->yvol->width; c++) {
-      for (r = 0; r < gtm->yvol->height; r++) {
-        if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
-        segid = MRIgetVoxVal(gtm->gtmseg, c, r, s, 0);
-        k++;  // have to do this here
-        if (segid == 0) continue;
-        for (nthseg = 0; nthseg < gtm->nsegs; nthseg++)
-          if (segid == gtm->segidlist[nthseg]) break;
-        for (mthseg = 0; mthseg < gtm->nsegs; mthseg++) {
-          mthsegid = gtm->segidlist[mthseg];
-          tt = gtm->ctGTMSeg->entries[mthsegid]->TissueType;
-          // printf("k=%d, segid = %d, nthseg = %d, mthsegid = %d, mthseg = %d, tt=%d\n",
-          // k,segid,nthseg,mthsegid,mthseg,tt);
-          fflush(stdout);
-          gtm->ttpct->rptr[nthseg + 1][tt] +=  // not tt+1
-              (gtm->X->rptr[k][mthseg + 1] * gtm->beta->rptr[mthseg + 1][1]);
-        }
-      }
+  // Go through the nonzeros of each column of X
+  rowseg = GTMnthsegPerRow(gtm);
+  for (mthseg = 0; mthseg < gtm->nsegs; mthseg++) {
+    mthsegid = gtm->segidlist[mthseg];
+    tt = gtm->ctGTMSeg->entries[mthsegid]->TissueType;
+    for (n = gtm->X->colptr[mthseg]; n < gtm->X->colptr[mthseg + 1]; n++) {
+      nthseg = rowseg[gtm->X->rowind[n]];
+      if (nthseg < 0) continue;
+      gtm->ttpct->rptr[nthseg + 1][tt] +=  // not tt+1
+          (gtm->X->val[n] * gtm->beta->rptr[mthseg + 1][1]);
     }
   }
+  free(rowseg);
 
   for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
     sum = 0;
@@ -2696,13 +3101,42 @@ int GTMttPercent(GTM *gtm)
   return (0);
 }
 
+/*
+  \fn int *GTMnthsegPerRow(GTM *gtm)
+  \brief Returns the nthseg of the gtmseg at the voxel of each row of X
+  (-1 if the voxel has no seg). Goes in the same order as GTMbuildX().
+ */
+int *GTMnthsegPerRow(GTM *gtm)
+{
+  int k, s, c, r, segid, *rowseg;
+
+  rowseg = (int *)calloc(sizeof(int), MAX(gtm->nmask, 1));
+  k = 0;
+  for (s = 0; s < gtm->yvol->depth; s++) {
+    for (c = 0; c < gtm->yvol->width; c++) {
+      for (r = 0; r < gtm->yvol->height; r++) {
+        if (gtm->mask && MRIgetVoxVal(gtm->mask, c, r, s, 0) < 0.5) continue;
+        segid = MRIgetVoxVal(gtm->gtmseg, c, r, s, 0);
+        rowseg[k] = (segid == 0) ? -1 : GTMsegid2nthseg(gtm, segid);
+        k++;
+      }
+    }
+  }
+  return (rowseg);
+}
+
 /*
   \fn int GTMsegid2nthseg(GTM *gtm, int segid)
-  \breif Returns the nthseg of the given segid
+  \breif Returns the nthseg of the given segid (-1 if it is not in the
+  list). Uses the lookup table from GTMsegidlist() when there is one.
  */
 int GTMsegid2nthseg(GTM *gtm, int segid)
 {
   int nthseg, ok;
+  if (gtm->nthseglut) {
+    if (segid < 0 || segid >= gtm->nnthseglut) return (-1);
+    return (gtm->nthseglut[segid]);
+  }
   ok = 0;
   for (nthseg = 0; nthseg < gtm->nsegs; nthseg++) {
     if (segid == gtm->segidlist[nthseg]) {
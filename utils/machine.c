@@ -24,6 +24,9 @@
  */
 
 #include <stdio.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "machine.h"
 
@@ -304,3 +307,49 @@ int ByteSwap8(void *buf8, long int nitems)
 
   return (0);
 }
+/*---------------------------------------------------------
+  Name: ByteSwapItems()
+  Reverses the byte order of each of the nitems nbytes-byte
+  items in buf (unlike ByteSwap2/4/8, nitems counts items,
+  not bytes). Uses SSE2 for the bulk of the buffer, so it is
+  meant for whole slices/frames of voxel data.
+  ---------------------------------------------------------*/
+int ByteSwapItems(void *buf, size_t nitems, int nbytes)
+{
+  unsigned char *cbuf = (unsigned char *)buf, ctmp;
+  size_t n = 0, nbytes_total = nitems * nbytes;
+  int i;
+
+  if (nbytes == 1) return (0);
+  if (nbytes != 2 && nbytes != 4 && nbytes != 8) {
+    printf("ERROR: ByteSwapItems: nbytes = %d not supported\n", nbytes);
+    return (1);
+  }
+
+#ifdef __SSE2__
+  for (; n + 16 <= nbytes_total; n += 16) {
+    __m128i v = _mm_loadu_si128((__m128i *)(cbuf + n));
+    /* swap the bytes of each 16-bit word ... */
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    /* ... then reverse the words within each item */
+    if (nbytes == 4) {
+      v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+      v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    }
+    else if (nbytes == 8) {
+      v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+      v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+    }
+    _mm_storeu_si128((__m128i *)(cbuf + n), v);
+  }
+#endif
+
+  for (; n < nbytes_total; n += nbytes) {
+    for (i = 0; i < nbytes / 2; i++) {
+      ctmp = cbuf[n + i];
+      cbuf[n + i] = cbuf[n + nbytes - 1 - i];
+      cbuf[n + nbytes - 1 - i] = ctmp;
+    }
+  }
+  return (0);
+}
@@ -37,6 +37,7 @@ const char *MRI_C_VERSION = "$Revision: 1.575 $";
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "faster_variants.h"
 #include "romp_support.h"
@@ -45,7 +46,6 @@ const char *MRI_C_VERSION = "$Revision: 1.575 $";
 #include "cma.h"
 #include "diag.h"
 #include "error.h"
-#include "fastmarching.h"
 #include "filter.h"
 #include "fnv_hash.h"
 #include "macros.h"
@@ -54,6 +54,7 @@ const char *MRI_C_VERSION = "$Revision: 1.575 $";
 #include "mri2.h"
 #include "mriBSpline.h"
 #include "mri_transform.h"
+#include "mriview.h"
 #include "pdf.h"
 #include "proto.h"
 #include "randomfields.h"
@@ -1474,52 +1475,23 @@ double MRIrmsDifferenceNonzero(MRI *mri1, MRI *mri2)
 MRI *MRIscalarMul(MRI *mri_src, MRI *mri_dst, float scalar)
 {
   int width, height, depth, x, y, z, frame;
-  BUFTYPE *psrc, *pdst;
-  float *pfsrc, *pfdst, dval;
-  short *pssrc, *psdst;
 
   width = mri_src->width;
   height = mri_src->height;
   depth = mri_src->depth;
   if (!mri_dst) mri_dst = MRIclone(mri_src, NULL);
 
-  for (frame = 0; frame < mri_src->nframes; frame++) {
-    for (z = 0; z < depth; z++) {
-      for (y = 0; y < height; y++) {
-        if (1) {
-          for (x = 0; x < width; x++) {
-            dval = MRIgetVoxVal(mri_src, x, y, z, frame);
-            MRIsetVoxVal(mri_dst, x, y, z, frame, dval * scalar);
-          }
+  MRI_TYPE_SWITCH(mri_src->type, S, MRI_TYPE_SWITCH(mri_dst->type, D,
+    for (frame = 0; frame < mri_src->nframes; frame++) {
+      for (z = 0; z < depth; z++) {
+        for (y = 0; y < height; y++) {
+          S *psrc = MRI_ROW(mri_src, S, y, z, frame);
+          D *pdst = MRI_ROW(mri_dst, D, y, z, frame);
+          for (x = 0; x < width; x++) MRI_STORE(D, pdst + x, MRI_LOAD(S, psrc + x) * scalar);
         }
-        else
-          switch (mri_src->type) {
-            case MRI_UCHAR:
-              psrc = &MRIseq_vox(mri_src, 0, y, z, frame);
-              pdst = &MRIseq_vox(mri_dst, 0, y, z, frame);
-              for (x = 0; x < width; x++) {
-                dval = *psrc++ * scalar;
-                if (dval < 0) dval = 0;
-                if (dval > 255) dval = 255;
-                *pdst++ = dval;
-              }
-              break;
-            case MRI_FLOAT:
-              pfsrc = &MRIFseq_vox(mri_src, 0, y, z, frame);
-              pfdst = &MRIFseq_vox(mri_dst, 0, y, z, frame);
-              for (x = 0; x < width; x++) *pfdst++ = *pfsrc++ * scalar;
-              break;
-            case MRI_SHORT:
-              pssrc = &MRISseq_vox(mri_src, 0, y, z, frame);
-              psdst = &MRISseq_vox(mri_dst, 0, y, z, frame);
-              for (x = 0; x < width; x++) *psdst++ = (short)nint((float)*pssrc++ * scalar);
-              break;
-            default:
-              ErrorReturn(NULL, (ERROR_UNSUPPORTED, "MRIscalarMul: unsupported type %d", mri_src->type));
-          }
       }
     }
-  }
+  ));
   return (mri_dst);
 }
 /*-----------------------------------------------------
@@ -4435,23 +4407,20 @@ MRI *MRIbinarize(MRI *mri_src, MRI *mri_dst, float threshold, float low_val, flo
     for (z = 0; z < depth; z++) {
       ROMP_PFLB_begin
       
-      double val;
       int x, y;
 
-      for (y = 0; y < height; y++) {
-        for (x = 0; x < width; x++) {
-          val = MRIgetVoxVal(mri_src, x, y, z, f);
-#if 0
-          MRIsampleVolumeFrameType
-          (mri_src, x, y, z, f, SAMPLE_NEAREST, &val) ;
-#endif
-          if (val < threshold)
-            val = low_val;
-          else
-            val = hi_val;
-          MRIsetVoxVal(mri_dst, x, y, z, f, val);
+      MRI_TYPE_SWITCH(mri_src->type, S, MRI_TYPE_SWITCH(mri_dst->type, D,
+        for (y = 0; y < height; y++) {
+          S *psrc = MRI_ROW(mri_src, S, y, z, f);
+          D *pdst = MRI_ROW(mri_dst, D, y, z, f);
+          for (x = 0; x < width; x++) {
+            if (MRI_LOAD(S, psrc + x) < threshold)
+              MRI_STORE(D, pdst + x, low_val);
+            else
+              MRI_STORE(D, pdst + x, hi_val);
+          }
         }
-      }
+      ));
       
       ROMP_PFLB_end
     }
@@ -5512,6 +5481,55 @@ MRI *MRIallocChunk(int width, int height, int depth, int type, int nframes)
   }
   return (mri);
 }
+/*-----------------------------------------------------*/
+/*!
+\fn int MRIsetMappedChunk(MRI *mri, void *map, size_t map_bytes, size_t offset)
+\brief Turns a header-only MRI (eg, from MRIreadHeader()) into a chunked
+MRI whose voxels start at map+offset. map is a private file mapping of
+map_bytes bytes that the MRI owns from then on; MRIfree() unmaps it.
+Writes to the voxels only touch private copies of the affected pages.
+See MRIreadMapped().
+*/
+int MRIsetMappedChunk(MRI *mri, void *map, size_t map_bytes, size_t offset)
+{
+  int slice, row;
+  BUFTYPE *p;
+
+  if (mri->slices != NULL || mri->chunk != NULL)
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "MRIsetMappedChunk: MRI already has pixel data"));
+
+  mri->ischunked = 1;
+  mri->bytes_per_vox = MRIsizeof(mri->type);
+  mri->bytes_per_row = mri->bytes_per_vox * mri->width;
+  mri->bytes_per_slice = mri->bytes_per_row * mri->height;
+  mri->bytes_per_vol = mri->bytes_per_slice * mri->depth;
+  mri->bytes_total = mri->bytes_per_vol * mri->nframes;
+  if (offset + mri->bytes_total > map_bytes)
+    ErrorReturn(ERROR_BADFILE,
+                (ERROR_BADFILE,
+                 "MRIsetMappedChunk: mapping has %lu bytes, need %lu",
+                 (unsigned long)map_bytes,
+                 (unsigned long)(offset + mri->bytes_total)));
+  mri->mapped = map;
+  mri->mapped_bytes = map_bytes;
+  mri->chunk = (BUFTYPE *)map + offset;
+
+  if (mri->xi == NULL) MRIallocIndices(mri);
+  mri->slices = (BUFTYPE ***)calloc(mri->depth * mri->nframes, sizeof(BUFTYPE **));
+  if (!mri->slices) ErrorExit(ERROR_NO_MEMORY, "MRIsetMappedChunk: could not allocate %d slices\n", mri->depth);
+
+  p = mri->chunk;
+  for (slice = 0; slice < mri->depth * mri->nframes; slice++) {
+    mri->slices[slice] = (BUFTYPE **)calloc(mri->height, sizeof(BUFTYPE *));
+    if (!mri->slices[slice])
+      ErrorExit(ERROR_NO_MEMORY, "MRIsetMappedChunk: could not allocate row pointers for slice %d\n", slice);
+    for (row = 0; row < mri->height; row++) {
+      mri->slices[slice][row] = p;
+      p += mri->bytes_per_row;
+    }
+  }
+  return (NO_ERROR);
+}
 /*-------------------------------------------------------------*/
 /*!
   \fn MRI *MRIallocSequence(int width, int height, int depth, int type, int nframes)
@@ -5726,6 +5744,8 @@ MRI *MRIallocHeader(int width, int height, int depth, int type, int nframes)
   // Chunking memory management
   mri->ischunked = 0;
   mri->chunk = NULL;
+  mri->mapped = NULL;
+  mri->mapped_bytes = 0;
   mri->bytes_per_vox = MRIsizeof(type);
 
   // These things are explicitly set to 0 here because we
@@ -5793,8 +5813,12 @@ int MRIfree(MRI **pmri)
   }
   else {
     // printf("Freeing MRI Chunk\n");
-    free(mri->chunk);
+    if (mri->mapped)
+      munmap(mri->mapped, mri->mapped_bytes);
+    else
+      free(mri->chunk);
     mri->chunk = NULL;
+    mri->mapped = NULL;
     for (slice = 0; slice < mri->depth * mri->nframes; slice++)
       if (mri->slices[slice]) free(mri->slices[slice]);
     free(mri->slices);
@@ -11222,9 +11246,23 @@ MRI *MRIcopyFrame(MRI *mri_src, MRI *mri_dst, int src_frame, int dst_frame)
     ErrorReturn(
         NULL, (ERROR_BADPARM, "MRIcopyFrame: dst frame #%d out of range (nframes=%d)\n", dst_frame, mri_dst->nframes));
 
-  for (z = 0; z < depth; z++)
-    for (y = 0; y < height; y++)
-      for (x = 0; x < width; x++) MRIsetVoxVal(mri_dst, x, y, z, dst_frame, MRIgetVoxVal(mri_src, x, y, z, src_frame));
+  if (mri_src->type == mri_dst->type) {
+    for (z = 0; z < depth; z++)
+      for (y = 0; y < height; y++)
+        memmove(mri_dst->slices[z + dst_frame * depth][y],
+                mri_src->slices[z + src_frame * depth][y],
+                width * MRIsizeof(mri_src->type));
+    return (mri_dst);
+  }
+
+  MRI_TYPE_SWITCH(mri_src->type, S, MRI_TYPE_SWITCH(mri_dst->type, D,
+    for (z = 0; z < depth; z++)
+      for (y = 0; y < height; y++) {
+        S *psrc = MRI_ROW(mri_src, S, y, z, src_frame);
+        D *pdst = MRI_ROW(mri_dst, D, y, z, dst_frame);
+        for (x = 0; x < width; x++) MRI_STORE(D, pdst + x, MRI_LOAD(S, psrc + x));
+      }
+  ));
   return (mri_dst);
 }
 /*-----------------------------------------------------
@@ -11462,50 +11500,16 @@ MRI *MRIchangeType(MRI *src, int dest_type, float f_low, float f_high, int no_sc
     MRIcopyHeader(src, dest);
     dest->type = dest_type;
 
-    for (frame = 0; frame < src->nframes; frame++)
-      for (k = 0; k < src->depth; k++)
-        for (j = 0; j < src->height; j++)
-          for (i = 0; i < src->width; i++) {
-#if 0	    
-	    if (src->type == MRI_UCHAR)
-	      val = (float)MRIvox(src, i, j, k);
-	    if (src->type == MRI_SHORT)
-	      val = (float)MRISvox(src, i, j, k);
-	    if (src->type == MRI_INT)
-	      val = (float)MRIIvox(src, i, j, k);
-	    if (src->type == MRI_LONG)
-	      val = (float)MRILvox(src, i, j, k);
-	    if (src->type == MRI_FLOAT)
-	      val = (float)MRIFvox(src, i, j, k);
-#else
-            val = MRIgetVoxVal(src, i, j, k, frame);
-#endif
-
-            if (dest->type == MRI_UCHAR) {
-              if (val < UCHAR_MIN) val = UCHAR_MIN;
-              if (val > UCHAR_MAX) val = UCHAR_MAX;
-              //            MRIvox(dest, i, j, k) = (unsigned char)nint(val);
-            }
-            if (dest->type == MRI_SHORT) {
-              if (val < SHORT_MIN) val = SHORT_MIN;
-              if (val > SHORT_MAX) val = SHORT_MAX;
-              //            MRISvox(dest, i, j, k) = (short)nint(val);
-            }
-            if (dest->type == MRI_INT) {
-              if (val < INT_MIN) val = INT_MIN;
-              if (val > INT_MAX) val = INT_MAX;
-              //            MRIIvox(dest, i, j, k) = (int)nint(val);
-            }
-            if (dest->type == MRI_LONG) {
-              if (val < LONG_MIN) val = LONG_MIN;
-              if (val > LONG_MAX) val = LONG_MAX;
-              //	      MRILvox(dest, i, j, k) = (long)nint(val);
-            }
-
-            //	    if (dest_type == MRI_FLOAT)
-            //            MRIFvox(dest, i, j, k) = (float)val;
-            MRIsetVoxVal(dest, i, j, k, frame, val);
+    // MRI_STORE() clips to the range of the destination type
+    MRI_TYPE_SWITCH(src->type, S, MRI_TYPE_SWITCH(dest->type, D,
+      for (frame = 0; frame < src->nframes; frame++)
+        for (k = 0; k < src->depth; k++)
+          for (j = 0; j < src->height; j++) {
+            S *psrc = MRI_ROW(src, S, j, k, frame);
+            D *pdst = MRI_ROW(dest, D, j, k, frame);
+            for (i = 0; i < src->width; i++) MRI_STORE(D, pdst + i, MRI_LOAD(S, psrc + i));
           }
+    ));
   }
   else {
     long nonzero = 0;
@@ -11516,33 +11520,23 @@ MRI *MRIchangeType(MRI *src, int dest_type, float f_low, float f_high, int no_sc
 
     for (i = 0; i < N_HIST_BINS; i++) hist_bins[i] = 0;
 
-    for (frame = 0; frame < src->nframes; frame++)
-      for (i = 0; i < src->width; i++)
-        for (j = 0; j < src->height; j++)
-          for (k = 0; k < src->depth; k++) {
-#if 0	    
-	    if (src->type == MRI_UCHAR)
-	      val = (float)MRIvox(src, i, j, k);
-	    if (src->type == MRI_SHORT)
-	      val = (float)MRISvox(src, i, j, k);
-	    if (src->type == MRI_INT)
-	      val = (float)MRIIvox(src, i, j, k);
-	    if (src->type == MRI_LONG)
-	      val = (float)MRILvox(src, i, j, k);
-	    if (src->type == MRI_FLOAT)
-	      val = (float)MRIFvox(src, i, j, k);
-#else
-            val = MRIgetVoxVal(src, i, j, k, frame);
-#endif
-
-            if (!DZERO(val)) nonzero++;
-            bin = (int)((val - src_min) / bin_size);
+    MRI_TYPE_SWITCH(src->type, S,
+      for (frame = 0; frame < src->nframes; frame++)
+        for (k = 0; k < src->depth; k++)
+          for (j = 0; j < src->height; j++) {
+            S *psrc = MRI_ROW(src, S, j, k, frame);
+            for (i = 0; i < src->width; i++) {
+              val = MRI_LOAD(S, psrc + i);
+              if (!DZERO(val)) nonzero++;
+              bin = (int)((val - src_min) / bin_size);
 
-            if (bin < 0) bin = 0;
-            if (bin >= N_HIST_BINS) bin = N_HIST_BINS - 1;
+              if (bin < 0) bin = 0;
+              if (bin >= N_HIST_BINS) bin = N_HIST_BINS - 1;
 
-            hist_bins[bin]++;
+              hist_bins[bin]++;
+            }
           }
+    );
 
     nth = (int)(f_low * src->width * src->height * src->depth);
     for (n_passed = 0, bin = 0; n_passed < nth && bin < N_HIST_BINS; bin++) n_passed += hist_bins[bin];
@@ -11596,47 +11590,18 @@ MRI *MRIchangeType(MRI *src, int dest_type, float f_low, float f_high, int no_sc
     MRIcopyHeader(src, dest);
     dest->type = dest_type;
 
-    for (frame = 0; frame < src->nframes; frame++)
-      for (i = 0; i < src->width; i++)
-        for (j = 0; j < src->height; j++)
-          for (k = 0; k < src->depth; k++) {
-#if 0
-          if (src->type == MRI_SHORT)
-            val = MRISvox(src, i, j, k);
-          if (src->type == MRI_INT)
-            val = MRIIvox(src, i, j, k);
-          if (src->type == MRI_LONG)
-            val = MRILvox(src, i, j, k);
-          if (src->type == MRI_FLOAT)
-            val = MRIFvox(src, i, j, k);
-#else
-            val = MRIgetVoxVal(src, i, j, k, frame);
-#endif
-
-            val = dest_min + scale * (val - src_min);
-
-            if (dest->type == MRI_UCHAR) {
-              if (val < UCHAR_MIN) val = UCHAR_MIN;
-              if (val > UCHAR_MAX) val = UCHAR_MAX;
-              //            MRIvox(dest, i, j, k) = (unsigned char)nint(val);
-            }
-            if (dest->type == MRI_SHORT) {
-              if (val < SHORT_MIN) val = SHORT_MIN;
-              if (val > SHORT_MAX) val = SHORT_MAX;
-              //            MRISvox(dest, i, j, k) = (short)nint(val);
-            }
-            if (dest->type == MRI_INT) {
-              if (val < INT_MIN) val = INT_MIN;
-              if (val > INT_MAX) val = INT_MAX;
-              //            MRIIvox(dest, i, j, k) = (int)nint(val);
-            }
-            if (dest->type == MRI_LONG) {
-              if (val < LONG_MIN) val = LONG_MIN;
-              if (val > LONG_MAX) val = LONG_MAX;
-              //            MRILvox(dest, i, j, k) = (long)nint(val);
+    MRI_TYPE_SWITCH(src->type, S, MRI_TYPE_SWITCH(dest->type, D,
+      for (frame = 0; frame < src->nframes; frame++)
+        for (k = 0; k < src->depth; k++)
+          for (j = 0; j < src->height; j++) {
+            S *psrc = MRI_ROW(src, S, j, k, frame);
+            D *pdst = MRI_ROW(dest, D, j, k, frame);
+            for (i = 0; i < src->width; i++) {
+              val = dest_min + scale * (MRI_LOAD(S, psrc + i) - src_min);
+              MRI_STORE(D, pdst + i, val);
             }
-            MRIsetVoxVal(dest, i, j, k, frame, val);
           }
+    ));
   }
 
   return (dest);
@@ -15128,55 +15093,17 @@ char *MRIsliceDirectionName(MRI *mri)
 }
 
 /**
- * This is deprecated.  Please use MRIextractDistanceMap in fastmarching.h
- * instead
+ * Distance (in mm) of each voxel to the boundary of label in mri_src,
+ * clamped to max_dist voxels (twice the largest dimension if <= 0).
+ * DTRANS_MODE_SIGNED is negative inside and positive outside,
+ * DTRANS_MODE_UNSIGNED positive on both sides, DTRANS_MODE_OUTSIDE zero
+ * inside and DTRANS_MODE_INSIDE zero outside. The distances are exact
+ * Euclidean ones (see MRIdistanceTransformLabels in mridtrans.c, which
+ * also does many labels at once).
  **/
 MRI *MRIdistanceTransform(MRI *mri_src, MRI *mri_dist, int label, float max_dist, int mode, MRI *mri_mask)
 {
-  const int width = mri_src->width;
-  const int height = mri_src->height;
-  const int depth = mri_src->depth;
-
-  if (mri_dist == NULL) {
-    mri_dist = MRIalloc(width, height, depth, MRI_FLOAT);
-    MRIcopyHeader(mri_src, mri_dist);
-  }
-  else
-    MRIclear(mri_dist);
-
-  // these are the modes in fastmarching...
-  const int outside = 1;
-  // this one isn't used in this function
-  // const int inside = 2;
-  const int both_signed = 3;
-  const int both_unsigned = 4;
-
-  if (mode == DTRANS_MODE_SIGNED) {
-    // DTRANS_MODE_SIGNED is negative inside and positive outside.  This
-    // corresponds to both.
-    mode = both_signed;
-  }
-  else if (mode == DTRANS_MODE_UNSIGNED) {
-    // DTRANS_MODE_UNSIGNED is positive inside and positive outside
-    mode = both_unsigned;
-  }
-  else if (mode == DTRANS_MODE_OUTSIDE) {
-    // DTRANS_MODE_OUTSIDE is zero inside and positive outside
-    mode = outside;
-  }
-
-  // Not to get an error within MRIextractDistanceMap
-  if (mri_src->type != MRI_FLOAT) {
-    MRI *mri_tmp = MRIchangeType(mri_src, MRI_FLOAT, 0, 1, 1);
-    mri_dist = MRIextractDistanceMap(mri_tmp, mri_dist, label, max_dist, mode, mri_mask);
-    MRIfree(&mri_tmp);
-  }
-  else
-    mri_dist = MRIextractDistanceMap(mri_src, mri_dist, label, max_dist, mode, mri_mask);
-
-  mri_dist->outside_val = max_dist;
-  MRIscalarMul(mri_dist, mri_dist, mri_src->xsize);
-  return mri_dist;
+  return (MRIdistanceTransformLabels(mri_src, mri_dist, &label, 1, max_dist, mode, mri_mask));
 }
 
 /** -------------------------------------------------------------------
@@ -46,6 +46,7 @@
 #include "stats.h"
 
 #include "mri2.h"
+#include "mriview.h"
 
 //#define MRI2_TIMERS
 
@@ -662,6 +663,52 @@ MRI *MRIreshape1d(MRI *src, MRI *trg)
   return (trg);
 }
 
+/*---------------------------------------------------------------
+  MRIvol2VolNearest() - the nearest-neighbor case of MRIvol2Vol() with
+  typed voxel access. Target voxels that map outside of the source are
+  left as they are. Both volumes must be MRI_TYPE_VIEWABLE().
+  ---------------------------------------------------------------*/
+static void MRIvol2VolNearest(MRI *src, MRI *targ, MATRIX *Vt2s)
+{
+  int st;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(experimental)
+#endif
+  for (st = 0; st < targ->depth; st++) {
+    ROMP_PFLB_begin
+    int ct, rt, f, ics, irs, iss;
+    float fcs, frs, fss;
+
+    MRI_TYPE_SWITCH(src->type, S, MRI_TYPE_SWITCH(targ->type, D,
+      for (rt = 0; rt < targ->height; rt++) {
+        for (ct = 0; ct < targ->width; ct++) {
+          fcs = Vt2s->rptr[1][1] * ct + Vt2s->rptr[1][2] * rt + Vt2s->rptr[1][3] * st + Vt2s->rptr[1][4];
+          ics = nint(fcs);
+          if (ics < 0 || ics >= src->width) continue;
+          frs = Vt2s->rptr[2][1] * ct + Vt2s->rptr[2][2] * rt + Vt2s->rptr[2][3] * st + Vt2s->rptr[2][4];
+          irs = nint(frs);
+          if (irs < 0 || irs >= src->height) continue;
+          fss = Vt2s->rptr[3][1] * ct + Vt2s->rptr[3][2] * rt + Vt2s->rptr[3][3] * st + Vt2s->rptr[3][4];
+          iss = nint(fss);
+          if (iss < 0 || iss >= src->depth) continue;
+          for (f = 0; f < src->nframes; f++)
+            MRI_STORE(D, MRI_ROW(targ, D, rt, st, f) + ct, MRI_LOAD(S, MRI_ROW(src, S, irs, iss, f) + ics));
+        }
+      }
+    ));
+#ifdef HAVE_OPENMP
+    // the last thread of the team, so not the master unless it is alone
+    if (omp_get_thread_num() == omp_get_num_threads() - 1) exec_progress_callback(st, targ->depth, 0, 1);
+#else
+    exec_progress_callback(st, targ->depth, 0, 1);
+#endif
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
 /*---------------------------------------------------------------
   MRIvol2Vol() - samples the values of one volume into that of
   another. Handles multiple frames. Can do nearest-neighbor,
@@ -744,6 +791,11 @@ int MRIvol2Vol(MRI *src, MRI *targ, MATRIX *Vt2s, int InterpCode, float param)
   }
 #else
 
+  if (InterpCode == SAMPLE_NEAREST && MRI_TYPE_VIEWABLE(src->type) && MRI_TYPE_VIEWABLE(targ->type)) {
+    MRIvol2VolNearest(src, targ, Vt2s);
+    goto done_sampling;
+  }
+
   if (InterpCode == SAMPLE_CUBIC_BSPLINE) bspline = MRItoBSpline(src, NULL, 3);
 
 #ifdef HAVE_OPENMP
@@ -835,6 +887,7 @@ int MRIvol2Vol(MRI *src, MRI *targ, MATRIX *Vt2s, int InterpCode, float param)
   free(valvects[0]);
 #endif
 
+done_sampling:
 #endif
 
 #ifdef VERBOSE_MODE
@@ -1783,6 +1836,57 @@ MRI *MRIframeBinarize(MRI *mri, double thresh, MRI *mask)
   }
   return (mask);
 }
+/*!
+  \fn MRI *MRIstreamFrameBinarize(MRI_STREAM *st, double thresh, MRI *mask)
+  \brief Same as MRIframeBinarize() but reads the input one frame at a
+  time from a stream (see MRIstreamOpen()). mask may have different
+  dimensions than the file (eg, reshaped) as long as it has as many
+  voxels; it is allocated like the file if NULL.
+*/
+MRI *MRIstreamFrameBinarize(MRI_STREAM *st, double thresh, MRI *mask)
+{
+  MRI *frame = NULL;
+  long v;
+  int f, premask = 1;
+  int c, r, s, fc, fr, fs;
+
+  if (!mask) {
+    mask = MRIcloneBySpace(st->mri, MRI_FLOAT, 1);
+    premask = 0;
+  }
+  if ((long)mask->width * mask->height * mask->depth != st->nvox) {
+    printf("ERROR: MRIstreamFrameBinarize(): mask and %s differ in size\n", st->fname);
+    return (NULL);
+  }
+
+  // Start with all voxels in (or those in the input mask), then remove
+  // any voxel that is at or below threshold in any frame
+  for (v = 0; v < st->nvox; v++) {
+    c = v % mask->width;
+    r = (v / mask->width) % mask->height;
+    s = v / ((long)mask->width * mask->height);
+    if (!premask || MRIgetVoxVal(mask, c, r, s, 0) > 0.5)
+      MRIsetVoxVal(mask, c, r, s, 0, 1);
+    else
+      MRIsetVoxVal(mask, c, r, s, 0, 0);
+  }
+  for (f = 0; f < st->mri->nframes; f++) {
+    frame = MRIstreamReadFrames(st, f, 1, frame);
+    if (frame == NULL) return (NULL);
+    for (v = 0; v < st->nvox; v++) {
+      fc = v % frame->width;
+      fr = (v / frame->width) % frame->height;
+      fs = v / ((long)frame->width * frame->height);
+      if (fabs(MRIgetVoxVal(frame, fc, fr, fs, 0)) > thresh) continue;
+      c = v % mask->width;
+      r = (v / mask->width) % mask->height;
+      s = v / ((long)mask->width * mask->height);
+      MRIsetVoxVal(mask, c, r, s, 0, 0);
+    }
+  }
+  MRIfree(&frame);
+  return (mask);
+}
 /*!
   \fn MRI *MRIexp(MRI *mri, double a, double b, MRI *mask, MRI *out)
   \brief Computes a*exp(b*mri). If a mask is supplied, then values
@@ -3728,6 +3832,261 @@ int MRIsegFrameAvg(MRI *seg, int segid, MRI *mri, double *favg)
   return (nvoxels);
 }
 
+/*---------------------------------------------------------
+  mriSegVoxelList() - one pass over seg that lists the voxels
+  (packed as (c*height + r)*depth + s, in the c, r, s order of
+  MRIsegStats()) whose id is in segids, with the index in segids of
+  each. Ids that appear more than once in segids map to their first
+  index, which first[n] gives. nvoxels[n] gets the number of voxels
+  of segids[n]. Returns the length of the list.
+  ---------------------------------------------------------*/
+static long mriSegVoxelList(MRI *seg, int nsegs, const int *segids, int **pvox, int **pidx, int *nvoxels, int *first)
+{
+  int n, c, r, s, id, minid, maxid, *table, *vox, *idx;
+  long nlist, span;
+
+  for (n = 0; n < nsegs; n++) nvoxels[n] = 0;
+  *pvox = *pidx = NULL;
+  if (nsegs == 0) return (0);
+
+  minid = maxid = segids[0];
+  for (n = 1; n < nsegs; n++) {
+    minid = MIN(minid, segids[n]);
+    maxid = MAX(maxid, segids[n]);
+  }
+  span = (long)maxid - minid + 1;
+  if (span > 10000000)
+    ErrorExit(ERROR_BADPARM, "mriSegVoxelList: segmentation ids %d to %d span too many values", minid, maxid);
+  table = (int *)malloc(span * sizeof(int));
+  if (!table) ErrorExit(ERROR_NOMEMORY, "mriSegVoxelList: could not allocate id table");
+  for (id = 0; id < span; id++) table[id] = -1;
+  for (n = nsegs - 1; n >= 0; n--) table[segids[n] - minid] = n;
+
+  for (nlist = 0, c = 0; c < seg->width; c++)
+    for (r = 0; r < seg->height; r++)
+      for (s = 0; s < seg->depth; s++) {
+        id = (int)MRIgetVoxVal(seg, c, r, s, 0);
+        if (id < minid || id > maxid || table[id - minid] < 0) continue;
+        nvoxels[table[id - minid]]++;
+        nlist++;
+      }
+
+  vox = (int *)malloc(MAX(nlist, 1) * sizeof(int));
+  idx = (int *)malloc(MAX(nlist, 1) * sizeof(int));
+  if (!vox || !idx) ErrorExit(ERROR_NOMEMORY, "mriSegVoxelList: could not allocate %ld voxels", nlist);
+  for (nlist = 0, c = 0; c < seg->width; c++)
+    for (r = 0; r < seg->height; r++)
+      for (s = 0; s < seg->depth; s++) {
+        id = (int)MRIgetVoxVal(seg, c, r, s, 0);
+        if (id < minid || id > maxid || table[id - minid] < 0) continue;
+        vox[nlist] = (c * seg->height + r) * seg->depth + s;
+        idx[nlist] = table[id - minid];
+        nlist++;
+      }
+
+  for (n = 0; n < nsegs; n++) {
+    first[n] = table[segids[n] - minid];
+    nvoxels[n] = nvoxels[first[n]];
+  }
+
+  free(table);
+  *pvox = vox;
+  *pidx = idx;
+  return (nlist);
+}
+
+#define SEG_VOX_CRS(seg, v, c, r, s)          \
+  {                                           \
+    s = (v) % (seg)->depth;                   \
+    r = ((v) / (seg)->depth) % (seg)->height; \
+    c = (v) / ((seg)->depth * (seg)->height); \
+  }
+
+/*---------------------------------------------------------
+  MRIsegStatsAll() - MRIsegStats() (or MRIsegStatsRobust() if
+  UseRobust) for every stats[n].segid with a single pass over the
+  volume instead of one pass per segmentation. Each segmentation
+  sees its voxels in the same order as in MRIsegStats(), so the
+  results are identical. stats[n].nvoxels is the number of voxels
+  with the id (also for the robust stats). If mri is NULL only the
+  voxels are counted.
+  ---------------------------------------------------------*/
+int MRIsegStatsAll(MRI *seg, MRI *mri, int frame, int UseRobust, float RobustPct, int nsegs, MRI_SEG_STATS *stats)
+{
+  int n, c, r, s, *segids, *nvoxels, *vox, *idx, *first;
+  long k, nlist;
+
+  segids = (int *)calloc(MAX(nsegs, 1), sizeof(int));
+  nvoxels = (int *)calloc(MAX(nsegs, 1), sizeof(int));
+  first = (int *)calloc(MAX(nsegs, 1), sizeof(int));
+  if (!segids || !nvoxels || !first) ErrorExit(ERROR_NOMEMORY, "MRIsegStatsAll: could not allocate %d segmentations", nsegs);
+  for (n = 0; n < nsegs; n++) segids[n] = stats[n].segid;
+  nlist = mriSegVoxelList(seg, nsegs, segids, &vox, &idx, nvoxels, first);
+
+  for (n = 0; n < nsegs; n++) {
+    stats[n].nvoxels = nvoxels[n];
+    stats[n].min = stats[n].max = stats[n].range = stats[n].mean = stats[n].std = 0;
+  }
+
+  if (mri != NULL && !UseRobust) {
+    double *sum, *sum2, val;
+    int *nv;
+
+    sum = (double *)calloc(MAX(nsegs, 1), sizeof(double));
+    sum2 = (double *)calloc(MAX(nsegs, 1), sizeof(double));
+    nv = (int *)calloc(MAX(nsegs, 1), sizeof(int));
+    if (!sum || !sum2 || !nv) ErrorExit(ERROR_NOMEMORY, "MRIsegStatsAll: could not allocate %d segmentations", nsegs);
+    for (k = 0; k < nlist; k++) {
+      MRI_SEG_STATS *st = &stats[idx[k]];
+      SEG_VOX_CRS(seg, vox[k], c, r, s);
+      val = MRIgetVoxVal(mri, c, r, s, frame);
+      nv[idx[k]]++;
+      if (nv[idx[k]] == 1) {
+        st->min = val;
+        st->max = val;
+      }
+      if (st->min > val) st->min = val;
+      if (st->max < val) st->max = val;
+      sum[idx[k]] += val;
+      sum2[idx[k]] += (val * val);
+    }
+    for (n = 0; n < nsegs; n++) {
+      MRI_SEG_STATS *st = &stats[n];
+      if (first[n] != n) continue;
+      st->range = st->max - st->min;
+      st->mean = nv[n] != 0 ? sum[n] / nv[n] : 0.0;
+      if (nv[n] > 1)
+        st->std = sqrt(((nv[n]) * (st->mean) * (st->mean) - 2 * (st->mean) * sum[n] + sum2[n]) / (nv[n] - 1));
+      else
+        st->std = 0.0;
+    }
+    free(sum);
+    free(sum2);
+    free(nv);
+  }
+  else if (mri != NULL) {
+    /* values of each segmentation in one array, sorted per segmentation */
+    long *start, *fill;
+    float *vlist;
+
+    start = (long *)calloc(nsegs + 1, sizeof(long));
+    fill = (long *)calloc(MAX(nsegs, 1), sizeof(long));
+    for (n = 0; n < nsegs; n++) start[n + 1] = start[n] + (first[n] == n ? nvoxels[n] : 0);
+    vlist = (float *)calloc(MAX(start[nsegs], 1), sizeof(float));
+    if (!start || !fill || !vlist) ErrorExit(ERROR_NOMEMORY, "MRIsegStatsAll: could not allocate %ld values", nlist);
+    for (k = 0; k < nlist; k++) {
+      SEG_VOX_CRS(seg, vox[k], c, r, s);
+      vlist[start[idx[k]] + fill[idx[k]]++] = MRIgetVoxVal(mri, c, r, s, frame);
+    }
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) schedule(dynamic, 1)
+#endif
+    for (n = 0; n < nsegs; n++) {
+      ROMP_PFLB_begin
+      MRI_SEG_STATS *st = &stats[n];
+      float *v = vlist + start[n];
+      int nvox = nvoxels[n], m, j;
+      double val, sum = 0, sum2 = 0;
+
+      if (first[n] != n || nvox == 0) ROMP_PFLB_continue;
+      qsort((void *)v, nvox, sizeof(float), compare_floats);
+
+      // as in MRIsegStatsRobust(), exclude Pct of the values from each end
+      m = 0;
+      for (j = 0; j < nvox; j++) {
+        if (j < RobustPct * nvox / 100.0) continue;
+        if (j > (100 - RobustPct) * nvox / 100.0) continue;
+        val = v[j];
+        if (m == 0) {
+          st->min = val;
+          st->max = val;
+        }
+        if (st->min > val) st->min = val;
+        if (st->max < val) st->max = val;
+        sum += val;
+        sum2 += (val * val);
+        m = m + 1;
+      }
+      st->range = st->max - st->min;
+      st->mean = sum / m;
+      if (m > 1)
+        st->std = sqrt(((m) * (st->mean) * (st->mean) - 2 * (st->mean) * sum + sum2) / (m - 1));
+      else
+        st->std = 0.0;
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    free(start);
+    free(fill);
+    free(vlist);
+  }
+
+  /* duplicated ids */
+  for (n = 0; n < nsegs; n++)
+    if (first[n] != n) {
+      int segid = stats[n].segid;
+      stats[n] = stats[first[n]];
+      stats[n].segid = segid;
+    }
+
+  free(first);
+  free(vox);
+  free(idx);
+  free(nvoxels);
+  free(segids);
+  return (NO_ERROR);
+}
+
+/*---------------------------------------------------------
+  MRIsegFrameAvgAll() - MRIsegFrameAvg() for the nsegs ids in
+  segids from a single pass over seg. Frames are averaged in
+  parallel, each over the voxels in the order of MRIsegFrameAvg(),
+  so the averages are identical. favg[n] must be preallocated to
+  the number of frames; nvoxels[n] gets the number of voxels of
+  segids[n].
+  ---------------------------------------------------------*/
+int MRIsegFrameAvgAll(MRI *seg, MRI *mri, int nsegs, const int *segids, double **favg, int *nvoxels)
+{
+  int f, *vox, *idx, *first;
+  long nlist;
+
+  first = (int *)calloc(MAX(nsegs, 1), sizeof(int));
+  if (!first) ErrorExit(ERROR_NOMEMORY, "MRIsegFrameAvgAll: could not allocate %d segmentations", nsegs);
+  nlist = mriSegVoxelList(seg, nsegs, segids, &vox, &idx, nvoxels, first);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (f = 0; f < mri->nframes; f++) {
+    ROMP_PFLB_begin
+    int c, r, s, m;
+    long k;
+
+    for (m = 0; m < nsegs; m++) favg[m][f] = 0;
+    for (k = 0; k < nlist; k++) {
+      SEG_VOX_CRS(seg, vox[k], c, r, s);
+      favg[idx[k]][f] += MRIgetVoxVal(mri, c, r, s, f);
+    }
+    for (m = 0; m < nsegs; m++) {
+      if (first[m] != m)
+        favg[m][f] = favg[first[m]][f];
+      else if (nvoxels[m] != 0)
+        favg[m][f] /= nvoxels[m];
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  free(first);
+  free(vox);
+  free(idx);
+  return (NO_ERROR);
+}
+
 MRI *MRImask_with_T2_and_aparc_aseg(
     MRI *mri_src, MRI *mri_dst, MRI *mri_T2, MRI *mri_aparc_aseg, float T2_thresh, int mm_from_exterior)
 {
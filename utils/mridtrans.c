@@ -0,0 +1,321 @@
+/**
+ * @file  mridtrans.c
+ * @brief exact Euclidean distance transforms of label volumes
+ *
+ * The squared distance to the nearest feature voxel is computed with three
+ * separable 1D passes (Felzenszwalb & Huttenlocher, "Distance Transforms of
+ * Sampled Functions"), each of which takes the lower envelope of parabolas
+ * along every line of the volume in linear time. The lines of a pass are
+ * independent and are split across threads.
+ *
+ * The result follows the conventions of the fast marching code it replaces
+ * in MRIdistanceTransform(): the label boundary lies half a voxel from the
+ * centers of the voxels on either side of it, distances are in mm and
+ * clamped to +-max_dist voxels (scaled by xsize).
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag.h"
+#include "error.h"
+#include "macros.h"
+#include "mri.h"
+#include "romp_support.h"
+
+/* squared distance of a voxel with no feature voxel on its lines (yet) */
+#define EDT_INF 1e20f
+
+/* the part of the volume a label's distances are computed in */
+typedef struct
+{
+  int x0, y0, z0;
+  int width, height, depth;
+} EDT_REGION;
+
+/*
+  1D pass over n samples of f, stride apart: replaces f[p] by
+  min_q (h*(p-q))^2 + f[q]. Samples at EDT_INF are not feature points
+  and contribute no parabola. v, zz and g are scratch space for n, n+1
+  and n values.
+*/
+static void edt1d(float *f, int n, int stride, double h, int *v, double *zz, float *g)
+{
+  double s, h2 = h * h;
+  int p, q, k, j;
+
+  for (p = 0; p < n; p++) g[p] = f[p * stride];
+
+  for (k = -1, q = 0; q < n; q++) {
+    if (g[q] >= EDT_INF) continue;
+    if (k < 0) {
+      k = 0;
+      v[0] = q;
+      zz[0] = -HUGE_VAL;
+      zz[1] = HUGE_VAL;
+      continue;
+    }
+    /* intersection with the rightmost parabola of the envelope; the first
+       one is never removed as its left end is -infinity */
+    for (;;) {
+      s = ((g[q] / h2 + (double)q * q) - (g[v[k]] / h2 + (double)v[k] * v[k])) / (2.0 * (q - v[k]));
+      if (s > zz[k]) break;
+      k--;
+    }
+    k++;
+    v[k] = q;
+    zz[k] = s;
+    zz[k + 1] = HUGE_VAL;
+  }
+
+  if (k < 0) return; /* no feature points, f is all EDT_INF */
+
+  for (j = 0, p = 0; p < n; p++) {
+    while (zz[j + 1] < p) j++;
+    f[p * stride] = h2 * (double)(p - v[j]) * (p - v[j]) + g[v[j]];
+  }
+}
+
+/* squared distances in f (rw x rh x rd, x fastest) to its zero entries */
+static void edt3d(float *f, int rw, int rh, int rd, double xsize, double ysize, double zsize)
+{
+  int nmax = MAX(rw, MAX(rh, rd)), x, y, z;
+
+  /* along x and then y, a slice at a time */
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) private(x, y)
+#endif
+  for (z = 0; z < rd; z++) {
+    ROMP_PFLB_begin
+    int *v = (int *)calloc(nmax, sizeof(int));
+    double *zz = (double *)calloc(nmax + 1, sizeof(double));
+    float *g = (float *)calloc(nmax, sizeof(float));
+    float *slice = f + (size_t)z * rw * rh;
+
+    if (!v || !zz || !g) ErrorExit(ERROR_NOMEMORY, "edt3d: could not allocate %d line buffers", nmax);
+    for (y = 0; y < rh; y++) edt1d(slice + (size_t)y * rw, rw, 1, xsize, v, zz, g);
+    for (x = 0; x < rw; x++) edt1d(slice + x, rh, rw, ysize, v, zz, g);
+    free(v);
+    free(zz);
+    free(g);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  /* along z, a row at a time */
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) private(x)
+#endif
+  for (y = 0; y < rh; y++) {
+    ROMP_PFLB_begin
+    int *v = (int *)calloc(nmax, sizeof(int));
+    double *zz = (double *)calloc(nmax + 1, sizeof(double));
+    float *g = (float *)calloc(nmax, sizeof(float));
+
+    if (!v || !zz || !g) ErrorExit(ERROR_NOMEMORY, "edt3d: could not allocate %d line buffers", nmax);
+    for (x = 0; x < rw; x++) edt1d(f + (size_t)y * rw + x, rd, rw * rh, zsize, v, zz, g);
+    free(v);
+    free(zz);
+    free(g);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+static void edtSetVal(MRI *mri_dist, int x, int y, int z, int frame, float val)
+{
+  if (mri_dist->type == MRI_FLOAT)
+    MRIFseq_vox(mri_dist, x, y, z, frame) = val;
+  else
+    MRIsetVoxVal(mri_dist, x, y, z, frame, val);
+}
+
+/*-----------------------------------------------------
+  MRIdistanceTransformLabels() - exact distance transform of each of
+  labels[0..nlabels-1] in mri_src into frame n of mri_dist (allocated if
+  NULL), in one pass over the label volume. See MRIdistanceTransform()
+  for the modes and max_dist. Voxels that are 0 in mri_mask (if not NULL)
+  are neither label nor background and are set to the limit.
+  ------------------------------------------------------*/
+MRI *MRIdistanceTransformLabels(
+    MRI *mri_src, MRI *mri_dist, int *labels, int nlabels, float max_dist, int mode, MRI *mri_mask)
+{
+  const int width = mri_src->width, height = mri_src->height, depth = mri_src->depth;
+  double half, limit;
+  EDT_REGION *regions;
+  int *lab, x, y, z, n, pad[3], *nvox;
+  unsigned char *masked = NULL;
+  float *f_out, *f_in;
+  size_t nvoxels = (size_t)width * height * depth, i;
+
+  if (max_dist <= 0) max_dist = 2 * MAX(MAX(width, height), depth);
+  limit = max_dist * mri_src->xsize;
+  half = 0.5 * MIN(mri_src->xsize, MIN(mri_src->ysize, mri_src->zsize));
+
+  if (mri_dist == NULL) {
+    mri_dist = MRIallocSequence(width, height, depth, MRI_FLOAT, nlabels);
+    MRIcopyHeader(mri_src, mri_dist);
+  }
+  else if (mri_dist->width != width || mri_dist->height != height || mri_dist->depth != depth ||
+           mri_dist->nframes < nlabels)
+    ErrorReturn(NULL,
+                (ERROR_BADPARM,
+                 "MRIdistanceTransformLabels: dst is %dx%dx%dx%d, not %dx%dx%dx%d",
+                 mri_dist->width,
+                 mri_dist->height,
+                 mri_dist->depth,
+                 mri_dist->nframes,
+                 width,
+                 height,
+                 depth,
+                 nlabels));
+
+  /* one pass for the labels and their bounding boxes */
+  lab = (int *)calloc(nvoxels, sizeof(int));
+  regions = (EDT_REGION *)calloc(MAX(nlabels, 1), sizeof(EDT_REGION));
+  nvox = (int *)calloc(MAX(nlabels, 1), sizeof(int));
+  if (mri_mask) masked = (unsigned char *)calloc(nvoxels, sizeof(unsigned char));
+  if (!lab || !regions || !nvox || (mri_mask && !masked))
+    ErrorExit(ERROR_NOMEMORY, "MRIdistanceTransformLabels: could not allocate %dx%dx%d", width, height, depth);
+  for (n = 0; n < nlabels; n++) {
+    regions[n].x0 = width;
+    regions[n].y0 = height;
+    regions[n].z0 = depth;
+    regions[n].width = regions[n].height = regions[n].depth = -1; /* max coords for now */
+  }
+  for (i = 0, z = 0; z < depth; z++)
+    for (y = 0; y < height; y++)
+      for (x = 0; x < width; x++, i++) {
+        lab[i] = (int)round(MRIgetVoxVal(mri_src, x, y, z, 0));
+        if (mri_mask && (int)MRIgetVoxVal(mri_mask, x, y, z, 0) == 0) {
+          masked[i] = 1;
+          continue;
+        }
+        for (n = 0; n < nlabels; n++) {
+          EDT_REGION *r = &regions[n];
+          if (lab[i] != labels[n]) continue;
+          nvox[n]++;
+          if (x < r->x0) r->x0 = x;
+          if (y < r->y0) r->y0 = y;
+          if (z < r->z0) r->z0 = z;
+          if (x > r->width) r->width = x;
+          if (y > r->height) r->height = y;
+          if (z > r->depth) r->depth = z;
+        }
+      }
+
+  /* nothing farther than the limit from a label voxel can be below the limit,
+     and the extra voxel keeps background all around the label so that the
+     interior distances are exact within the region too */
+  pad[0] = (int)ceil((limit + half) / mri_src->xsize) + 1;
+  pad[1] = (int)ceil((limit + half) / mri_src->ysize) + 1;
+  pad[2] = (int)ceil((limit + half) / mri_src->zsize) + 1;
+  for (n = 0; n < nlabels; n++) {
+    EDT_REGION *r = &regions[n];
+    int x1 = r->width, y1 = r->height, z1 = r->depth;
+
+    if (nvox[n] == 0 || masked) {
+      /* masked out voxels may hide the background, so use everything */
+      r->x0 = r->y0 = r->z0 = 0;
+      r->width = width;
+      r->height = height;
+      r->depth = depth;
+      continue;
+    }
+    r->x0 = MAX(0, r->x0 - pad[0]);
+    r->y0 = MAX(0, r->y0 - pad[1]);
+    r->z0 = MAX(0, r->z0 - pad[2]);
+    r->width = MIN(width - 1, x1 + pad[0]) - r->x0 + 1;
+    r->height = MIN(height - 1, y1 + pad[1]) - r->y0 + 1;
+    r->depth = MIN(depth - 1, z1 + pad[2]) - r->z0 + 1;
+  }
+
+  f_out = (float *)calloc(nvoxels, sizeof(float));
+  f_in = (float *)calloc(nvoxels, sizeof(float));
+  if (!f_out || !f_in)
+    ErrorExit(ERROR_NOMEMORY, "MRIdistanceTransformLabels: could not allocate %dx%dx%d", width, height, depth);
+
+  for (n = 0; n < nlabels; n++) {
+    EDT_REGION *r = &regions[n];
+    int rw = r->width, rh = r->height, rd = r->depth, xi, yi, zi;
+    float far_val = (mode == DTRANS_MODE_INSIDE) ? 0 : limit;
+
+    /* everything outside the region is at or beyond the limit */
+    if (rw < width || rh < height || rd < depth)
+      for (z = 0; z < depth; z++)
+        for (y = 0; y < height; y++)
+          for (x = 0; x < width; x++) edtSetVal(mri_dist, x, y, z, n, far_val);
+
+    /* squared distances to the label (f_out) and to the background (f_in) */
+    for (i = 0, zi = 0; zi < rd; zi++)
+      for (yi = 0; yi < rh; yi++)
+        for (xi = 0; xi < rw; xi++, i++) {
+          size_t vox = ((size_t)(zi + r->z0) * height + yi + r->y0) * width + xi + r->x0;
+          int in = lab[vox] == labels[n];
+          if (masked && masked[vox])
+            f_out[i] = f_in[i] = EDT_INF;
+          else {
+            f_out[i] = in ? 0 : EDT_INF;
+            f_in[i] = in ? EDT_INF : 0;
+          }
+        }
+    if (mode != DTRANS_MODE_INSIDE)
+      edt3d(f_out, rw, rh, rd, mri_src->xsize, mri_src->ysize, mri_src->zsize);
+    if (mode != DTRANS_MODE_OUTSIDE)
+      edt3d(f_in, rw, rh, rd, mri_src->xsize, mri_src->ysize, mri_src->zsize);
+
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(shown_reproducible) private(yi, xi)
+#endif
+    for (zi = 0; zi < rd; zi++) {
+      ROMP_PFLB_begin
+      for (yi = 0; yi < rh; yi++)
+        for (xi = 0; xi < rw; xi++) {
+          size_t j = ((size_t)zi * rh + yi) * rw + xi;
+          size_t vox = ((size_t)(zi + r->z0) * height + yi + r->y0) * width + xi + r->x0;
+          double dist;
+
+          if (masked && masked[vox])
+            dist = (mode == DTRANS_MODE_INSIDE) ? -limit : limit;
+          else if (lab[vox] == labels[n]) {
+            /* interior, negative */
+            dist = (mode == DTRANS_MODE_OUTSIDE) ? 0 : -MIN(sqrt(f_in[j]) - half, limit);
+            if (mode == DTRANS_MODE_UNSIGNED) dist = -dist;
+          }
+          else
+            dist = (mode == DTRANS_MODE_INSIDE) ? 0 : MIN(sqrt(f_out[j]) - half, limit);
+          edtSetVal(mri_dist, xi + r->x0, yi + r->y0, zi + r->z0, n, dist);
+        }
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+  }
+
+  free(f_out);
+  free(f_in);
+  free(lab);
+  free(regions);
+  free(nvox);
+  if (masked) free(masked);
+
+  mri_dist->outside_val = max_dist;
+  return (mri_dist);
+}
@@ -2573,6 +2573,380 @@ MRI *MRIstdNonzero(MRI *mri_src, MRI *mri_dst, MRI *mri_mean, int wsize)
   return (mri_dst);
 }
 
+/* One axis of an FFT convolution. Each line of len samples is padded to a
+   power of 2 long enough that the kernel does not wrap around, either with
+   zeros or with its end values, and multiplied in the frequency domain by
+   the spectrum of a real kernel of klen taps centered on klen/2 (the same
+   convention as MRIconvolve1d()). Two lines share each complex transform,
+   one as the real part and one as the imaginary part. */
+typedef struct
+{
+  int len, left, right, replicate; /* left and right reach of the kernel */
+  FFT_PLAN *plan;
+  float *kr, *ki; /* kernel spectrum, with the 1/n of the inverse folded in */
+} FFT_AXIS;
+
+/* the kernel taps that can reach a voxel of a zero padded line */
+static void fftAxisReach(int len, int klen, int replicate, int *pleft, int *pright)
+{
+  *pleft = klen / 2;
+  *pright = klen - 1 - klen / 2;
+  if (!replicate) {
+    *pleft = MIN(*pleft, len - 1);
+    *pright = MIN(*pright, len - 1);
+  }
+}
+
+static int fftAxisLength(int len, int klen, int replicate)
+{
+  int left, right, n;
+
+  fftAxisReach(len, klen, replicate, &left, &right);
+  for (n = 1; n < len + (replicate ? left + right : MAX(left, right)); n <<= 1)
+    ;
+  return (n);
+}
+
+/* the cost per voxel of a forward and a backward transform of length n for
+   each pair of lines of len voxels, in units of one direct kernel tap */
+static double fftAxisCost(int len, int n) { return (7.0 * FFTlog2(n) * n / len); }
+
+static FFT_AXIS *fftAxisAlloc(int len, float *kernel, int klen, int replicate)
+{
+  FFT_AXIS *ax;
+  int n, k, d;
+
+  ax = (FFT_AXIS *)calloc(1, sizeof(FFT_AXIS));
+  if (!ax) ErrorExit(ERROR_NOMEMORY, "fftAxisAlloc: could not allocate axis");
+  ax->len = len;
+  ax->replicate = replicate;
+  fftAxisReach(len, klen, replicate, &ax->left, &ax->right);
+  n = fftAxisLength(len, klen, replicate);
+  ax->plan = FFTallocPlan(n);
+  ax->kr = (float *)calloc(n, sizeof(float));
+  ax->ki = (float *)calloc(n, sizeof(float));
+  if (!ax->plan || !ax->kr || !ax->ki) ErrorExit(ERROR_NOMEMORY, "fftAxisAlloc: could not allocate %d point FFT", n);
+
+  /* out[i] = sum_k kernel[k] in[i + k - klen/2] is a circular convolution
+     with kernel[k] placed at -(k - klen/2) */
+  for (k = 0; k < klen; k++) {
+    d = k - klen / 2;
+    if (d < -ax->left || d > ax->right) continue;
+    ax->kr[(n - d) % n] += kernel[k];
+  }
+  FFTplanForward(ax->plan, ax->kr, ax->ki);
+  for (k = 0; k < n; k++) {
+    ax->kr[k] /= n;
+    ax->ki[k] /= n;
+  }
+  return (ax);
+}
+
+static void fftAxisFree(FFT_AXIS **pax)
+{
+  FFT_AXIS *ax = *pax;
+
+  if (ax == NULL) return;
+  FFTfreePlan(&ax->plan);
+  free(ax->kr);
+  free(ax->ki);
+  free(ax);
+  *pax = NULL;
+}
+
+/* voxel i of line u of slab w along an axis */
+static void fftAxisVoxel(int axis, int i, int u, int w, int *px, int *py, int *pz)
+{
+  switch (axis) {
+    case MRI_WIDTH:
+      *px = i, *py = u, *pz = w;
+      break;
+    case MRI_HEIGHT:
+      *px = u, *py = i, *pz = w;
+      break;
+    default:
+      *px = u, *py = w, *pz = i;
+      break;
+  }
+}
+
+static void fftAxisGather(FFT_AXIS *ax, MRI *mri, int axis, int u, int w, int frame, float *line)
+{
+  int i, x, y, z, n = FFTplanLength(ax->plan);
+
+  for (i = 0; i < ax->len; i++) {
+    fftAxisVoxel(axis, i, u, w, &x, &y, &z);
+    line[i] = mri->type == MRI_FLOAT ? MRIFseq_vox(mri, x, y, z, frame) : MRIgetVoxVal(mri, x, y, z, frame);
+  }
+  for (i = ax->len; i < n; i++) {
+    if (ax->replicate && i < ax->len + ax->right)
+      line[i] = line[ax->len - 1];
+    else if (ax->replicate && i >= n - ax->left)
+      line[i] = line[0];
+    else
+      line[i] = 0;
+  }
+}
+
+static void fftAxisScatter(FFT_AXIS *ax, MRI *mri, int axis, int u, int w, int frame, float *line)
+{
+  int i, x, y, z;
+
+  for (i = 0; i < ax->len; i++) {
+    fftAxisVoxel(axis, i, u, w, &x, &y, &z);
+    if (mri->type == MRI_FLOAT)
+      MRIFseq_vox(mri, x, y, z, frame) = line[i];
+    else
+      MRIsetVoxVal(mri, x, y, z, frame, line[i]);
+  }
+}
+
+/* convolve every line of every frame of mri along axis, in place */
+static void fftAxisConvolve(FFT_AXIS *ax, MRI *mri, int axis)
+{
+  int nlines, nslabs, slab;
+
+  nlines = axis == MRI_WIDTH ? mri->height : mri->width;
+  nslabs = axis == MRI_DEPTH ? mri->height : mri->depth;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible)
+#endif
+  for (slab = 0; slab < nslabs * mri->nframes; slab++) {
+    ROMP_PFLB_begin
+    int n = FFTplanLength(ax->plan), u, i, frame = slab / nslabs, w = slab % nslabs;
+    float *re, *im, r;
+
+    re = (float *)malloc(n * sizeof(float));
+    im = (float *)malloc(n * sizeof(float));
+    if (!re || !im) ErrorExit(ERROR_NOMEMORY, "fftAxisConvolve: could not allocate %d point lines", n);
+    for (u = 0; u < nlines; u += 2) {
+      fftAxisGather(ax, mri, axis, u, w, frame, re);
+      if (u + 1 < nlines)
+        fftAxisGather(ax, mri, axis, u + 1, w, frame, im);
+      else
+        memset(im, 0, n * sizeof(float));
+      FFTplanForward(ax->plan, re, im);
+      for (i = 0; i < n; i++) {
+        r = re[i] * ax->kr[i] - im[i] * ax->ki[i];
+        im[i] = re[i] * ax->ki[i] + im[i] * ax->kr[i];
+        re[i] = r;
+      }
+      FFTplanBackward(ax->plan, re, im);
+      fftAxisScatter(ax, mri, axis, u, w, frame, re);
+      if (u + 1 < nlines) fftAxisScatter(ax, mri, axis, u + 1, w, frame, im);
+    }
+    free(re);
+    free(im);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+/* A separable Gaussian smoother for one geometry, with the kernel spectra
+   (and, when masked, the smoothed mask) computed once so that smoothing
+   many volumes, eg, the noise of every iteration of a simulation, only
+   costs the transforms, however wide the kernel. */
+struct MRI_GAUSSIAN_FFT
+{
+  int width, height, depth;
+  FFT_AXIS *axes[3]; /* columns, rows and slices, NULL if not smoothed */
+  MRI *mri_norm;     /* smoothed mask inside the mask and 0 outside, or NULL */
+};
+
+static const int gaussianFFTaxes[3] = {MRI_WIDTH, MRI_HEIGHT, MRI_DEPTH};
+
+/* the taps beyond 6 std are below float precision */
+static int gaussianNIhalf(int len, double std) { return (MIN(len - 1, (int)ceil(6 * std))); }
+
+/* the taps of a row of GaussianMatrix(len, std, 1) around its diagonal, out
+   to where they no longer matter in float, divided by the sum of the row
+   MRIgaussianSmoothNI() rescales by */
+static float *gaussianNIkernel(int len, double std, int *pklen)
+{
+  double var = std * std, f = sqrt(2 * M_PI) * std, sum = 0, scale = 0;
+  int half = gaussianNIhalf(len, std), c, d;
+  float *kernel;
+
+  for (c = 0; c < len; c++) {
+    d = c - len / 2;
+    sum += exp(-(d * d) / (2 * var)) / f;
+  }
+  f /= sum;
+  for (c = 0; c < len; c++) {
+    d = c - (len / 2 - 1);
+    scale += exp(-(d * d) / (2 * var)) / f;
+  }
+
+  *pklen = 2 * half + 1;
+  kernel = (float *)calloc(*pklen, sizeof(float));
+  if (!kernel) ErrorExit(ERROR_NOMEMORY, "gaussianNIkernel: could not allocate %d taps", *pklen);
+  for (d = -half; d <= half; d++) kernel[d + half] = exp(-(d * d) / (2 * var)) / f / scale;
+  return (kernel);
+}
+
+static double gaussianFFTstd(MRI *mri, int a, double cstd, double rstd, double sstd)
+{
+  switch (a) {
+    case 0:
+      return (cstd / mri->xsize);
+    case 1:
+      return (rstd / mri->ysize);
+    default:
+      return (sstd / mri->zsize);
+  }
+}
+
+static int gaussianFFTlen(MRI *mri, int a) { return (a == 0 ? mri->width : a == 1 ? mri->height : mri->depth); }
+
+/*---------------------------------------------------------------------
+  MRIallocGaussianFFT() - precomputes the FFT smoothing of volumes with
+  the geometry of mri by a Gaussian with standard deviations cstd, rstd
+  and sstd (in mm, 0 to not smooth along that axis). Without binmask
+  MRIgaussianFFTsmooth() then gives the same result as
+  MRIgaussianSmoothNI(), and with it the same as
+  MRImaskedGaussianSmooth(). Free with MRIfreeGaussianFFT().
+  -------------------------------------------------------------------*/
+MRI_GAUSSIAN_FFT *MRIallocGaussianFFT(MRI *mri, double cstd, double rstd, double sstd, MRI *binmask)
+{
+  MRI_GAUSSIAN_FFT *gf;
+  float *kernel;
+  double std;
+  int a, klen, len, c, r, s;
+
+  gf = (MRI_GAUSSIAN_FFT *)calloc(1, sizeof(MRI_GAUSSIAN_FFT));
+  if (!gf) ErrorExit(ERROR_NOMEMORY, "MRIallocGaussianFFT: could not allocate plan");
+  gf->width = mri->width;
+  gf->height = mri->height;
+  gf->depth = mri->depth;
+  for (a = 0; a < 3; a++) {
+    std = gaussianFFTstd(mri, a, cstd, rstd, sstd);
+    len = gaussianFFTlen(mri, a);
+    if (std <= 0 || len < 2) continue;
+    kernel = gaussianNIkernel(len, std, &klen);
+    gf->axes[a] = fftAxisAlloc(len, kernel, klen, 0);
+    free(kernel);
+  }
+
+  if (binmask) {
+    gf->mri_norm = MRIallocSequence(mri->width, mri->height, mri->depth, MRI_FLOAT, 1);
+    if (!gf->mri_norm) ErrorExit(ERROR_NOMEMORY, "MRIallocGaussianFFT: could not allocate mask");
+    for (s = 0; s < mri->depth; s++)
+      for (r = 0; r < mri->height; r++)
+        for (c = 0; c < mri->width; c++) MRIFvox(gf->mri_norm, c, r, s) = MRIgetVoxVal(binmask, c, r, s, 0);
+    for (a = 0; a < 3; a++)
+      if (gf->axes[a]) fftAxisConvolve(gf->axes[a], gf->mri_norm, gaussianFFTaxes[a]);
+    for (s = 0; s < mri->depth; s++)
+      for (r = 0; r < mri->height; r++)
+        for (c = 0; c < mri->width; c++)
+          if (MRIgetVoxVal(binmask, c, r, s, 0) < 0.5) MRIFvox(gf->mri_norm, c, r, s) = 0;
+  }
+  return (gf);
+}
+
+int MRIfreeGaussianFFT(MRI_GAUSSIAN_FFT **pgf)
+{
+  MRI_GAUSSIAN_FFT *gf = *pgf;
+  int a;
+
+  if (gf == NULL) return (NO_ERROR);
+  for (a = 0; a < 3; a++) fftAxisFree(&gf->axes[a]);
+  if (gf->mri_norm) MRIfree(&gf->mri_norm);
+  free(gf);
+  *pgf = NULL;
+  return (NO_ERROR);
+}
+
+/*---------------------------------------------------------------------
+  MRIgaussianFFTsmooth() - smooths all the frames of src with a plan
+  from MRIallocGaussianFFT(). If targ is NULL it is allocated as float.
+  Can be done in-place.
+  -------------------------------------------------------------------*/
+MRI *MRIgaussianFFTsmooth(MRI_GAUSSIAN_FFT *gf, MRI *src, MRI *targ)
+{
+  int a, c, r, s, f;
+  float norm;
+
+  if (src->width != gf->width || src->height != gf->height || src->depth != gf->depth)
+    ErrorReturn(NULL,
+                (ERROR_BADPARM,
+                 "MRIgaussianFFTsmooth: volume %dx%dx%d does not match plan %dx%dx%d",
+                 src->width,
+                 src->height,
+                 src->depth,
+                 gf->width,
+                 gf->height,
+                 gf->depth));
+  if (targ == NULL) {
+    targ = MRIallocSequence(src->width, src->height, src->depth, MRI_FLOAT, src->nframes);
+    if (targ == NULL) ErrorReturn(NULL, (ERROR_NOMEMORY, "MRIgaussianFFTsmooth: could not alloc"));
+  }
+  else if (src->width != targ->width || src->height != targ->height || src->depth != targ->depth ||
+           src->nframes != targ->nframes)
+    ErrorReturn(NULL, (ERROR_BADPARM, "MRIgaussianFFTsmooth: src and targ dimensions differ"));
+  if (src != targ) MRIcopy(src, targ);
+
+  // values outside the mask must not leak into it
+  if (gf->mri_norm)
+    for (s = 0; s < src->depth; s++)
+      for (r = 0; r < src->height; r++)
+        for (c = 0; c < src->width; c++)
+          if (MRIFvox(gf->mri_norm, c, r, s) == 0)
+            for (f = 0; f < src->nframes; f++) MRIsetVoxVal(targ, c, r, s, f, 0);
+
+  for (a = 0; a < 3; a++)
+    if (gf->axes[a]) fftAxisConvolve(gf->axes[a], targ, gaussianFFTaxes[a]);
+
+  // rescale so that the kernel sums to 1 near the edge of the mask
+  if (gf->mri_norm)
+    for (s = 0; s < src->depth; s++)
+      for (r = 0; r < src->height; r++)
+        for (c = 0; c < src->width; c++) {
+          norm = MRIFvox(gf->mri_norm, c, r, s);
+          for (f = 0; f < src->nframes; f++)
+            MRIsetVoxVal(targ, c, r, s, f, norm == 0 ? 0 : MRIgetVoxVal(targ, c, r, s, f) / norm);
+        }
+  return (targ);
+}
+
+/* a tap of the full matrices in MRIgaussianSmoothNI(), in double and read
+   and written a voxel at a time, costs several times one of MRIconvolve1d() */
+#define GAUSSIAN_NI_TAP_COST 8
+
+/* whether MRIgaussianSmoothNI() is faster through an FFT than with its
+   full len x len matrices */
+static int gaussianFFTpays(MRI *mri, double cstd, double rstd, double sstd)
+{
+  double direct = 0, fft = 0, std;
+  int a, len, n, klen;
+
+  for (a = 0; a < 3; a++) {
+    std = gaussianFFTstd(mri, a, cstd, rstd, sstd);
+    len = gaussianFFTlen(mri, a);
+    if (std <= 0 || len < 2) continue;
+    klen = 2 * gaussianNIhalf(len, std) + 1;
+    n = fftAxisLength(len, klen, 0);
+    direct += GAUSSIAN_NI_TAP_COST * len;
+    fft += fftAxisCost(len, n);
+  }
+  return (direct > 0 && fft < direct);
+}
+
+/* whether a kernel of klen taps is cheaper to apply to mri through FFTs */
+static int convolveGaussianFFTpays(MRI *mri, int klen)
+{
+  double direct = 0, fft = 0;
+  int a, len;
+
+  for (a = 0; a < 3; a++) {
+    len = gaussianFFTlen(mri, a);
+    direct += klen;
+    fft += fftAxisCost(len, fftAxisLength(len, klen, 1));
+  }
+  return (fft < direct);
+}
+
 /*-----------------------------------------------------
 MRIconvolveGaussian() - see also MRIgaussianSmooth();
 ------------------------------------------------------*/
@@ -2618,6 +2992,21 @@ MRI *MRIconvolveGaussian(MRI *mri_src, MRI *mri_dst, MRI *mri_gaussian)
 
   mri_dst = MRIconvolveGaussian_cuda(mri_src, mri_dst, kernel, klen);
 #else
+  // long kernels on float volumes go through FFTs, which do not get
+  // slower as the kernel gets wider
+  if (mri_src->type == MRI_FLOAT && convolveGaussianFFTpays(mri_src, klen)) {
+    FFT_AXIS *ax;
+    int a;
+
+    MRIcopy(mri_src, mri_dst);
+    for (a = 0; a < 3; a++) {
+      ax = fftAxisAlloc(gaussianFFTlen(mri_src, a), kernel, klen, 1);
+      fftAxisConvolve(ax, mri_dst, gaussianFFTaxes[a]);
+      fftAxisFree(&ax);
+    }
+    return (mri_dst);
+  }
+
   if (mri_dst == mri_src) {
     mri_tmp = mri_dst = MRIclone(mri_src, NULL);
   }
@@ -2660,6 +3049,207 @@ MRI *MRIconvolveGaussian(MRI *mri_src, MRI *mri_dst, MRI *mri_gaussian)
   return (mri_dst);
 }
 
+/* Deriche's 4th order recursive Gaussian: the sum of a causal filter
+   y+[i] = n0 x[i] + ... + n3 x[i-3] - d1 y+[i-1] - ... - d4 y+[i-4] and
+   an anticausal one y-[i] = m1 x[i+1] + ... + m4 x[i+4] - d1 y-[i+1] - ...
+   - d4 y-[i+4], with coefficients fitted to a Gaussian (Deriche 1993) and
+   scaled so that a constant line stays constant */
+typedef struct
+{
+  double n[4], m[4], d[4];
+  double gain_n, gain_m; /* steady state of each filter for a unit input */
+} IIR_GAUSSIAN;
+
+/* below this (in voxels) the fit is not accurate, and the kernel is short
+   enough to convolve with directly */
+#define IIR_MIN_SIGMA 1.0
+
+static void iirGaussianCoefs(double sigma, IIR_GAUSSIAN *g)
+{
+  const double a0 = 1.680, a1 = 3.735, b0 = 1.783, b1 = 1.723, w0 = 0.6318, w1 = 1.997, c0 = -0.6803, c1 = -0.2598;
+  double cw0 = cos(w0 / sigma), sw0 = sin(w0 / sigma), cw1 = cos(w1 / sigma), sw1 = sin(w1 / sigma);
+  double e0 = exp(-b0 / sigma), e1 = exp(-b1 / sigma), sum_n, sum_m, sum_d, scale;
+  int k;
+
+  g->n[0] = a0 + c0;
+  g->n[1] = e1 * (c1 * sw1 - (c0 + 2 * a0) * cw1) + e0 * (a1 * sw0 - (2 * c0 + a0) * cw0);
+  g->n[2] = 2 * e0 * e1 * ((a0 + c0) * cw1 * cw0 - a1 * cw1 * sw0 - c1 * cw0 * sw1) + c0 * e0 * e0 + a0 * e1 * e1;
+  g->n[3] = e1 * e0 * e0 * (c1 * sw1 - c0 * cw1) + e0 * e1 * e1 * (a1 * sw0 - a0 * cw0);
+  g->d[0] = -2 * e1 * cw1 - 2 * e0 * cw0;
+  g->d[1] = 4 * cw1 * cw0 * e0 * e1 + e1 * e1 + e0 * e0;
+  g->d[2] = -2 * cw0 * e0 * e1 * e1 - 2 * cw1 * e1 * e0 * e0;
+  g->d[3] = e0 * e0 * e1 * e1;
+  for (k = 0; k < 3; k++) g->m[k] = g->n[k + 1] - g->d[k] * g->n[0];
+  g->m[3] = -g->d[3] * g->n[0];
+
+  for (sum_n = sum_m = 0, sum_d = 1, k = 0; k < 4; k++) {
+    sum_n += g->n[k];
+    sum_m += g->m[k];
+    sum_d += g->d[k];
+  }
+  scale = sum_d / (sum_n + sum_m);
+  for (k = 0; k < 4; k++) {
+    g->n[k] *= scale;
+    g->m[k] *= scale;
+  }
+  g->gain_n = sum_n * scale / sum_d;
+  g->gain_m = sum_m * scale / sum_d;
+}
+
+/*
+  Filters n lines at once along the axis given by the row pointers
+  rows[0..len-1] (each of n contiguous floats), in place. Past either end
+  the line is taken to continue with its end value, which starts each
+  filter in its steady state. ym is scratch space for len*n floats and
+  state for 7n doubles.
+*/
+static void iirGaussianRows(const IIR_GAUSSIAN *g, float **rows, int len, int n, float *ym, double *state)
+{
+  double *y1 = state, *y2 = state + n, *y3 = state + 2 * n, *y4 = state + 3 * n;
+  double *x1 = state + 4 * n, *x2 = state + 5 * n, *x3 = state + 6 * n;
+  int i, x;
+
+  /* anticausal part into ym */
+  for (x = 0; x < n; x++) y1[x] = y2[x] = y3[x] = y4[x] = g->gain_m * rows[len - 1][x];
+  for (i = len - 1; i >= 0; i--) {
+    float *r1 = rows[MIN(i + 1, len - 1)], *r2 = rows[MIN(i + 2, len - 1)], *r3 = rows[MIN(i + 3, len - 1)],
+          *r4 = rows[MIN(i + 4, len - 1)], *out = ym + (size_t)i * n;
+    for (x = 0; x < n; x++) {
+      double y = g->m[0] * r1[x] + g->m[1] * r2[x] + g->m[2] * r3[x] + g->m[3] * r4[x] - g->d[0] * y1[x] -
+                 g->d[1] * y2[x] - g->d[2] * y3[x] - g->d[3] * y4[x];
+      y4[x] = y3[x];
+      y3[x] = y2[x];
+      y2[x] = y1[x];
+      y1[x] = out[x] = y;
+    }
+  }
+
+  /* causal part, added in place, keeping the inputs it still needs */
+  for (x = 0; x < n; x++) {
+    y1[x] = y2[x] = y3[x] = y4[x] = g->gain_n * rows[0][x];
+    x1[x] = x2[x] = x3[x] = rows[0][x];
+  }
+  for (i = 0; i < len; i++) {
+    float *r = rows[i], *in = ym + (size_t)i * n;
+    for (x = 0; x < n; x++) {
+      double xi = r[x];
+      double y = g->n[0] * xi + g->n[1] * x1[x] + g->n[2] * x2[x] + g->n[3] * x3[x] - g->d[0] * y1[x] -
+                 g->d[1] * y2[x] - g->d[2] * y3[x] - g->d[3] * y4[x];
+      y4[x] = y3[x];
+      y3[x] = y2[x];
+      y2[x] = y1[x];
+      y1[x] = y;
+      x3[x] = x2[x];
+      x2[x] = x1[x];
+      x1[x] = xi;
+      r[x] = y + in[x];
+    }
+  }
+}
+
+/*-----------------------------------------------------
+  MRIconvolveGaussianRecursive() - smooths every frame of mri_src with a
+  Gaussian of standard deviation sigma voxels along each axis, using a
+  recursive filter whose cost does not depend on sigma. The result is
+  close to, but not the same as, MRIconvolveGaussian() with
+  MRIgaussian1d(sigma, -1), whose kernel has polynomial tails beyond
+  2 sigma. Small sigmas are convolved directly. mri_dst must be MRI_FLOAT
+  (allocated if NULL) and may be mri_src.
+------------------------------------------------------*/
+MRI *MRIconvolveGaussianRecursive(MRI *mri_src, MRI *mri_dst, float sigma)
+{
+  IIR_GAUSSIAN g;
+  int width = mri_src->width, height = mri_src->height, depth = mri_src->depth, frame, x, y, z;
+
+  if (!mri_dst) {
+    mri_dst = MRIallocSequence(width, height, depth, MRI_FLOAT, mri_src->nframes);
+    MRIcopyHeader(mri_src, mri_dst);
+  }
+  if (mri_dst->type != MRI_FLOAT)
+    ErrorReturn(NULL, (ERROR_UNSUPPORTED, "MRIconvolveGaussianRecursive: dst must be MRI_FLOAT"));
+
+  if (sigma < IIR_MIN_SIGMA) {
+    MRI *mri_kernel = MRIgaussian1d(sigma, -1), *mri_tmp;
+
+    mri_tmp = mri_src->type == MRI_FLOAT ? mri_src : MRIchangeType(mri_src, MRI_FLOAT, 0, 1, 1);
+    MRIconvolveGaussian(mri_tmp, mri_dst, mri_kernel);
+    if (mri_tmp != mri_src) MRIfree(&mri_tmp);
+    MRIfree(&mri_kernel);
+    return (mri_dst);
+  }
+
+  if (mri_dst != mri_src)
+    for (frame = 0; frame < mri_src->nframes; frame++)
+      for (z = 0; z < depth; z++)
+        for (y = 0; y < height; y++)
+          for (x = 0; x < width; x++)
+            MRIFseq_vox(mri_dst, x, y, z, frame) = MRIgetVoxVal(mri_src, x, y, z, frame);
+
+  iirGaussianCoefs(sigma, &g);
+  for (frame = 0; frame < mri_dst->nframes; frame++) {
+    /* along x on a transposed copy of each slice, so that all its rows are
+       filtered at once, and then along y all the rows of the slice at once */
+    ROMP_PF_begin
+#ifdef HAVE_OPENMP
+    #pragma omp parallel for if_ROMP(assume_reproducible) private(x, y)
+#endif
+    for (z = 0; z < depth; z++) {
+      ROMP_PFLB_begin
+      float **rows = (float **)calloc(MAX(width, height), sizeof(float *));
+      float *ym = (float *)calloc((size_t)width * height, sizeof(float));
+      float *slice = (float *)calloc((size_t)width * height, sizeof(float));
+      double *state = (double *)calloc(7 * MAX(width, height), sizeof(double));
+
+      if (!rows || !ym || !slice || !state)
+        ErrorExit(ERROR_NOMEMORY, "MRIconvolveGaussianRecursive: could not allocate %dx%d buffers", width, height);
+      if (width > 1) {
+        for (y = 0; y < height; y++)
+          for (x = 0; x < width; x++) slice[(size_t)x * height + y] = MRIFseq_vox(mri_dst, x, y, z, frame);
+        for (x = 0; x < width; x++) rows[x] = slice + (size_t)x * height;
+        iirGaussianRows(&g, rows, width, height, ym, state);
+        for (y = 0; y < height; y++)
+          for (x = 0; x < width; x++) MRIFseq_vox(mri_dst, x, y, z, frame) = slice[(size_t)x * height + y];
+      }
+      if (height > 1) {
+        for (y = 0; y < height; y++) rows[y] = &MRIFseq_vox(mri_dst, 0, y, z, frame);
+        iirGaussianRows(&g, rows, height, width, ym, state);
+      }
+      free(rows);
+      free(ym);
+      free(slice);
+      free(state);
+      ROMP_PFLB_end
+    }
+    ROMP_PF_end
+
+    /* along z, the rows with the same y at once */
+    if (depth > 1) {
+      ROMP_PF_begin
+#ifdef HAVE_OPENMP
+      #pragma omp parallel for if_ROMP(assume_reproducible) private(z)
+#endif
+      for (y = 0; y < height; y++) {
+        ROMP_PFLB_begin
+        float **rows = (float **)calloc(depth, sizeof(float *));
+        float *ym = (float *)calloc((size_t)width * depth, sizeof(float));
+        double *state = (double *)calloc(7 * width, sizeof(double));
+
+        if (!rows || !ym || !state)
+          ErrorExit(ERROR_NOMEMORY, "MRIconvolveGaussianRecursive: could not allocate %dx%d buffers", width, depth);
+        for (z = 0; z < depth; z++) rows[z] = &MRIFseq_vox(mri_dst, 0, y, z, frame);
+        iirGaussianRows(&g, rows, depth, width, ym, state);
+        free(rows);
+        free(ym);
+        free(state);
+        ROMP_PFLB_end
+      }
+      ROMP_PF_end
+    }
+  }
+
+  return (mri_dst);
+}
+
 /*---------------------------------------------------------------------
   MRIgaussianSmooth() - performs isotropic gaussian spatial smoothing.
   The standard deviation of the gaussian is std. If norm must be set to 1.
@@ -3021,6 +3611,72 @@ MRI *MRIreduceByte(MRI *mri_src, MRI *mri_dst)
   return (mri_dst);
 }
 
+#ifndef FS_CUDA
+/*-----------------------------------------------------
+  mriConvolve1dRows() - the UCHAR and FLOAT source cases of MRIconvolve1d()
+  into a FLOAT dst. Each output row accumulates one kernel tap at a time
+  over a whole contiguous row (a padded copy of the row for MRI_WIDTH, the
+  neighboring rows for MRI_HEIGHT and MRI_DEPTH), so the inner loops are
+  unit stride and vectorize, and the sum for each voxel is taken in the
+  same order as the per-voxel loop it replaces.
+------------------------------------------------------*/
+static void mriConvolve1dRows(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int src_frame, int dst_frame)
+{
+  int width = mri_src->width, height = mri_src->height, depth = mri_src->depth, halflen = len / 2, z;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(assume_reproducible) schedule(static, 1)
+#endif
+  for (z = 0; z < depth; z++) {
+    ROMP_PFLB_begin
+    int x, y, i, n;
+    float *pad = (float *)calloc(width + len, sizeof(float));
+
+    if (!pad) ErrorExit(ERROR_NOMEMORY, "MRIconvolve1d: could not allocate %d row buffer", width + len);
+    for (y = 0; y < height; y++) {
+      float *out = &MRIFseq_vox(mri_dst, 0, y, z, dst_frame);
+
+      if (axis == MRI_WIDTH) {
+        /* the row with its end values replicated halflen times on each side */
+        for (x = -halflen; x < width + len - halflen; x++) {
+          int xs = MIN(MAX(x, 0), width - 1);
+          pad[x + halflen] =
+              mri_src->type == MRI_UCHAR ? MRIseq_vox(mri_src, xs, y, z, src_frame) : MRIFseq_vox(mri_src, xs, y, z, src_frame);
+        }
+        for (x = 0; x < width; x++) out[x] = 0.0f;
+        for (i = 0; i < len; i++) {
+          float ki = k[i], *p = pad + i;
+          for (x = 0; x < width; x++) out[x] += ki * p[x];
+        }
+      }
+      else {
+        n = axis == MRI_HEIGHT ? height : depth;
+        for (x = 0; x < width; x++) out[x] = 0.0f;
+        for (i = 0; i < len; i++) {
+          float ki = k[i];
+          int j = MIN(MAX((axis == MRI_HEIGHT ? y : z) + i - halflen, 0), n - 1);
+          int ys = axis == MRI_HEIGHT ? j : y, zs = axis == MRI_HEIGHT ? z : j;
+
+          if (mri_src->type == MRI_UCHAR) {
+            BUFTYPE *in = &MRIseq_vox(mri_src, 0, ys, zs, src_frame);
+            for (x = 0; x < width; x++) out[x] += ki * (float)in[x];
+          }
+          else {
+            float *in = &MRIFseq_vox(mri_src, 0, ys, zs, src_frame);
+            for (x = 0; x < width; x++) out[x] += ki * in[x];
+          }
+        }
+      }
+    }
+    free(pad);
+    exec_progress_callback(z, depth, 0, 1);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+#endif
+
 /*-----------------------------------------------------
         Parameters:
 
@@ -3033,10 +3689,9 @@ MRI *MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int
 {
   int width, height, depth;
 #ifndef FS_CUDA
-  int x = 0, y = 0, z = 0, halflen, *xi, *yi, *zi;
+  int x = 0, y = 0, z = 0, halflen;
   register int i = 0;
-  BUFTYPE *inBase = NULL;
-  float *ki = NULL, total = 0, *inBase_f = NULL, *foutPix = NULL, val = 0;
+  float *ki = NULL, total = 0, *foutPix = NULL, val = 0;
 #endif
 
   width = mri_src->width;
@@ -3071,182 +3726,10 @@ MRI *MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int
 
   halflen = len / 2;
 
-  xi = mri_src->xi;
-  yi = mri_src->yi;
-  zi = mri_src->zi;
-
   switch (mri_src->type) {
     case MRI_UCHAR:
-      switch (axis) {
-        case MRI_WIDTH:
-          ROMP_PF_begin
-#ifdef HAVE_OPENMP
-	  #pragma omp parallel for if_ROMP(experimental) firstprivate(y, x, inBase, foutPix, ki, i, total) \
-    shared(depth, height, width, len, halflen, mri_src, mri_dst, src_frame, dst_frame, xi, yi, zi) schedule(static, 1)
-#endif
-          for (z = 0; z < depth; z++) {
-	    ROMP_PFLB_begin
-	    
-            for (y = 0; y < height; y++) {
-              inBase = &MRIseq_vox(mri_src, 0, y, z, src_frame);
-              foutPix = &MRIFseq_vox(mri_dst, 0, y, z, dst_frame);
-              for (x = 0; x < width; x++) {
-                total = 0.0f;
-
-                for (ki = k, i = 0; i < len; i++) {
-                  total += *ki++ * (float)(*(inBase + xi[x + i - halflen]));
-                }
-
-                *foutPix++ = total;
-              }
-            }
-            exec_progress_callback(z, depth, 0, 1);
-	    
-	    ROMP_PFLB_end
-          }
-	  ROMP_PF_end
-	  
-          break;
-        case MRI_HEIGHT:
-          ROMP_PF_begin
-#ifdef HAVE_OPENMP
-	  #pragma omp parallel for if_ROMP(experimental) firstprivate(y, x, foutPix, ki, i, total) \
-    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi, yi, zi) schedule(static, 1)
-#endif
-          for (z = 0; z < depth; z++) {
-	    ROMP_PFLB_begin
-	    
-            for (y = 0; y < height; y++) {
-              foutPix = &MRIFseq_vox(mri_dst, 0, y, z, dst_frame);
-              for (x = 0; x < width; x++) {
-                if (x == Gx && y == Gy && z == Gz) {
-                  DiagBreak();
-                }
-                total = 0.0f;
-
-                for (ki = k, i = 0; i < len; i++)
-                  total += *ki++ * (float)(MRIseq_vox(mri_src, x, yi[y + i - halflen], z, src_frame));
-
-                *foutPix++ = total;
-              }
-            }
-            exec_progress_callback(z, depth, 0, 1);
-	    ROMP_PFLB_end
-          }
-	  ROMP_PF_end
-          break;
-        case MRI_DEPTH:
-          ROMP_PF_begin
-#ifdef HAVE_OPENMP
-	  #pragma omp parallel for if_ROMP(experimental) firstprivate(y, x, foutPix, ki, i, total) \
-    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi, yi, zi) schedule(static, 1)
-#endif
-          for (z = 0; z < depth; z++) {
-	    ROMP_PFLB_begin
-            for (y = 0; y < height; y++) {
-              foutPix = &MRIFseq_vox(mri_dst, 0, y, z, dst_frame);
-              for (x = 0; x < width; x++) {
-                total = 0.0f;
-
-                for (ki = k, i = 0; i < len; i++)
-                  total += *ki++ * (float)(MRIseq_vox(mri_src, x, y, zi[z + i - halflen], src_frame));
-
-                *foutPix++ = total;
-              }
-            }
-            exec_progress_callback(z, depth, 0, 1);
-	    ROMP_PFLB_end
-          }
-	  ROMP_PF_end
-          break;
-      }
-      break;
     case MRI_FLOAT:
-      switch (axis) {
-        case MRI_WIDTH:
-          ROMP_PF_begin
-#ifdef HAVE_OPENMP
-	  #pragma omp parallel for if_ROMP(assume_reproducible) firstprivate(y, x, inBase_f, foutPix, ki, i, total) \
-    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi, yi, zi) schedule(static, 1)
-#endif
-          for (z = 0; z < depth; z++) {
-	    ROMP_PFLB_begin
-	    
-            for (y = 0; y < height; y++) {
-              inBase_f = &MRIFseq_vox(mri_src, 0, y, z, src_frame);
-              foutPix = &MRIFseq_vox(mri_dst, 0, y, z, dst_frame);
-              for (x = 0; x < width; x++) {
-                if (Gx == x && Gy == y && Gz == z) {
-                  DiagBreak();
-                }
-                total = 0.0f;
-
-                for (ki = k, i = 0; i < len; i++) {
-                  total += *ki++ * (*(inBase_f + xi[x + i - halflen]));
-                }
-
-                *foutPix++ = total;
-              }
-            }
-            exec_progress_callback(z, depth, 0, 1);
-	    
-	    ROMP_PFLB_end
-          }
-	  ROMP_PF_end
-          break;
-        case MRI_HEIGHT:
-          ROMP_PF_begin
-#ifdef HAVE_OPENMP
-	  #pragma omp parallel for if_ROMP(assume_reproducible) firstprivate(y, x, foutPix, ki, i, total) \
-    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi, yi, zi) schedule(static, 1)
-#endif
-          for (z = 0; z < depth; z++) {
-	    ROMP_PFLB_begin
-            for (y = 0; y < height; y++) {
-              foutPix = &MRIFseq_vox(mri_dst, 0, y, z, dst_frame);
-              for (x = 0; x < width; x++) {
-                total = 0.0f;
-
-                if (x == Gx && y == Gy && z == Gz) {
-                  DiagBreak();
-                }
-
-                for (ki = k, i = 0; i < len; i++)
-                  total += *ki++ * MRIFseq_vox(mri_src, x, yi[y + i - halflen], z, src_frame);
-
-                *foutPix++ = total;
-              }
-            }
-            exec_progress_callback(z, depth, 0, 1);
-	    ROMP_PFLB_end
-          }
-	  ROMP_PF_end
-          break;
-        case MRI_DEPTH:
-          ROMP_PF_begin
-#ifdef HAVE_OPENMP
-	  #pragma omp parallel for if_ROMP(assume_reproducible) firstprivate(y, x, foutPix, ki, i, total) \
-    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi, yi, zi) schedule(static, 1)
-#endif
-          for (z = 0; z < depth; z++) {
-	    ROMP_PFLB_begin
-            for (y = 0; y < height; y++) {
-              foutPix = &MRIFseq_vox(mri_dst, 0, y, z, dst_frame);
-              for (x = 0; x < width; x++) {
-                total = 0.0f;
-
-                for (ki = k, i = 0; i < len; i++)
-                  total += *ki++ * MRIFseq_vox(mri_src, x, y, zi[z + i - halflen], src_frame);
-
-                *foutPix++ = total;
-              }
-            }
-            exec_progress_callback(z, depth, 0, 1);
-	    ROMP_PFLB_end
-          }
-	  ROMP_PF_end
-          break;
-      }
+      mriConvolve1dRows(mri_src, mri_dst, k, len, axis, src_frame, dst_frame);
       break;
     default:
       switch (axis) {
@@ -3254,7 +3737,7 @@ MRI *MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int
           ROMP_PF_begin
 #ifdef HAVE_OPENMP
 	  #pragma omp parallel for if_ROMP(experimental) firstprivate(y, x, foutPix, ki, i, val, total) \
-    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi, yi, zi) schedule(static, 1)
+    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame) schedule(static, 1)
 #endif
           for (z = 0; z < depth; z++) {
 	    ROMP_PFLB_begin
@@ -3282,7 +3765,7 @@ MRI *MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int
           ROMP_PF_begin
 #ifdef HAVE_OPENMP
 	  #pragma omp parallel for if_ROMP(experimental) firstprivate(y, x, foutPix, ki, i, val, total) \
-    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi, yi, zi) schedule(static, 1)
+    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame) schedule(static, 1)
 #endif
           for (z = 0; z < depth; z++) {
 	    ROMP_PFLB_begin
@@ -3312,7 +3795,7 @@ MRI *MRIconvolve1d(MRI *mri_src, MRI *mri_dst, float *k, int len, int axis, int
           ROMP_PF_begin
 #ifdef HAVE_OPENMP
 	  #pragma omp parallel for if_ROMP(experimental) firstprivate(y, x, foutPix, ki, i, val, total) \
-    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame, xi, yi, zi) schedule(static, 1)
+    shared(depth, height, width, len, halflen, mri_dst, src_frame, dst_frame) schedule(static, 1)
 #endif
           for (z = 0; z < depth; z++) {
 	    ROMP_PFLB_begin
@@ -6186,6 +6669,14 @@ MRI *MRIgaussianSmoothNI(MRI *src, double cstd, double rstd, double sstd, MRI *t
     printf("MRIgaussianSmoothNI(): %d avail.processors, using %d\n", omp_get_num_procs(), omp_get_max_threads());
 #endif
 
+  // for all but small volumes the full matrices below cost more than FFTs
+  if (gaussianFFTpays(src, cstd, rstd, sstd)) {
+    MRI_GAUSSIAN_FFT *gf = MRIallocGaussianFFT(src, cstd, rstd, sstd, NULL);
+    MRIgaussianFFTsmooth(gf, targ, targ);
+    MRIfreeGaussianFFT(&gf);
+    return (targ);
+  }
+
   /* -----------------Smooth the columns -----------------------------*/
   if (cstd > 0) {
     G = GaussianMatrix(src->width, cstd / src->xsize, 1, NULL);
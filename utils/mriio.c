@@ -39,6 +39,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
@@ -8921,7 +8922,17 @@ static MRI *nifti1Read(const char *fname, int read_volume)
     ErrorReturn(NULL, (ERROR_BADFILE, "nifti1Read(): error opening file %s", img_fname));
   }
 
-  if (hdr.scl_slope == 0)  // no voxel value scaling needed
+  if (hdr.scl_slope == 0 && mri->ischunked && mri->bytes_per_vox == bytes_per_voxel) {
+    // chunked: read all frames straight into the chunk
+    if (fread(mri->chunk, 1, mri->bytes_total, fp) != mri->bytes_total) {
+      fclose(fp);
+      MRIfree(&mri);
+      errno = 0;
+      ErrorReturn(NULL, (ERROR_BADFILE, "nifti1Read(): error reading from %s", img_fname));
+    }
+    if (swapped_flag) ByteSwapItems(mri->chunk, mri->bytes_total / bytes_per_voxel, bytes_per_voxel);
+  }
+  else if (hdr.scl_slope == 0)  // no voxel value scaling needed
   {
     void *buf;
 
@@ -9325,18 +9336,28 @@ static int nifti1Write(MRI *mri0, const char *fname)
     ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "nifti1Write(): error opening file %s", img_fname));
   }
 
-  for (t = 0; t < mri->nframes; t++)
-    for (k = 0; k < mri->depth; k++) {
-      for (j = 0; j < mri->height; j++) {
-        buf = &MRIseq_vox(mri, 0, j, k, t);
-        if ((int)fwrite(buf, hdr.bitpix / 8, mri->width, fp) != mri->width) {
-          fclose(fp);
-          errno = 0;
-          ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "nifti1Write(): error writing data to %s", img_fname));
+  if (mri->ischunked && mri->bytes_per_vox == hdr.bitpix / 8) {
+    // chunked: native byte order, write all frames at once
+    if (fwrite(mri->chunk, 1, mri->bytes_total, fp) != mri->bytes_total) {
+      fclose(fp);
+      errno = 0;
+      ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "nifti1Write(): error writing data to %s", img_fname));
+    }
+  }
+  else {
+    for (t = 0; t < mri->nframes; t++)
+      for (k = 0; k < mri->depth; k++) {
+        for (j = 0; j < mri->height; j++) {
+          buf = &MRIseq_vox(mri, 0, j, k, t);
+          if ((int)fwrite(buf, hdr.bitpix / 8, mri->width, fp) != mri->width) {
+            fclose(fp);
+            errno = 0;
+            ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "nifti1Write(): error writing data to %s", img_fname));
+          }
         }
+        exec_progress_callback(k, mri->depth, t, mri->nframes);
       }
-      exec_progress_callback(k, mri->depth, t, mri->nframes);
-    }
+  }
 
   fclose(fp);
   if (FreeMRI) MRIfree(&mri);
@@ -9350,6 +9371,53 @@ static int nifti1Write(MRI *mri0, const char *fname)
   edit both. Automatically detects whether an input is Ico7
   and reshapes.
   -----------------------------------------------------------------*/
+/*!
+  \fn static int znzReadBulk(znzFile fp, void *buf, size_t nbytes)
+  \brief Reads nbytes into buf in as few znzread() calls as possible
+  (gzread takes an int length, so very large reads are split up).
+  Returns 0 on success.
+*/
+static int znzReadBulk(znzFile fp, void *buf, size_t nbytes)
+{
+  size_t n;
+
+  while (nbytes > 0) {
+    n = nbytes < (1UL << 30) ? nbytes : (1UL << 30);
+    if (znzread(buf, 1, n, fp) != n) return (1);
+    buf = (char *)buf + n;
+    nbytes -= n;
+  }
+  return (0);
+}
+
+/*!
+  \fn static int znzWriteBulk(znzFile fp, void *buf, size_t nbytes)
+  \brief Counterpart of znzReadBulk(). Returns 0 on success.
+*/
+static int znzWriteBulk(znzFile fp, void *buf, size_t nbytes)
+{
+  size_t n;
+
+  while (nbytes > 0) {
+    n = nbytes < (1UL << 30) ? nbytes : (1UL << 30);
+    if (znzwrite(buf, 1, n, fp) != n) return (1);
+    buf = (char *)buf + n;
+    nbytes -= n;
+  }
+  return (0);
+}
+
+/*!
+  \fn static void mghOrderBytes(void *buf, size_t nitems, int bpv)
+  \brief Converts a buffer between host and MGH (big endian) byte order.
+*/
+static void mghOrderBytes(void *buf, size_t nitems, int bpv)
+{
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+  ByteSwapItems(buf, nitems, bpv);
+#endif
+}
+
 static MRI *niiRead(const char *fname, int read_volume)
 {
   znzFile fp;
@@ -9622,41 +9690,59 @@ static MRI *niiRead(const char *fname, int read_volume)
     float *fbuf;
     double *dbuf;
     int nn;
-    fbuf = (float *)calloc(mri->width, sizeof(float));
-    dbuf = (double *)calloc(mri->width, sizeof(double));
 
-    for (t = 0; t < mri->nframes; t++) {
-      for (k = 0; k < mri->depth; k++) {
-        for (j = 0; j < mri->height; j++) {
-          buf = &MRIseq_vox(mri, 0, j, k, t);
+    if (mri->ischunked && hdr.datatype != DT_DOUBLE && mri->bytes_per_vox == bytes_per_voxel) {
+      // chunked: each frame is contiguous in memory, so read it straight
+      // into the chunk and fix the byte order in one pass
+      for (t = 0; t < mri->nframes; t++) {
+        buf = (char *)mri->chunk + t * mri->bytes_per_vol;
+        if (znzReadBulk(fp, buf, mri->bytes_per_vol)) {
+          znzclose(fp);
+          MRIfree(&mri);
+          errno = 0;
+          ErrorReturn(NULL, (ERROR_BADFILE, "niiRead(): error reading from %s", fname));
+        }
+        if (swapped_flag) ByteSwapItems(buf, mri->bytes_per_vol / bytes_per_voxel, bytes_per_voxel);
+        exec_progress_callback(mri->depth - 1, mri->depth, t, mri->nframes);
+      }
+    }
+    else {
+      fbuf = (float *)calloc(mri->width, sizeof(float));
+      dbuf = (double *)calloc(mri->width, sizeof(double));
 
-          if (hdr.datatype != DT_DOUBLE)
-            n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
-          else
-            n_read = znzread(dbuf, bytes_per_voxel, mri->width, fp);
-          if (n_read != mri->width) {
-            printf("ERROR: Read %d, expected %d\n", n_read, mri->width);
-            znzclose(fp);
-            MRIfree(&mri);
-            errno = 0;
-            ErrorReturn(NULL, (ERROR_BADFILE, "niiRead(): error reading from %s", fname));
-          }
+      for (t = 0; t < mri->nframes; t++) {
+        for (k = 0; k < mri->depth; k++) {
+          for (j = 0; j < mri->height; j++) {
+            buf = &MRIseq_vox(mri, 0, j, k, t);
 
-          if (swapped_flag) {
-            if (bytes_per_voxel == 2) byteswapbufshort(buf, bytes_per_voxel * mri->width);
-            if (bytes_per_voxel == 4) byteswapbuffloat(buf, bytes_per_voxel * mri->width);
-            if (bytes_per_voxel == 8) byteswapbuffloat(dbuf, bytes_per_voxel * mri->width);
-          }
-          if (hdr.datatype == DT_DOUBLE) {
-            for (nn = 0; nn < mri->width; nn++) fbuf[nn] = (float)dbuf[nn];
-            memcpy(buf, fbuf, 4 * mri->width);
+            if (hdr.datatype != DT_DOUBLE)
+              n_read = znzread(buf, bytes_per_voxel, mri->width, fp);
+            else
+              n_read = znzread(dbuf, bytes_per_voxel, mri->width, fp);
+            if (n_read != mri->width) {
+              printf("ERROR: Read %d, expected %d\n", n_read, mri->width);
+              znzclose(fp);
+              MRIfree(&mri);
+              errno = 0;
+              ErrorReturn(NULL, (ERROR_BADFILE, "niiRead(): error reading from %s", fname));
+            }
+
+            if (swapped_flag) {
+              if (bytes_per_voxel == 2) byteswapbufshort(buf, bytes_per_voxel * mri->width);
+              if (bytes_per_voxel == 4) byteswapbuffloat(buf, bytes_per_voxel * mri->width);
+              if (bytes_per_voxel == 8) byteswapbuffloat(dbuf, bytes_per_voxel * mri->width);
+            }
+            if (hdr.datatype == DT_DOUBLE) {
+              for (nn = 0; nn < mri->width; nn++) fbuf[nn] = (float)dbuf[nn];
+              memcpy(buf, fbuf, 4 * mri->width);
+            }
           }
+          exec_progress_callback(k, mri->depth, t, mri->nframes);
         }
-        exec_progress_callback(k, mri->depth, t, mri->nframes);
       }
+      free(fbuf);
+      free(dbuf);
     }
-    free(fbuf);
-    free(dbuf);
   }
   else {
     // voxel value scaling needed
@@ -9898,7 +9984,7 @@ static int niiWrite(MRI *mri0, const char *fname)
 
   use_compression = 0;
   fnamelen = strlen(fname);
-  if (fname[fnamelen - 1] == 'z') use_compression = 1;
+  if (fname[fnamelen - 1] == 'z') use_compression = ZNZ_BLOCKED;
   if (Gdiag_no > 0) printf("niiWrite: use_compression = %d\n", use_compression);
 
   // Check for ico7 surface
@@ -10041,19 +10127,32 @@ static int niiWrite(MRI *mri0, const char *fname)
 
   // printf("In niiWrite():before dumping: %d, %d, %d, %d\n", mri->nframes,mri->depth,mri->width,mri->height );
   // Now dump the pixel data
-  for (t = 0; t < mri->nframes; t++)
-    for (k = 0; k < mri->depth; k++) {
-      for (j = 0; j < mri->height; j++) {
-        // printf("%d,%d,%d\n",t, k, j);
-        buf = &MRIseq_vox(mri, 0, j, k, t);
-        if ((int)znzwrite(buf, hdr.bitpix / 8, mri->width, fp) != mri->width) {
-          znzclose(fp);
-          errno = 0;
-          ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "niiWrite(): error writing data to %s", fname));
-        }
+  if (mri->ischunked && mri->bytes_per_vox == hdr.bitpix / 8) {
+    // chunked: nifti is stored in native byte order, so write whole frames
+    for (t = 0; t < mri->nframes; t++) {
+      if (znzWriteBulk(fp, (char *)mri->chunk + t * mri->bytes_per_vol, mri->bytes_per_vol)) {
+        znzclose(fp);
+        errno = 0;
+        ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "niiWrite(): error writing data to %s", fname));
       }
-      exec_progress_callback(k, mri->depth, t, mri->nframes);
+      exec_progress_callback(mri->depth - 1, mri->depth, t, mri->nframes);
     }
+  }
+  else {
+    for (t = 0; t < mri->nframes; t++)
+      for (k = 0; k < mri->depth; k++) {
+        for (j = 0; j < mri->height; j++) {
+          // printf("%d,%d,%d\n",t, k, j);
+          buf = &MRIseq_vox(mri, 0, j, k, t);
+          if ((int)znzwrite(buf, hdr.bitpix / 8, mri->width, fp) != mri->width) {
+            znzclose(fp);
+            errno = 0;
+            ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "niiWrite(): error writing data to %s", fname));
+          }
+        }
+        exec_progress_callback(k, mri->depth, t, mri->nframes);
+      }
+  }
 
   znzclose(fp);
 
@@ -10077,7 +10176,7 @@ static int itkMorphWrite(MRI *mri, const char *fname)
 
   use_compression = 0;
   fnamelen = strlen(fname);
-  if (fname[fnamelen - 1] == 'z') use_compression = 1;
+  if (fname[fnamelen - 1] == 'z') use_compression = ZNZ_BLOCKED;
   if (Gdiag_no > 0) printf("itkMorphWrite: use_compression = %d\n", use_compression);
 
   shortmax = (int)(pow(2.0, 15.0));
@@ -11203,6 +11302,25 @@ int znzTAGreadMRIframes(znzFile fp, MRI *mri, long len)
 // declare function pointer
 // static int (*myclose)(FILE *stream);
 
+/*!
+  \fn static void mghSkipBytes(znzFile fp, long nbytes)
+  \brief Skips nbytes forward. Uncompressed and block-indexed .mgz files
+  are seeked directly (touching only the blocks read afterwards); a plain
+  gzip stream has to be decompressed up to the new position.
+*/
+static void mghSkipBytes(znzFile fp, long nbytes)
+{
+  long count;
+  uchar buf[STRLEN];
+
+  if (znzcanseek(fp)) {
+    znzseek(fp, nbytes, SEEK_CUR);
+    return;
+  }
+  for (count = 0; count < nbytes - STRLEN; count += STRLEN) znzread(buf, STRLEN, 1, fp);
+  znzread(buf, nbytes - count, 1, fp);
+}
+
 static MRI *mghRead(const char *fname, int read_volume, int frame)
 {
   MRI *mri;
@@ -11316,26 +11434,12 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
     mri = MRIallocHeader(width, height, depth, type, nframes);
     mri->dof = dof;
     mri->nframes = nframes;
-    if (gzipped) {  // pipe cannot seek
-      long count, total_bytes;
-      uchar buf[STRLEN];
-
-      total_bytes = (long)mri->nframes * width * height * depth * bpv;
-      for (count = 0; count < total_bytes - STRLEN; count += STRLEN) znzread(buf, STRLEN, 1, fp);
-      znzread(buf, total_bytes - count, 1, fp);
-    }
-    else
-      znzseek(fp, (long)mri->nframes * width * height * depth * bpv, SEEK_CUR);
+    mghSkipBytes(fp, (long)mri->nframes * width * height * depth * bpv);
   }
   else {
     if (frame >= 0) {
       start_frame = end_frame = frame;
-      if (gzipped) {  // pipe cannot seek
-        long count;
-        for (count = 0; count < (long)frame * width * height * depth * bpv; count++) znzgetc(fp);
-      }
-      else
-        znzseek(fp, (long)frame * width * height * depth * bpv, SEEK_CUR);
+      mghSkipBytes(fp, (long)frame * width * height * depth * bpv);
       nframes = 1;
     }
     else { /* hack - # of frames < -1 means to only read in that
@@ -11348,52 +11452,69 @@ static MRI *mghRead(const char *fname, int read_volume, int frame)
       end_frame = nframes - 1;
       if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) fprintf(stderr, "read %d frames\n", nframes);
     }
-    buf = (BUFTYPE *)calloc(bytes, sizeof(BUFTYPE));
+    buf = NULL;
     mri = MRIallocSequence(width, height, depth, type, nframes);
     mri->dof = dof;
-    for (frame = start_frame; frame <= end_frame; frame++) {
-      for (z = 0; z < depth; z++) {
-        if ((int)znzread(buf, sizeof(char), bytes, fp) != bytes) {
-          // fclose(fp) ;
+    if (mri->ischunked && mri->bytes_per_vox == bpv) {
+      // chunked: each frame is contiguous in memory, so read it straight
+      // into the chunk and fix the byte order in one pass
+      for (frame = start_frame; frame <= end_frame; frame++) {
+        void *fbuf = (char *)mri->chunk + (frame - start_frame) * mri->bytes_per_vol;
+        if (znzReadBulk(fp, fbuf, mri->bytes_per_vol)) {
           znzclose(fp);
-          free(buf);
-          ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): could not read %d bytes at slice %d", fname, bytes, z));
+          MRIfree(&mri);
+          ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): could not read frame %d", fname, frame));
         }
-        switch (type) {
-          case MRI_INT:
-            for (i = y = 0; y < height; y++) {
-              for (x = 0; x < width; x++, i++) {
-                ival = orderIntBytes(((int *)buf)[i]);
-                MRIIseq_vox(mri, x, y, z, frame - start_frame) = ival;
+        mghOrderBytes(fbuf, mri->bytes_per_vol / bpv, bpv);
+        exec_progress_callback(depth - 1, depth, frame - start_frame, end_frame - start_frame + 1);
+      }
+    }
+    else {
+      buf = (BUFTYPE *)calloc(bytes, sizeof(BUFTYPE));
+      for (frame = start_frame; frame <= end_frame; frame++) {
+        for (z = 0; z < depth; z++) {
+          if ((int)znzread(buf, sizeof(char), bytes, fp) != bytes) {
+            // fclose(fp) ;
+            znzclose(fp);
+            free(buf);
+            ErrorReturn(NULL, (ERROR_BADFILE, "mghRead(%s): could not read %d bytes at slice %d", fname, bytes, z));
+          }
+          switch (type) {
+            case MRI_INT:
+              for (i = y = 0; y < height; y++) {
+                for (x = 0; x < width; x++, i++) {
+                  ival = orderIntBytes(((int *)buf)[i]);
+                  MRIIseq_vox(mri, x, y, z, frame - start_frame) = ival;
+                }
               }
-            }
-            break;
-          case MRI_SHORT:
-            for (i = y = 0; y < height; y++) {
-              for (x = 0; x < width; x++, i++) {
-                sval = orderShortBytes(((short *)buf)[i]);
-                MRISseq_vox(mri, x, y, z, frame - start_frame) = sval;
+              break;
+            case MRI_SHORT:
+              for (i = y = 0; y < height; y++) {
+                for (x = 0; x < width; x++, i++) {
+                  sval = orderShortBytes(((short *)buf)[i]);
+                  MRISseq_vox(mri, x, y, z, frame - start_frame) = sval;
+                }
               }
-            }
-            break;
-          case MRI_TENSOR:
-          case MRI_FLOAT:
-            for (i = y = 0; y < height; y++) {
-              for (x = 0; x < width; x++, i++) {
-                fval = orderFloatBytes(((float *)buf)[i]);
-                MRIFseq_vox(mri, x, y, z, frame - start_frame) = fval;
+              break;
+            case MRI_TENSOR:
+            case MRI_FLOAT:
+              for (i = y = 0; y < height; y++) {
+                for (x = 0; x < width; x++, i++) {
+                  fval = orderFloatBytes(((float *)buf)[i]);
+                  MRIFseq_vox(mri, x, y, z, frame - start_frame) = fval;
+                }
               }
-            }
-            break;
-          case MRI_UCHAR:
-            local_buffer_to_image(buf, mri, z, frame - start_frame);
-            break;
-          default:
-            errno = 0;
-            ErrorReturn(NULL, (ERROR_UNSUPPORTED, "mghRead: unsupported type %d", mri->type));
-            break;
+              break;
+            case MRI_UCHAR:
+              local_buffer_to_image(buf, mri, z, frame - start_frame);
+              break;
+            default:
+              errno = 0;
+              ErrorReturn(NULL, (ERROR_UNSUPPORTED, "mghRead: unsupported type %d", mri->type));
+              break;
+          }
+          exec_progress_callback(z, depth, frame - start_frame, end_frame - start_frame + 1);
         }
-        exec_progress_callback(z, depth, frame - start_frame, end_frame - start_frame + 1);
       }
     }
     if (buf) free(buf);
@@ -11582,6 +11703,10 @@ static int mghWrite(MRI *mri, const char *fname, int frame)
     }
   }
   if (valid_ext) {
+    // .mgz files are written as a block-indexed gzip container so that
+    // header and single-frame reads only decompress what they need. It is
+    // still valid gzip; set FS_PLAIN_GZIP to write a single stream.
+    if (gzipped) gzipped = ZNZ_BLOCKED;
     fp = znzopen(fname, "wb", gzipped);
     if (znz_isnull(fp)) {
       errno = 0;
@@ -11640,47 +11765,81 @@ static int mghWrite(MRI *mri, const char *fname, int frame)
   memset(buf, 0, UNUSED_SPACE_SIZE * sizeof(char));
   znzwrite(buf, sizeof(char), unused_space_size, fp);
 
-  for (frame = start_frame; frame <= end_frame; frame++) {
-    for (z = 0; z < depth; z++) {
-      for (y = 0; y < height; y++) {
-        switch (mri->type) {
-          case MRI_SHORT:
-            for (x = 0; x < width; x++) {
-              if (z == 74 && y == 16 && x == 53) DiagBreak();
-              sval = MRISseq_vox(mri, x, y, z, frame);
-              znzwriteShort(sval, fp);
-            }
-            break;
-          case MRI_INT:
-            for (x = 0; x < width; x++) {
-              if (z == 74 && y == 16 && x == 53) DiagBreak();
-              ival = MRIIseq_vox(mri, x, y, z, frame);
-              znzwriteInt(ival, fp);
-            }
-            break;
-          case MRI_FLOAT:
-            for (x = 0; x < width; x++) {
-              if (z == 74 && y == 16 && x == 53) DiagBreak();
-              // printf("mghWrite: MRI_FLOAT: curr (x, y, z, frame) = (%d, %d, %d, %d)\n", x, y, z, frame);
-              fval = MRIFseq_vox(mri, x, y, z, frame);
-              // if(x==10 && y == 0 && z == 0 && frame == 67)
-              // printf("MRIIO: %g\n",fval);
-              znzwriteFloat(fval, fp);
-            }
-            break;
-          case MRI_UCHAR:
-            if ((int)znzwrite(&MRIseq_vox(mri, 0, y, z, frame), sizeof(BUFTYPE), width, fp) != width) {
+  if (mri->ischunked && (mri->type == MRI_SHORT || mri->type == MRI_INT || mri->type == MRI_FLOAT ||
+                         mri->type == MRI_UCHAR)) {
+    // chunked: convert slabs of whole slices to big endian in a scratch
+    // buffer and write each slab with a single call
+    size_t nslices, nslab, slab_bytes;
+    BUFTYPE *slab;
+
+    nslices = (32 * 1024 * 1024) / mri->bytes_per_slice;
+    if (nslices < 1) nslices = 1;
+    if (nslices > (size_t)depth) nslices = depth;
+    slab = (BUFTYPE *)malloc(nslices * mri->bytes_per_slice);
+    if (slab == NULL) {
+      znzclose(fp);
+      ErrorReturn(ERROR_NOMEMORY, (ERROR_NOMEMORY, "mghWrite: could not allocate %d slices", (int)nslices));
+    }
+    for (frame = start_frame; frame <= end_frame; frame++) {
+      for (z = 0; z < depth; z += nslab) {
+        nslab = depth - z < (int)nslices ? depth - z : nslices;
+        slab_bytes = nslab * mri->bytes_per_slice;
+        memcpy(slab, &MRIseq_vox(mri, 0, 0, z, frame), slab_bytes);
+        mghOrderBytes(slab, slab_bytes / mri->bytes_per_vox, mri->bytes_per_vox);
+        if (znzWriteBulk(fp, slab, slab_bytes)) {
+          free(slab);
+          znzclose(fp);
+          errno = 0;
+          ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "mghWrite: could not write %d bytes to %s", (int)slab_bytes, fname));
+        }
+        exec_progress_callback(z + nslab - 1, depth, frame - start_frame, end_frame - start_frame + 1);
+      }
+    }
+    free(slab);
+  }
+  else {
+    for (frame = start_frame; frame <= end_frame; frame++) {
+      for (z = 0; z < depth; z++) {
+        for (y = 0; y < height; y++) {
+          switch (mri->type) {
+            case MRI_SHORT:
+              for (x = 0; x < width; x++) {
+                if (z == 74 && y == 16 && x == 53) DiagBreak();
+                sval = MRISseq_vox(mri, x, y, z, frame);
+                znzwriteShort(sval, fp);
+              }
+              break;
+            case MRI_INT:
+              for (x = 0; x < width; x++) {
+                if (z == 74 && y == 16 && x == 53) DiagBreak();
+                ival = MRIIseq_vox(mri, x, y, z, frame);
+                znzwriteInt(ival, fp);
+              }
+              break;
+            case MRI_FLOAT:
+              for (x = 0; x < width; x++) {
+                if (z == 74 && y == 16 && x == 53) DiagBreak();
+                // printf("mghWrite: MRI_FLOAT: curr (x, y, z, frame) = (%d, %d, %d, %d)\n", x, y, z, frame);
+                fval = MRIFseq_vox(mri, x, y, z, frame);
+                // if(x==10 && y == 0 && z == 0 && frame == 67)
+                // printf("MRIIO: %g\n",fval);
+                znzwriteFloat(fval, fp);
+              }
+              break;
+            case MRI_UCHAR:
+              if ((int)znzwrite(&MRIseq_vox(mri, 0, y, z, frame), sizeof(BUFTYPE), width, fp) != width) {
+                errno = 0;
+                ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "mghWrite: could not write %d bytes to %s", width, fname));
+              }
+              break;
+            default:
               errno = 0;
-              ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "mghWrite: could not write %d bytes to %s", width, fname));
-            }
-            break;
-          default:
-            errno = 0;
-            ErrorReturn(ERROR_UNSUPPORTED, (ERROR_UNSUPPORTED, "mghWrite: unsupported type %d", mri->type));
-            break;
+              ErrorReturn(ERROR_UNSUPPORTED, (ERROR_UNSUPPORTED, "mghWrite: unsupported type %d", mri->type));
+              break;
+          }
         }
+        exec_progress_callback(z, depth, frame - start_frame, end_frame - start_frame + 1);
       }
-      exec_progress_callback(z, depth, frame - start_frame, end_frame - start_frame + 1);
     }
   }
 
@@ -12208,6 +12367,306 @@ static int mghAppend(MRI *mri, const char *fname, int frame)
   return (NO_ERROR);
 }
 
+/*---------------------------------------------------------------
+  MRIreadMapped() - like MRIread() for uncompressed .mgh and .nii
+  files, but instead of copying the voxels into memory the file is
+  mapped and the (chunked) MRI points straight at its voxel data.
+  Pages are loaded on demand and shared with every other process
+  mapping the same file. Voxels may be changed; the changes are private
+  to the process (copy on write) and never reach the file. NaNs are not
+  removed, as that would touch every page. Falls back to MRIread() when
+  the voxels cannot be used in place (compressed or other formats,
+  byte order differs from the host, scaled nifti data). As .mgh is big
+  endian, on a little endian host only uchar .mgh files are mapped;
+  short, int and float ones are always read.
+  ---------------------------------------------------------------*/
+MRI *MRIreadMapped(const char *fname)
+{
+  MRI *mri;
+  int type, fd, swapped = 0, in_place = 0;
+  size_t offset = 0, len;
+  struct stat stat_buf;
+  void *map;
+
+  chklc();
+
+  len = strlen(fname);
+  if (len == 0 || fname[len - 1] == 'z' || stat(fname, &stat_buf) != 0 || !S_ISREG(stat_buf.st_mode))
+    return (MRIread(fname));
+  type = mri_identify(fname);
+
+  if (type == MRI_MGH_FILE) {
+    // the voxels follow the fixed-size header and are big endian
+    offset = 7 * sizeof(int) + UNUSED_SPACE_SIZE;
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+    swapped = 1;
+#endif
+    in_place = 1;
+  }
+  else if (type == NII_FILE) {
+    struct nifti_1_header hdr;
+    FILE *fp = fopen(fname, "rb");
+    if (fp && fread(&hdr, sizeof(hdr), 1, fp) == 1) {
+      if (hdr.dim[0] < 1 || hdr.dim[0] > 7) {
+        swapped = 1;
+        swap_nifti_1_header(&hdr);
+      }
+      offset = (size_t)hdr.vox_offset;
+      in_place = (hdr.scl_slope == 0 && hdr.datatype != DT_DOUBLE);
+    }
+    if (fp) fclose(fp);
+  }
+  if (!in_place) return (MRIread(fname));
+
+  mri = MRIreadHeader(fname, type);
+  if (mri == NULL) return (NULL);
+  if (mri->type != MRI_UCHAR && mri->type != MRI_SHORT && mri->type != MRI_INT && mri->type != MRI_FLOAT) in_place = 0;
+  if (swapped && mri->type != MRI_UCHAR) in_place = 0;
+  if (!in_place) {
+    if (Gdiag & DIAG_VERBOSE_ON) printf("MRIreadMapped(%s): cannot map in place, reading\n", fname);
+    MRIfree(&mri);
+    return (MRIread(fname));
+  }
+
+  fd = open(fname, O_RDONLY);
+  if (fd < 0) {
+    MRIfree(&mri);
+    ErrorReturn(NULL, (ERROR_BADFILE, "MRIreadMapped(%s): could not open file", fname));
+  }
+  map = mmap(NULL, stat_buf.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    MRIfree(&mri);
+    return (MRIread(fname));
+  }
+  if (MRIsetMappedChunk(mri, map, stat_buf.st_size, offset) != NO_ERROR) {
+    munmap(map, stat_buf.st_size);
+    MRIfree(&mri);
+    return (NULL);
+  }
+  return (mri);
+
+} /* end MRIreadMapped() */
+
+/* seek to offset in a stream file; 0 on success. znzseek() returns 0
+   for plain files but the new offset for gzip and block-indexed ones */
+static int mriStreamSeek(znzFile fp, long offset)
+{
+  return (znzseek(fp, offset, SEEK_SET) < 0);
+}
+
+/*---------------------------------------------------------------
+  MRIstreamOpen() - opens a 4D volume for streaming. The header is
+  read into st->mri; the voxels are left in the file and read piece
+  by piece with MRIstreamReadVoxels() (a range of voxels across all
+  frames, eg, a slab of vertices for a per-vertex GLM) or
+  MRIstreamReadFrames() (a range of frames across all voxels, eg, for
+  frame statistics), so that only the piece being worked on is ever
+  in memory. Works for .mgh, .mgz, .nii and .nii.gz; .mgz/.nii.gz
+  written as block-indexed gzip (the default) can be read in any
+  order, plain gzip only efficiently from front to back. Other
+  formats, and scaled or double nifti, are read whole and the pieces
+  copied out of memory.
+  ---------------------------------------------------------------*/
+MRI_STREAM *MRIstreamOpen(const char *fname)
+{
+  MRI_STREAM *st;
+  int type, streamable = 0;
+  long nbytes;
+
+  type = mri_identify(fname);
+  st = (MRI_STREAM *)calloc(1, sizeof(MRI_STREAM));
+  strcpy(st->fname, fname);
+
+  st->mri = MRIreadHeader(fname, type);
+  if (st->mri == NULL) {
+    free(st);
+    return (NULL);
+  }
+  st->nvox = (long)st->mri->width * st->mri->height * st->mri->depth;
+
+  if (type == MRI_MGH_FILE) {
+    // the voxels follow the fixed-size header and are big endian
+    st->offset = 7 * sizeof(int) + UNUSED_SPACE_SIZE;
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+    st->swapped = 1;
+#endif
+    streamable = 1;
+  }
+  else if (type == NII_FILE) {
+    struct nifti_1_header hdr;
+    znzFile fp = znzopen(fname, "r", fname[strlen(fname) - 1] == 'z');
+    if (!znz_isnull(fp) && znzread(&hdr, sizeof(hdr), 1, fp) == 1) {
+      if (hdr.dim[0] < 1 || hdr.dim[0] > 7) {
+        st->swapped = 1;
+        swap_nifti_1_header(&hdr);
+      }
+      st->offset = (long)hdr.vox_offset;
+      streamable = (hdr.scl_slope == 0 && hdr.datatype != DT_DOUBLE);
+    }
+    if (!znz_isnull(fp)) znzclose(fp);
+  }
+  if (st->mri->type != MRI_UCHAR && st->mri->type != MRI_SHORT && st->mri->type != MRI_INT &&
+      st->mri->type != MRI_FLOAT)
+    streamable = 0;
+
+  if (streamable) {
+    st->fp = znzopen(fname, "r", fname[strlen(fname) - 1] == 'z');
+    if (znz_isnull(st->fp)) {
+      MRIstreamClose(&st);
+      ErrorReturn(NULL, (ERROR_BADFILE, "MRIstreamOpen(%s): could not open file", fname));
+    }
+    st->bytes_per_vox = MRIsizeof(st->mri->type);
+    // make sure the file is as long as the header says
+    nbytes = st->offset + st->nvox * st->mri->nframes * st->bytes_per_vox;
+    if (znzcanseek(st->fp) && (mriStreamSeek(st->fp, nbytes - 1) || znzgetc(st->fp) < 0)) {
+      MRIstreamClose(&st);
+      ErrorReturn(NULL, (ERROR_BADFILE, "MRIstreamOpen(%s): file is shorter than its header says", fname));
+    }
+    return (st);
+  }
+
+  if (Gdiag & DIAG_VERBOSE_ON) printf("MRIstreamOpen(%s): cannot stream, reading\n", fname);
+  st->loaded = MRIread(fname);
+  if (st->loaded == NULL) {
+    MRIstreamClose(&st);
+    return (NULL);
+  }
+  return (st);
+}
+
+/*---------------------------------------------------------------
+  MRIstreamClose() - closes the file and frees the stream.
+  ---------------------------------------------------------------*/
+int MRIstreamClose(MRI_STREAM **pst)
+{
+  MRI_STREAM *st = *pst;
+
+  if (st == NULL) return (NO_ERROR);
+  if (st->fp) znzclose(st->fp);
+  if (st->mri) MRIfree(&st->mri);
+  if (st->loaded) MRIfree(&st->loaded);
+  free(st);
+  *pst = NULL;
+  return (NO_ERROR);
+}
+
+/*---------------------------------------------------------------
+  MRIstreamSlabVoxels() - number of voxels to pass to
+  MRIstreamReadVoxels() so that a slab (all frames) takes about
+  max_bytes as float. At least one voxel, at most the whole volume.
+  ---------------------------------------------------------------*/
+long MRIstreamSlabVoxels(MRI_STREAM *st, size_t max_bytes)
+{
+  long nv;
+
+  nv = (long)(max_bytes / ((size_t)st->mri->nframes * sizeof(float)));
+  if (nv < 1) nv = 1;
+  if (nv > st->nvox) nv = st->nvox;
+  return (nv);
+}
+
+/*---------------------------------------------------------------
+  MRIstreamReadVoxels() - reads voxels v0 to v0+nv-1 (counted with the
+  column changing fastest, then row, then slice) of every frame into
+  dst, an nv x 1 x 1 volume with the same type and number of frames
+  as the file. dst is allocated if NULL (or reallocated if it is not
+  the right size) and returned. Voxel v of the slab is at column v.
+  ---------------------------------------------------------------*/
+MRI *MRIstreamReadVoxels(MRI_STREAM *st, long v0, long nv, MRI *dst)
+{
+  MRI *src = st->mri;
+  long v, c, r, s;
+  int f;
+
+  if (v0 < 0 || nv < 1 || v0 + nv > st->nvox)
+    ErrorReturn(NULL, (ERROR_BADPARM, "MRIstreamReadVoxels(%s): voxels %ld-%ld out of range", st->fname, v0, v0 + nv - 1));
+
+  if (dst && (dst->width != nv || dst->type != src->type || dst->nframes != src->nframes)) MRIfree(&dst);
+  if (dst == NULL) {
+    dst = MRIallocSequence(nv, 1, 1, src->type, src->nframes);
+    if (dst == NULL) return (NULL);
+    MRIcopyHeader(src, dst);
+  }
+
+  if (st->loaded) {
+    for (f = 0; f < src->nframes; f++) {
+      for (v = 0; v < nv; v++) {
+        c = (v0 + v) % src->width;
+        r = ((v0 + v) / src->width) % src->height;
+        s = (v0 + v) / ((long)src->width * src->height);
+        MRIsetVoxVal(dst, v, 0, 0, f, MRIgetVoxVal(st->loaded, c, r, s, f));
+      }
+    }
+    return (dst);
+  }
+
+  for (f = 0; f < src->nframes; f++) {
+    if (mriStreamSeek(st->fp, st->offset + ((long)f * st->nvox + v0) * st->bytes_per_vox) ||
+        znzReadBulk(st->fp, dst->slices[f][0], (size_t)nv * st->bytes_per_vox)) {
+      MRIfree(&dst);
+      ErrorReturn(NULL, (ERROR_BADFILE, "MRIstreamReadVoxels(%s): could not read frame %d", st->fname, f));
+    }
+    if (st->swapped) ByteSwapItems(dst->slices[f][0], nv, st->bytes_per_vox);
+  }
+  return (dst);
+}
+
+/*---------------------------------------------------------------
+  MRIstreamReadFrames() - reads frames f0 to f0+nf-1 (all voxels) into
+  dst, which has the dimensions and type of the file and nf frames. dst
+  is allocated if NULL (or reallocated if it is not the right size) and
+  returned.
+  ---------------------------------------------------------------*/
+MRI *MRIstreamReadFrames(MRI_STREAM *st, int f0, int nf, MRI *dst)
+{
+  MRI *src = st->mri;
+  int f, r, s;
+  size_t rowbytes;
+
+  if (f0 < 0 || nf < 1 || f0 + nf > src->nframes)
+    ErrorReturn(NULL, (ERROR_BADPARM, "MRIstreamReadFrames(%s): frames %d-%d out of range", st->fname, f0, f0 + nf - 1));
+
+  if (dst && (MRIdimMismatch(dst, src, 0) || dst->type != src->type || dst->nframes != nf)) MRIfree(&dst);
+  if (dst == NULL) {
+    dst = MRIallocSequence(src->width, src->height, src->depth, src->type, nf);
+    if (dst == NULL) return (NULL);
+    MRIcopyHeader(src, dst);
+  }
+
+  if (st->loaded) {
+    for (f = 0; f < nf; f++) MRIcopyFrame(st->loaded, dst, f0 + f, f);
+    return (dst);
+  }
+
+  if (mriStreamSeek(st->fp, st->offset + (long)f0 * st->nvox * st->bytes_per_vox)) {
+    MRIfree(&dst);
+    ErrorReturn(NULL, (ERROR_BADFILE, "MRIstreamReadFrames(%s): could not seek to frame %d", st->fname, f0));
+  }
+  rowbytes = (size_t)src->width * st->bytes_per_vox;
+  for (f = 0; f < nf; f++) {
+    if (dst->ischunked) {
+      // frames are contiguous in the chunk
+      if (znzReadBulk(st->fp, (char *)dst->chunk + f * dst->bytes_per_vol, dst->bytes_per_vol)) break;
+      if (st->swapped) ByteSwapItems((char *)dst->chunk + f * dst->bytes_per_vol, st->nvox, st->bytes_per_vox);
+      continue;
+    }
+    for (s = 0; s < src->depth; s++) {
+      for (r = 0; r < src->height; r++) {
+        if (znzReadBulk(st->fp, dst->slices[f * src->depth + s][r], rowbytes)) break;
+        if (st->swapped) ByteSwapItems(dst->slices[f * src->depth + s][r], src->width, st->bytes_per_vox);
+      }
+      if (r < src->height) break;
+    }
+    if (s < src->depth) break;
+  }
+  if (f < nf) {
+    MRIfree(&dst);
+    ErrorReturn(NULL, (ERROR_BADFILE, "MRIstreamReadFrames(%s): could not read frame %d", st->fname, f0 + f));
+  }
+  return (dst);
+}
+
 /*-----------------------------------------------------
   Parameters:
 
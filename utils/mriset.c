@@ -45,6 +45,7 @@ double round(double x);
 #include "minc_volume_io.h"
 #include "mri.h"
 #include "mri2.h"
+#include "mriview.h"
 #include "proto.h"
 #include "region.h"
 
@@ -2309,7 +2310,6 @@ MRI *MRImaskDifferentGeometry(MRI *mri_src, MRI *mri_mask, MRI *mri_dst, int mas
 MRI *MRImask(MRI *mri_src, MRI *mri_mask, MRI *mri_dst, int mask, float out_val)
 {
   int width, height, depth, nframes, x, y, z, f, mask_val;
-  float val;
 
   if (mri_src->width != mri_mask->width || mri_src->height != mri_mask->height || mri_src->depth != mri_mask->depth ||
       mri_src->xsize != mri_mask->xsize || mri_src->ysize != mri_mask->ysize || mri_src->zsize != mri_mask->zsize ||
@@ -2332,21 +2332,26 @@ MRI *MRImask(MRI *mri_src, MRI *mri_mask, MRI *mri_dst, int mask, float out_val)
 
   if (mri_src->type != mri_dst->type) ErrorReturn(NULL, (ERROR_UNSUPPORTED, "MRImask: src and dst must be same type"));
 
-  for (z = 0; z < depth; z++) {
-    for (y = 0; y < height; y++) {
-      for (x = 0; x < width; x++) {
-        if (x == Gx && y == Gy && z == Gz) DiagBreak();
-        mask_val = MRIgetVoxVal(mri_mask, x, y, z, 0);
-        for (f = 0; f < nframes; f++) {
-          if (mask_val == mask)
-            val = out_val;
-          else
-            val = MRIgetVoxVal(mri_src, x, y, z, f);
-          MRIsetVoxVal(mri_dst, x, y, z, f, val);
+  // src and dst have the same type, so voxels outside the mask are
+  // copied as they are
+  MRI_TYPE_SWITCH(mri_mask->type, M, MRI_TYPE_SWITCH(mri_src->type, T,
+    for (f = 0; f < nframes; f++) {
+      for (z = 0; z < depth; z++) {
+        for (y = 0; y < height; y++) {
+          M *pmask = MRI_ROW(mri_mask, M, y, z, 0);
+          T *psrc = MRI_ROW(mri_src, T, y, z, f);
+          T *pdst = MRI_ROW(mri_dst, T, y, z, f);
+          for (x = 0; x < width; x++) {
+            mask_val = MRI_LOAD(M, pmask + x);
+            if (mask_val == mask)
+              MRI_STORE(T, pdst + x, out_val);
+            else
+              pdst[x] = psrc[x];
+          }
         }
       }
     }
-  }
+  ));
   return (mri_dst);
 }
 /*------------------------------------------------------------------
@@ -0,0 +1,299 @@
+/**
+ * @file  mriskdtree.c
+ * @brief kd-tree of surface vertex positions for closest-vertex queries
+ *
+ * The tree is implicit: the points are reordered so that the median of
+ * every range [lo,hi) splits it on the axis stored at the median, with
+ * the smaller coordinates in [lo,median). Ranges of KDT_LEAF_SIZE points
+ * or fewer are scanned linearly.
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diag.h"
+#include "error.h"
+#include "macros.h"
+#include "mriskdtree.h"
+#include "mrisurf.h"
+#include "romp_support.h"
+
+#define KDT_LEAF_SIZE 8
+
+/* MRISfindClosestVertex() returns -1 unless a vertex is closer than this */
+#define KDT_MAX_DIST 10000.0f
+
+typedef struct
+{
+  float *c[3]; /* coordinates by axis, indexed by vertex number */
+  int *idx;    /* vertex numbers being ordered */
+} KDT_BUILD;
+
+/* orders idx[lo..hi) so that idx[k] has the k-th smallest coordinate on axis */
+static void kdtSelect(KDT_BUILD *b, int lo, int hi, int k, int axis)
+{
+  float *c = b->c[axis];
+  int *idx = b->idx;
+
+  hi--;
+  while (hi > lo) {
+    float pivot = c[idx[lo + (hi - lo) / 2]];
+    int i = lo, j = hi, tmp;
+
+    while (i <= j) {
+      while (c[idx[i]] < pivot) i++;
+      while (c[idx[j]] > pivot) j--;
+      if (i <= j) {
+        tmp = idx[i];
+        idx[i] = idx[j];
+        idx[j] = tmp;
+        i++;
+        j--;
+      }
+    }
+    if (k <= j)
+      hi = j;
+    else if (k >= i)
+      lo = i;
+    else
+      break;
+  }
+}
+
+static void kdtBuild(KDT_BUILD *b, unsigned char *axis, int lo, int hi)
+{
+  float min[3], max[3], extent;
+  int n, a, m, best;
+
+  if (hi - lo <= KDT_LEAF_SIZE) return;
+
+  /* split on the axis with the largest extent */
+  for (a = 0; a < 3; a++) min[a] = max[a] = b->c[a][b->idx[lo]];
+  for (n = lo + 1; n < hi; n++)
+    for (a = 0; a < 3; a++) {
+      float c = b->c[a][b->idx[n]];
+      if (c < min[a]) min[a] = c;
+      if (c > max[a]) max[a] = c;
+    }
+  for (best = 0, extent = max[0] - min[0], a = 1; a < 3; a++)
+    if (max[a] - min[a] > extent) {
+      extent = max[a] - min[a];
+      best = a;
+    }
+
+  m = lo + (hi - lo) / 2;
+  kdtSelect(b, lo, hi, m, best);
+  axis[m] = best;
+  kdtBuild(b, axis, lo, m);
+  kdtBuild(b, axis, m + 1, hi);
+}
+
+/*-----------------------------------------------------
+  MRISkdtreeCreate() - builds a kd-tree of the unripped vertices of
+  mris at the coordinates given by which (see MRISvertexCoord2XYZ_float).
+  ------------------------------------------------------*/
+MRIS_KDTREE *MRISkdtreeCreate(MRI_SURFACE *mris, int which)
+{
+  MRIS_KDTREE *kdt;
+  KDT_BUILD b;
+  int vno, n, a;
+
+  kdt = (MRIS_KDTREE *)calloc(1, sizeof(MRIS_KDTREE));
+  for (a = 0; a < 3; a++) b.c[a] = (float *)calloc(MAX(mris->nvertices, 1), sizeof(float));
+  b.idx = (int *)calloc(MAX(mris->nvertices, 1), sizeof(int));
+  if (!kdt || !b.c[0] || !b.c[1] || !b.c[2] || !b.idx)
+    ErrorExit(ERROR_NOMEMORY, "MRISkdtreeCreate: could not allocate %d vertices", mris->nvertices);
+
+  kdt->which = which;
+  for (n = vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX *v = &mris->vertices[vno];
+    if (v->ripflag) continue;
+    MRISvertexCoord2XYZ_float(v, which, &b.c[0][vno], &b.c[1][vno], &b.c[2][vno]);
+    b.idx[n++] = vno;
+  }
+  kdt->npoints = n;
+
+  kdt->vno = (int *)calloc(MAX(n, 1), sizeof(int));
+  kdt->x = (float *)calloc(MAX(n, 1), sizeof(float));
+  kdt->y = (float *)calloc(MAX(n, 1), sizeof(float));
+  kdt->z = (float *)calloc(MAX(n, 1), sizeof(float));
+  kdt->axis = (unsigned char *)calloc(MAX(n, 1), sizeof(unsigned char));
+  if (!kdt->vno || !kdt->x || !kdt->y || !kdt->z || !kdt->axis)
+    ErrorExit(ERROR_NOMEMORY, "MRISkdtreeCreate: could not allocate %d points", n);
+
+  kdtBuild(&b, kdt->axis, 0, n);
+
+  /* store the points in tree order so that the leaves are contiguous */
+  for (n = 0; n < kdt->npoints; n++) {
+    vno = b.idx[n];
+    kdt->vno[n] = vno;
+    kdt->x[n] = b.c[0][vno];
+    kdt->y[n] = b.c[1][vno];
+    kdt->z[n] = b.c[2][vno];
+  }
+
+  for (a = 0; a < 3; a++) free(b.c[a]);
+  free(b.idx);
+  return (kdt);
+}
+
+void MRISkdtreeFree(MRIS_KDTREE **pkdt)
+{
+  MRIS_KDTREE *kdt = *pkdt;
+
+  if (!kdt) return;
+  *pkdt = NULL;
+  free(kdt->vno);
+  free(kdt->x);
+  free(kdt->y);
+  free(kdt->z);
+  free(kdt->axis);
+  free(kdt);
+}
+
+typedef struct
+{
+  float x, y, z;
+  float dmin; /* distance of the best point so far */
+  int best;   /* index of the best point so far, -1 if none */
+} KDT_QUERY;
+
+/* the distance is computed as in MRISfindClosestVertex() and ties go to
+   the lowest vertex number, so that both give the same vertex */
+static void kdtVisit(MRIS_KDTREE const *kdt, KDT_QUERY *q, int n)
+{
+  float dx = kdt->x[n] - q->x, dy = kdt->y[n] - q->y, dz = kdt->z[n] - q->z;
+  float d = sqrt(dx * dx + dy * dy + dz * dz);
+
+  if (d < q->dmin || (d == q->dmin && q->best >= 0 && kdt->vno[n] < kdt->vno[q->best])) {
+    q->dmin = d;
+    q->best = n;
+  }
+}
+
+static void kdtSearch(MRIS_KDTREE const *kdt, KDT_QUERY *q, int lo, int hi)
+{
+  int m, n;
+  float diff;
+
+  if (hi - lo <= KDT_LEAF_SIZE) {
+    for (n = lo; n < hi; n++) kdtVisit(kdt, q, n);
+    return;
+  }
+
+  m = lo + (hi - lo) / 2;
+  switch (kdt->axis[m]) {
+    case 0:
+      diff = q->x - kdt->x[m];
+      break;
+    case 1:
+      diff = q->y - kdt->y[m];
+      break;
+    default:
+      diff = q->z - kdt->z[m];
+      break;
+  }
+
+  /* near side first; the far side only if the splitting plane is within
+     dmin (with slack for the rounding of the float distances) */
+  if (diff < 0) {
+    kdtSearch(kdt, q, lo, m);
+    if (-diff <= q->dmin * 1.0001f) {
+      kdtVisit(kdt, q, m);
+      kdtSearch(kdt, q, m + 1, hi);
+    }
+  }
+  else {
+    kdtSearch(kdt, q, m + 1, hi);
+    if (diff <= q->dmin * 1.0001f) {
+      kdtVisit(kdt, q, m);
+      kdtSearch(kdt, q, lo, m);
+    }
+  }
+}
+
+int MRISkdtreeFindClosest(MRIS_KDTREE const *kdt, float x, float y, float z, float *dmin)
+{
+  KDT_QUERY q;
+
+  q.x = x;
+  q.y = y;
+  q.z = z;
+  q.dmin = KDT_MAX_DIST;
+  q.best = -1;
+  kdtSearch(kdt, &q, 0, kdt->npoints);
+
+  if (dmin != NULL) {
+    *dmin = q.dmin;
+  }
+  return (q.best < 0 ? -1 : kdt->vno[q.best]);
+}
+
+int MRISkdtreeFindClosestBatch(
+    MRIS_KDTREE const *kdt, int n, float const *x, float const *y, float const *z, int *vno, float *dmin)
+{
+  int i;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(static, 1024)
+#endif
+  for (i = 0; i < n; i++) {
+    ROMP_PFLB_begin
+    vno[i] = MRISkdtreeFindClosest(kdt, x[i], y[i], z[i], dmin ? &dmin[i] : NULL);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  return (NO_ERROR);
+}
+
+MRIS_KDTREE *MRISgetVertexIndex(MRI_SURFACE const *mris, int which)
+{
+  MRIS_KDTREE *kdt;
+
+  for (kdt = mris->kdtree; kdt; kdt = kdt->next)
+    if (kdt->which == which) return (kdt);
+  return (NULL);
+}
+
+MRIS_KDTREE *MRISattachVertexIndex(MRI_SURFACE *mris, int which)
+{
+  MRIS_KDTREE *kdt;
+
+  MRISdetachVertexIndex(mris, which);
+  kdt = MRISkdtreeCreate(mris, which);
+  kdt->next = mris->kdtree;
+  mris->kdtree = kdt;
+  return (kdt);
+}
+
+int MRISdetachVertexIndex(MRI_SURFACE *mris, int which)
+{
+  MRIS_KDTREE **pkdt = &mris->kdtree, *kdt;
+
+  while ((kdt = *pkdt) != NULL) {
+    if (which < 0 || kdt->which == which) {
+      *pkdt = kdt->next;
+      MRISkdtreeFree(&kdt);
+    }
+    else
+      pkdt = &kdt->next;
+  }
+  return (NO_ERROR);
+}
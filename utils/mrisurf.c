@@ -66,10 +66,6 @@ static const int debugNonDeterminism = 0;
 #include <sys/types.h>
 #include <unistd.h>
 
-#ifndef __APPLE__
-#include <mcheck.h>
-#endif
-
 #include "mri.h"
 #include "mrisurf.h"
 #include "mrishash_internals.h"
@@ -90,6 +86,7 @@ static const int debugNonDeterminism = 0;
 #include "mri2.h"
 #include "mri_circulars.h"
 #include "mri_identify.h"
+#include "mriskdtree.h"
 #include "proto.h"
 #include "realm.h"
 #include "selxavgio.h"
@@ -519,6 +516,8 @@ static double mrisComputeDistanceError(MRI_SURFACE *mris, INTEGRATION_PARMS *par
 double mrisComputeCorrelationError(MRI_SURFACE *mris, INTEGRATION_PARMS *parms, int use_stds);
 static int mrisComputeVertexDistances(MRI_SURFACE *mris);
 static int mrisComputeOriginalVertexDistances(MRI_SURFACE *mris);
+static void mrisNbhdReserve(MRI_SURFACE *mris, int vno, int room, int keep_v, int keep_dist);
+static void mrisNbhdArenaFree(MRI_SURFACE *mris);
 static double mrisComputeError(MRI_SURFACE *mris,
                                INTEGRATION_PARMS *parms,
                                float *parea_rms,
@@ -1989,6 +1988,8 @@ int MRISfree(MRI_SURFACE **pmris)
   mris = *pmris;
   *pmris = NULL;
 
+  mrisNbhdArenaFree(mris);
+  MRISdetachVertexIndex(mris, -1);
   if (mris->dx2) {
     free(mris->dx2);
   }
@@ -2072,19 +2073,200 @@ int MRISfree(MRI_SURFACE **pmris)
   ------------------------------------------------------*/
 int MRISfreeDists(MRI_SURFACE *mris)
 {
+  MRIS_NBHD_ARENA *arena = mris->nbhd_arena;
   int vno;
 
   for (vno = 0; vno < mris->nvertices; vno++) {
-    if (mris->vertices[vno].dist) {
-      free(mris->vertices[vno].dist);
+    VERTEX *v = &mris->vertices[vno];
+    long start = (arena && vno < arena->nvertices) ? arena->start[vno] : -1;
+
+    if (v->dist && (start < 0 || v->dist != arena->dist + start)) {
+      free(v->dist);
     }
-    if (mris->vertices[vno].dist_orig) {
-      free(mris->vertices[vno].dist_orig);
+    if (v->dist_orig && (start < 0 || v->dist_orig != arena->dist_orig + start)) {
+      free(v->dist_orig);
+    }
+    v->dist = v->dist_orig = NULL;
+    v->vtotal = 0;
+  }
+
+  return (NO_ERROR);
+}
+
+/*-----------------------------------------------------
+  The neighborhood arena (see MRIS_NBHD_ARENA). A vertex's v, dist or
+  dist_orig is in the arena iff it points at the vertex's slot; anything
+  else is a heap array of its own, e.g. one allocated by code that does
+  not know about the arena.
+  ------------------------------------------------------*/
+#define NBHD_IN_ARENA(arena, vno, ptr, field) \
+  ((arena)->start[vno] >= 0 && (ptr) == (arena)->field + (arena)->start[vno])
+
+/* make start/room cover mris->max_vertices vertices */
+static void mrisNbhdArenaGrowVertices(MRI_SURFACE *mris, MRIS_NBHD_ARENA *arena)
+{
+  int vno, nvertices = MAX(mris->max_vertices, mris->nvertices);
+
+  if (arena->nvertices >= nvertices) return;
+  arena->start = (long *)realloc(arena->start, nvertices * sizeof(long));
+  arena->room = (int *)realloc(arena->room, nvertices * sizeof(int));
+  if (!arena->start || !arena->room)
+    ErrorExit(ERROR_NOMEMORY, "mrisNbhdArenaGrowVertices: could not allocate %d vertices", nvertices);
+  for (vno = arena->nvertices; vno < nvertices; vno++) {
+    arena->start[vno] = -1;
+    arena->room[vno] = 0;
+  }
+  arena->nvertices = nvertices;
+}
+
+/* move the slots in use into blocks with room for at least 'need' more entries */
+static void mrisNbhdArenaCompact(MRI_SURFACE *mris, size_t need)
+{
+  MRIS_NBHD_ARENA *arena = mris->nbhd_arena;
+  size_t live, size, used;
+  int vno, *nv;
+  float *ndist, *ndist_orig;
+
+  for (live = 0, vno = 0; vno < arena->nvertices; vno++)
+    if (arena->start[vno] >= 0) live += arena->room[vno];
+  size = MAX(2 * arena->size, live + need);
+  nv = (int *)malloc(size * sizeof(int));
+  ndist = (float *)malloc(size * sizeof(float));
+  ndist_orig = (float *)malloc(size * sizeof(float));
+  if (!nv || !ndist || !ndist_orig)
+    ErrorExit(ERROR_NOMEMORY, "mrisNbhdArenaCompact: could not allocate %ld neighbors", (long)size);
+
+  for (used = 0, vno = 0; vno < arena->nvertices; vno++) {
+    VERTEX *v;
+    int in_v, in_dist, in_dist_orig, room = arena->room[vno];
+
+    if (vno >= mris->nvertices) {
+      arena->start[vno] = -1;
+      continue;
     }
-    mris->vertices[vno].dist = mris->vertices[vno].dist_orig = NULL;
-    mris->vertices[vno].vtotal = 0;
+    v = &mris->vertices[vno];
+    in_v = NBHD_IN_ARENA(arena, vno, v->v, v);
+    in_dist = NBHD_IN_ARENA(arena, vno, v->dist, dist);
+    in_dist_orig = NBHD_IN_ARENA(arena, vno, v->dist_orig, dist_orig);
+    arena->start[vno] = -1;
+    if (!in_v && !in_dist && !in_dist_orig) continue;
+    if (in_v) v->v = (int *)memmove(nv + used, v->v, room * sizeof(int));
+    if (in_dist) v->dist = (float *)memmove(ndist + used, v->dist, room * sizeof(float));
+    if (in_dist_orig) v->dist_orig = (float *)memmove(ndist_orig + used, v->dist_orig, room * sizeof(float));
+    arena->start[vno] = used;
+    used += room;
+  }
+  free(arena->v);
+  free(arena->dist);
+  free(arena->dist_orig);
+  arena->v = nv;
+  arena->dist = ndist;
+  arena->dist_orig = ndist_orig;
+  arena->size = size;
+  arena->used = used;
+}
+
+/*
+  Gives vertex vno v, dist and dist_orig arrays with at least room
+  entries from the arena, keeping the first keep_v neighbors and the
+  first keep_dist distances and zeroing the rest. The slot is reused if
+  it is big enough, so no memory is allocated when a neighborhood is
+  rebuilt at the same or a smaller size.
+*/
+static void mrisNbhdReserve(MRI_SURFACE *mris, int vno, int room, int keep_v, int keep_dist)
+{
+  MRIS_NBHD_ARENA *arena = mris->nbhd_arena;
+  VERTEX *v = &mris->vertices[vno];
+  long slot;
+
+  if (!arena) {
+    arena = mris->nbhd_arena = (MRIS_NBHD_ARENA *)calloc(1, sizeof(MRIS_NBHD_ARENA));
+    if (!arena) ErrorExit(ERROR_NOMEMORY, "mrisNbhdReserve: could not allocate arena");
+  }
+  mrisNbhdArenaGrowVertices(mris, arena);
+  keep_v = MIN(keep_v, room);
+  keep_dist = MIN(keep_dist, room);
+
+  if (arena->start[vno] >= 0 && arena->room[vno] >= room)
+    slot = arena->start[vno];
+  else {
+    if (arena->used + room > arena->size) mrisNbhdArenaCompact(mris, MAX(room, 7 * mris->nvertices));
+    slot = arena->used;
+    arena->used += room;
+  }
+
+#define NBHD_MOVE(field, type, keep)                                                 \
+  {                                                                                  \
+    type *dst = arena->field + slot;                                                 \
+    int kept = v->field ? keep : 0;                                                  \
+    if (v->field != dst) {                                                           \
+      if (kept) memmove(dst, v->field, kept * sizeof(type));                         \
+      if (v->field && !NBHD_IN_ARENA(arena, vno, v->field, field)) free(v->field);   \
+      v->field = dst;                                                                \
+    }                                                                                \
+    memset(dst + kept, 0, (room - kept) * sizeof(type));                             \
+  }
+  NBHD_MOVE(v, int, keep_v)
+  NBHD_MOVE(dist, float, keep_dist)
+  NBHD_MOVE(dist_orig, float, keep_dist)
+#undef NBHD_MOVE
+
+  if (arena->start[vno] != slot) {
+    arena->start[vno] = slot;
+    arena->room[vno] = room;
   }
+}
+
+/* forgets the arena: arena arrays of the vertices are set to NULL */
+static void mrisNbhdArenaFree(MRI_SURFACE *mris)
+{
+  MRIS_NBHD_ARENA *arena = mris->nbhd_arena;
+  int vno;
+
+  if (!arena) return;
+  for (vno = 0; vno < MIN(arena->nvertices, mris->nvertices); vno++) {
+    VERTEX *v = &mris->vertices[vno];
+    if (NBHD_IN_ARENA(arena, vno, v->v, v)) v->v = NULL;
+    if (NBHD_IN_ARENA(arena, vno, v->dist, dist)) v->dist = NULL;
+    if (NBHD_IN_ARENA(arena, vno, v->dist_orig, dist_orig)) v->dist_orig = NULL;
+  }
+  free(arena->v);
+  free(arena->dist);
+  free(arena->dist_orig);
+  free(arena->start);
+  free(arena->room);
+  free(arena);
+  mris->nbhd_arena = NULL;
+}
 
+/*-----------------------------------------------------
+  MRISdetachNeighborArena() - gives every vertex heap copies of the
+  v, dist and dist_orig arrays it has in the neighborhood arena and
+  frees the arena. Call it before freeing or reallocating those arrays
+  directly.
+  ------------------------------------------------------*/
+int MRISdetachNeighborArena(MRI_SURFACE *mris)
+{
+  MRIS_NBHD_ARENA *arena = mris->nbhd_arena;
+  int vno;
+
+  if (!arena) return (NO_ERROR);
+  for (vno = 0; vno < MIN(arena->nvertices, mris->nvertices); vno++) {
+    VERTEX *v = &mris->vertices[vno];
+    int room = arena->room[vno];
+
+#define NBHD_DETACH(field, type)                                                              \
+  if (NBHD_IN_ARENA(arena, vno, v->field, field)) {                                           \
+    type *copy = (type *)calloc(room, sizeof(type));                                          \
+    if (!copy && room) ErrorExit(ERROR_NOMEMORY, "MRISdetachNeighborArena: copy v=%d", vno); \
+    v->field = (type *)memmove(copy, v->field, room * sizeof(type));                          \
+  }
+    NBHD_DETACH(v, int)
+    NBHD_DETACH(dist, float)
+    NBHD_DETACH(dist_orig, float)
+#undef NBHD_DETACH
+  }
+  mrisNbhdArenaFree(mris);
   return (NO_ERROR);
 }
 
@@ -2180,39 +2362,14 @@ int mrisFindNeighbors(MRI_SURFACE *mris)
         vtmp[(int)v->vnum++] = f->v[n1];
       }
     }
-    if (mris->vertices[k].v) {
-      free(mris->vertices[k].v);
-    }
-    mris->vertices[k].v = (int *)calloc(mris->vertices[k].vnum, sizeof(int));
-    if (!mris->vertices[k].v) ErrorExit(ERROR_NOMEMORY, "mrisFindNeighbors: could not allocate nbr array");
+    /* v, dist and dist_orig come from the neighborhood arena */
+    mrisNbhdReserve(mris, k, v->vnum, 0, 0);
 
     v->vtotal = v->vnum;
     v->nsize = 1;
     for (i = 0; i < v->vnum; i++) {
       v->v[i] = vtmp[i];
     }
-
-    if (v->dist) {
-      free(v->dist);
-    }
-    if (v->dist_orig) {
-      free(v->dist_orig);
-    }
-
-    v->dist = (float *)calloc(v->vnum, sizeof(float));
-    if (!v->dist)
-      ErrorExit(ERROR_NOMEMORY,
-                "mrisFindNeighbors: could not allocate list of %d "
-                "dists at v=%d",
-                v->vnum,
-                k);
-    v->dist_orig = (float *)calloc(v->vnum, sizeof(float));
-    if (!v->dist_orig)
-      ErrorExit(ERROR_NOMEMORY,
-                "mrisFindNeighbors: could not allocate list of %d "
-                "dists at v=%d",
-                v->vnum,
-                k);
     /*
       if (v->num != v->vnum)
       printf("%d: num=%d vnum=%d\n",k,v->num,v->vnum);
@@ -2356,19 +2513,14 @@ int MRISsampleDistances(MRI_SURFACE *mris, int *nbrs, int max_nbhd)
   int i, n, vno, vnum, old_vnum, total_nbrs, max_possible, max_v, vtotal;
   VERTEX *v, *vn, *vn2;
   int *vnbrs, *vall, *vnb, found, n2, vnbrs_num, vall_num, nbhd_size, done, checks = 0;
-  float xd, yd, zd, min_dist, dist, dist_scale, *old_dist;
+  float xd, yd, zd, min_dist, dist, dist_scale;
   float min_angle, angle;
   VECTOR *v1, *v2;
-  float c[100], *orig_old_dist;
-  int nc[100], *old_v;
+  float c[100];
+  int nc[100];
   int diag_vno1, diag_vno2;
   char *cp;
 
-  orig_old_dist = old_dist = (float *)calloc(MAX_V, sizeof(float));
-  old_v = (int *)calloc(MAX_V, sizeof(int));
-  if (old_dist == NULL || old_v == NULL)
-    ErrorExit(ERROR_NOMEMORY, "MRISsampleDistances: could not allocated old_dist buffer");
-
   if ((cp = getenv("VDIAG1")) != NULL) {
     diag_vno1 = atoi(cp);
   }
@@ -2451,54 +2603,11 @@ int MRISsampleDistances(MRI_SURFACE *mris, int *nbrs, int max_nbhd)
 
     max_v = v->vtotal + max_possible;
     if (vtotal < max_v) /* won't fit in current allocation,
-                         reallocate stuff */
+                         grow it in the arena, keeping the fixed
+                         small neighborhood and its distances */
     {
-      /* save and restore neighbor list */
-      memmove(old_v, v->v, v->vtotal * sizeof(v->v[0]));
-      free(v->v);
-      v->v = (int *)calloc(max_v, sizeof(int));
-      if (!v->v)
-        ErrorExit(ERROR_NO_MEMORY,
-                  "MRISsampleDistances: could not allocate list of %d "
-                  "nbrs at v=%d",
-                  max_v,
-                  vno);
-      memmove(v->v, old_v, v->vtotal * sizeof(v->v[0]));
-
-      /* save and restore distance vector */
-      if (v->vtotal >= MAX_V || old_dist != orig_old_dist)
-        printf("!!!!!!!!!!!!! v %d has too many (%d) vertices to save distances for !!!!!!!!!!!!!!!!!\n", vno, vtotal);
-      memmove(old_dist, v->dist, v->vtotal * sizeof(v->dist[0]));
-      free(v->dist);
-      v->dist = (float *)calloc(max_v, sizeof(float));
-      if (!v->dist)
-        ErrorExit(ERROR_NOMEMORY,
-                  "MRISsampleDistances: could not allocate list of %d "
-                  "dists at v=%d",
-                  max_v,
-                  vno);
-      memmove(v->dist, old_dist, v->vtotal * sizeof(v->dist[0]));
-
-      /* save and restore original distance vector */
-      {
-        int k;
-        for (k = 0; k < v->vtotal; k++) {
-          old_dist[k] = 0;
-          v->dist_orig[k] *= 1;
-          old_dist[k] = v->dist_orig[k];
-        }
-        if (vno == Gdiag_no) DiagBreak();
-      }
-      memmove(old_dist, v->dist_orig, v->vtotal * sizeof(v->dist_orig[0]));
-      free(v->dist_orig);
-      v->dist_orig = (float *)calloc(max_v, sizeof(float));
-      if (!v->dist_orig)
-        ErrorExit(ERROR_NOMEMORY,
-                  "MRISsampleDistances: could not allocate list of %d "
-                  "dists at v=%d",
-                  max_v,
-                  vno);
-      memmove(v->dist_orig, old_dist, v->vtotal * sizeof(v->dist_orig[0]));
+      mrisNbhdReserve(mris, vno, max_v, v->vtotal, v->vtotal);
+      if (vno == Gdiag_no) DiagBreak();
     }
 
     if ((vno > 139000 || !(vno % 100)) && 0) {
@@ -2892,8 +3001,6 @@ int MRISsampleDistances(MRI_SURFACE *mris, int *nbrs, int max_nbhd)
   free(vnbrs);
   free(vall);
   free(vnb);
-  free(old_dist);
-  free(old_v);
   VectorFree(&v1);
   VectorFree(&v2);
   if (Gdiag & DIAG_HEARTBEAT) {
@@ -3374,42 +3481,17 @@ int MRISsetNeighborhoodSize(MRI_SURFACE *mris, int nsize)
         }
       }
       /*
-        now reallocate the v->v structure and
+        now grow the v->v list in the neighborhood arena and
         place the 2-connected neighbors
         suquentially after the 1-connected neighbors.
       */
-      free(v->v);
-      v->v = (int *)calloc(neighbors, sizeof(int));
-      if (!v->v)
-        ErrorExit(ERROR_NO_MEMORY,
-                  "MRISsetNeighborhoodSize: could not allocate list of %d "
-                  "nbrs at v=%d",
-                  neighbors,
-                  vno);
+      mrisNbhdReserve(mris, vno, neighbors, 0, 0);
 
       v->marked = 0;
       for (n = 0; n < neighbors; n++) {
         v->v[n] = vtmp[n];
         mris->vertices[vtmp[n]].marked = 0;
       }
-      if (v->dist) free(v->dist);
-
-      if (v->dist_orig) free(v->dist_orig);
-
-      v->dist = (float *)calloc(neighbors, sizeof(float));
-      if (!v->dist)
-        ErrorExit(ERROR_NOMEMORY,
-                  "MRISsetNeighborhoodSize: could not allocate list of %d "
-                  "dists at v=%d",
-                  neighbors,
-                  vno);
-      v->dist_orig = (float *)calloc(neighbors, sizeof(float));
-      if (!v->dist_orig)
-        ErrorExit(ERROR_NOMEMORY,
-                  "MRISsetNeighborhoodSize: could not allocate list of %d "
-                  "dists at v=%d",
-                  neighbors,
-                  vno);
       v->nsize++;
       switch (v->nsize) {
         case 2:
@@ -3436,88 +3518,21 @@ int MRISsetNeighborhoodSize(MRI_SURFACE *mris, int nsize)
     }
   }
 
-#ifndef __APPLE__
-  // The parallel loop fails under mcheck with an arcane 
-  //        *** Error in `../mris_fix_topology': free(): invalid pointer: 0x0000000007bda5f0 ***
-  // errors.  I suspect mcheck has some threading issues.
-  //
-  // With this loop serial, no problems are detected either here or in the entire mris_fix_topology test
-  // and the only strange thing about this loop is it is intensely free/calloc intensive which is why
-  // I suspect a problem in mcheck rather than here.
-  //
-  // Freeing all the pointers before allocating any gives mcheck a chance to detect duplicate pointers.
-  // It does not find any problems - but when this loop is done in parallel, it complains - further reinforcing
-  // my belief this is a mcheck problem.
-  //
-  static bool allowParallelFreeingOfDist = true;
-  {
-    static long once;
-    if (!once++) {
-      allowParallelFreeingOfDist = (mprobe(malloc(1)) == MCHECK_DISABLED);
-      if (!allowParallelFreeingOfDist) 
-        fprintf(stderr, "%s:%d Disabling this parallel loop because mcheck in use\n",__FILE__,__LINE__);
-    }
-  }
-
-  if (!allowParallelFreeingOfDist) {
-    fprintf(stderr, "%s:%d Doing free's first because mcheck in use - detect duplicate pointers\n",__FILE__,__LINE__);
-    for (vno = 0; vno < mris->nvertices; vno++) {
-      VERTEX *v;
-      v = &mris->vertices[vno];
-      if (v->vtotal > 0) {
-        if (v->dist)      { free(v->dist);        v->dist      = NULL; }
-        if (v->dist_orig) { free(v->dist_orig);   v->dist_orig = NULL; }
-      }
-    }
-    fprintf(stderr, "%s:%d Free's done, now do allocations\n",__FILE__,__LINE__);
-  }
-#endif
-
+  // clear the distances; the arena slots already have room for vtotal
+  // entries, so this neither allocates nor frees anything
   ntotal = vtotal = 0;
-  ROMP_PF_begin		// mris_fix_topology
-
-#ifdef HAVE_OPENMP
-#ifndef __APPLE__
-  #pragma omp parallel for if_ROMP2(allowParallelFreeingOfDist,shown_reproducible) reduction(+ : ntotal, vtotal)
-#else
-  #pragma omp parallel for if_ROMP(shown_reproducible) reduction(+ : ntotal, vtotal)
-#endif
-#endif
-
   for (vno = 0; vno < mris->nvertices; vno++) {
-    ROMP_PFLB_begin
     VERTEX *v;
 
     v = &mris->vertices[vno];
-    if (v->vtotal > 0) {
-      if (v->dist) free(v->dist);
-
-      if (v->dist_orig) free(v->dist_orig);
-
-      v->dist = (float *)calloc(v->vtotal, sizeof(float));
-      if (!v->dist)
-        ErrorExit(ERROR_NOMEMORY,
-                  "MRISsetNeighborhoodSize: could not allocate list of %d "
-                  "dists at v=%d",
-                  v->vtotal,
-                  vno);
-      v->dist_orig = (float *)calloc(v->vtotal, sizeof(float));
-      if (!v->dist_orig)
-        ErrorExit(ERROR_NOMEMORY,
-                  "MRISsetNeighborhoodSize: could not allocate list of %d "
-                  "orig dists at v=%d",
-                  v->vtotal,
-                  vno);
-    }
+    if (v->vtotal > 0) mrisNbhdReserve(mris, vno, v->vtotal, v->vtotal, 0);
 
     if (v->ripflag) continue;
 
     vtotal += v->vtotal;
     ntotal++;
-    ROMP_PFLB_end
   }
-  ROMP_PF_end
-  
+
   mris->avg_nbrs = (float)vtotal / (float)ntotal;
   mris->nsize = nsize;
   if (Gdiag & DIAG_SHOW && mris->nsize > 1 && DIAG_VERBOSE_ON) fprintf(stdout, "avg_nbrs = %2.1f\n", mris->avg_nbrs);
@@ -3618,6 +3633,7 @@ int MRISremoveRippedVertices(MRI_SURFACE *mris)
   VERTEX *v;
   FACE   *face;
 
+  MRISdetachNeighborArena(mris) ;  /* vertices are moved to other numbers below */
   out_vnos = (int *)calloc(mris->nvertices, sizeof(int)) ;
   nvertices = mris->nvertices ;
   for (out_vno = vno = 0; vno < mris->nvertices; vno++) 
@@ -32075,13 +32091,21 @@ int MRISzeroNegativeAreas(MRI_SURFACE *mris)
   Returns value:
 
   Description
+  MRISfindClosestVertex() and the Original/Canonical/White variants
+  below scan all the vertices, unless a kd-tree of their coordinates
+  has been attached with MRISattachVertexIndex() (see mriskdtree.h).
   ------------------------------------------------------*/
 int MRISfindClosestVertex(MRI_SURFACE *mris, float x, float y, float z, float *dmin)
 {
   int vno, min_v = -1;
   VERTEX *v;
   float d, min_d, dx, dy, dz;
+  MRIS_KDTREE *kdt;
 
+  kdt = MRISgetVertexIndex(mris, CURRENT_VERTICES);
+  if (kdt) {
+    return (MRISkdtreeFindClosest(kdt, x, y, z, dmin));
+  }
   min_d = 10000.0f;
   for (vno = 0; vno < mris->nvertices; vno++) {
     v = &mris->vertices[vno];
@@ -32114,7 +32138,12 @@ int MRISfindClosestOriginalVertex(MRI_SURFACE *mris, float x, float y, float z)
   int vno, min_v = -1;
   VERTEX *v;
   float d, min_d, dx, dy, dz;
+  MRIS_KDTREE *kdt;
 
+  kdt = MRISgetVertexIndex(mris, ORIGINAL_VERTICES);
+  if (kdt) {
+    return (MRISkdtreeFindClosest(kdt, x, y, z, NULL));
+  }
   min_d = 10000.0f;
   for (vno = 0; vno < mris->nvertices; vno++) {
     if (vno == 91007 || vno == 91814) {
@@ -32148,7 +32177,12 @@ int MRISfindClosestCanonicalVertex(MRI_SURFACE *mris, float x, float y, float z)
   int vno, min_v = -1;
   VERTEX *v;
   float d, min_d, dx, dy, dz;
+  MRIS_KDTREE *kdt;
 
+  kdt = MRISgetVertexIndex(mris, CANONICAL_VERTICES);
+  if (kdt) {
+    return (MRISkdtreeFindClosest(kdt, x, y, z, NULL));
+  }
   min_d = 10000.0f;
   for (vno = 0; vno < mris->nvertices; vno++) {
     v = &mris->vertices[vno];
@@ -32179,7 +32213,12 @@ int MRISfindClosestWhiteVertex(MRI_SURFACE *mris, float x, float y, float z)
   int vno, min_v = -1;
   VERTEX *v;
   float d, min_d, dx, dy, dz;
+  MRIS_KDTREE *kdt;
 
+  kdt = MRISgetVertexIndex(mris, WHITE_VERTICES);
+  if (kdt) {
+    return (MRISkdtreeFindClosest(kdt, x, y, z, NULL));
+  }
   min_d = 10000.0f;
   for (vno = 0; vno < mris->nvertices; vno++) {
     v = &mris->vertices[vno];
@@ -41747,6 +41786,7 @@ static int mrisDivideFace(MRI_SURFACE *mris, int fno, int vno1, int vno2, int vn
       v2->f[n] = fnew_no;
     }
 
+  MRISdetachNeighborArena(mris); /* v->v is freed below */
   /* add new face and edge connected to new vertex to v3 */
   memmove(flist, v3->f, v3->num * sizeof(v3->f[0]));
   memmove(vlist, v3->v, v3->vnum * sizeof(v3->v[0]));
@@ -49759,6 +49799,7 @@ static void removeVertex(MRIS *mris, int vno)
     return;
   }
 
+  MRISdetachNeighborArena(mris); /* v->v is freed below */
   for (n = 0; n < v->vnum; n++) {
     /* remove vno from the list of v->v[n] */
     vn = &mris->vertices[v->v[n]];
@@ -50642,6 +50683,7 @@ static int mrisRestoreVertexState(MRI_SURFACE *mris, DEFECT_VERTEX_STATE *dvs)
 
   /* remove the added faces */
   MRIStruncateNFaces(mris, dvs->nfaces);
+  MRISdetachNeighborArena(mris); /* v->v is freed below */
 
   for (i = 0; i < dvs->nvertices; i++) {
     vs = &dvs->vs[i];
@@ -53371,6 +53413,7 @@ MRI_SURFACE *MRIScorrectTopology(
     fprintf(WHICH_OUTPUT, "\n") ;
   }
 #endif
+  MRISdetachNeighborArena(mris_corrected); /* the dists are freed below */
   for (vno = 0; vno < mris_corrected->nvertices; vno++) {
     VERTEX *v;
 
@@ -62613,6 +62656,7 @@ static int mrisAddEdge(MRI_SURFACE *mris, int vno1, int vno2)
   if (Gdiag & DIAG_SHOW && DIAG_VERBOSE_ON) {
     fprintf(stdout, "adding edge %d <--> %d\n", vno1, vno2);
   }
+  MRISdetachNeighborArena(mris); /* v->v is freed below */
 
   /* add v2 link to v1 struct */
   v = &mris->vertices[vno1];
@@ -68307,6 +68351,221 @@ MRI *MRISsmoothMRI(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *BinMask, MRI *Ta
   MRIScrsLUTFree(crslut);
   return (Targ);
 }
+/*-------------------------------------------------------------------
+  MRISsmoothOpAlloc() - builds one step of the nearest neighbor
+  averaging of MRISsmoothMRIFast() as a sparse matrix in compressed
+  row form. The row of a vertex holds the vertex itself and then each
+  neighbor that is neither ripped nor out of the mask, and a step
+  replaces the value at the vertex with the mean over its row.
+  Vertices out of the mask have an empty row and are set to 0. The
+  mask is inclusive and must be nvertices x 1 x 1; it is ignored if
+  NULL. Build it once and apply it with MRISsmoothOpApply() to any
+  number of frames and steps.
+  -------------------------------------------------------------------*/
+MRIS_SMOOTH_OP *MRISsmoothOpAlloc(MRIS *Surf, MRI *IncMask)
+{
+  MRIS_SMOOTH_OP *op;
+  int vno, nthnbr, nbrvno, nnz, pass;
+  char *in;
+
+  op = (MRIS_SMOOTH_OP *)calloc(1, sizeof(MRIS_SMOOTH_OP));
+  in = (char *)calloc(Surf->nvertices, sizeof(char));
+  if (op == NULL || in == NULL) ErrorExit(ERROR_NOMEMORY, "MRISsmoothOpAlloc: could not alloc");
+  op->nvertices = Surf->nvertices;
+  op->row = (int *)calloc(Surf->nvertices + 1, sizeof(int));
+  if (op->row == NULL) ErrorExit(ERROR_NOMEMORY, "MRISsmoothOpAlloc: could not alloc");
+  for (vno = 0; vno < Surf->nvertices; vno++) in[vno] = (IncMask == NULL || MRIgetVoxVal(IncMask, vno, 0, 0, 0) >= 0.5);
+
+  // count the entries, then fill them in
+  for (pass = 0; pass < 2; pass++) {
+    for (nnz = vno = 0; vno < Surf->nvertices; vno++) {
+      op->row[vno] = nnz;
+      if (!in[vno]) continue;
+      if (pass) op->nbr[nnz] = vno;
+      nnz++;
+      for (nthnbr = 0; nthnbr < Surf->vertices[vno].vnum; nthnbr++) {
+        nbrvno = Surf->vertices[vno].v[nthnbr];
+        if (Surf->vertices[nbrvno].ripflag || !in[nbrvno]) continue;
+        if (pass) op->nbr[nnz] = nbrvno;
+        nnz++;
+      }
+    }
+    op->row[Surf->nvertices] = nnz;
+    if (!pass) {
+      op->nbr = (int *)calloc(nnz + 1, sizeof(int));
+      if (op->nbr == NULL) ErrorExit(ERROR_NOMEMORY, "MRISsmoothOpAlloc: could not alloc %d entries", nnz);
+    }
+  }
+  free(in);
+  return (op);
+}
+
+int MRISsmoothOpFree(MRIS_SMOOTH_OP **pop)
+{
+  MRIS_SMOOTH_OP *op = *pop;
+
+  if (op == NULL) return (NO_ERROR);
+  free(op->row);
+  free(op->nbr);
+  free(op);
+  *pop = NULL;
+  return (NO_ERROR);
+}
+
+// number of frames interleaved and smoothed together
+#define SMOOTH_OP_BLOCK 8
+
+/* Y = P X for nb interleaved frames, or 2 P X - Z if Z is given (the
+   Chebyshev recurrence), then acc += c Y if acc is given. The sum over
+   a row is in the same order as MRISsmoothMRI(), so a plain step gives
+   the same floats. */
+static void mrisSmoothOpStep(MRIS_SMOOTH_OP *op, float *X, float *Y, float *Z, float *acc, float c, int nb)
+{
+  int vno;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(static)
+#endif
+  for (vno = 0; vno < op->nvertices; vno++) {
+    ROMP_PFLB_begin
+    int j, b, num = op->row[vno + 1] - op->row[vno], *nbr = &op->nbr[op->row[vno]];
+    float sum[SMOOTH_OP_BLOCK], *x, *y = &Y[vno * nb];
+
+    if (num == 0) {
+      for (b = 0; b < nb; b++) y[b] = 0;
+      ROMP_PFLB_continue;
+    }
+    x = &X[nbr[0] * nb];
+    for (b = 0; b < nb; b++) sum[b] = x[b];
+    for (j = 1; j < num; j++) {
+      x = &X[nbr[j] * nb];
+      for (b = 0; b < nb; b++) sum[b] += x[b];
+    }
+    for (b = 0; b < nb; b++) y[b] = sum[b] / num;
+    if (Z)
+      for (b = 0; b < nb; b++) y[b] = 2 * y[b] - Z[vno * nb + b];
+    if (acc)
+      for (b = 0; b < nb; b++) acc[vno * nb + b] += c * y[b];
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+}
+
+/* The step P is a row normalized adjacency, so its eigenvalues are real
+   and in [-1,1], and P^n = sum_k c_k T_k(P) over the Chebyshev
+   polynomials with c_k = 2^(1-n) binom(n, (n-k)/2) for k = n, n-2, ...
+   (half that for k = 0). The c_k are a binomial distribution, so all
+   but about 6 sqrt(n) of them are below float precision, and P^n can be
+   applied with that many products instead of n. This is off unless
+   USE_CHEBYSHEV_SURF_SMOOTHER is set (and not 0), since it changes the
+   results in the last float bits. Returns the degree to stop at, or 0
+   if it is off or would not save passes, and the coefficients in
+   *pcoefs. */
+static int mrisSmoothOpChebyshev(int nsteps, double **pcoefs)
+{
+  double *coefs, tail;
+  int k, degree;
+  char *env;
+
+  // Must explicitly "setenv USE_CHEBYSHEV_SURF_SMOOTHER 1" to turn it on
+  env = getenv("USE_CHEBYSHEV_SURF_SMOOTHER");
+  if (!env || !strcmp(env, "0")) return (0);
+  if (nsteps < 2) return (0);
+
+  coefs = (double *)calloc(nsteps + 1, sizeof(double));
+  for (k = nsteps % 2; k <= nsteps; k += 2) {
+    int j = (nsteps - k) / 2;
+    coefs[k] = exp(lgamma(nsteps + 1.0) - lgamma(j + 1.0) - lgamma(nsteps - j + 1.0) + (1 - nsteps) * M_LN2);
+  }
+  coefs[0] /= 2;
+  for (tail = 0, degree = nsteps; degree > 0 && tail + coefs[degree] < 1e-7; degree--) tail += coefs[degree];
+
+  // each term also reads the term before last and adds to the sum
+  if (1.3 * degree >= nsteps) {
+    free(coefs);
+    return (0);
+  }
+  *pcoefs = coefs;
+  return (degree);
+}
+
+/*-------------------------------------------------------------------
+  MRISsmoothOpApply() - applies nSmoothSteps steps of a smoothing
+  operator from MRISsmoothOpAlloc() in place to frames frame0 to
+  frame0+nframes-1 of mri, which must be float and nvertices x 1 x 1.
+  Frames are smoothed in blocks so that each pass over the operator
+  serves several of them, and the pass is threaded over vertices. With
+  USE_CHEBYSHEV_SURF_SMOOTHER set and many steps, P^n is expanded in
+  Chebyshev polynomials of P (see mrisSmoothOpChebyshev()), which needs
+  about 6 sqrt(n) passes instead of n and matches the step by step result
+  to float precision.
+  -------------------------------------------------------------------*/
+int MRISsmoothOpApply(MRIS_SMOOTH_OP *op, MRI *mri, int frame0, int nframes, int nSmoothSteps)
+{
+  float *buf[4], *X, *Y, *Z, *acc, *tmp;
+  double *coefs = NULL;
+  int f0, nb, vno, b, k, nthstep, degree, i;
+
+  if (mri->width != op->nvertices || mri->height != 1 || mri->depth != 1 || mri->type != MRI_FLOAT)
+    ErrorReturn(ERROR_BADPARM,
+                (ERROR_BADPARM,
+                 "MRISsmoothOpApply: need a float %d x 1 x 1 volume, not %d x %d x %d",
+                 op->nvertices,
+                 mri->width,
+                 mri->height,
+                 mri->depth));
+  if (frame0 < 0 || frame0 + nframes > mri->nframes)
+    ErrorReturn(ERROR_BADPARM, (ERROR_BADPARM, "MRISsmoothOpApply: frames %d to %d out of range", frame0, frame0 + nframes - 1));
+
+  degree = mrisSmoothOpChebyshev(nSmoothSteps, &coefs);
+  nb = MIN(nframes, SMOOTH_OP_BLOCK);
+  for (i = 0; i < 4; i++) {
+    buf[i] = (float *)calloc((size_t)op->nvertices * nb, sizeof(float));
+    if (buf[i] == NULL) ErrorExit(ERROR_NOMEMORY, "MRISsmoothOpApply: could not alloc %d x %d", op->nvertices, nb);
+  }
+
+  for (f0 = frame0; f0 < frame0 + nframes; f0 += nb) {
+    nb = MIN(SMOOTH_OP_BLOCK, frame0 + nframes - f0);
+    X = buf[0];
+    Y = buf[1];
+    Z = buf[2];
+    acc = buf[3];
+    for (vno = 0; vno < op->nvertices; vno++)
+      for (b = 0; b < nb; b++)
+        X[vno * nb + b] = op->row[vno + 1] > op->row[vno] ? MRIFseq_vox(mri, vno, 0, 0, f0 + b) : 0;
+
+    if (degree == 0) {
+      for (nthstep = 0; nthstep < nSmoothSteps; nthstep++) {
+        mrisSmoothOpStep(op, X, Y, NULL, NULL, 0, nb);
+        tmp = X;
+        X = Y;
+        Y = tmp;
+      }
+      acc = X;
+    }
+    else {
+      // X = T_0, Y = T_1, Z = T_2 and so on
+      for (i = 0; i < op->nvertices * nb; i++) acc[i] = coefs[0] * X[i];
+      mrisSmoothOpStep(op, X, Y, NULL, coefs[1] ? acc : NULL, coefs[1], nb);
+      for (k = 2; k <= degree; k++) {
+        mrisSmoothOpStep(op, Y, Z, X, coefs[k] ? acc : NULL, coefs[k], nb);
+        tmp = X;
+        X = Y;
+        Y = Z;
+        Z = tmp;
+      }
+    }
+
+    for (vno = 0; vno < op->nvertices; vno++)
+      for (b = 0; b < nb; b++) MRIFseq_vox(mri, vno, 0, 0, f0 + b) = acc[vno * nb + b];
+  }
+
+  for (i = 0; i < 4; i++) free(buf[i]);
+  if (coefs) free(coefs);
+  return (NO_ERROR);
+}
+
 /*-------------------------------------------------------------------
   MRISsmoothMRIFast() - faster version of MRISsmoothMRI(). Smooths
   values on the surface when the surface values are stored in an
@@ -68319,17 +68578,18 @@ MRI *MRISsmoothMRI(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *BinMask, MRI *Ta
   data from ripped vertices into unripped vertices (but does go the
   other way). Same for mask. The mask is inclusive, so voxels with
   mask=1 are included. If mask is NULL, it is ignored. Gives identical
-  results as MRISsmoothMRI(); see MRISsmoothMRIFastCheck().
+  results as MRISsmoothMRI() (see MRISsmoothMRIFastCheck()), or the
+  same to float precision when USE_CHEBYSHEV_SURF_SMOOTHER is set and
+  there are enough steps to evaluate them with Chebyshev polynomials;
+  see MRISsmoothOpApply().
   -------------------------------------------------------------------*/
 MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI *Targ)
 {
-  int nnbrs, nthstep, frame, vno, nthnbr, num, nvox, nbrvno, reshape;
+  int nvox, reshape;
   MRI *SrcTmp, *mritmp, *IncMaskTmp = NULL;
+  MRIS_SMOOTH_OP *op;
   struct timeb mytimer;
   int msecTime;
-  int *nNbrs, *nNbrs0, *rip, *rip0, nNbrsMax;
-  float **pF, **pF0, *tF, *tF0, sumF;
-  VERTEX *v, *vn;
 
   if (Gdiag_no > 0) printf("MRISsmoothMRIFast()\n");
 
@@ -68369,86 +68629,10 @@ MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI
     }
   }
 
-  // Alloc arrays. If there are ripped vertices, then only rip
-  // needs nvertices elements
-  nNbrsMax = 12;  // Should measure this, but overalloc does not hurt
-  pF = (float **)calloc(Surf->nvertices * nNbrsMax, sizeof(float *));
-  tF = (float *)calloc(Surf->nvertices, sizeof(float));
-  nNbrs = (int *)calloc(Surf->nvertices, sizeof(int));
-  rip = (int *)calloc(Surf->nvertices, sizeof(int));
-
-  pF0 = pF;
-  tF0 = tF;
-  rip0 = rip;
-  nNbrs0 = nNbrs;
-
   TimerStart(&mytimer);
-
-  // Loop through frames
-  for (frame = 0; frame < Src->nframes; frame++) {
-    // Set up pointers for this frame
-    pF = pF0;
-    rip = rip0;
-    nNbrs = nNbrs0;
-    for (vno = 0; vno < Surf->nvertices; vno++) {
-      v = &Surf->vertices[vno];
-      if (IncMaskTmp && MRIgetVoxVal(IncMaskTmp, vno, 0, 0, 0) < 0.5) {
-        // Mask is inclusive, so look for out of mask
-        // should exclude rips here too? Original does not.
-        rip[vno] = 1;
-        MRIFseq_vox(SrcTmp, vno, 0, 0, frame) = 0;
-        continue;
-      }
-      rip[vno] = 0;
-      *pF++ = (float *)(&(MRIFseq_vox(SrcTmp, vno, 0, 0, frame)));
-      nnbrs = Surf->vertices[vno].vnum;
-      num = 1;
-      for (nthnbr = 0; nthnbr < nnbrs; nthnbr++) {
-        nbrvno = Surf->vertices[vno].v[nthnbr];
-        vn = &Surf->vertices[nbrvno];
-        if (vn->ripflag) {
-          continue;
-        }
-        if (IncMaskTmp && MRIgetVoxVal(IncMaskTmp, nbrvno, 0, 0, 0) < 0.5) {
-          continue;
-        }
-        *pF++ = (float *)(&(MRIFseq_vox(SrcTmp, nbrvno, 0, 0, frame)));
-        num++;
-      }
-      *nNbrs++ = num;  // num takes into account all rips/masks
-    }
-
-    // Step through the iterations
-    for (nthstep = 0; nthstep < nSmoothSteps; nthstep++) {
-      // Init pointers for this iteration
-      pF = pF0;
-      rip = rip0;
-      tF = tF0;
-      nNbrs = nNbrs0;
-      // Loop through vertices, average nearest neighbors
-      for (vno = 0; vno < Surf->nvertices; vno++) {
-        if (*rip++) {
-          continue;
-        }
-        sumF = *(*pF++);
-        for (nthnbr = 0; nthnbr < (*nNbrs) - 1; nthnbr++) {
-          sumF += *(*pF++);
-        }
-        *tF++ = sumF / (*nNbrs);
-        nNbrs++;
-      }
-      // Load up for the next step
-      rip = rip0;
-      tF = tF0;
-      for (vno = 0; vno < Surf->nvertices; vno++) {
-        if (*rip++) {
-          continue;
-        }
-        MRIsetVoxVal(SrcTmp, vno, 0, 0, frame, *tF++);
-      }
-    }
-
-  } /* end loop over frame */
+  op = MRISsmoothOpAlloc(Surf, IncMaskTmp);
+  MRISsmoothOpApply(op, SrcTmp, 0, Src->nframes, nSmoothSteps);
+  MRISsmoothOpFree(&op);
 
   // Copy to the output
   if (reshape) {
@@ -68468,10 +68652,6 @@ MRI *MRISsmoothMRIFast(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MRI
 
   MRIfree(&SrcTmp);
   if (IncMaskTmp) MRIfree(&IncMaskTmp);
-  free(pF0);
-  free(tF0);
-  free(rip0);
-  free(nNbrs0);
 
   return (Targ);
 }
@@ -68632,125 +68812,35 @@ MRI *MRISsmoothMRIFastD(MRIS *Surf, MRI *Src, int nSmoothSteps, MRI *IncMask, MR
 
 /*------------------------------------------------------------------
   MRISsmoothMRIFastFrame() same as MRISsmoothMRIFast() but operates
-  on a single frame. This allows the pointers to be cached in
-  a static data structure. Note: this will fail if Src is not
-  nvertices x 1 x 1 x nframes.
+  on a single frame, in place. The smoothing operator is kept in a
+  static structure for as long as Surf and IncMask stay the same, so
+  the mask must not change between calls. Note: this will fail if Src
+  is not nvertices x 1 x 1 x nframes.
   ------------------------------------------------------------------*/
 int MRISsmoothMRIFastFrame(MRIS *Surf, MRI *Src, int frame, int nSmoothSteps, MRI *IncMask)
 {
-  int nnbrs, nthstep, vno, nthnbr, num, nvox, nbrvno;
+  static MRIS_SMOOTH_OP *op = NULL;
+  static MRIS *SurfInit = NULL;
+  static MRI *IncMaskInit = NULL;
   struct timeb mytimer;
   int msecTime;
-  float sumF;
-  VERTEX *v, *vn;
-  static MRIS *SurfInit = NULL;
-  static MRI *SrcInit = NULL;
-  static int DoInit = 1, frameInit = 0, *nNbrs = NULL, *nNbrs0 = NULL, *rip = NULL, *rip0 = NULL, nNbrsMax = 0;
-  static float **pF = NULL, **pF0 = NULL, *tF = NULL, *tF0 = NULL;
 
   if (Gdiag_no > 0) printf("MRISsmoothMRIFastFrame()\n");
 
-  if (DoInit) {
-    if (Gdiag_no > 0) {
-      printf("MRISsmoothMRIFastFrame() Init\n");
-    }
-    nvox = Src->width * Src->height * Src->depth;
-    if (Surf->nvertices != nvox) {
-      printf("ERROR: MRISsmoothMRIFastFrame(): Surf/Src dimension mismatch\n");
-      return (1);
-    }
-    // Alloc arrays. If there are ripped vertices, then only rip
-    // needs nvertices elements
-    nNbrsMax = 12;  // Should measure this, but overalloc does not hurt
-    pF = (float **)calloc(Surf->nvertices * nNbrsMax, sizeof(float *));
-    tF = (float *)calloc(Surf->nvertices, sizeof(float));
-    nNbrs = (int *)calloc(Surf->nvertices, sizeof(int));
-    rip = (int *)calloc(Surf->nvertices, sizeof(int));
-    pF0 = pF;
-    tF0 = tF;
-    rip0 = rip;
-    nNbrs0 = nNbrs;
-    SrcInit = Src;
-    SurfInit = Surf;
-    frameInit = frame;
-    DoInit = 0;
-  }
-  if (Src != SrcInit) {
-    printf("ERROR: Src and SrcInit do not agree\n");
-    exit(1);
-  }
-  if (Surf != SurfInit) {
-    printf("ERROR: Surf and SurfInit do not agree\n");
-    exit(1);
+  if (Surf->nvertices != Src->width * Src->height * Src->depth) {
+    printf("ERROR: MRISsmoothMRIFastFrame(): Surf/Src dimension mismatch\n");
+    return (1);
   }
-  if (frame != frameInit) {
-    printf("ERROR: frame and frameInit do not agree\n");
-    exit(1);
+  if (op == NULL || Surf != SurfInit || IncMask != IncMaskInit) {
+    if (Gdiag_no > 0) printf("MRISsmoothMRIFastFrame() Init\n");
+    MRISsmoothOpFree(&op);
+    op = MRISsmoothOpAlloc(Surf, IncMask);
+    SurfInit = Surf;
+    IncMaskInit = IncMask;
   }
 
   TimerStart(&mytimer);
-
-  // Set up pointers for this call
-  pF = pF0;
-  rip = rip0;
-  nNbrs = nNbrs0;
-  for (vno = 0; vno < Surf->nvertices; vno++) {
-    v = &Surf->vertices[vno];
-    if (IncMask && MRIgetVoxVal(IncMask, vno, 0, 0, 0) < 0.5) {
-      // Mask is inclusive, so look for out of mask
-      // should exclude rips here too? Original does not.
-      rip[vno] = 1;
-      MRIFseq_vox(Src, vno, 0, 0, frame) = 0;
-      continue;
-    }
-    rip[vno] = 0;
-    *pF++ = (float *)(&(MRIFseq_vox(Src, vno, 0, 0, frame)));
-    nnbrs = Surf->vertices[vno].vnum;
-    num = 1;
-    for (nthnbr = 0; nthnbr < nnbrs; nthnbr++) {
-      nbrvno = Surf->vertices[vno].v[nthnbr];
-      vn = &Surf->vertices[nbrvno];
-      if (vn->ripflag) {
-        continue;
-      }
-      if (IncMask && MRIgetVoxVal(IncMask, nbrvno, 0, 0, 0) < 0.5) {
-        continue;
-      }
-      *pF++ = (float *)(&(MRIFseq_vox(Src, nbrvno, 0, 0, frame)));
-      num++;
-    }
-    *nNbrs++ = num;  // num takes into account all rips/masks
-  }
-
-  // Step through the iterations
-  for (nthstep = 0; nthstep < nSmoothSteps; nthstep++) {
-    // Init pointers for this iteration
-    pF = pF0;
-    rip = rip0;
-    tF = tF0;
-    nNbrs = nNbrs0;
-    // Loop through vertices, average nearest neighbors
-    for (vno = 0; vno < Surf->nvertices; vno++) {
-      if (*rip++) {
-        continue;
-      }
-      sumF = *(*pF++);
-      for (nthnbr = 0; nthnbr < (*nNbrs) - 1; nthnbr++) {
-        sumF += *(*pF++);
-      }
-      *tF++ = sumF / (*nNbrs);
-      nNbrs++;
-    }
-    // Load up for the next step
-    rip = rip0;
-    tF = tF0;
-    for (vno = 0; vno < Surf->nvertices; vno++) {
-      if (*rip++) {
-        continue;
-      }
-      MRIsetVoxVal(Src, vno, 0, 0, frame, *tF++);
-    }
-  }
+  if (MRISsmoothOpApply(op, Src, frame, 1, nSmoothSteps) != NO_ERROR) return (1);
 
   msecTime = TimerStop(&mytimer);
   if (Gdiag_no > 0) {
@@ -74822,6 +74912,7 @@ int MRIScomputeAllDistances(MRI_SURFACE *mris)
   }
 
   MRIScomputeMetricProperties(mris);
+  MRISdetachNeighborArena(mris); /* v->v and dists are freed below */
   nvalid = MRISvalidVertices(mris);
 #if 0
   // this for loop can't be parallelized due to the use of MRISdistanceTransform
@@ -62,6 +62,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "timer.h"
 
 #include "romp_support.h"
@@ -69,12 +70,16 @@
 #include "bfileio.h"
 #include "corio.h"
 #include "diag.h"
+#include "error.h"
+#include "fio.h"
+#include "fnv_hash.h"
 #include "label.h"
 #include "matrix.h"
 #include "mri.h"
 #include "mri2.h"
 #include "mrimorph.h"
 #include "mrishash.h"
+#include "mriskdtree.h"
 #include "mrisurf.h"
 #include "proto.h"  // nint
 
@@ -872,55 +877,144 @@ trg1 and src2 are from the same anatomy.
 \param int ReverseMapFlag - perform reverse mapping
 \param int DoJac - perform jacobian correction (conserves sum(SrcVals))
 \param int UseHash - use hash table (no reason not to, much faster).
+Without the hash, closest vertices are found with a kd-tree (mriskdtree.h),
+which gives the same vertices as a brute force search.
+The mapping is built once as a sparse matrix (see MRISregMap()) and kept
+for the next call with the same surfaces, and in the FS_SURFREG_CACHE
+directory across runs if that is set.
 */
 MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int ReverseMapFlag, int DoJac, int UseHash)
 {
-  MRI *TrgSurfVals = NULL;
-  MRI_SURFACE *SrcSurfReg, *TrgSurfReg;
-  int svtx = 0, tvtx, tvtxN, svtxN = 0, f, n, nrevhits, nSrcLost;
-  int npairs, kS, kT, nhits;
-  // int nunmapped;
-  VERTEX *v;
-  float dmin;
-  MHT **Hash = NULL;
-  MRI *SrcHits, *TrgHits;
+  static MRIS_REG_MAP *map = NULL;
 
-  npairs = nsurfs / 2;
   printf("MRISapplyReg: nsurfs = %d, revmap=%d, jac=%d,  hash=%d\n", nsurfs, ReverseMapFlag, DoJac, UseHash);
 
-  SrcSurfReg = SurfReg[0];
-  TrgSurfReg = SurfReg[nsurfs - 1];
-
   /* check dimension consistency */
-  if (SrcSurfVals->width != SrcSurfReg->nvertices) {
+  if (SrcSurfVals->width != SurfReg[0]->nvertices) {
     printf("MRISapplyReg: Vals and Reg dimension mismatch\n");
-    printf("nVals = %d, nReg %d\n", SrcSurfVals->width, SrcSurfReg->nvertices);
+    printf("nVals = %d, nReg %d\n", SrcSurfVals->width, SurfReg[0]->nvertices);
     return (NULL);
   }
-  for (n = 0; n < npairs - 1; n++) {
-    kS = 2 * n + 1;
-    kT = kS + 1;
-    if (SurfReg[kT]->nvertices != SurfReg[kS]->nvertices) {
-      printf("MRISapplyReg: Reg dimension mismatch %d, %d\n", kT, kS);
-      printf("targ = %d, next source = %d\n", SurfReg[kT]->nvertices, SurfReg[kS]->nvertices);
-      return (NULL);
-    }
+
+  if (map == NULL || !MRISregMapMatches(map, SurfReg, nsurfs, ReverseMapFlag, DoJac, UseHash)) {
+    MRISregMapFree(&map);
+    map = MRISregMap(SurfReg, nsurfs, ReverseMapFlag, DoJac, UseHash);
+    if (map == NULL) return (NULL);
   }
+  else
+    printf("MRISapplyReg: reusing the map from the last call\n");
 
-  /* allocate a "volume" to hold the output */
-  TrgSurfVals = MRIallocSequence(TrgSurfReg->nvertices, 1, 1, MRI_FLOAT, SrcSurfVals->nframes);
-  if (TrgSurfVals == NULL) return (NULL);
-  MRIcopyHeader(SrcSurfVals, TrgSurfVals);
+  return (MRISregMapApply(map, SrcSurfVals, NULL));
+}
 
-  /* number of source vertices mapped to each target vertex */
-  TrgHits = MRIallocSequence(TrgSurfReg->nvertices, 1, 1, MRI_FLOAT, 1);
-  if (TrgHits == NULL) return (NULL);
-  MRIcopyHeader(SrcSurfVals, TrgHits);
+/* A map is keyed by the vertex count and current coordinates of each
+   reg surface, which is all that the closest vertex search looks at
+   (mris_hash_add() would also cover the values callers load into the
+   reg surfaces, so the key would change with every overlay). */
+static void mrisRegMapHash(MRIS_HASH *hash, MRI_SURFACE *mris)
+{
+  int vno;
 
-  /* number of target vertices mapped to by each source vertex */
-  SrcHits = MRIallocSequence(SrcSurfReg->nvertices, 1, 1, MRI_FLOAT, 1);
-  if (SrcHits == NULL) return (NULL);
-  MRIcopyHeader(SrcSurfVals, SrcHits);
+  mris_hash_init(hash, NULL);
+  hash->hash = fnv_add(hash->hash, (const unsigned char *)&mris->nvertices, sizeof(mris->nvertices));
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX *v = &mris->vertices[vno];
+    hash->hash = fnv_add(hash->hash, (const unsigned char *)&v->x, sizeof(v->x));
+    hash->hash = fnv_add(hash->hash, (const unsigned char *)&v->y, sizeof(v->y));
+    hash->hash = fnv_add(hash->hash, (const unsigned char *)&v->z, sizeof(v->z));
+  }
+}
+
+/*!
+\fn int MRISregMapMatches(MRIS_REG_MAP *map, MRI_SURFACE **SurfReg, int nsurfs,
+                          int ReverseMapFlag, int DoJac, int UseHash)
+\brief Returns 1 if map was built from reg surfaces with the same
+coordinates and with the same options, 0 otherwise. The hash table can
+pick a different closest vertex than the kd-tree, so a map built with
+one is not used for the other.
+*/
+int MRISregMapMatches(MRIS_REG_MAP *map, MRI_SURFACE **SurfReg, int nsurfs, int ReverseMapFlag, int DoJac, int UseHash)
+{
+  MRIS_HASH hash;
+  int n;
+
+  if (map->nsurfs != nsurfs || map->ReverseMapFlag != ReverseMapFlag || map->DoJac != DoJac ||
+      map->UseHash != (UseHash != 0) ||
+      map->nsrc != SurfReg[0]->nvertices || map->ntrg != SurfReg[nsurfs - 1]->nvertices)
+    return (0);
+  for (n = 0; n < nsurfs; n++) {
+    mrisRegMapHash(&hash, SurfReg[n]);
+    if (hash.hash != map->hash[n].hash) return (0);
+  }
+  return (1);
+}
+
+static MRIS_REG_MAP *mrisRegMapAlloc(int nsurfs, int ntrg, int nsrc, int nnz)
+{
+  MRIS_REG_MAP *map;
+
+  map = (MRIS_REG_MAP *)calloc(1, sizeof(MRIS_REG_MAP));
+  if (map == NULL) ErrorExit(ERROR_NOMEMORY, "mrisRegMapAlloc: could not alloc");
+  map->nsurfs = nsurfs;
+  map->ntrg = ntrg;
+  map->nsrc = nsrc;
+  map->nnz = nnz;
+  map->hash = (MRIS_HASH *)calloc(nsurfs, sizeof(MRIS_HASH));
+  map->row = (int *)calloc(ntrg + 1, sizeof(int));
+  map->col = (int *)calloc(nnz + 1, sizeof(int));
+  map->w = (float *)calloc(nnz + 1, sizeof(float));
+  if (map->hash == NULL || map->row == NULL || map->col == NULL || map->w == NULL)
+    ErrorExit(ERROR_NOMEMORY, "mrisRegMapAlloc: could not alloc %d x %d map with %d entries", ntrg, nsrc, nnz);
+  return (map);
+}
+
+/*!
+\fn int MRISregMapFree(MRIS_REG_MAP **pmap)
+*/
+int MRISregMapFree(MRIS_REG_MAP **pmap)
+{
+  MRIS_REG_MAP *map = *pmap;
+
+  if (map == NULL) return (NO_ERROR);
+  free(map->hash);
+  free(map->row);
+  free(map->col);
+  free(map->w);
+  free(map);
+  *pmap = NULL;
+  return (NO_ERROR);
+}
+
+/* The forward loop maps each target vertex to its closest source vertex
+   through the chain of regs, and the reverse loop maps each source
+   vertex that was missed to its closest target vertex. Each target gets
+   the forward entry first and then the reverse ones in source order,
+   the order in which the values used to be summed. */
+static MRIS_REG_MAP *mrisRegMapBuild(MRI_SURFACE **SurfReg, int nsurfs, int ReverseMapFlag, int DoJac, int UseHash)
+{
+  MRIS_REG_MAP *map;
+  MRI_SURFACE *SrcSurfReg, *TrgSurfReg;
+  int svtx = 0, tvtx, tvtxN, svtxN = 0, n, k, nrevhits, nSrcLost;
+  int npairs, kS, kT, *fwd, *rev, *SrcHits, *TrgHits;
+  VERTEX *v;
+  float dmin;
+  MHT **Hash = NULL;
+  MRIS_KDTREE **Tree = NULL;
+
+  npairs = nsurfs / 2;
+  SrcSurfReg = SurfReg[0];
+  TrgSurfReg = SurfReg[nsurfs - 1];
+
+  /* number of source vertices mapped to each target vertex, and
+     number of target vertices mapped to by each source vertex */
+  TrgHits = (int *)calloc(TrgSurfReg->nvertices, sizeof(int));
+  SrcHits = (int *)calloc(SrcSurfReg->nvertices, sizeof(int));
+  /* the source vertex of each target vertex, and the target vertex of
+     each source vertex the forward loop missed (or -1) */
+  fwd = (int *)calloc(TrgSurfReg->nvertices, sizeof(int));
+  rev = (int *)calloc(SrcSurfReg->nvertices, sizeof(int));
+  if (TrgHits == NULL || SrcHits == NULL || fwd == NULL || rev == NULL)
+    ErrorExit(ERROR_NOMEMORY, "MRISapplyReg: could not alloc");
 
   if (UseHash) {
     printf("MRISapplyReg: building hash tables (res=16).\n");
@@ -929,138 +1023,287 @@ MRI *MRISapplyReg(MRI *SrcSurfVals, MRI_SURFACE **SurfReg, int nsurfs, int Rever
       Hash[n] = MHTcreateVertexTable_Resolution(SurfReg[n], CURRENT_VERTICES, 16);
     }
   }
-
-  if (DoJac) {
-    // If using jacobian correction, get a list of the number of times
-    // that a give source vertex gets sampled.
-    for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) {
-      // Compute the source vertex that corresponds to this target vertex
-      tvtxN = tvtx;
-      for (n = npairs - 1; n >= 0; n--) {
-        kS = 2 * n;
-        kT = kS + 1;
-        v = &(SurfReg[kT]->vertices[tvtxN]);
-        /* find closest source vertex */
-        if (UseHash)
-          svtx = MHTfindClosestVertexNo(Hash[kS], SurfReg[kS], v, &dmin);
-        else
-          svtx = MRISfindClosestVertex(SurfReg[kS], v->x, v->y, v->z, &dmin);
-        tvtxN = svtx;
-      }
-      /* update the number of hits and distance */
-      MRIFseq_vox((SrcHits), svtx, 0, 0, 0)++;
-      MRIFseq_vox((TrgHits), tvtx, 0, 0, 0)++;
+  else {
+    printf("MRISapplyReg: building kd-trees.\n");
+    Tree = (MRIS_KDTREE **)calloc(sizeof(MRIS_KDTREE *), nsurfs);
+    for (n = 0; n < nsurfs; n++) {
+      Tree[n] = MRISkdtreeCreate(SurfReg[n], CURRENT_VERTICES);
     }
   }
 
   /* Go through the forwad loop (finding closest srcvtx to each trgvtx).
   This maps each target vertex to a source vertex */
   printf("MRISapplyReg: Forward Loop (%d)\n", TrgSurfReg->nvertices);
-  // nunmapped = 0;
   for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) {
-    if (!UseHash) {
-      if (tvtx % 100 == 0) {
-        printf("%5d ", tvtx);
-        fflush(stdout);
-      }
-      if (tvtx % 1000 == 999) {
-        printf("\n");
-        fflush(stdout);
-      }
-    }
-
     // Compute the source vertex that corresponds to this target vertex
     tvtxN = tvtx;
     for (n = npairs - 1; n >= 0; n--) {
       kS = 2 * n;
       kT = kS + 1;
-      // printf("%5d %5d %d %d %d\n",tvtx,tvtxN,n,kS,kT);
       v = &(SurfReg[kT]->vertices[tvtxN]);
       /* find closest source vertex */
-      if (UseHash) svtx = MHTfindClosestVertexNo(Hash[kS], SurfReg[kS], v, &dmin);
-      if (!UseHash || svtx < 0) {
-        if (svtx < 0) printf("Target vertex %d of pair %d unmapped in hash, using brute force\n", tvtxN, n);
-        svtx = MRISfindClosestVertex(SurfReg[kS], v->x, v->y, v->z, &dmin);
+      if (UseHash) {
+        svtx = MHTfindClosestVertexNo(Hash[kS], SurfReg[kS], v, &dmin);
+        if (svtx < 0) {
+          printf("Target vertex %d of pair %d unmapped in hash, using brute force\n", tvtxN, n);
+          svtx = MRISfindClosestVertex(SurfReg[kS], v->x, v->y, v->z, &dmin);
+        }
       }
+      else
+        svtx = MRISkdtreeFindClosest(Tree[kS], v->x, v->y, v->z, &dmin);
       tvtxN = svtx;
     }
-
-    if (!DoJac) {
-      /* update the number of hits */
-      MRIFseq_vox(SrcHits, svtx, 0, 0, 0)++;
-      MRIFseq_vox(TrgHits, tvtx, 0, 0, 0)++;
-      nhits = 1;
-    }
-    else
-      nhits = MRIgetVoxVal(SrcHits, svtx, 0, 0, 0);
-
-    /* accumulate mapped values for each frame */
-    for (f = 0; f < SrcSurfVals->nframes; f++)
-      MRIFseq_vox(TrgSurfVals, tvtx, 0, 0, f) += (MRIFseq_vox(SrcSurfVals, svtx, 0, 0, f) / nhits);
+    fwd[tvtx] = svtx;
+    /* update the number of hits */
+    SrcHits[svtx]++;
+    TrgHits[tvtx]++;
   }
 
   /*---------------------------------------------------------------
   Go through the reverse loop (finding closest trgvtx to each srcvtx
   unmapped by the forward loop). This assures that each source vertex
   is represented in the map */
-  if (ReverseMapFlag) {
-    printf("MRISapplyReg: Reverse Loop (%d)\n", SrcSurfReg->nvertices);
-    nrevhits = 0;
-    for (svtx = 0; svtx < SrcSurfReg->nvertices; svtx++) {
-      if (MRIFseq_vox((SrcHits), svtx, 0, 0, 0) != 0) continue;
-      nrevhits++;
-
-      // Compute the target vertex that corresponds to this source vertex
-      svtxN = svtx;
-      for (n = 0; n < npairs; n++) {
-        kS = 2 * n;
-        kT = kS + 1;
-        // printf("%5d %5d %d %d %d\n",svtx,svtxN,n,kS,kT);
-        v = &(SurfReg[kS]->vertices[svtxN]);
-        /* find closest target vertex */
-        if (UseHash) tvtx = MHTfindClosestVertexNo(Hash[kT], SurfReg[kT], v, &dmin);
-        if (!UseHash || tvtx < 0) {
-          if (tvtx < 0) printf("Source vertex %d of pair %d unmapped in hash, using brute force\n", svtxN, n);
+  nrevhits = 0;
+  for (svtx = 0; svtx < SrcSurfReg->nvertices; svtx++) {
+    rev[svtx] = -1;
+    if (!ReverseMapFlag || SrcHits[svtx] != 0) continue;
+    if (nrevhits++ == 0) printf("MRISapplyReg: Reverse Loop (%d)\n", SrcSurfReg->nvertices);
+
+    // Compute the target vertex that corresponds to this source vertex
+    svtxN = svtx;
+    for (n = 0; n < npairs; n++) {
+      kS = 2 * n;
+      kT = kS + 1;
+      v = &(SurfReg[kS]->vertices[svtxN]);
+      /* find closest target vertex */
+      if (UseHash) {
+        tvtx = MHTfindClosestVertexNo(Hash[kT], SurfReg[kT], v, &dmin);
+        if (tvtx < 0) {
+          printf("Source vertex %d of pair %d unmapped in hash, using brute force\n", svtxN, n);
           tvtx = MRISfindClosestVertex(SurfReg[kT], v->x, v->y, v->z, &dmin);
         }
-        svtxN = tvtx;
       }
-
-      /* update the number of hits */
-      MRIFseq_vox((SrcHits), svtx, 0, 0, 0)++;
-      MRIFseq_vox((TrgHits), tvtx, 0, 0, 0)++;
-      /* accumulate mapped values for each frame */
-      for (f = 0; f < SrcSurfVals->nframes; f++)
-        MRIFseq_vox(TrgSurfVals, tvtx, 0, 0, f) += MRIFseq_vox(SrcSurfVals, svtx, 0, 0, f);
+      else
+        tvtx = MRISkdtreeFindClosest(Tree[kT], v->x, v->y, v->z, &dmin);
+      svtxN = tvtx;
     }
-    printf("  Reverse Loop had %d hits\n", nrevhits);
+    rev[svtx] = tvtx;
   }
+  if (ReverseMapFlag) printf("  Reverse Loop had %d hits\n", nrevhits);
 
-  /*---------------------------------------------------------------
-  Finally, divide the value at each target vertex by the number
-  of source vertices mapping into it */
-  if (!DoJac) {
-    printf("MRISapplyReg: Dividing by number of hits (%d)\n", TrgSurfReg->nvertices);
-    for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) {
-      n = MRIFseq_vox((TrgHits), tvtx, 0, 0, 0);
-      if (n > 1) {
-        for (f = 0; f < SrcSurfVals->nframes; f++) MRIFseq_vox(TrgSurfVals, tvtx, 0, 0, f) /= n;
-      }
-    }
+  /* With jacobian correction each source value is split evenly among
+     the forward hits on it (the reverse hits keep it all); without,
+     each target is the average of the source values mapped to it. */
+  map = mrisRegMapAlloc(nsurfs, TrgSurfReg->nvertices, SrcSurfReg->nvertices, TrgSurfReg->nvertices + nrevhits);
+  for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) map->row[tvtx + 1] = 1;
+  for (svtx = 0; svtx < SrcSurfReg->nvertices; svtx++) {
+    if (rev[svtx] < 0) continue;
+    map->row[rev[svtx] + 1]++;
+    SrcHits[svtx]++;
+    if (!DoJac) TrgHits[rev[svtx]]++;
+  }
+  for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) map->row[tvtx + 1] += map->row[tvtx];
+  for (tvtx = 0; tvtx < TrgSurfReg->nvertices; tvtx++) {
+    k = map->row[tvtx];
+    map->col[k] = fwd[tvtx];
+    map->w[k] = DoJac ? 1.0 / SrcHits[fwd[tvtx]] : 1.0 / TrgHits[tvtx];
+    TrgHits[tvtx] = k + 1;  // now the next free entry
+  }
+  for (svtx = 0; svtx < SrcSurfReg->nvertices; svtx++) {
+    if (rev[svtx] < 0) continue;
+    tvtx = rev[svtx];
+    k = TrgHits[tvtx]++;
+    map->col[k] = svtx;
+    map->w[k] = DoJac ? 1.0 : 1.0 / (map->row[tvtx + 1] - map->row[tvtx]);
   }
+  map->ReverseMapFlag = ReverseMapFlag;
+  map->DoJac = DoJac;
+  map->UseHash = (UseHash != 0);
+  for (n = 0; n < nsurfs; n++) mrisRegMapHash(&map->hash[n], SurfReg[n]);
 
   /* Count lost sources */
   nSrcLost = 0;
-  for (svtx = 0; svtx < SrcSurfReg->nvertices; svtx++) {
-    n = MRIFseq_vox((SrcHits), svtx, 0, 0, 0);
-    if (n == 0) nSrcLost++;
-  }
+  for (svtx = 0; svtx < SrcSurfReg->nvertices; svtx++)
+    if (SrcHits[svtx] == 0) nSrcLost++;
   printf("MRISapplyReg: nSrcLost = %d\n", nSrcLost);
 
-  MRIfree(&SrcHits);
-  MRIfree(&TrgHits);
-  if (UseHash)
+  free(SrcHits);
+  free(TrgHits);
+  free(fwd);
+  free(rev);
+  if (UseHash) {
     for (n = 0; n < nsurfs; n++) MHTfree(&Hash[n]);
+    free(Hash);
+  }
+  else {
+    for (n = 0; n < nsurfs; n++) MRISkdtreeFree(&Tree[n]);
+    free(Tree);
+  }
+  return (map);
+}
+
+/*!
+\fn MRIS_REG_MAP *MRISregMap(MRI_SURFACE **SurfReg, int nsurfs,
+                             int ReverseMapFlag, int DoJac, int UseHash)
+\brief Builds the resampling of MRISapplyReg() as a sparse matrix that
+can be applied to any number of overlays with MRISregMapApply(). If the
+FS_SURFREG_CACHE environment variable names a directory, the map is
+read from there when it was built before from reg surfaces with the
+same coordinates and with the same options, UseHash included (see
+MRISregMapMatches()), and saved there otherwise.
+*/
+MRIS_REG_MAP *MRISregMap(MRI_SURFACE **SurfReg, int nsurfs, int ReverseMapFlag, int DoJac, int UseHash)
+{
+  MRIS_REG_MAP *map = NULL;
+  MRIS_HASH key;
+  char *cachedir, fname[STRLEN], tmpname[STRLEN];
+  int n, kS, kT, flags[3] = {ReverseMapFlag, DoJac, UseHash != 0};
+
+  for (n = 0; n < nsurfs / 2 - 1; n++) {
+    kS = 2 * n + 1;
+    kT = kS + 1;
+    if (SurfReg[kT]->nvertices != SurfReg[kS]->nvertices) {
+      printf("MRISapplyReg: Reg dimension mismatch %d, %d\n", kT, kS);
+      printf("targ = %d, next source = %d\n", SurfReg[kT]->nvertices, SurfReg[kS]->nvertices);
+      return (NULL);
+    }
+  }
+
+  cachedir = getenv("FS_SURFREG_CACHE");
+  if (cachedir == NULL) return (mrisRegMapBuild(SurfReg, nsurfs, ReverseMapFlag, DoJac, UseHash));
+
+  // the file name comes from all the surfaces and options, the file
+  // itself has the hash of each surface to check against
+  mris_hash_init(&key, NULL);
+  for (n = 0; n < nsurfs; n++) {
+    MRIS_HASH hash;
+    mrisRegMapHash(&hash, SurfReg[n]);
+    key.hash = fnv_add(key.hash, (const unsigned char *)&hash.hash, sizeof(hash.hash));
+  }
+  key.hash = fnv_add(key.hash, (const unsigned char *)flags, sizeof(flags));
+  sprintf(fname, "%s/surfreg.%016lx.map", cachedir, key.hash);
+
+  if (fio_FileExistsReadable(fname)) {
+    map = MRISregMapRead(fname);
+    if (map && MRISregMapMatches(map, SurfReg, nsurfs, ReverseMapFlag, DoJac, UseHash)) {
+      printf("MRISapplyReg: read map from %s\n", fname);
+      return (map);
+    }
+    MRISregMapFree(&map);
+  }
+
+  map = mrisRegMapBuild(SurfReg, nsurfs, ReverseMapFlag, DoJac, UseHash);
+  // write under another name first, so that concurrent runs sharing the
+  // cache never read a partial map
+  sprintf(tmpname, "%s.%d", fname, (int)getpid());
+  if (MRISregMapWrite(map, tmpname) == NO_ERROR && rename(tmpname, fname) == 0)
+    printf("MRISapplyReg: saved map to %s\n", fname);
+  else
+    unlink(tmpname);
+  return (map);
+}
+
+#define MRIS_REG_MAP_MAGIC 0x53524d32  // "SRM2", also catches the other byte order
+
+/*!
+\fn int MRISregMapWrite(MRIS_REG_MAP *map, const char *fname)
+\brief Writes the map in native byte order; it is meant as a cache on
+the machine that made it.
+*/
+int MRISregMapWrite(MRIS_REG_MAP *map, const char *fname)
+{
+  FILE *fp;
+  int n, hdr[8] = {MRIS_REG_MAP_MAGIC, map->nsurfs, map->ReverseMapFlag, map->DoJac, map->UseHash, map->ntrg, map->nsrc, map->nnz};
+
+  fp = fopen(fname, "wb");
+  if (fp == NULL) ErrorReturn(ERROR_NOFILE, (ERROR_NOFILE, "MRISregMapWrite: could not open %s", fname));
+  n = (fwrite(hdr, sizeof(int), 8, fp) != 8);
+  n += (fwrite(map->hash, sizeof(MRIS_HASH), map->nsurfs, fp) != (size_t)map->nsurfs);
+  n += (fwrite(map->row, sizeof(int), map->ntrg + 1, fp) != (size_t)map->ntrg + 1);
+  n += (fwrite(map->col, sizeof(int), map->nnz, fp) != (size_t)map->nnz);
+  n += (fwrite(map->w, sizeof(float), map->nnz, fp) != (size_t)map->nnz);
+  n += (fclose(fp) != 0);
+  if (n) ErrorReturn(ERROR_BADFILE, (ERROR_BADFILE, "MRISregMapWrite: could not write %s", fname));
+  return (NO_ERROR);
+}
+
+/*!
+\fn MRIS_REG_MAP *MRISregMapRead(const char *fname)
+*/
+MRIS_REG_MAP *MRISregMapRead(const char *fname)
+{
+  MRIS_REG_MAP *map;
+  FILE *fp;
+  int n, hdr[8];
+
+  fp = fopen(fname, "rb");
+  if (fp == NULL) ErrorReturn(NULL, (ERROR_NOFILE, "MRISregMapRead: could not open %s", fname));
+  if (fread(hdr, sizeof(int), 8, fp) != 8 || hdr[0] != MRIS_REG_MAP_MAGIC || hdr[1] < 2 || hdr[5] < 0 || hdr[6] < 0 ||
+      hdr[7] < 0) {
+    fclose(fp);
+    ErrorReturn(NULL, (ERROR_BADFILE, "MRISregMapRead: %s is not a surface reg map", fname));
+  }
+  map = mrisRegMapAlloc(hdr[1], hdr[5], hdr[6], hdr[7]);
+  map->ReverseMapFlag = hdr[2];
+  map->DoJac = hdr[3];
+  map->UseHash = hdr[4];
+  n = (fread(map->hash, sizeof(MRIS_HASH), map->nsurfs, fp) != (size_t)map->nsurfs);
+  n += (fread(map->row, sizeof(int), map->ntrg + 1, fp) != (size_t)map->ntrg + 1);
+  n += (fread(map->col, sizeof(int), map->nnz, fp) != (size_t)map->nnz);
+  n += (fread(map->w, sizeof(float), map->nnz, fp) != (size_t)map->nnz);
+  fclose(fp);
+  if (n == 0 && map->row[0] == 0 && map->row[map->ntrg] == map->nnz)
+    for (n = 0; n < map->nnz && map->col[n] >= 0 && map->col[n] < map->nsrc; n++)
+      ;
+  if (n != map->nnz) {
+    MRISregMapFree(&map);
+    ErrorReturn(NULL, (ERROR_BADFILE, "MRISregMapRead: %s is truncated or corrupt", fname));
+  }
+  return (map);
+}
+
+/*!
+\fn MRI *MRISregMapApply(MRIS_REG_MAP *map, MRI *SrcSurfVals, MRI *TrgSurfVals)
+\brief Resamples all the frames of SrcSurfVals (nsrc x 1 x 1, float)
+onto the target surface; TrgSurfVals is allocated if NULL.
+*/
+MRI *MRISregMapApply(MRIS_REG_MAP *map, MRI *SrcSurfVals, MRI *TrgSurfVals)
+{
+  int tvtx;
+
+  if (SrcSurfVals->width != map->nsrc) {
+    printf("MRISregMapApply: Vals and map dimension mismatch\n");
+    printf("nVals = %d, nMap %d\n", SrcSurfVals->width, map->nsrc);
+    return (NULL);
+  }
+  if (TrgSurfVals == NULL) {
+    TrgSurfVals = MRIallocSequence(map->ntrg, 1, 1, MRI_FLOAT, SrcSurfVals->nframes);
+    if (TrgSurfVals == NULL) return (NULL);
+    MRIcopyHeader(SrcSurfVals, TrgSurfVals);
+  }
+  else if (TrgSurfVals->width != map->ntrg || TrgSurfVals->nframes != SrcSurfVals->nframes ||
+           TrgSurfVals->type != MRI_FLOAT) {
+    printf("MRISregMapApply: output dimension mismatch\n");
+    return (NULL);
+  }
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) schedule(static)
+#endif
+  for (tvtx = 0; tvtx < map->ntrg; tvtx++) {
+    ROMP_PFLB_begin
+    int f, k;
+    for (f = 0; f < SrcSurfVals->nframes; f++) {
+      double sum = 0;
+      for (k = map->row[tvtx]; k < map->row[tvtx + 1]; k++)
+        sum += map->w[k] * MRIFseq_vox(SrcSurfVals, map->col[k], 0, 0, f);
+      MRIFseq_vox(TrgSurfVals, tvtx, 0, 0, f) = sum;
+    }
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
   return (TrgSurfVals);
 }
 
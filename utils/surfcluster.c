@@ -123,11 +123,14 @@ SCS *sclustMapSurfClusters(
    criteria. The cluster map itself is defined using the
    undefval of the MRI_SURF structure. If a vertex meets the
    cluster criteria, then undefval is set to the ClusterNo.
-   The ClustNo cannot be 0.
+   The ClustNo cannot be 0. The vertices still to be grown from
+   are kept on an explicit stack rather than by recursion, which
+   can overflow the small stacks of OpenMP threads (mri_glmfit
+   --sim) on large clusters.
    ------------------------------------------------------------ */
 int sclustGrowSurfCluster(int ClusterNo, int SeedVtx, MRI_SURFACE *Surf, float thmin, float thmax, int thsign)
 {
-  int nbr, nbr_vtx, nbr_inrange, nbr_clustno;
+  int nbr, vtx, nbr_vtx, nbr_inrange, nbr_clustno, nstack, *stack;
   float nbr_val;
 
   if (ClusterNo == 0) {
@@ -135,18 +138,31 @@ int sclustGrowSurfCluster(int ClusterNo, int SeedVtx, MRI_SURFACE *Surf, float t
     return (1);
   }
 
+  /* a vertex is pushed once, when it is put in the cluster */
+  stack = (int *)malloc(Surf->nvertices * sizeof(int));
+  if (stack == NULL) {
+    printf("ERROR: clustGrowSurfCluster(): could not alloc %d vertices\n", Surf->nvertices);
+    return (1);
+  }
   Surf->vertices[SeedVtx].undefval = ClusterNo;
-
-  for (nbr = 0; nbr < Surf->vertices[SeedVtx].vnum; nbr++) {
-    nbr_vtx = Surf->vertices[SeedVtx].v[nbr];
-    nbr_clustno = Surf->vertices[nbr_vtx].undefval;
-    if (nbr_clustno != 0) continue;
-    nbr_val = Surf->vertices[nbr_vtx].val;
-    if (fabs(nbr_val) < thmin) continue;
-    nbr_inrange = clustValueInRange(nbr_val, thmin, thmax, thsign);
-    if (!nbr_inrange) continue;
-    sclustGrowSurfCluster(ClusterNo, nbr_vtx, Surf, thmin, thmax, thsign);
+  stack[0] = SeedVtx;
+  nstack = 1;
+
+  while (nstack > 0) {
+    vtx = stack[--nstack];
+    for (nbr = 0; nbr < Surf->vertices[vtx].vnum; nbr++) {
+      nbr_vtx = Surf->vertices[vtx].v[nbr];
+      nbr_clustno = Surf->vertices[nbr_vtx].undefval;
+      if (nbr_clustno != 0) continue;
+      nbr_val = Surf->vertices[nbr_vtx].val;
+      if (fabs(nbr_val) < thmin) continue;
+      nbr_inrange = clustValueInRange(nbr_val, thmin, thmax, thsign);
+      if (!nbr_inrange) continue;
+      Surf->vertices[nbr_vtx].undefval = ClusterNo;
+      stack[nstack++] = nbr_vtx;
+    }
   }
+  free(stack);
   return (0);
 }
 /*----------------------------------------------------------------
@@ -0,0 +1,223 @@
+/**
+ * @file  test_gaussianfft.c
+ * @brief check the FFT Gaussian smoothing (MRIallocGaussianFFT) against
+ *        the full matrix smoothing it replaces, and time a plan reused
+ *        across iterations as in a simulation
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "fftutils.h"
+#include "matrix.h"
+#include "mri.h"
+#include "timer.h"
+#include "utils.h"
+
+const char *Progname = "test_gaussianfft";
+
+/* the plan against a direct DFT */
+static int check_plan(void)
+{
+  FFT_PLAN *plan;
+  float re[256], im[256];
+  double xr[256], xi[256], sr, si, max_err;
+  int n, i, k, errs = 0;
+
+  for (n = 1; n <= 256; n *= 2) {
+    plan = FFTallocPlan(n);
+    for (i = 0; i < n; i++) {
+      re[i] = xr[i] = randomNumber(-1, 1);
+      im[i] = xi[i] = randomNumber(-1, 1);
+    }
+    FFTplanForward(plan, re, im);
+    for (max_err = 0, k = 0; k < n; k++) {
+      for (sr = si = 0, i = 0; i < n; i++) {
+        sr += xr[i] * cos(2 * M_PI * i * k / n) + xi[i] * sin(2 * M_PI * i * k / n);
+        si += xi[i] * cos(2 * M_PI * i * k / n) - xr[i] * sin(2 * M_PI * i * k / n);
+      }
+      max_err = MAX(max_err, MAX(fabs(sr - re[k]), fabs(si - im[k])));
+    }
+    FFTplanBackward(plan, re, im);
+    for (i = 0; i < n; i++) max_err = MAX(max_err, MAX(fabs(xr[i] - re[i] / n), fabs(xi[i] - im[i] / n)));
+    if (max_err > 1e-4 * sqrt(n)) {
+      printf("length %d: max error %g\n", n, max_err);
+      errs++;
+    }
+    FFTfreePlan(&plan);
+  }
+  return (errs);
+}
+
+static MRI *make_volume(int width, int height, int depth, int nframes)
+{
+  MRI *mri;
+  int x, y, z, f;
+
+  mri = MRIallocSequence(width, height, depth, MRI_FLOAT, nframes);
+  mri->xsize = 1;
+  mri->ysize = 1.5;
+  mri->zsize = 2;
+  for (f = 0; f < nframes; f++)
+    for (z = 0; z < depth; z++)
+      for (y = 0; y < height; y++)
+        for (x = 0; x < width; x++)
+          MRIFseq_vox(mri, x, y, z, f) = (x / 8 + y / 8 + z / 8) % 2 ? 200 : randomNumber(0, 100);
+  return (mri);
+}
+
+/* what MRIgaussianSmoothNI() computes with its full matrices */
+static MRI *matrix_smooth(MRI *src, double std)
+{
+  MRI *mri;
+  MATRIX *G;
+  int a, len, i, j, u, v, f, dims[3] = {src->width, src->height, src->depth};
+  float sizes[3] = {src->xsize, src->ysize, src->zsize};
+  double line[256], scale, total;
+
+  mri = MRIcopy(src, NULL);
+  for (a = 0; a < 3; a++) {
+    len = dims[a];
+    G = GaussianMatrix(len, std / sizes[a], 1, NULL);
+    for (scale = 0, j = 0; j < len; j++) scale += G->rptr[len / 2][j + 1];
+    for (f = 0; f < mri->nframes; f++)
+      for (u = 0; u < dims[(a + 1) % 3]; u++)
+        for (v = 0; v < dims[(a + 2) % 3]; v++) {
+          int xyz[3];
+          xyz[(a + 1) % 3] = u;
+          xyz[(a + 2) % 3] = v;
+          for (i = 0; i < len; i++) {
+            xyz[a] = i;
+            line[i] = MRIFseq_vox(mri, xyz[0], xyz[1], xyz[2], f);
+          }
+          for (i = 0; i < len; i++) {
+            for (total = 0, j = 0; j < len; j++) total += G->rptr[i + 1][j + 1] * line[j];
+            xyz[a] = i;
+            MRIFseq_vox(mri, xyz[0], xyz[1], xyz[2], f) = total / scale;
+          }
+        }
+    MatrixFree(&G);
+  }
+  return (mri);
+}
+
+static double max_diff(MRI *mri1, MRI *mri2)
+{
+  double diff = 0;
+  int x, y, z, f;
+
+  for (f = 0; f < mri1->nframes; f++)
+    for (z = 0; z < mri1->depth; z++)
+      for (y = 0; y < mri1->height; y++)
+        for (x = 0; x < mri1->width; x++)
+          diff = MAX(diff, fabs(MRIgetVoxVal(mri1, x, y, z, f) - MRIgetVoxVal(mri2, x, y, z, f)));
+  return (diff);
+}
+
+int main(int argc, char *argv[])
+{
+  MRI *mri, *mri_ref, *mri_fft, *mri_mask, *mri_kernel, *mri_tmp;
+  MRI_GAUSSIAN_FFT *gf;
+  struct timeb then;
+  double stds[] = {1, 3, 8}, fwhm, diff;
+  int n, x, y, z, iter, errs = 0, direct_msec, fft_msec, plan_msec;
+
+  setRandomSeed(5);
+  errs += check_plan();
+
+  /* unmasked, anisotropic voxels, several frames */
+  mri = make_volume(72, 60, 50, 2);
+  for (n = 0; n < (int)(sizeof(stds) / sizeof(stds[0])); n++) {
+    mri_ref = matrix_smooth(mri, stds[n]);
+    mri_fft = MRIgaussianSmoothNI(mri, stds[n], stds[n], stds[n], NULL);
+    diff = max_diff(mri_ref, mri_fft);
+    printf("std %g: max diff from full matrices %g\n", stds[n], diff);
+    if (diff > 1e-3) errs++;
+    MRIfree(&mri_ref);
+    MRIfree(&mri_fft);
+  }
+
+  /* masked, in place, against MRImaskedGaussianSmooth() */
+  mri_mask = MRIalloc(mri->width, mri->height, mri->depth, MRI_UCHAR);
+  MRIcopyHeader(mri, mri_mask);
+  for (z = 0; z < mri->depth; z++)
+    for (y = 0; y < mri->height; y++)
+      for (x = 0; x < mri->width; x++)
+        MRIvox(mri_mask, x, y, z) = SQR(x - 36) + SQR(y - 30) + SQR(z - 25) < SQR(24);
+  mri_ref = MRImaskedGaussianSmooth(mri, mri_mask, 4, NULL);
+  gf = MRIallocGaussianFFT(mri, 4, 4, 4, mri_mask);
+  mri_fft = MRIcopy(mri, NULL);
+  MRIgaussianFFTsmooth(gf, mri_fft, mri_fft);
+  diff = max_diff(mri_ref, mri_fft);
+  printf("masked: max diff %g\n", diff);
+  if (diff > 1e-3) errs++;
+  MRIfreeGaussianFFT(&gf);
+  MRIfree(&mri_ref);
+  MRIfree(&mri_fft);
+  MRIfree(&mri_mask);
+  MRIfree(&mri);
+
+  /* a long kernel in MRIconvolveGaussian() against the direct convolution */
+  mri = make_volume(128, 128, 128, 1);
+  mri_kernel = MRIgaussian1d(16, -1);
+  mri_tmp = MRIalloc(mri->width, mri->height, mri->depth, MRI_FLOAT);
+  mri_ref = MRIalloc(mri->width, mri->height, mri->depth, MRI_FLOAT);
+  TimerStart(&then);
+  MRIconvolve1d(mri, mri_tmp, &MRIFvox(mri_kernel, 0, 0, 0), mri_kernel->width, MRI_WIDTH, 0, 0);
+  MRIconvolve1d(mri_tmp, mri_ref, &MRIFvox(mri_kernel, 0, 0, 0), mri_kernel->width, MRI_HEIGHT, 0, 0);
+  MRIconvolve1d(mri_ref, mri_tmp, &MRIFvox(mri_kernel, 0, 0, 0), mri_kernel->width, MRI_DEPTH, 0, 0);
+  direct_msec = TimerStop(&then);
+  TimerStart(&then);
+  mri_fft = MRIconvolveGaussian(mri, NULL, mri_kernel);
+  fft_msec = TimerStop(&then);
+  diff = max_diff(mri_tmp, mri_fft);
+  printf("%d tap kernel: direct %d ms, fft %d ms, max diff %g\n", mri_kernel->width, direct_msec, fft_msec, diff);
+  if (diff > 1e-3) errs++;
+  MRIfree(&mri_fft);
+  MRIfree(&mri_ref);
+  MRIfree(&mri_tmp);
+  MRIfree(&mri_kernel);
+  MRIfree(&mri);
+
+  /* a simulation: smooth new noise each iteration, at several FWHMs */
+  mri = MRIallocSequence(96, 96, 96, MRI_FLOAT, 1);
+  mri_mask = MRIalloc(mri->width, mri->height, mri->depth, MRI_UCHAR);
+  for (z = 0; z < mri->depth; z++)
+    for (y = 0; y < mri->height; y++)
+      for (x = 0; x < mri->width; x++) MRIvox(mri_mask, x, y, z) = SQR(x - 48) + SQR(y - 48) + SQR(z - 48) < SQR(40);
+  for (fwhm = 4; fwhm <= 16; fwhm *= 2) {
+    TimerStart(&then);
+    gf = MRIallocGaussianFFT(mri, fwhm / sqrt(log(256.0)), fwhm / sqrt(log(256.0)), fwhm / sqrt(log(256.0)), mri_mask);
+    plan_msec = TimerStop(&then);
+    TimerStart(&then);
+    for (iter = 0; iter < 4; iter++) {
+      MRIrandn(mri->width, mri->height, mri->depth, 1, 0, 1, mri);
+      MRIgaussianFFTsmooth(gf, mri, mri);
+    }
+    fft_msec = TimerStop(&then) / 4;
+    MRIfreeGaussianFFT(&gf);
+    printf("96^3 fwhm %2g: plan %d ms, %d ms per iteration\n", fwhm, plan_msec, fft_msec);
+  }
+  MRIfree(&mri_mask);
+  MRIfree(&mri);
+
+  if (errs) printf("test_gaussianfft: %d failures\n", errs);
+  exit(errs ? 1 : 0);
+}
@@ -0,0 +1,164 @@
+/**
+ * @file  test_gcacache.c
+ * @brief check and time the cached Gaussian inverses and determinants
+ *        (GCAbuildGaussianCache) against the uncached matrix computations
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "gca.h"
+#include "matrix.h"
+#include "timer.h"
+#include "utils.h"
+
+const char *Progname = "test_gcacache";
+
+#define NINPUTS 3
+#define NSAMPLES 20
+
+/* random symmetric positive definite covariances */
+static GCA *make_gca(void)
+{
+  GCA *gca;
+  int x, y, z, n, r, c, k, i;
+
+  gca = GCAalloc(NINPUTS, 4, 8, 128, 128, 128, 0);
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        GCA_NODE *gcan = &gca->nodes[x][y][z];
+        gcan->nlabels = 1 + (x + y + z) % gcan->max_labels;
+        for (n = 0; n < gcan->nlabels; n++) {
+          GC1D *gc = &gcan->gcs[n];
+          double a[NINPUTS][NINPUTS];
+          gcan->labels[n] = n + 1;
+          for (r = 0; r < NINPUTS; r++) {
+            gc->means[r] = randomNumber(50, 150);
+            for (c = 0; c < NINPUTS; c++) a[r][c] = randomNumber(-5, 5);
+          }
+          for (i = r = 0; r < NINPUTS; r++)
+            for (c = r; c < NINPUTS; c++, i++) {
+              double cov = r == c ? 1 : 0;
+              for (k = 0; k < NINPUTS; k++) cov += a[r][k] * a[c][k];
+              gc->covars[i] = cov;
+            }
+        }
+      }
+  return (gca);
+}
+
+static int differ(double a, double b)
+{
+  return (fabs(a - b) > 1e-4 * MAX(1, fabs(a)));
+}
+
+int main(int argc, char *argv[])
+{
+  GCA *gca;
+  GC1D *gc;
+  MATRIX *m_inv_ref = NULL, *m_inv_new = NULL;
+  struct timeb then;
+  float vals[NSAMPLES][NINPUTS];
+  double *ref, *det_ref, sum_ref = 0, sum_new = 0;
+  int x, y, z, n, s, r, c, ngcs, errs = 0, ref_msec, new_msec, build_msec;
+
+  setRandomSeed(3);
+  gca = make_gca();
+  for (s = 0; s < NSAMPLES; s++)
+    for (r = 0; r < NINPUTS; r++) vals[s][r] = randomNumber(0, 200);
+  for (ngcs = x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) ngcs += gca->nodes[x][y][z].nlabels;
+  ref = (double *)calloc(ngcs * NSAMPLES, sizeof(double));
+  det_ref = (double *)calloc(ngcs, sizeof(double));
+
+  TimerStart(&then);
+  for (ngcs = x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++)
+        for (n = 0; n < gca->nodes[x][y][z].nlabels; n++, ngcs++) {
+          gc = &gca->nodes[x][y][z].gcs[n];
+          det_ref[ngcs] = covariance_determinant(gc, NINPUTS);
+          for (s = 0; s < NSAMPLES; s++) ref[ngcs * NSAMPLES + s] = GCAmahDist(gc, vals[s], NINPUTS);
+        }
+  ref_msec = TimerStop(&then);
+
+  TimerStart(&then);
+  GCAbuildGaussianCache(gca);
+  build_msec = TimerStop(&then);
+
+  TimerStart(&then);
+  for (ngcs = x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++)
+        for (n = 0; n < gca->nodes[x][y][z].nlabels; n++, ngcs++) {
+          gc = &gca->nodes[x][y][z].gcs[n];
+          if (differ(det_ref[ngcs], covariance_determinant(gc, NINPUTS))) errs++;
+          for (s = 0; s < NSAMPLES; s++) {
+            double dsq = GCAmahDist(gc, vals[s], NINPUTS);
+            sum_ref += ref[ngcs * NSAMPLES + s];
+            sum_new += dsq;
+            if (differ(ref[ngcs * NSAMPLES + s], dsq)) {
+              if (errs++ < 10)
+                printf("node (%d, %d, %d) gc %d sample %d: %g %g\n", x, y, z, n, s, ref[ngcs * NSAMPLES + s], dsq);
+            }
+          }
+        }
+  new_msec = TimerStop(&then);
+  printf("%d gcs x %d samples: uncached %d ms, cache build %d ms, cached %d ms, sums %g %g\n",
+         ngcs,
+         NSAMPLES,
+         ref_msec,
+         build_msec,
+         new_msec,
+         sum_ref,
+         sum_new);
+
+  /* the cached inverse covariance matrix */
+  gc = &gca->nodes[1][2][3].gcs[0];
+  m_inv_new = load_inverse_covariance_matrix(gc, NULL, NINPUTS);
+  m_inv_ref = load_covariance_matrix(gc, NULL, NINPUTS);
+  m_inv_ref = MatrixInverse(m_inv_ref, NULL);
+  for (r = 1; r <= NINPUTS; r++)
+    for (c = 1; c <= NINPUTS; c++)
+      if (differ(*MATRIX_RELT(m_inv_ref, r, c), *MATRIX_RELT(m_inv_new, r, c))) errs++;
+
+  /* changed covariances are not taken from the stale cache */
+  gc->covars[1] += 0.5;
+  det_ref[0] = covariance_determinant(gc, NINPUTS);
+  ref[0] = GCAmahDist(gc, vals[0], NINPUTS);
+  m_inv_new = load_inverse_covariance_matrix(gc, m_inv_new, NINPUTS);
+  GCAbuildGaussianCache(gca);
+  if (differ(det_ref[0], covariance_determinant(gc, NINPUTS))) errs++;
+  if (differ(ref[0], GCAmahDist(gc, vals[0], NINPUTS))) errs++;
+  m_inv_ref = load_inverse_covariance_matrix(gc, m_inv_ref, NINPUTS);
+  for (r = 1; r <= NINPUTS; r++)
+    for (c = 1; c <= NINPUTS; c++)
+      if (differ(*MATRIX_RELT(m_inv_ref, r, c), *MATRIX_RELT(m_inv_new, r, c))) errs++;
+
+  MatrixFree(&m_inv_ref);
+  MatrixFree(&m_inv_new);
+  free(ref);
+  free(det_ref);
+  GCAfree(&gca);
+  if (errs) printf("test_gcacache: %d failures\n", errs);
+  exit(errs ? 1 : 0);
+}
@@ -0,0 +1,168 @@
+/**
+ * @file  test_gcaflat.c
+ * @brief check that a flat (.gcaf) atlas reads back the same as the .gca,
+ *        and time both readers
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "gca.h"
+#include "timer.h"
+#include "utils.h"
+
+const char *Progname = "test_gcaflat";
+
+/* an atlas with a varying number of labels, Gibbs tables and priors */
+static GCA *make_gca(int ninputs, int flags)
+{
+  GCA *gca;
+  int x, y, z, n, i, j, ncovars = (ninputs * (ninputs + 1)) / 2;
+
+  gca = GCAalloc(ninputs, 4, 8, 128, 128, 128, flags);
+  gca->type = GCA_NORMAL;
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        GCA_NODE *gcan = &gca->nodes[x][y][z];
+        gcan->nlabels = (x + 2 * y + z) % (gcan->max_labels + 1);
+        gcan->total_training = x + y;
+        for (n = 0; n < gcan->nlabels; n++) {
+          GC1D *gc = &gcan->gcs[n];
+          gcan->labels[n] = 1 + (7 * n + x) % 40;
+          for (i = 0; i < ninputs; i++) gc->means[i] = randomNumber(0, 100);
+          for (i = 0; i < ncovars; i++) gc->covars[i] = randomNumber(10, 20);
+          if (flags & GCA_NO_MRF) continue;
+          for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+            gc->nlabels[i] = (n + i + x) % 4;
+            gc->labels[i] = (unsigned short *)calloc(gc->nlabels[i] + 1, sizeof(unsigned short));
+            gc->label_priors[i] = (float *)calloc(gc->nlabels[i] + 1, sizeof(float));
+            for (j = 0; j < gc->nlabels[i]; j++) {
+              gc->labels[i][j] = i + j;
+              gc->label_priors[i][j] = randomNumber(0, 1);
+            }
+          }
+        }
+      }
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++) {
+        GCA_PRIOR *gcap = &gca->priors[x][y][z];
+        gcap->nlabels = (x + y * z) % (gcap->max_labels + 1);
+        gcap->total_training = z;
+        for (n = 0; n < gcap->nlabels; n++) {
+          gcap->labels[n] = 1 + (5 * n + z) % 40;
+          gcap->priors[n] = randomNumber(0, 1);
+        }
+      }
+  return (gca);
+}
+
+static int compare(GCA *gca1, GCA *gca2)
+{
+  int x, y, z, n, i, j, errs = 0, ncovars = (gca1->ninputs * (gca1->ninputs + 1)) / 2;
+
+  if (gca1->node_width != gca2->node_width || gca1->prior_width != gca2->prior_width ||
+      gca1->flags != gca2->flags || gca1->type != gca2->type || gca1->max_label != gca2->max_label ||
+      gca1->x_r != gca2->x_r || gca1->c_s != gca2->c_s)
+    return (1);
+  for (x = 0; x < gca1->node_width; x++)
+    for (y = 0; y < gca1->node_height; y++)
+      for (z = 0; z < gca1->node_depth; z++) {
+        GCA_NODE *gcan1 = &gca1->nodes[x][y][z], *gcan2 = &gca2->nodes[x][y][z];
+        if (gcan1->nlabels != gcan2->nlabels || gcan1->total_training != gcan2->total_training) {
+          errs++;
+          continue;
+        }
+        for (n = 0; n < gcan1->nlabels; n++) {
+          GC1D *gc1 = &gcan1->gcs[n], *gc2 = &gcan2->gcs[n];
+          if (gcan1->labels[n] != gcan2->labels[n] || gc1->ntraining != gc2->ntraining) errs++;
+          for (i = 0; i < gca1->ninputs; i++) errs += (gc1->means[i] != gc2->means[i]);
+          for (i = 0; i < ncovars; i++) errs += (gc1->covars[i] != gc2->covars[i]);
+          if (gca1->flags & GCA_NO_MRF) continue;
+          for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+            if (gc1->nlabels[i] != gc2->nlabels[i]) {
+              errs++;
+              continue;
+            }
+            for (j = 0; j < gc1->nlabels[i]; j++)
+              errs += (gc1->labels[i][j] != gc2->labels[i][j] || gc1->label_priors[i][j] != gc2->label_priors[i][j]);
+          }
+        }
+      }
+  for (x = 0; x < gca1->prior_width; x++)
+    for (y = 0; y < gca1->prior_height; y++)
+      for (z = 0; z < gca1->prior_depth; z++) {
+        GCA_PRIOR *gcap1 = &gca1->priors[x][y][z], *gcap2 = &gca2->priors[x][y][z];
+        if (gcap1->nlabels != gcap2->nlabels || gcap1->total_training != gcap2->total_training) {
+          errs++;
+          continue;
+        }
+        for (n = 0; n < gcap1->nlabels; n++)
+          errs += (gcap1->labels[n] != gcap2->labels[n] || gcap1->priors[n] != gcap2->priors[n]);
+      }
+  return (errs);
+}
+
+static int check(int ninputs, int flags)
+{
+  GCA *gca, *gca_read, *gca_flat;
+  struct timeb then;
+  int errs, read_msec, flat_msec;
+
+  gca = make_gca(ninputs, flags);
+  if (GCAwrite(gca, "gcaflattest.gca") != NO_ERROR || GCAwrite(gca, "gcaflattest.gcaf") != NO_ERROR) return (1);
+  TimerStart(&then);
+  gca_read = GCAread("gcaflattest.gca");
+  read_msec = TimerStop(&then);
+  TimerStart(&then);
+  gca_flat = GCAread("gcaflattest.gcaf");
+  flat_msec = TimerStop(&then);
+  if (gca_read == NULL || gca_flat == NULL) return (1);
+
+  errs = compare(gca_read, gca_flat);
+  errs += (gca_flat->flat == NULL || !GCAisFlat("gcaflattest.gcaf") || GCAisFlat("gcaflattest.gca"));
+  printf("ninputs %d flags %x: gca %d ms, flat %d ms, mismatches %d\n", ninputs, flags, read_msec, flat_msec, errs);
+
+  /* a flat atlas can be changed and freed like any other */
+  gca_flat->nodes[1][1][1].gcs[0].means[0] = 1;
+  GCAfreeGibbs(gca_flat);
+
+  GCAfree(&gca_flat);
+  GCAfree(&gca_read);
+  GCAfree(&gca);
+  unlink("gcaflattest.gca");
+  unlink("gcaflattest.gcaf");
+  return (errs);
+}
+
+int main(int argc, char *argv[])
+{
+  int errs = 0;
+
+  setRandomSeed(1);
+  errs += check(1, GCA_NO_MRF);
+  errs += check(1, 0);
+  errs += check(2, GCA_NO_MRF);
+  errs += check(2, 0);
+
+  if (errs) printf("test_gcaflat: %d failures\n", errs);
+  exit(errs ? 1 : 0);
+}
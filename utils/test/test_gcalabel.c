@@ -0,0 +1,177 @@
+/**
+ * @file  test_gcalabel.c
+ * @brief check that GCAlabel() gives the same labels as scoring each
+ *        voxel one label at a time, with one and with several inputs,
+ *        and time it
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "gca.h"
+#include "matrix.h"
+#include "mri.h"
+#include "timer.h"
+#include "transform.h"
+#include "utils.h"
+
+const char *Progname = "test_gcalabel";
+
+#define WIDTH 96
+#define NLABELS 6
+#define BIG_AND_NEGATIVE -10000000.0  // as in gca.c
+
+/* random positive definite covariances; priors that sometimes allow a
+   label the node has never seen, so that the closest one is used */
+static GCA *make_gca(int ninputs)
+{
+  GCA *gca;
+  int x, y, z, n, r, c, k, i;
+  double total;
+
+  gca = GCAalloc(ninputs, 2, 4, WIDTH, WIDTH, WIDTH, 0);
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        GCA_NODE *gcan = &gca->nodes[x][y][z];
+        gcan->nlabels = 1 + (x + 2 * y + 3 * z) % MIN(NLABELS, gcan->max_labels);
+        for (n = 0; n < gcan->nlabels; n++) {
+          GC1D *gc = &gcan->gcs[n];
+          double a[MAX_GCA_INPUTS][MAX_GCA_INPUTS];
+          gcan->labels[n] = n + 1;
+          gc->ntraining = 10;
+          for (r = 0; r < ninputs; r++) {
+            gc->means[r] = 20 + 30 * n + randomNumber(-10, 10);
+            for (c = 0; c < ninputs; c++) a[r][c] = randomNumber(-5, 5);
+          }
+          for (i = r = 0; r < ninputs; r++)
+            for (c = r; c < ninputs; c++, i++) {
+              double cov = r == c ? 10 : 0;
+              for (k = 0; k < ninputs; k++) cov += a[r][k] * a[c][k];
+              gc->covars[i] = cov;
+            }
+        }
+      }
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++) {
+        GCA_PRIOR *gcap = &gca->priors[x][y][z];
+        gcap->nlabels = 1 + (x + y + z) % MIN(NLABELS, gcap->max_labels);
+        for (total = 0, n = 0; n < gcap->nlabels; n++) {
+          gcap->labels[n] = n + 1;
+          gcap->priors[n] = randomNumber(0.01, 1);
+          total += gcap->priors[n];
+        }
+        for (n = 0; n < gcap->nlabels; n++) gcap->priors[n] /= total;
+      }
+  GCAbuildGaussianCache(gca);
+  // a stale cache is not used
+  if (ninputs > 1) gca->nodes[3][4][5].gcs[0].covars[0] += 1;
+  return (gca);
+}
+
+/* one voxel and one label at a time */
+static MRI *label_voxelwise(MRI *mri_inputs, GCA *gca, TRANSFORM *transform)
+{
+  MRI *mri_dst;
+  GCA_PRIOR *gcap;
+  GC1D *gc;
+  int x, y, z, n, xn, yn, zn, label;
+  float vals[MAX_GCA_INPUTS], max_p, p;
+
+  mri_dst = MRIalloc(mri_inputs->width, mri_inputs->height, mri_inputs->depth, MRI_INT);
+  MRIcopyHeader(mri_inputs, mri_dst);
+  for (x = 0; x < mri_inputs->width; x++)
+    for (y = 0; y < mri_inputs->height; y++)
+      for (z = 0; z < mri_inputs->depth; z++) {
+        if (GCAsourceVoxelToNode(gca, mri_inputs, transform, x, y, z, &xn, &yn, &zn)) continue;
+        load_vals(mri_inputs, x, y, z, vals, gca->ninputs);
+        gcap = getGCAP(gca, mri_inputs, transform, x, y, z);
+        if (gcap == NULL) continue;
+        label = 0;
+        max_p = 2 * GIBBS_NEIGHBORS * BIG_AND_NEGATIVE;
+        for (n = 0; n < gcap->nlabels; n++) {
+          gc = GCAfindGC(gca, xn, yn, zn, gcap->labels[n]);
+          if (gc == NULL) gc = GCAfindClosestValidGC(gca, xn, yn, zn, gcap->labels[n], 0);
+          if (gc == NULL) continue;
+          p = GCAcomputeConditionalLogDensity(gc, vals, gca->ninputs, gcap->labels[n]) + log(gcap->priors[n]);
+          if (p > max_p) {
+            max_p = p;
+            label = gcap->labels[n];
+          }
+        }
+        MRIsetVoxVal(mri_dst, x, y, z, 0, label);
+      }
+  return (mri_dst);
+}
+
+static int check(int ninputs)
+{
+  GCA *gca;
+  MRI *mri_inputs, *mri_ref, *mri_new;
+  TRANSFORM *transform;
+  struct timeb then;
+  int x, y, z, f, ndiff = 0, ref_msec, new_msec;
+
+  gca = make_gca(ninputs);
+  mri_inputs = MRIallocSequence(WIDTH, WIDTH, WIDTH, MRI_FLOAT, ninputs);
+  for (f = 0; f < ninputs; f++)
+    for (z = 0; z < WIDTH; z++)
+      for (y = 0; y < WIDTH; y++)
+        for (x = 0; x < WIDTH; x++)
+          MRIFseq_vox(mri_inputs, x, y, z, f) = 20 + 30 * ((x / 7 + y / 5 + z / 3) % NLABELS) + randomNumber(-20, 20);
+  transform = TransformAlloc(LINEAR_VOX_TO_VOX, NULL);
+
+  TimerStart(&then);
+  mri_ref = label_voxelwise(mri_inputs, gca, transform);
+  ref_msec = TimerStop(&then);
+  TimerStart(&then);
+  mri_new = GCAlabel(mri_inputs, gca, NULL, transform);
+  new_msec = TimerStop(&then);
+
+  for (z = 0; z < WIDTH; z++)
+    for (y = 0; y < WIDTH; y++)
+      for (x = 0; x < WIDTH; x++)
+        if (MRIgetVoxVal(mri_ref, x, y, z, 0) != MRIgetVoxVal(mri_new, x, y, z, 0)) ndiff++;
+  printf("%d inputs, %d^3: voxel by voxel %d ms, GCAlabel %d ms, %d labels differ\n",
+         ninputs,
+         WIDTH,
+         ref_msec,
+         new_msec,
+         ndiff);
+
+  MRIfree(&mri_new);
+  MRIfree(&mri_ref);
+  MRIfree(&mri_inputs);
+  TransformFree(&transform);
+  GCAfree(&gca);
+  return (ndiff > 0);
+}
+
+int main(int argc, char *argv[])
+{
+  int errs = 0;
+
+  setRandomSeed(7);
+  errs += check(1);
+  errs += check(3);
+  if (errs) printf("test_gcalabel: %d failures\n", errs);
+  exit(errs ? 1 : 0);
+}
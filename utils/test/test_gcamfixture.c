@@ -0,0 +1,81 @@
+/**
+ * @file  test_gcamfixture.c
+ * @brief the morph, images and weights that the GCA morph tests share
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <string.h>
+
+#include "gca.h"
+#include "test_gcamfixture.h"
+#include "utils.h"
+
+/* a morph that has been moved around a bit from where its areas were stored,
+   with some invalid, unknown and ignored nodes, and some without a gc */
+GCA_MORPH *make_gcam(int width, int height, int depth)
+{
+  GCA_MORPH *gcam;
+  GCA_MORPH_NODE *gcamn;
+  int x, y, z;
+
+  gcam = GCAMalloc(width, height, depth);
+  gcam->ninputs = 1;
+  gcam->exp_k = EXP_K;
+  GCAMstoreMetricProperties(gcam);
+  for (x = 0; x < width; x++)
+    for (y = 0; y < height; y++)
+      for (z = 0; z < depth; z++) {
+        gcamn = &gcam->nodes[x][y][z];
+        gcamn->x += randomNumber(-0.4, 0.4);
+        gcamn->y += randomNumber(-0.4, 0.4);
+        gcamn->z += randomNumber(-0.4, 0.4);
+        gcamn->label = ((x / 5 + y / 7 + z / 3) % NLABELS);
+        if ((x + 2 * y + 3 * z) % 17 == 0) gcamn->invalid = GCAM_POSITION_INVALID;
+        if ((x + y + z) % 23 == 0) gcamn->status = GCAM_IGNORE_LIKELIHOOD;
+        if ((x * y + z) % 5) {
+          gcamn->gc = alloc_gcs(1, GCA_NO_MRF, gcam->ninputs);
+          gcamn->gc->means[0] = 30 * (gcamn->label + 1) + randomNumber(-5, 5);
+          gcamn->gc->covars[0] = randomNumber(10, 100);
+        }
+      }
+  // a fold, so that some areas are negative
+  gcam->nodes[width / 2][height / 2][depth / 2].x += 1.5;
+  return (gcam);
+}
+
+MRI *make_image(int width, int period)
+{
+  MRI *mri;
+  int x, y, z;
+
+  mri = MRIalloc(width, width, width, MRI_FLOAT);
+  for (x = 0; x < width; x++)
+    for (y = 0; y < width; y++)
+      for (z = 0; z < width; z++)
+        MRIFvox(mri, x, y, z) = 30 * (1 + (x / period + y / 7 + z / 3) % NLABELS) + randomNumber(-10, 10);
+  return (mri);
+}
+
+/* the log-likelihood, smoothness and Jacobian terms, which can be fused */
+void set_parms(GCA_MORPH_PARMS *parms)
+{
+  memset(parms, 0, sizeof(*parms));
+  parms->l_log_likelihood = 0.2;
+  parms->l_smoothness = 2;
+  parms->l_jacobian = 1;
+  parms->ratio_thresh = 0.25;
+}
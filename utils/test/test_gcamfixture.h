@@ -0,0 +1,33 @@
+/**
+ * @file  test_gcamfixture.h
+ * @brief the morph, images and weights that the GCA morph tests share
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#ifndef TEST_GCAMFIXTURE_H
+#define TEST_GCAMFIXTURE_H
+
+#include "gcamorph.h"
+#include "mri.h"
+
+#define NLABELS 4
+
+GCA_MORPH *make_gcam(int width, int height, int depth);
+MRI *make_image(int width, int period);
+void set_parms(GCA_MORPH_PARMS *parms);
+
+#endif
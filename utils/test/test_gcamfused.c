@@ -0,0 +1,150 @@
+/**
+ * @file  test_gcamfused.c
+ * @brief check that gcamFusedTerms() and gcamFusedEnergies() give the
+ *        gradient and energies of the log-likelihood, smoothness and
+ *        Jacobian terms that the separate term and energy functions give,
+ *        and time both
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+#include "error.h"
+#include "gcamorph.h"
+#include "mri.h"
+#include "test_gcamfixture.h"
+#include "timer.h"
+#include "utils.h"
+
+const char *Progname = "test_gcamfused";
+
+#define WIDTH 48
+
+/* the three terms one after another, as gcamComputeGradient() runs them */
+static void separate_terms(GCA_MORPH *gcam, MRI *mri, MRI *mri_smooth, GCA_MORPH_PARMS *parms)
+{
+  gcamLogLikelihoodTerm(gcam, mri, mri_smooth, parms->l_log_likelihood);
+  gcamSmoothnessTerm(gcam, mri, parms->l_smoothness);
+  gcamJacobianTerm(gcam, mri, parms->l_jacobian, parms->ratio_thresh);
+}
+
+/* something already in the gradient, as the label term leaves */
+static void start_gradient(GCA_MORPH *gcam)
+{
+  int i;
+
+  gcamClearGradient(gcam);
+  for (i = 0; i < GCAM_NNODES(gcam); i++) GCAM_NODE(gcam, i)->dx = 0.01 * (i % 7);
+}
+
+static int compare_energy(double e1, double e2, double tol, const char *name)
+{
+  double diff = fabs(e1 - e2) / MAX(fabs(e1), 1e-10);
+
+  printf("%s energy: separate %f, fused %f, relative difference %g\n", name, e1, e2, diff);
+  return (diff > tol);
+}
+
+int main(int argc, char *argv[])
+{
+  GCA_MORPH *gcam;
+  GCA_MORPH_NODE *gcamn;
+  GCA_MORPH_PARMS parms;
+  MRI *mri, *mri_smooth;
+  struct timeb then;
+  int i, nnodes, ndiff, errs = 0, separate_msec, fused_msec;
+  float *grad;
+  double ll, s, j, fll, fs, fj, fll1, fs1, fj1, sse, fused_sse;
+
+  setRandomSeed(3);
+#ifdef HAVE_OPENMP
+  omp_set_num_threads(4);
+#endif
+  gcam = make_gcam(WIDTH, WIDTH, WIDTH);
+  mri = make_image(WIDTH, 5);
+  mri_smooth = make_image(WIDTH, 6);
+  set_parms(&parms);
+  gcamComputeMetricProperties(gcam);
+  nnodes = GCAM_NNODES(gcam);
+  grad = (float *)calloc(3 * nnodes, sizeof(float));
+
+  start_gradient(gcam);
+  TimerStart(&then);
+  separate_terms(gcam, mri, mri_smooth, &parms);
+  separate_msec = TimerStop(&then);
+  for (i = 0; i < nnodes; i++) {
+    gcamn = GCAM_NODE(gcam, i);
+    grad[3 * i] = gcamn->dx;
+    grad[3 * i + 1] = gcamn->dy;
+    grad[3 * i + 2] = gcamn->dz;
+  }
+
+  // each node's terms are summed in the same order, so the same gradient
+  start_gradient(gcam);
+  TimerStart(&then);
+  gcamFusedTerms(gcam, mri, mri_smooth, &parms);
+  fused_msec = TimerStop(&then);
+  for (ndiff = 0, i = 0; i < nnodes; i++) {
+    gcamn = GCAM_NODE(gcam, i);
+    if (grad[3 * i] != gcamn->dx || grad[3 * i + 1] != gcamn->dy || grad[3 * i + 2] != gcamn->dz) ndiff++;
+  }
+  if (ndiff) errs++;
+  printf("%d^3 gradient: separate terms %d ms, fused %d ms, %d nodes differ\n", WIDTH, separate_msec, fused_msec, ndiff);
+
+  TimerStart(&then);
+  ll = gcamLogLikelihoodEnergy(gcam, mri);
+  s = gcamSmoothnessEnergy(gcam, mri);
+  j = gcamJacobianEnergy(gcam, mri);
+  separate_msec = TimerStop(&then);
+  TimerStart(&then);
+  gcamFusedEnergies(gcam, mri, &fll, &fs, &fj);
+  fused_msec = TimerStop(&then);
+  printf("%d^3 energies: separate %d ms, fused %d ms\n", WIDTH, separate_msec, fused_msec);
+  // the log-likelihood and Jacobian planes are summed the same way, the
+  // smoothness energy in slabs that depend on the number of threads
+  errs += compare_energy(ll, fll, 0, "log-likelihood");
+  errs += compare_energy(s, fs, 1e-12, "smoothness");
+  errs += compare_energy(j, fj, 0, "Jacobian");
+
+#ifdef HAVE_OPENMP
+  omp_set_num_threads(1);
+#endif
+  gcamFusedEnergies(gcam, mri, &fll1, &fs1, &fj1);
+  if (fll1 != fll || fs1 != fs || fj1 != fj) {
+    printf("fused energies differ with one thread\n");
+    errs++;
+  }
+
+  // and through gcamComputeSSE
+  sse = gcamComputeSSE(gcam, mri, &parms);
+  gcam_fused_terms = 1;
+  fused_sse = gcamComputeSSE(gcam, mri, &parms);
+  gcam_fused_terms = 0;
+  errs += compare_energy(sse, fused_sse, 1e-12, "gcamComputeSSE");
+
+  free(grad);
+  MRIfree(&mri_smooth);
+  MRIfree(&mri);
+  GCAMfree(&gcam);
+  if (errs) printf("test_gcamfused: %d failures\n", errs);
+  exit(errs ? 1 : 0);
+}
@@ -0,0 +1,164 @@
+/**
+ * @file  test_gcamnodes.c
+ * @brief check that the nodes of a GCA_MORPH are one block that the
+ *        linear node loops (gcamApplyGradient, gcamUndoGradient,
+ *        GCAMcopyNodePositions) walk the same as nodes[x][y][z], and report
+ *        the node size and the memory of a 256^3 morph
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "gcamorph.h"
+#include "test_gcamfixture.h"
+#include "timer.h"
+#include "utils.h"
+
+const char *Progname = "test_gcamnodes";
+
+#define STEP_DT 0.7
+#define STEP_MOMENTUM 0.5
+
+/* what gcamApplyGradient() does to a node, one node at a time */
+static void apply_gradient(GCA_MORPH *gcam)
+{
+  int x, y, z;
+  float dx, dy, dz, dt = STEP_DT, momentum = STEP_MOMENTUM;
+  GCA_MORPH_NODE *gcamn;
+
+  for (x = 0; x < gcam->width; x++)
+    for (y = 0; y < gcam->height; y++)
+      for (z = 0; z < gcam->depth; z++) {
+        gcamn = &gcam->nodes[x][y][z];
+        if (gcamn->invalid == GCAM_POSITION_INVALID) continue;
+        dx = gcamn->dx * dt + gcamn->odx * momentum;
+        dy = gcamn->dy * dt + gcamn->ody * momentum;
+        dz = gcamn->dz * dt + gcamn->odz * momentum;
+        gcamn->odx = dx;
+        gcamn->ody = dy;
+        gcamn->odz = dz;
+        gcamn->x += dx;
+        gcamn->y += dy;
+        gcamn->z += dz;
+      }
+}
+
+static int compare(GCA_MORPH *gcam1, GCA_MORPH *gcam2, const char *name)
+{
+  int x, y, z, ndiff = 0;
+  GCA_MORPH_NODE *gcamn1, *gcamn2;
+
+  for (x = 0; x < gcam1->width; x++)
+    for (y = 0; y < gcam1->height; y++)
+      for (z = 0; z < gcam1->depth; z++) {
+        gcamn1 = &gcam1->nodes[x][y][z];
+        gcamn2 = &gcam2->nodes[x][y][z];
+        if (gcamn1->x != gcamn2->x || gcamn1->y != gcamn2->y || gcamn1->z != gcamn2->z ||
+            gcamn1->odx != gcamn2->odx || gcamn1->ody != gcamn2->ody || gcamn1->odz != gcamn2->odz ||
+            gcamn1->xs2 != gcamn2->xs2)
+          ndiff++;
+      }
+  printf("%s: %d nodes differ\n", name, ndiff);
+  return (ndiff > 0);
+}
+
+/* the shared morph, with a gradient and momentum at every node */
+static GCA_MORPH *make_moving_gcam(int width, int height, int depth)
+{
+  GCA_MORPH *gcam;
+  GCA_MORPH_NODE *gcamn;
+  int i;
+
+  gcam = make_gcam(width, height, depth);
+  for (i = 0; i < GCAM_NNODES(gcam); i++) {
+    gcamn = GCAM_NODE(gcam, i);
+    gcamn->dx = randomNumber(-1, 1);
+    gcamn->dy = randomNumber(-1, 1);
+    gcamn->dz = randomNumber(-1, 1);
+    gcamn->odx = randomNumber(-1, 1);
+    gcamn->ody = randomNumber(-1, 1);
+    gcamn->odz = randomNumber(-1, 1);
+  }
+  return (gcam);
+}
+
+int main(int argc, char *argv[])
+{
+  GCA_MORPH *gcam, *gcam_ref;
+  GCA_MORPH_PARMS parms;
+  struct timeb then;
+  int x, y, z, i, errs = 0, ref_msec, linear_msec;
+  int width = 67, height = 71, depth = 59;
+
+  // the nodes are in one block, z fastest
+  gcam = GCAMalloc(width, height, depth);
+  for (x = 0; x < width; x++)
+    for (y = 0; y < height; y++)
+      for (z = 0; z < depth; z++)
+        if (&gcam->nodes[x][y][z] != GCAM_NODE(gcam, GCAM_NODE_INDEX(gcam, x, y, z)) ||
+            gcam->nodes[x][y][z].x != x || gcam->nodes[x][y][z].origz != z)
+          errs++;
+  if (errs) printf("nodes[x][y][z] is not GCAM_NODE(gcam, GCAM_NODE_INDEX(gcam, x, y, z))\n");
+  GCAMfree(&gcam);
+
+  setRandomSeed(13);
+  gcam = make_moving_gcam(width, height, depth);
+  gcam_ref = GCAMalloc(width, height, depth);
+  memmove(gcam_ref->node_data, gcam->node_data, GCAM_NNODES(gcam) * sizeof(GCA_MORPH_NODE));
+
+  memset(&parms, 0, sizeof(parms));
+  parms.dt = STEP_DT;
+  parms.momentum = STEP_MOMENTUM;
+  TimerStart(&then);
+  apply_gradient(gcam_ref);
+  ref_msec = TimerStop(&then);
+  TimerStart(&then);
+  gcamApplyGradient(gcam, &parms);
+  linear_msec = TimerStop(&then);
+  errs += compare(gcam, gcam_ref, "gcamApplyGradient");
+
+  GCAMcopyNodePositions(gcam, CURRENT_POSITIONS, SAVED2_POSITIONS);
+  gcamUndoGradient(gcam);
+  gcamClearMomentum(gcam);
+  GCAMcopyNodePositions(gcam, SAVED2_POSITIONS, CURRENT_POSITIONS);
+  for (x = 0; x < width; x++)
+    for (y = 0; y < height; y++)
+      for (z = 0; z < depth; z++) {
+        GCA_MORPH_NODE *gcamn = &gcam_ref->nodes[x][y][z];
+        gcamn->xs2 = gcamn->x;
+        gcamn->odx = gcamn->ody = gcamn->odz = 0;
+      }
+  errs += compare(gcam, gcam_ref, "GCAMcopyNodePositions");
+
+  printf("%d bytes per node, %2.0f MB for a 256^3 morph; apply gradient to %d nodes: nodes[x][y][z] %d ms, linear %d ms\n",
+         (int)sizeof(GCA_MORPH_NODE),
+         256.0 * 256 * 256 * sizeof(GCA_MORPH_NODE) / (1024 * 1024),
+         GCAM_NNODES(gcam),
+         ref_msec,
+         linear_msec);
+
+  // the copy shares the gcs of the morph it was copied from
+  for (i = 0; i < GCAM_NNODES(gcam_ref); i++) GCAM_NODE(gcam_ref, i)->gc = NULL;
+  GCAMfree(&gcam_ref);
+  GCAMfree(&gcam);
+  if (errs) printf("test_gcamnodes: %d failures\n", errs);
+  exit(errs ? 1 : 0);
+}
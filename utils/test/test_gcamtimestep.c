@@ -0,0 +1,146 @@
+/**
+ * @file  test_gcamtimestep.c
+ * @brief check that gcamFindOptimalTimeStep() picks the same time step
+ *        trying each one on saved positions, and sweeping several at once
+ *        with the fused energies, as it does applying and undoing each
+ *        one, that it leaves the positions where they were, and time them.
+ *        Pass a width (e.g. 96) to time a morph that does not fit in cache;
+ *        the default is 48.
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+#include "error.h"
+#include "gcamorph.h"
+#include "mri.h"
+#include "test_gcamfixture.h"
+#include "timer.h"
+#include "utils.h"
+
+const char *Progname = "test_gcamtimestep";
+
+#define WIDTH 48
+
+/* the time step, and the number of nodes not back where they started */
+static double find_dt(
+    GCA_MORPH *gcam, MRI *mri, GCA_MORPH_PARMS *parms, int overlay, int sweep, int *pmoved, int *pmsec)
+{
+  struct timeb then;
+  double dt;
+  int i, moved = 0;
+  GCA_MORPH_NODE *gcamn;
+  GCAM_REAL *x = (GCAM_REAL *)calloc(3 * GCAM_NNODES(gcam), sizeof(GCAM_REAL));
+
+  for (i = 0; i < GCAM_NNODES(gcam); i++) {
+    gcamn = GCAM_NODE(gcam, i);
+    x[3 * i] = gcamn->x;
+    x[3 * i + 1] = gcamn->y;
+    x[3 * i + 2] = gcamn->z;
+  }
+  gcam_timestep_overlay = overlay;
+  gcam_timestep_sweep = sweep;
+  TimerStart(&then);
+  dt = gcamFindOptimalTimeStep(gcam, parms, mri);
+  *pmsec = TimerStop(&then);
+  gcam_timestep_overlay = gcam_timestep_sweep = 1;
+  for (i = 0; i < GCAM_NNODES(gcam); i++) {
+    gcamn = GCAM_NODE(gcam, i);
+    if (gcamn->x != x[3 * i] || gcamn->y != x[3 * i + 1] || gcamn->z != x[3 * i + 2]) moved++;
+    // the next search starts from the same place
+    gcamn->x = x[3 * i];
+    gcamn->y = x[3 * i + 1];
+    gcamn->z = x[3 * i + 2];
+  }
+  *pmoved = moved;
+  free(x);
+  return (dt);
+}
+
+static int check(GCA_MORPH *gcam, MRI *mri, MRI *mri_smooth, GCA_MORPH_PARMS *parms, double scale)
+{
+  int i, moved, overlay_moved, sweep_moved, msec, overlay_msec, sweep_msec;
+  double dt, overlay_dt, sweep_dt;
+
+  gcamClearGradient(gcam);
+  gcamComputeMetricProperties(gcam);
+  gcamFusedTerms(gcam, mri, mri_smooth, parms);
+  for (i = 0; i < GCAM_NNODES(gcam); i++) {
+    GCAM_NODE(gcam, i)->dx *= scale;
+    GCAM_NODE(gcam, i)->dy *= scale;
+    GCAM_NODE(gcam, i)->dz *= scale;
+  }
+
+  dt = find_dt(gcam, mri, parms, 0, 0, &moved, &msec);
+  overlay_dt = find_dt(gcam, mri, parms, 1, 0, &overlay_moved, &overlay_msec);
+  sweep_dt = find_dt(gcam, mri, parms, 1, 1, &sweep_moved, &sweep_msec);
+  printf("gradient x %g: apply and undo dt %g (%d ms, %d nodes moved), saved positions dt %g (%d ms, %d nodes moved), "
+         "swept dt %g (%d ms, %d nodes moved)\n",
+         scale,
+         dt,
+         msec,
+         moved,
+         overlay_dt,
+         overlay_msec,
+         overlay_moved,
+         sweep_dt,
+         sweep_msec,
+         sweep_moved);
+#ifdef GCAM_SINGLE_PRECISION
+  // float positions lose enough when each step is undone that the
+  // search can land elsewhere, which is why the steps are tried on
+  // saved positions
+  dt = overlay_dt;
+#endif
+  return (dt != overlay_dt || overlay_dt != sweep_dt || overlay_moved > 0 || sweep_moved > 0);
+}
+
+int main(int argc, char *argv[])
+{
+  GCA_MORPH *gcam;
+  GCA_MORPH_PARMS parms;
+  MRI *mri, *mri_smooth;
+  int width, errs = 0;
+
+  width = argc > 1 ? atoi(argv[1]) : WIDTH;
+  setRandomSeed(17);
+  gcam = make_gcam(width, width, width);
+  mri = make_image(width, 5);
+  mri_smooth = make_image(width, 6);
+  set_parms(&parms);
+  parms.dt = 0.05;
+  parms.momentum = 0.9;
+  // the sweep is only used with the fused energies
+  gcam_fused_terms = 1;
+
+  errs += check(gcam, mri, mri_smooth, &parms, 1);
+  // steps small enough to lose bits when they are undone
+  errs += check(gcam, mri, mri_smooth, &parms, 1e-6);
+  parms.noneg = True;
+  errs += check(gcam, mri, mri_smooth, &parms, 1);
+
+  MRIfree(&mri_smooth);
+  MRIfree(&mri);
+  GCAMfree(&gcam);
+  if (errs) printf("test_gcamtimestep: %d failures\n", errs);
+  exit(errs ? 1 : 0);
+}
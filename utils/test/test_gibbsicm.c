@@ -0,0 +1,189 @@
+/**
+ * @file  test_gibbsicm.c
+ * @brief check that GCAreclassifyUsingGibbsPriors() in checkerboard order
+ *        gives the same labels with any number of threads, that it agrees
+ *        with the random order (Dice), and time both
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+#include "error.h"
+#include "gca.h"
+#include "mri.h"
+#include "timer.h"
+#include "transform.h"
+#include "utils.h"
+
+const char *Progname = "test_gibbsicm";
+
+#define WIDTH 64
+#define NLABELS 5
+#define MIN_DICE 0.9
+
+/* labels in blocks, with neighbors that mostly have the same label */
+static GCA *make_gca(void)
+{
+  GCA *gca;
+  int x, y, z, n, i, j;
+  double total;
+
+  gca = GCAalloc(1, 2, 4, WIDTH, WIDTH, WIDTH, 0);
+  for (x = 0; x < gca->node_width; x++)
+    for (y = 0; y < gca->node_height; y++)
+      for (z = 0; z < gca->node_depth; z++) {
+        GCA_NODE *gcan = &gca->nodes[x][y][z];
+        gcan->nlabels = MIN(NLABELS, gcan->max_labels);
+        gcan->total_training = 10 * gcan->nlabels;
+        for (n = 0; n < gcan->nlabels; n++) {
+          GC1D *gc = &gcan->gcs[n];
+          gcan->labels[n] = n + 1;
+          gc->ntraining = 10;
+          gc->means[0] = 20 + 30 * n + randomNumber(-5, 5);
+          gc->covars[0] = 150 + randomNumber(-50, 50);
+          for (i = 0; i < GIBBS_NEIGHBORS; i++) {
+            gc->nlabels[i] = NLABELS;
+            gc->labels[i] = (unsigned short *)calloc(NLABELS, sizeof(unsigned short));
+            gc->label_priors[i] = (float *)calloc(NLABELS, sizeof(float));
+            for (total = 0, j = 0; j < NLABELS; j++) {
+              gc->labels[i][j] = j + 1;
+              gc->label_priors[i][j] = j == n ? 0.8 : randomNumber(0, 0.1);
+              total += gc->label_priors[i][j];
+            }
+            for (j = 0; j < NLABELS; j++) gc->label_priors[i][j] /= total;
+          }
+        }
+      }
+  for (x = 0; x < gca->prior_width; x++)
+    for (y = 0; y < gca->prior_height; y++)
+      for (z = 0; z < gca->prior_depth; z++) {
+        GCA_PRIOR *gcap = &gca->priors[x][y][z];
+        gcap->nlabels = MIN(NLABELS, gcap->max_labels);
+        gcap->total_training = 10;
+        for (total = 0, n = 0; n < gcap->nlabels; n++) {
+          gcap->labels[n] = n + 1;
+          gcap->priors[n] = randomNumber(0.1, 1);
+          total += gcap->priors[n];
+        }
+        for (n = 0; n < gcap->nlabels; n++) gcap->priors[n] /= total;
+      }
+  GCAbuildGaussianCache(gca);
+  return (gca);
+}
+
+static double dice(MRI *mri1, MRI *mri2, int label)
+{
+  int x, y, z, n1 = 0, n2 = 0, n12 = 0, in1, in2;
+
+  for (z = 0; z < mri1->depth; z++)
+    for (y = 0; y < mri1->height; y++)
+      for (x = 0; x < mri1->width; x++) {
+        in1 = nint(MRIgetVoxVal(mri1, x, y, z, 0)) == label;
+        in2 = nint(MRIgetVoxVal(mri2, x, y, z, 0)) == label;
+        n1 += in1;
+        n2 += in2;
+        n12 += in1 && in2;
+      }
+  return (n1 + n2 > 0 ? 2.0 * n12 / (n1 + n2) : 1);
+}
+
+static MRI *relabel(MRI *mri_inputs, GCA *gca, MRI *mri_labels, TRANSFORM *transform, int checkerboard, int *pmsec)
+{
+  MRI *mri_dst;
+  struct timeb then;
+
+  mri_dst = MRIcopy(mri_labels, NULL);
+  gca_icm_checkerboard = checkerboard;
+  TimerStart(&then);
+  GCAreclassifyUsingGibbsPriors(mri_inputs, gca, mri_dst, transform, 10, NULL, 0, NULL, 0.5, 1);
+  *pmsec = TimerStop(&then);
+  gca_icm_checkerboard = 0;
+  return (mri_dst);
+}
+
+int main(int argc, char *argv[])
+{
+  GCA *gca;
+  MRI *mri_inputs, *mri_labels, *mri_random, *mri_board, *mri_board1;
+  TRANSFORM *transform;
+  int x, y, z, label, ndiff, errs = 0, random_msec, board_msec, board1_msec;
+  double d, min_dice = 1, ll_labels, ll_random, ll_board;
+
+  setRandomSeed(5);
+  gca = make_gca();
+  mri_inputs = MRIalloc(WIDTH, WIDTH, WIDTH, MRI_FLOAT);
+  for (z = 0; z < WIDTH; z++)
+    for (y = 0; y < WIDTH; y++)
+      for (x = 0; x < WIDTH; x++)
+        MRIFvox(mri_inputs, x, y, z) = 20 + 30 * ((x / 9 + y / 7 + z / 5) % NLABELS) + randomNumber(-25, 25);
+  transform = TransformAlloc(LINEAR_VOX_TO_VOX, NULL);
+  mri_labels = GCAlabel(mri_inputs, gca, NULL, transform);
+
+  mri_random = relabel(mri_inputs, gca, mri_labels, transform, 0, &random_msec);
+  mri_board = relabel(mri_inputs, gca, mri_labels, transform, 1, &board_msec);
+#ifdef HAVE_OPENMP
+  omp_set_num_threads(1);
+#endif
+  mri_board1 = relabel(mri_inputs, gca, mri_labels, transform, 1, &board1_msec);
+
+  // the same labels with one thread as with many
+  for (ndiff = 0, z = 0; z < WIDTH; z++)
+    for (y = 0; y < WIDTH; y++)
+      for (x = 0; x < WIDTH; x++)
+        if (MRIgetVoxVal(mri_board, x, y, z, 0) != MRIgetVoxVal(mri_board1, x, y, z, 0)) ndiff++;
+  if (ndiff) errs++;
+
+  for (label = 1; label <= NLABELS; label++) {
+    d = dice(mri_random, mri_board, label);
+    printf("label %d: Dice %2.4f\n", label, d);
+    min_dice = MIN(min_dice, d);
+  }
+  if (min_dice < MIN_DICE) errs++;
+
+  // both should do better than the labels they started from
+  ll_labels = GCAgibbsImageLogPosterior(gca, mri_labels, mri_inputs, transform, 1);
+  ll_random = GCAgibbsImageLogPosterior(gca, mri_random, mri_inputs, transform, 1);
+  ll_board = GCAgibbsImageLogPosterior(gca, mri_board, mri_inputs, transform, 1);
+  if (ll_random < ll_labels || ll_board < ll_labels) errs++;
+
+  printf("%d^3: random order %d ms, checkerboard %d ms (%d ms with one thread), %d labels differ by threads, "
+         "min Dice %2.4f, ll %2.3f -> %2.3f (random), %2.3f (checkerboard)\n",
+         WIDTH,
+         random_msec,
+         board_msec,
+         board1_msec,
+         ndiff,
+         min_dice,
+         ll_labels / (WIDTH * WIDTH * WIDTH),
+         ll_random / (WIDTH * WIDTH * WIDTH),
+         ll_board / (WIDTH * WIDTH * WIDTH));
+
+  MRIfree(&mri_board1);
+  MRIfree(&mri_board);
+  MRIfree(&mri_random);
+  MRIfree(&mri_labels);
+  MRIfree(&mri_inputs);
+  TransformFree(&transform);
+  GCAfree(&gca);
+  if (errs) printf("test_gibbsicm: %d failures\n", errs);
+  exit(errs ? 1 : 0);
+}
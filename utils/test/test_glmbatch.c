@@ -0,0 +1,162 @@
+/**
+ * @file  test_glmbatch.c
+ * @brief check that MRIglmFitAndTest() gives the same outputs when it
+ *        fits a shared design many voxels at a time as when it fits one
+ *        voxel at a time, and time both
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "fmriutils.h"
+#include "fsglm.h"
+#include "matrix.h"
+#include "mri.h"
+#include "timer.h"
+#include "utils.h"
+
+const char *Progname = "test_glmbatch";
+
+#define NREG 4
+
+static MRIGLM *make_glm(MRI *y, MATRIX *Xg, MRI *mask, int pervox)
+{
+  MRIGLM *mriglm;
+  GLMMAT *glm;
+
+  mriglm = (MRIGLM *)calloc(sizeof(MRIGLM), 1);
+  mriglm->y = y;
+  mriglm->Xg = Xg;
+  mriglm->mask = mask;
+  mriglm->yhatsave = 1;
+  mriglm->condsave = 1;
+  // a frame mask that keeps every frame forces the voxel by voxel fit
+  if (pervox) {
+    mriglm->FrameMask = MRIallocSequence(y->width, y->height, y->depth, MRI_FLOAT, y->nframes);
+    MRIconst(y->width, y->height, y->depth, y->nframes, 1, mriglm->FrameMask);
+  }
+
+  glm = mriglm->glm = GLMalloc();
+  glm->DoPCC = 1;
+  glm->X = MatrixCopy(Xg, NULL);
+  glm->ncontrasts = 3;
+  // a t-test with a partial correlation
+  glm->C[0] = MatrixConstVal(0, 1, NREG, NULL);
+  glm->C[0]->rptr[1][2] = 1;
+  // an F-test
+  glm->C[1] = MatrixConstVal(0, 2, NREG, NULL);
+  glm->C[1]->rptr[1][3] = 1;
+  glm->C[1]->rptr[2][4] = 1;
+  // a difference against a nonzero expected value
+  glm->C[2] = MatrixConstVal(0, 1, NREG, NULL);
+  glm->C[2]->rptr[1][2] = 1;
+  glm->C[2]->rptr[1][3] = -1;
+  glm->UseGamma0[2] = 1;
+  glm->gamma0[2] = MatrixConstVal(0.5, 1, 1, NULL);
+  return (mriglm);
+}
+
+static int compare(MRI *mri1, MRI *mri2, const char *name)
+{
+  int c, r, s, f, errs = 0;
+
+  for (f = 0; f < mri1->nframes; f++)
+    for (s = 0; s < mri1->depth; s++)
+      for (r = 0; r < mri1->height; r++)
+        for (c = 0; c < mri1->width; c++)
+          // the constant voxel has a 0/0 partial correlation both ways
+          if (MRIgetVoxVal(mri1, c, r, s, f) != MRIgetVoxVal(mri2, c, r, s, f) &&
+              !(isnan(MRIgetVoxVal(mri1, c, r, s, f)) && isnan(MRIgetVoxVal(mri2, c, r, s, f)))) {
+            if (errs++ < 5)
+              printf("%s (%d, %d, %d, %d): %g %g\n",
+                     name,
+                     c,
+                     r,
+                     s,
+                     f,
+                     MRIgetVoxVal(mri1, c, r, s, f),
+                     MRIgetVoxVal(mri2, c, r, s, f));
+          }
+  return (errs);
+}
+
+int main(int argc, char *argv[])
+{
+  MRIGLM *batch, *pervox;
+  MRI *y, *mask;
+  MATRIX *Xg;
+  struct timeb then;
+  int c, r, s, f, n, nf = 40, errs = 0, batch_msec, pervox_msec;
+
+  setRandomSeed(21);
+  Xg = MatrixAlloc(nf, NREG, MATRIX_REAL);
+  for (f = 1; f <= nf; f++) {
+    Xg->rptr[f][1] = 1;
+    Xg->rptr[f][2] = f % 2;
+    Xg->rptr[f][3] = randomNumber(-1, 1);
+    Xg->rptr[f][4] = sin(f / 3.0);
+  }
+
+  y = MRIallocSequence(30, 28, 26, MRI_FLOAT, nf);
+  mask = MRIalloc(y->width, y->height, y->depth, MRI_FLOAT);
+  for (s = 0; s < y->depth; s++)
+    for (r = 0; r < y->height; r++)
+      for (c = 0; c < y->width; c++) {
+        double b = c / 10.0, g = r / 20.0;
+        MRIFvox(mask, c, r, s) = (c + r + s) % 7 != 0;
+        for (f = 0; f < nf; f++)
+          MRIFseq_vox(y, c, r, s, f) = 100 + b * Xg->rptr[f + 1][2] + g * Xg->rptr[f + 1][3] + randomNumber(-1, 1);
+      }
+  // a voxel with no residual at all
+  for (f = 0; f < nf; f++) MRIFseq_vox(y, 1, 1, 1, f) = 7;
+
+  batch = make_glm(y, Xg, mask, 0);
+  TimerStart(&then);
+  MRIglmFitAndTest(batch);
+  batch_msec = TimerStop(&then);
+  pervox = make_glm(y, Xg, mask, 1);
+  TimerStart(&then);
+  MRIglmFitAndTest(pervox);
+  pervox_msec = TimerStop(&then);
+
+  errs += compare(batch->beta, pervox->beta, "beta");
+  errs += compare(batch->eres, pervox->eres, "eres");
+  errs += compare(batch->rvar, pervox->rvar, "rvar");
+  errs += compare(batch->yhat, pervox->yhat, "yhat");
+  errs += compare(batch->cond, pervox->cond, "cond");
+  for (n = 0; n < batch->glm->ncontrasts; n++) {
+    errs += compare(batch->gamma[n], pervox->gamma[n], "gamma");
+    errs += compare(batch->F[n], pervox->F[n], "F");
+    errs += compare(batch->p[n], pervox->p[n], "p");
+    errs += compare(batch->z[n], pervox->z[n], "z");
+    if (batch->gammaVar[n]) errs += compare(batch->gammaVar[n], pervox->gammaVar[n], "gammaVar");
+    if (batch->pcc[n]) errs += compare(batch->pcc[n], pervox->pcc[n], "pcc");
+    if (batch->ypmf[n]) errs += compare(batch->ypmf[n], pervox->ypmf[n], "ypmf");
+  }
+  printf("%d voxels x %d frames: batched %d ms, voxel by voxel %d ms, %d differences\n",
+         y->width * y->height * y->depth,
+         nf,
+         batch_msec,
+         pervox_msec,
+         errs);
+
+  if (errs) printf("test_glmbatch: %d failures\n", errs);
+  exit(errs ? 1 : 0);
+}
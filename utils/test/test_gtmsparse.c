@@ -0,0 +1,140 @@
+/**
+ * @file  test_gtmsparse.c
+ * @brief check the sparse GTM design matrix products (GTMsparseMtN,
+ *        GTMsparseAtB, GTMsparseMultiply) against the dense ones they
+ *        replace, and the conjugate gradient solve against the inverse
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "gtm.h"
+#include "matrix.h"
+#include "timer.h"
+#include "utils.h"
+
+const char *Progname = "test_gtmsparse";
+
+#define NROWS 20000
+#define NSEGS 150
+#define NFRAMES 3
+
+/* each column covers a band of rows, like a smoothed seg in its bounding box */
+static GTM_SPARSE *make_X(int smooth)
+{
+  GTM_SPARSE *X;
+  int c, r, r0, len;
+  long nnz;
+
+  for (nnz = 0, c = 0; c < NSEGS; c++) nnz += 200 + 40 * (c % 5) + 2 * smooth * 30;
+  X = GTMsparseAlloc(NROWS, NSEGS, nnz);
+  for (nnz = 0, c = 0; c < NSEGS; c++) {
+    X->colptr[c] = nnz;
+    len = 200 + 40 * (c % 5) + 2 * smooth * 30;
+    r0 = MAX(0, MIN(NROWS - len, (c * NROWS) / NSEGS - smooth * 30));
+    for (r = r0; r < r0 + len; r++) {
+      X->rowind[nnz] = r;
+      X->val[nnz++] = smooth ? 0.1 + randomNumber(0, 1) : 1;
+    }
+  }
+  X->colptr[NSEGS] = X->nnz = nnz;
+  return (X);
+}
+
+static int compare(MATRIX *m1, MATRIX *m2, double tol, const char *name)
+{
+  int r, c, errs = 0;
+  double diff = 0;
+
+  for (r = 1; r <= m1->rows; r++)
+    for (c = 1; c <= m1->cols; c++) diff = MAX(diff, fabs(m1->rptr[r][c] - m2->rptr[r][c]));
+  if (diff > tol) errs++;
+  printf("%s: max diff %g\n", name, diff);
+  return (errs);
+}
+
+int main(int argc, char *argv[])
+{
+  GTM_SPARSE *X, *X0;
+  MATRIX *Xd, *X0d, *X0t, *y, *beta, *betacg, *dense, *sparse, *iXtX;
+  struct timeb then;
+  int r, f, errs = 0, dense_msec, sparse_msec;
+
+  setRandomSeed(11);
+  X = make_X(1);
+  X0 = make_X(0);
+  Xd = GTMsparseToMatrix(X, NULL);
+  X0d = GTMsparseToMatrix(X0, NULL);
+  y = MatrixAlloc(NROWS, NFRAMES, MATRIX_REAL);
+  for (r = 1; r <= NROWS; r++)
+    for (f = 1; f <= NFRAMES; f++) y->rptr[r][f] = randomNumber(0, 100);
+
+  // the sparse products sum in the same order as the dense ones
+  TimerStart(&then);
+  dense = MatrixMtM(Xd, NULL);
+  dense_msec = TimerStop(&then);
+  TimerStart(&then);
+  sparse = GTMsparseMtN(X, X, NULL);
+  sparse_msec = TimerStop(&then);
+  printf("XtX: dense %d ms, sparse %d ms\n", dense_msec, sparse_msec);
+  errs += compare(dense, sparse, 0, "XtX");
+  iXtX = MatrixInverse(dense, NULL);
+  MatrixFree(&dense);
+  MatrixFree(&sparse);
+
+  X0t = MatrixTranspose(X0d, NULL);
+  dense = MatrixMultiplyD(X0t, Xd, NULL);
+  sparse = GTMsparseMtN(X0, X, NULL);
+  errs += compare(dense, sparse, 0, "X0tX");
+  MatrixFree(&dense);
+  MatrixFree(&sparse);
+
+  dense = MatrixAtB(Xd, y, NULL);
+  sparse = GTMsparseAtB(X, y, NULL);
+  errs += compare(dense, sparse, 0, "Xty");
+
+  // beta from conjugate gradients against the inverse
+  beta = MatrixMultiplyD(iXtX, dense, NULL);
+  MatrixFree(&dense);
+  dense = GTMsparseMtN(X, X, NULL);
+  betacg = MatrixAlloc(NSEGS, NFRAMES, MATRIX_REAL);
+  if (GTMsolveCG(dense, sparse, betacg, 1e-10, 10 * NSEGS)) errs++;
+  errs += compare(beta, betacg, 1e-3, "beta CG");
+  MatrixFree(&betacg);
+  MatrixFree(&dense);
+  MatrixFree(&sparse);
+
+  dense = MatrixMultiplyD(Xd, beta, NULL);
+  sparse = GTMsparseMultiply(X, beta, NULL);
+  errs += compare(dense, sparse, 0, "yhat");
+
+  MatrixFree(&dense);
+  MatrixFree(&sparse);
+  MatrixFree(&beta);
+  MatrixFree(&iXtX);
+  MatrixFree(&X0t);
+  MatrixFree(&y);
+  MatrixFree(&X0d);
+  MatrixFree(&Xd);
+  GTMsparseFree(&X0);
+  GTMsparseFree(&X);
+  if (errs) printf("test_gtmsparse: %d failures\n", errs);
+  exit(errs ? 1 : 0);
+}
@@ -0,0 +1,158 @@
+/**
+ * @file  test_mriconvolve.c
+ * @brief check the row-wise MRIconvolve1d() against a per-voxel
+ *        convolution, the recursive Gaussian against a direct one, and
+ *        time both across sigma and volume size
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "mri.h"
+#include "timer.h"
+#include "utils.h"
+
+const char *Progname = "test_mriconvolve";
+
+static MRI *make_volume(int width, int height, int depth, int type, int nframes)
+{
+  MRI *mri;
+  int x, y, z, f;
+
+  mri = MRIallocSequence(width, height, depth, type, nframes);
+  for (f = 0; f < nframes; f++)
+    for (z = 0; z < depth; z++)
+      for (y = 0; y < height; y++)
+        for (x = 0; x < width; x++)
+          MRIsetVoxVal(mri, x, y, z, f, (x / 8 + y / 8 + z / 8) % 2 ? 200 : randomNumber(0, 100));
+  return (mri);
+}
+
+/* the convolution one voxel at a time, with replicated borders */
+static double convolve_voxel(MRI *mri, float *k, int len, int axis, int x, int y, int z)
+{
+  double total = 0;
+  int i, d;
+
+  for (i = 0; i < len; i++) {
+    d = i - len / 2;
+    if (axis == MRI_WIDTH)
+      total += k[i] * MRIgetVoxVal(mri, MIN(MAX(x + d, 0), mri->width - 1), y, z, 0);
+    else if (axis == MRI_HEIGHT)
+      total += k[i] * MRIgetVoxVal(mri, x, MIN(MAX(y + d, 0), mri->height - 1), z, 0);
+    else
+      total += k[i] * MRIgetVoxVal(mri, x, y, MIN(MAX(z + d, 0), mri->depth - 1), 0);
+  }
+  return (total);
+}
+
+static int check_convolve1d(int type)
+{
+  MRI *mri, *mri_dst, *mri_kernel;
+  int axis, x, y, z, errs = 0;
+
+  mri = make_volume(37, 29, 23, type, 1);
+  mri_kernel = MRIgaussian1d(2, -1);
+  mri_dst = MRIalloc(mri->width, mri->height, mri->depth, MRI_FLOAT);
+  for (axis = MRI_WIDTH; axis <= MRI_DEPTH; axis++) {
+    MRIconvolve1d(mri, mri_dst, &MRIFvox(mri_kernel, 0, 0, 0), mri_kernel->width, axis, 0, 0);
+    for (z = 0; z < mri->depth; z++)
+      for (y = 0; y < mri->height; y++)
+        for (x = 0; x < mri->width; x++) {
+          double ref = convolve_voxel(mri, &MRIFvox(mri_kernel, 0, 0, 0), mri_kernel->width, axis, x, y, z);
+          if (fabs(ref - MRIFvox(mri_dst, x, y, z)) > 1e-3) {
+            if (errs++ < 10) printf("type %d axis %d (%d, %d, %d): %g %g\n", type, axis, x, y, z, ref, MRIFvox(mri_dst, x, y, z));
+          }
+        }
+  }
+  MRIfree(&mri_kernel);
+  MRIfree(&mri_dst);
+  MRIfree(&mri);
+  return (errs);
+}
+
+/* an untruncated Gaussian for comparison with the recursive one */
+static MRI *exact_gaussian(float sigma)
+{
+  MRI *mri;
+  int x, half = (int)ceil(5 * sigma);
+  double norm = 0;
+
+  mri = MRIalloc(2 * half + 1, 1, 1, MRI_FLOAT);
+  for (x = 0; x < mri->width; x++) norm += (MRIFvox(mri, x, 0, 0) = exp(-SQR(x - half) / (2 * SQR(sigma))));
+  for (x = 0; x < mri->width; x++) MRIFvox(mri, x, 0, 0) /= norm;
+  return (mri);
+}
+
+int main(int argc, char *argv[])
+{
+  MRI *mri, *mri_fir, *mri_iir, *mri_kernel;
+  struct timeb then;
+  int size, n, x, y, z, errs = 0, fir_msec, iir_msec;
+  float sigmas[] = {1, 2, 4, 8};
+  double max_diff;
+
+  setRandomSeed(7);
+  errs += check_convolve1d(MRI_FLOAT);
+  errs += check_convolve1d(MRI_UCHAR);
+
+  for (size = 64; size <= 256; size *= 2) {
+    mri = make_volume(size, size, size, MRI_FLOAT, 1);
+    for (n = 0; n < (int)(sizeof(sigmas) / sizeof(sigmas[0])); n++) {
+      mri_kernel = exact_gaussian(sigmas[n]);
+      TimerStart(&then);
+      mri_fir = MRIconvolveGaussian(mri, NULL, mri_kernel);
+      fir_msec = TimerStop(&then);
+      TimerStart(&then);
+      mri_iir = MRIconvolveGaussianRecursive(mri, NULL, sigmas[n]);
+      iir_msec = TimerStop(&then);
+
+      /* within 0.05% of the range of the image, at the borders too */
+      for (max_diff = 0, z = 0; z < size; z++)
+        for (y = 0; y < size; y++)
+          for (x = 0; x < size; x++) max_diff = MAX(max_diff, fabs(MRIFvox(mri_fir, x, y, z) - MRIFvox(mri_iir, x, y, z)));
+      printf("%3d^3 sigma %g: kernel %3d taps %5d ms, recursive %5d ms, max diff %2.3f\n",
+             size,
+             sigmas[n],
+             mri_kernel->width,
+             fir_msec,
+             iir_msec,
+             max_diff);
+      if (max_diff > 0.1) errs++;
+      MRIfree(&mri_kernel);
+      MRIfree(&mri_fir);
+      MRIfree(&mri_iir);
+    }
+    MRIfree(&mri);
+  }
+
+  /* a constant volume stays constant, in place, with several frames */
+  mri = MRIallocSequence(40, 30, 20, MRI_FLOAT, 2);
+  MRIsetValues(mri, 100);
+  MRIconvolveGaussianRecursive(mri, mri, 6);
+  for (n = 0; n < 2; n++)
+    for (z = 0; z < mri->depth; z++)
+      for (y = 0; y < mri->height; y++)
+        for (x = 0; x < mri->width; x++) errs += fabs(MRIFseq_vox(mri, x, y, z, n) - 100) > 1e-3;
+  MRIfree(&mri);
+
+  if (errs) printf("test_mriconvolve: %d failures\n", errs);
+  exit(errs ? 1 : 0);
+}
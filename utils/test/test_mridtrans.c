@@ -0,0 +1,178 @@
+/**
+ * @file  test_mridtrans.c
+ * @brief check the exact distance transform (MRIdistanceTransformLabels)
+ *        against brute force and against the fast marching one it replaces
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "fastmarching.h"
+#include "mri.h"
+#include "timer.h"
+#include "utils.h"
+
+const char *Progname = "test_mridtrans";
+
+#define NLABELS 3
+
+/* two blobs and a slab, with holes and a label touching the edge */
+static MRI *make_labels(int size, float xsize, float ysize, float zsize)
+{
+  MRI *mri;
+  int x, y, z;
+  double c = size / 2.0, r = size / 4.0;
+
+  mri = MRIalloc(size, size, size, MRI_FLOAT);
+  mri->xsize = xsize;
+  mri->ysize = ysize;
+  mri->zsize = zsize;
+  for (z = 0; z < size; z++)
+    for (y = 0; y < size; y++)
+      for (x = 0; x < size; x++) {
+        double d = sqrt(SQR(x - c) + SQR(y - c) + SQR(z - c));
+        int label = 0;
+        if (d < r && randomNumber(0, 1) > 0.02) label = 1;
+        if (SQR(x - c / 3) + SQR(y - c / 2) + SQR(z - c) < SQR(r / 2)) label = 2;
+        if (x > size - size / 6 && y > size / 3) label = 3;
+        MRIsetVoxVal(mri, x, y, z, 0, label);
+      }
+  return (mri);
+}
+
+/* signed distance at (x,y,z) by looking at every voxel */
+static double brute_force(MRI *mri, int label, int x, int y, int z, double half, double limit)
+{
+  int in = nint(MRIgetVoxVal(mri, x, y, z, 0)) == label, xi, yi, zi;
+  double dmin = 1e10;
+
+  for (zi = 0; zi < mri->depth; zi++)
+    for (yi = 0; yi < mri->height; yi++)
+      for (xi = 0; xi < mri->width; xi++) {
+        double d;
+        if ((nint(MRIgetVoxVal(mri, xi, yi, zi, 0)) == label) == in) continue;
+        d = SQR((xi - x) * mri->xsize) + SQR((yi - y) * mri->ysize) + SQR((zi - z) * mri->zsize);
+        if (d < dmin) dmin = d;
+      }
+  dmin = MIN(sqrt(dmin) - half, limit);
+  return (in ? -dmin : dmin);
+}
+
+static int check_brute_force(float xsize, float ysize, float zsize)
+{
+  MRI *mri, *mri_dist;
+  int labels[NLABELS] = {1, 2, 3}, x, y, z, n, errs = 0;
+  double half = 0.5 * MIN(xsize, MIN(ysize, zsize)), limit = 6 * xsize;
+
+  mri = make_labels(16, xsize, ysize, zsize);
+  mri_dist = MRIdistanceTransformLabels(mri, NULL, labels, NLABELS, 6, DTRANS_MODE_SIGNED, NULL);
+  for (n = 0; n < NLABELS; n++)
+    for (z = 0; z < mri->depth; z++)
+      for (y = 0; y < mri->height; y++)
+        for (x = 0; x < mri->width; x++) {
+          double ref = brute_force(mri, labels[n], x, y, z, half, limit);
+          if (fabs(ref - MRIgetVoxVal(mri_dist, x, y, z, n)) > 1e-4) {
+            if (errs++ < 10)
+              printf("label %d (%d, %d, %d): brute force %g, edt %g\n",
+                     labels[n],
+                     x,
+                     y,
+                     z,
+                     ref,
+                     MRIgetVoxVal(mri_dist, x, y, z, n));
+          }
+        }
+  printf("voxel size %g x %g x %g: %d differences from brute force\n", xsize, ysize, zsize, errs);
+  MRIfree(&mri_dist);
+  MRIfree(&mri);
+  return (errs);
+}
+
+int main(int argc, char *argv[])
+{
+  MRI *mri, *mri_fm, *mri_edt, *mri_all;
+  struct timeb then;
+  int labels[NLABELS] = {1, 2, 3}, x, y, z, n, mode, errs = 0, fm_msec, edt_msec, all_msec;
+  double diff, max_diff, mean_diff;
+
+  setRandomSeed(11);
+  errs += check_brute_force(1, 1, 1);
+  errs += check_brute_force(1, 1.5, 2.5);
+
+  /* against fast marching, which is close but not exact */
+  mri = make_labels(128, 1, 1, 1);
+  for (n = 0; n < NLABELS; n++) {
+    TimerStart(&then);
+    mri_fm = MRIextractDistanceMap(mri, NULL, labels[n], 10, 3, NULL);
+    fm_msec = TimerStop(&then);
+    TimerStart(&then);
+    mri_edt = MRIdistanceTransform(mri, NULL, labels[n], 10, DTRANS_MODE_SIGNED, NULL);
+    edt_msec = TimerStop(&then);
+    max_diff = mean_diff = 0;
+    for (z = 0; z < mri->depth; z++)
+      for (y = 0; y < mri->height; y++)
+        for (x = 0; x < mri->width; x++) {
+          float fm = MRIFvox(mri_fm, x, y, z), edt = MRIFvox(mri_edt, x, y, z);
+          if ((fm < 0) != (edt < 0)) errs++;
+          diff = fabs(fm - edt);
+          mean_diff += diff;
+          if (diff > max_diff) max_diff = diff;
+        }
+    mean_diff /= (mri->width * mri->height * mri->depth);
+    printf("label %d: fast marching %d ms, edt %d ms, mean diff %2.3f, max diff %2.3f\n",
+           labels[n],
+           fm_msec,
+           edt_msec,
+           mean_diff,
+           max_diff);
+    if (mean_diff > 0.1 || max_diff > 1.5) errs++;
+    MRIfree(&mri_fm);
+    MRIfree(&mri_edt);
+  }
+
+  /* all the labels at once are the same as one at a time, in every mode */
+  for (mode = DTRANS_MODE_SIGNED; mode <= DTRANS_MODE_INSIDE; mode++) {
+    TimerStart(&then);
+    mri_all = MRIdistanceTransformLabels(mri, NULL, labels, NLABELS, 10, mode, NULL);
+    all_msec = TimerStop(&then);
+    TimerStart(&then);
+    for (n = 0; n < NLABELS; n++) {
+      mri_edt = MRIdistanceTransform(mri, NULL, labels[n], 10, mode, NULL);
+      for (z = 0; z < mri->depth; z++)
+        for (y = 0; y < mri->height; y++)
+          for (x = 0; x < mri->width; x++) {
+            float edt = MRIFvox(mri_edt, x, y, z);
+            int in = nint(MRIgetVoxVal(mri, x, y, z, 0)) == labels[n];
+            errs += (edt != MRIFseq_vox(mri_all, x, y, z, n));
+            if (mode == DTRANS_MODE_UNSIGNED) errs += (edt < 0);
+            if (mode == DTRANS_MODE_OUTSIDE) errs += in ? (edt != 0) : (edt < 0);
+            if (mode == DTRANS_MODE_INSIDE) errs += in ? (edt > 0) : (edt != 0);
+          }
+      MRIfree(&mri_edt);
+    }
+    edt_msec = TimerStop(&then);
+    printf("mode %d: %d labels at once %d ms, one at a time %d ms\n", mode, NLABELS, all_msec, edt_msec);
+    MRIfree(&mri_all);
+  }
+
+  MRIfree(&mri);
+  if (errs) printf("test_mridtrans: %d failures\n", errs);
+  exit(errs ? 1 : 0);
+}
@@ -0,0 +1,175 @@
+/**
+ * @file  test_mriio_bulk.c
+ * @brief check and time the bulk (chunked) MGH/NIfTI i/o path against the row-wise path,
+ *        and check mapped and streamed reads
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "machine.h"
+#include "mri.h"
+#include "mri2.h"
+#include "timer.h"
+
+const char *Progname = "test_mriio_bulk";
+
+static MRI *make_volume(int chunked, int type)
+{
+  MRI *mri;
+  int c, r, s, f;
+
+  if (chunked)
+    mri = MRIallocChunk(128, 128, 96, type, 4);
+  else
+    mri = MRIallocSequence(128, 128, 96, type, 4);
+  for (f = 0; f < mri->nframes; f++)
+    for (s = 0; s < mri->depth; s++)
+      for (r = 0; r < mri->height; r++)
+        for (c = 0; c < mri->width; c++) MRIsetVoxVal(mri, c, r, s, f, (c * 7 + r * 3 + s + f * 11) % 200 - 50);
+  return (mri);
+}
+
+/* write with one layout, read back with the other, compare with the source */
+static int check(const char *fname, int type, int write_chunked, int read_chunked)
+{
+  MRI *src, *dst;
+  struct timeb then;
+  int wmsec, rmsec, c, r, s, f;
+  double diff;
+
+  src = make_volume(write_chunked, type);
+  TimerStart(&then);
+  if (MRIwrite(src, fname) != NO_ERROR) return (1);
+  wmsec = TimerStop(&then);
+
+  setenv("FS_USE_MRI_CHUNK", read_chunked ? "1" : "0", 1);
+  TimerStart(&then);
+  dst = MRIread(fname);
+  rmsec = TimerStop(&then);
+  if (dst == NULL) return (1);
+
+  diff = MRImaxAbsDiff(src, dst, &c, &r, &s, &f);
+  printf("%-14s type %d  write %s %5d ms  read %s %5d ms  maxdiff %g\n",
+         fname,
+         type,
+         write_chunked ? "bulk" : "rows",
+         wmsec,
+         read_chunked ? "bulk" : "rows",
+         rmsec,
+         diff);
+  MRIfree(&src);
+  MRIfree(&dst);
+  unlink(fname);
+  return (diff != 0);
+}
+
+/* MRIreadMapped must return the same voxels as MRIread, and map the
+   uncompressed files it can use in place: every .nii here, but only
+   uchar .mgh on a little endian host, as .mgh is big endian */
+static int check_mapped(const char *fname, int type)
+{
+  MRI *src, *dst;
+  int c, r, s, f, mapped, expect_mapped;
+  double diff;
+
+  expect_mapped = !strcmp(fname + strlen(fname) - 4, ".nii");
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+  if (!strcmp(fname + strlen(fname) - 4, ".mgh")) expect_mapped = (type == MRI_UCHAR);
+#else
+  if (!strcmp(fname + strlen(fname) - 4, ".mgh")) expect_mapped = 1;
+#endif
+
+  src = make_volume(0, type);
+  if (MRIwrite(src, fname) != NO_ERROR) return (1);
+  dst = MRIreadMapped(fname);
+  if (dst == NULL) return (1);
+  diff = MRImaxAbsDiff(src, dst, &c, &r, &s, &f);
+  mapped = (dst->mapped != NULL);
+  printf("%-14s type %d  mapped %d  maxdiff %g\n", fname, type, mapped, diff);
+  MRIfree(&src);
+  MRIfree(&dst);
+  unlink(fname);
+  return (diff != 0 || mapped != expect_mapped);
+}
+
+/* slabs and frame ranges from MRIstreamOpen() must match the volume */
+static int check_stream(const char *fname, int type)
+{
+  MRI_STREAM *st;
+  MRI *src, *slab = NULL, *frames = NULL;
+  long v, v0, nv;
+  int c, r, s, f, errs = 0;
+
+  src = make_volume(0, type);
+  if (MRIwrite(src, fname) != NO_ERROR) return (1);
+  st = MRIstreamOpen(fname);
+  if (st == NULL) return (1);
+
+  nv = 10000;  // does not divide the volume, so the last slab is short
+  for (v0 = 0; v0 < st->nvox; v0 += nv) {
+    if (v0 + nv > st->nvox) nv = st->nvox - v0;
+    slab = MRIstreamReadVoxels(st, v0, nv, slab);
+    if (slab == NULL) return (1);
+    for (f = 0; f < src->nframes; f++)
+      for (v = 0; v < nv; v++) {
+        c = (v0 + v) % src->width;
+        r = ((v0 + v) / src->width) % src->height;
+        s = (v0 + v) / (src->width * src->height);
+        if (MRIgetVoxVal(slab, v, 0, 0, f) != MRIgetVoxVal(src, c, r, s, f)) errs++;
+      }
+  }
+  for (f = 0; f < src->nframes; f += 2) {
+    frames = MRIstreamReadFrames(st, f, 2, frames);
+    if (frames == NULL) return (1);
+    for (s = 0; s < src->depth; s++)
+      for (r = 0; r < src->height; r++)
+        for (c = 0; c < src->width; c++)
+          if (MRIgetVoxVal(frames, c, r, s, 1) != MRIgetVoxVal(src, c, r, s, f + 1)) errs++;
+  }
+  printf("%-14s type %d  streamed %d  mismatches %d\n", fname, type, st->loaded == NULL, errs);
+  MRIfree(&slab);
+  MRIfree(&frames);
+  MRIstreamClose(&st);
+  MRIfree(&src);
+  unlink(fname);
+  return (errs != 0);
+}
+
+int main(int argc, char *argv[])
+{
+  const char *fnames[] = {"bulktest.mgh", "bulktest.mgz", "bulktest.nii", "bulktest.nii.gz"};
+  int types[] = {MRI_UCHAR, MRI_SHORT, MRI_INT, MRI_FLOAT};
+  int n, t, errs = 0;
+
+  for (n = 0; n < 4; n++)
+    for (t = 0; t < 4; t++) {
+      errs += check(fnames[n], types[t], 0, 0);
+      errs += check(fnames[n], types[t], 1, 1);
+      errs += check(fnames[n], types[t], 1, 0);
+      errs += check(fnames[n], types[t], 0, 1);
+      errs += check_mapped(fnames[n], types[t]);
+      errs += check_stream(fnames[n], types[t]);
+    }
+
+  if (errs) printf("test_mriio_bulk: %d failures\n", errs);
+  exit(errs ? 1 : 0);
+}
@@ -0,0 +1,103 @@
+/**
+ * @file  test_mrisegstats.c
+ * @brief check and time the single pass MRIsegStatsAll()/MRIsegFrameAvgAll()
+ *        against one MRIsegStats()/MRIsegFrameAvg() call per segmentation
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "mri.h"
+#include "mri2.h"
+#include "timer.h"
+#include "utils.h"
+
+const char *Progname = "test_mrisegstats";
+
+#define NSEGS 60
+
+int main(int argc, char *argv[])
+{
+  MRI *seg, *mri;
+  MRI_SEG_STATS stats[NSEGS];
+  struct timeb then;
+  float min, max, range, mean, std;
+  double *favg_ref[NSEGS], *favg_new[NSEGS];
+  int segids[NSEGS], nvox[NSEGS], c, r, s, f, n, robust, errs = 0, ref_msec, new_msec;
+
+  setRandomSeed(5);
+  seg = MRIalloc(96, 96, 96, MRI_INT);
+  mri = MRIallocSequence(96, 96, 96, MRI_FLOAT, 8);
+  for (s = 0; s < seg->depth; s++)
+    for (r = 0; r < seg->height; r++)
+      for (c = 0; c < seg->width; c++) {
+        /* blocky labels with gaps in the ids */
+        MRIsetVoxVal(seg, c, r, s, 0, 2 * ((c / 24 + 4 * (r / 24) + 16 * (s / 48)) % 50));
+        for (f = 0; f < mri->nframes; f++) MRIsetVoxVal(mri, c, r, s, f, randomNumber(-100, 1000));
+      }
+  /* ids that are missing and one that is listed twice */
+  for (n = 0; n < NSEGS; n++) segids[n] = n < 50 ? 2 * n : (n == 50 ? 4 : 1000 + n);
+
+  for (robust = 0; robust < 2; robust++) {
+    for (n = 0; n < NSEGS; n++) stats[n].segid = segids[n];
+    TimerStart(&then);
+    MRIsegStatsAll(seg, mri, 3, robust, 10, NSEGS, stats);
+    new_msec = TimerStop(&then);
+    TimerStart(&then);
+    for (n = 0; n < NSEGS; n++) {
+      if (robust)
+        MRIsegStatsRobust(seg, segids[n], mri, 3, &min, &max, &range, &mean, &std, 10);
+      else
+        MRIsegStats(seg, segids[n], mri, 3, &min, &max, &range, &mean, &std);
+      if (stats[n].nvoxels == 0) continue;
+      if (min != stats[n].min || max != stats[n].max || range != stats[n].range || mean != stats[n].mean ||
+          std != stats[n].std) {
+        printf("segid %d robust %d: mean %g %g std %g %g\n", segids[n], robust, mean, stats[n].mean, std, stats[n].std);
+        errs++;
+      }
+    }
+    ref_msec = TimerStop(&then);
+    printf("stats robust %d: per segmentation %5d ms  single pass %5d ms\n", robust, ref_msec, new_msec);
+  }
+
+  for (n = 0; n < NSEGS; n++) {
+    favg_ref[n] = (double *)calloc(mri->nframes, sizeof(double));
+    favg_new[n] = (double *)calloc(mri->nframes, sizeof(double));
+  }
+  TimerStart(&then);
+  MRIsegFrameAvgAll(seg, mri, NSEGS, segids, favg_new, nvox);
+  new_msec = TimerStop(&then);
+  TimerStart(&then);
+  for (n = 0; n < NSEGS; n++) {
+    if (MRIsegFrameAvg(seg, segids[n], mri, favg_ref[n]) != nvox[n]) errs++;
+    for (f = 0; f < mri->nframes; f++)
+      if (favg_ref[n][f] != favg_new[n][f]) errs++;
+  }
+  ref_msec = TimerStop(&then);
+  printf("frame avg: per segmentation %5d ms  single pass %5d ms\n", ref_msec, new_msec);
+
+  for (n = 0; n < NSEGS; n++) {
+    free(favg_ref[n]);
+    free(favg_new[n]);
+  }
+  MRIfree(&seg);
+  MRIfree(&mri);
+  if (errs) printf("test_mrisegstats: %d failures\n", errs);
+  exit(errs ? 1 : 0);
+}
@@ -0,0 +1,119 @@
+/**
+ * @file  test_mriskdtree.c
+ * @brief check and time the kd-tree closest vertex search against the
+ *        brute force MRISfindClosestVertex()
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "mriskdtree.h"
+#include "mrisurf.h"
+#include "timer.h"
+#include "utils.h"
+
+const char *Progname = "test_mriskdtree";
+
+#define NVERTS 150000
+#define NQUERIES 2000
+
+/* vertices on a bumpy sphere, some ripped, some duplicated so there are ties */
+static MRI_SURFACE *make_surface(void)
+{
+  MRI_SURFACE *mris;
+  int vno;
+
+  mris = MRISalloc(NVERTS, 0);
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX *v = &mris->vertices[vno];
+    double theta = acos(2 * randomNumber(0, 1) - 1), phi = randomNumber(0, 2 * M_PI);
+    double r = 100 + 5 * sin(5 * theta) * cos(3 * phi);
+    v->x = v->origx = r * sin(theta) * cos(phi);
+    v->y = v->origy = r * sin(theta) * sin(phi);
+    v->z = v->origz = r * cos(theta);
+    v->ripflag = (vno % 97) == 0;
+  }
+  for (vno = 1; vno < mris->nvertices; vno += 1001) {
+    mris->vertices[vno].x = mris->vertices[vno - 1].x;
+    mris->vertices[vno].y = mris->vertices[vno - 1].y;
+    mris->vertices[vno].z = mris->vertices[vno - 1].z;
+  }
+  return (mris);
+}
+
+int main(int argc, char *argv[])
+{
+  MRI_SURFACE *mris;
+  MRIS_KDTREE *kdt;
+  struct timeb then;
+  float x[NQUERIES], y[NQUERIES], z[NQUERIES], d_ref[NQUERIES], d_new[NQUERIES];
+  int vno_ref[NQUERIES], vno_new[NQUERIES], n, errs = 0, ref_msec, new_msec, build_msec;
+
+  setRandomSeed(17);
+  mris = make_surface();
+  for (n = 0; n < NQUERIES; n++) {
+    VERTEX *v = &mris->vertices[(n * 7919) % mris->nvertices];
+    /* near the surface, exactly on a vertex, or far away */
+    x[n] = v->x + (n % 3 == 1 ? 0 : randomNumber(-3, 3)) * (n % 3 == 2 ? 100 : 1);
+    y[n] = v->y + (n % 3 == 1 ? 0 : randomNumber(-3, 3)) * (n % 3 == 2 ? 100 : 1);
+    z[n] = v->z + (n % 3 == 1 ? 0 : randomNumber(-3, 3)) * (n % 3 == 2 ? 100 : 1);
+  }
+
+  TimerStart(&then);
+  for (n = 0; n < NQUERIES; n++) vno_ref[n] = MRISfindClosestVertex(mris, x[n], y[n], z[n], &d_ref[n]);
+  ref_msec = TimerStop(&then);
+
+  TimerStart(&then);
+  kdt = MRISkdtreeCreate(mris, CURRENT_VERTICES);
+  build_msec = TimerStop(&then);
+  TimerStart(&then);
+  for (n = 0; n < NQUERIES; n++) vno_new[n] = MRISkdtreeFindClosest(kdt, x[n], y[n], z[n], &d_new[n]);
+  new_msec = TimerStop(&then);
+  for (n = 0; n < NQUERIES; n++)
+    if (vno_new[n] != vno_ref[n] || d_new[n] != d_ref[n]) {
+      printf("query %d: brute force %d (%g), kd-tree %d (%g)\n", n, vno_ref[n], d_ref[n], vno_new[n], d_new[n]);
+      errs++;
+    }
+  printf("%d queries on %d vertices: brute force %d ms, kd-tree build %d ms, queries %d ms\n",
+         NQUERIES,
+         mris->nvertices,
+         ref_msec,
+         build_msec,
+         new_msec);
+
+  /* batch queries */
+  MRISkdtreeFindClosestBatch(kdt, NQUERIES, x, y, z, vno_new, d_new);
+  for (n = 0; n < NQUERIES; n++)
+    if (vno_new[n] != vno_ref[n] || d_new[n] != d_ref[n]) errs++;
+  MRISkdtreeFree(&kdt);
+
+  /* an attached index is used by MRISfindClosest*Vertex() */
+  MRISattachVertexIndex(mris, ORIGINAL_VERTICES);
+  for (n = 0; n < NQUERIES; n++) vno_new[n] = MRISfindClosestOriginalVertex(mris, x[n], y[n], z[n]);
+  MRISdetachVertexIndex(mris, ORIGINAL_VERTICES);
+  for (n = 0; n < NQUERIES; n++)
+    if (vno_new[n] != MRISfindClosestOriginalVertex(mris, x[n], y[n], z[n])) errs++;
+
+  MRISattachVertexIndex(mris, ORIGINAL_VERTICES); /* freed with the surface */
+  MRISfree(&mris);
+
+  if (errs) printf("test_mriskdtree: %d failures\n", errs);
+  exit(errs ? 1 : 0);
+}
@@ -0,0 +1,108 @@
+/**
+ * @file  test_mrisnbhd.c
+ * @brief check that rebuilding the vertex neighborhoods and sampled
+ *        distances reuses the neighborhood arena (MRIS_NBHD_ARENA) and
+ *        gives the same neighborhoods, and time the builds. Pass an
+ *        icosahedron .tri file (e.g. lib/bem/ic7.tri, 163842 vertices)
+ *        to time a surface the size of a hemisphere; the default is the
+ *        built-in ic2562.
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error.h"
+#include "icosahedron.h"
+#include "mrisurf.h"
+#include "timer.h"
+#include "utils.h"
+
+const char *Progname = "test_mrisnbhd";
+
+#define NBHD_SIZE 4
+#define NBRS_PER_DISTANCE 8
+#define NREBUILDS 3
+
+/* the sampled neighborhoods, MRISsampleAtEachDistance() as mris_curvature
+   runs it, and the distances to them. The samples are drawn at random,
+   so the seed is reset to get the same ones each time. */
+static int sample(MRIS *mris)
+{
+  struct timeb then;
+
+  setRandomSeed(3);
+  TimerStart(&then);
+  MRISsampleAtEachDistance(mris, NBHD_SIZE, NBRS_PER_DISTANCE);
+  MRIScomputeMetricProperties(mris);
+  return (TimerStop(&then));
+}
+
+int main(int argc, char *argv[])
+{
+  MRIS *mris;
+  MRIS_NBHD_ARENA *arena;
+  int vno, n, ntotal, *vtotal, *v, build_msec, rebuild_msec, ndiff = 0, errs = 0;
+  struct timeb then;
+  size_t size;
+  int *arena_v;
+
+  mris = argc > 1 ? ICOread(argv[1]) : ic2562_make_surface(0, 0);
+  if (!mris) ErrorExit(ERROR_NOFILE, "%s: could not read %s", Progname, argv[1]);
+
+  TimerStart(&then);
+  MRISsetNeighborhoodSize(mris, 3);
+  build_msec = TimerStop(&then);
+  build_msec += sample(mris);
+
+  // rebuilding fits in the slots the first build left, so the arena
+  // keeps its blocks and nothing is allocated per vertex
+  arena = mris->nbhd_arena;
+  size = arena ? arena->size : 0;
+  arena_v = arena ? arena->v : NULL;
+  vtotal = (int *)calloc(mris->nvertices, sizeof(int));
+  v = NULL;
+  for (rebuild_msec = n = 0; n < NREBUILDS; n++) {
+    MRISresetNeighborhoodSize(mris, 3);
+    rebuild_msec += sample(mris);
+    if (n > 0) continue;
+    // the sampling after MRISsetNeighborhoodSize() leaves vertex 0 with
+    // a different neighborhood than later ones do, arena or not, so
+    // compare the later rebuilds with the first one
+    for (ntotal = vno = 0; vno < mris->nvertices; vno++) ntotal += vtotal[vno] = mris->vertices[vno].vtotal;
+    v = (int *)calloc(ntotal, sizeof(int));
+    for (ntotal = vno = 0; vno < mris->nvertices; ntotal += vtotal[vno++])
+      memmove(v + ntotal, mris->vertices[vno].v, vtotal[vno] * sizeof(int));
+  }
+  if (!arena || mris->nbhd_arena != arena || arena->size != size || arena->v != arena_v) {
+    printf("the neighborhood arena was reallocated\n");
+    errs++;
+  }
+  for (ntotal = vno = 0; vno < mris->nvertices; ntotal += vtotal[vno++]) {
+    VERTEX const *vertex = &mris->vertices[vno];
+    if (vertex->vtotal != vtotal[vno] || memcmp(vertex->v, v + ntotal, vtotal[vno] * sizeof(int))) ndiff++;
+  }
+  if (ndiff) errs++;
+  printf("%d vertices, %d neighbors: build %d ms, %d rebuilds %d ms, %d neighborhoods differ\n",
+         mris->nvertices, ntotal, build_msec, NREBUILDS, rebuild_msec, ndiff);
+
+  free(v);
+  free(vtotal);
+  MRISfree(&mris);
+  exit(errs ? 1 : 0);
+}
@@ -0,0 +1,110 @@
+/**
+ * @file  test_mrissmooth.c
+ * @brief check the sparse surface smoothing operator (MRISsmoothOpApply)
+ *        against the step by step MRISsmoothMRI(), with and without the
+ *        Chebyshev expansion, and time them
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "error.h"
+#include "icosahedron.h"
+#include "mri.h"
+#include "mrisurf.h"
+#include "timer.h"
+#include "utils.h"
+
+const char *Progname = "test_mrissmooth";
+
+#define NFRAMES 11
+
+static double max_diff(MRI *mri1, MRI *mri2, int frame0, int nframes)
+{
+  double diff = 0;
+  int x, f;
+
+  for (f = frame0; f < frame0 + nframes; f++)
+    for (x = 0; x < mri1->width; x++)
+      diff = MAX(diff, fabs(MRIFseq_vox(mri1, x, 0, 0, f) - MRIFseq_vox(mri2, x, 0, 0, f)));
+  return (diff);
+}
+
+int main(int argc, char *argv[])
+{
+  MRIS *mris;
+  MRI *src, *mask, *mri_slow, *mri_fast, *mri_frame;
+  struct timeb then;
+  int nsteps[] = {1, 10, 100, 400}, n, vno, f, errs = 0, slow_msec, fast_msec;
+  double diff;
+
+  setRandomSeed(3);
+  mris = ic2562_make_surface(0, 0);
+  for (vno = 0; vno < mris->nvertices; vno += 37) mris->vertices[vno].ripflag = 1;
+
+  src = MRIallocSequence(mris->nvertices, 1, 1, MRI_FLOAT, NFRAMES);
+  mask = MRIalloc(mris->nvertices, 1, 1, MRI_FLOAT);
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    for (f = 0; f < NFRAMES; f++) MRIFseq_vox(src, vno, 0, 0, f) = randomNumber(0, 100);
+    MRIFvox(mask, vno, 0, 0) = mris->vertices[vno].z < 60;
+  }
+
+  for (n = 0; n < (int)(sizeof(nsteps) / sizeof(nsteps[0])); n++) {
+    setenv("USE_FAST_SURF_SMOOTHER", "0", 1);
+    TimerStart(&then);
+    mri_slow = MRISsmoothMRI(mris, src, nsteps[n], mask, NULL);
+    slow_msec = TimerStop(&then);
+    setenv("USE_FAST_SURF_SMOOTHER", "1", 1);
+
+    // one step at a time, the default, gives exactly the same floats
+    unsetenv("USE_CHEBYSHEV_SURF_SMOOTHER");
+    mri_fast = MRISsmoothMRI(mris, src, nsteps[n], mask, NULL);
+    diff = max_diff(mri_slow, mri_fast, 0, NFRAMES);
+    if (diff != 0) errs++;
+    MRIfree(&mri_fast);
+
+    // the Chebyshev expansion to float precision
+    setenv("USE_CHEBYSHEV_SURF_SMOOTHER", "1", 1);
+    TimerStart(&then);
+    mri_fast = MRISsmoothMRI(mris, src, nsteps[n], mask, NULL);
+    fast_msec = TimerStop(&then);
+    printf("%3d steps: step by step %5d ms, operator %4d ms, exact %s, max diff %g\n",
+           nsteps[n],
+           slow_msec,
+           fast_msec,
+           diff == 0 ? "yes" : "no",
+           max_diff(mri_slow, mri_fast, 0, NFRAMES));
+    if (max_diff(mri_slow, mri_fast, 0, NFRAMES) > 1e-3) errs++;
+
+    // a frame at a time in place, as in a simulation (still Chebyshev)
+    mri_frame = MRIcopy(src, NULL);
+    MRISsmoothMRIFastFrame(mris, mri_frame, NFRAMES / 2, nsteps[n], mask);
+    if (max_diff(mri_frame, mri_fast, NFRAMES / 2, 1) != 0 || max_diff(mri_frame, src, 0, NFRAMES / 2) != 0) errs++;
+
+    MRIfree(&mri_frame);
+    MRIfree(&mri_fast);
+    MRIfree(&mri_slow);
+  }
+
+  MRIfree(&mask);
+  MRIfree(&src);
+  MRISfree(&mris);
+  if (errs) printf("test_mrissmooth: %d failures\n", errs);
+  exit(errs ? 1 : 0);
+}
@@ -0,0 +1,234 @@
+/**
+ * @file  test_mriview.cpp
+ * @brief check and time the kernels ported to typed voxel access (mriview.h)
+ *        against MRIgetVoxVal/MRIsetVoxVal loops
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+extern "C"
+{
+#include "error.h"
+#include "matrix.h"
+#include "mri.h"
+#include "mri2.h"
+#include "timer.h"
+#include "utils.h"
+
+const char *Progname = "test_mriview";
+}
+
+#include "mriview.hpp"
+
+using namespace Freesurfer;
+
+static int nprogress = 0;
+static void count_progress(int progress) { nprogress++; }
+
+static MRI *make_volume(int type, int nframes)
+{
+  MRI *mri;
+  int c, r, s, f;
+
+  mri = MRIallocSequence(160, 160, 128, type, nframes);
+  for (f = 0; f < mri->nframes; f++)
+    for (s = 0; s < mri->depth; s++)
+      for (r = 0; r < mri->height; r++)
+        for (c = 0; c < mri->width; c++)
+          MRIsetVoxVal(mri, c, r, s, f, (c * 7 + r * 3 + s + f * 11) % 200 - 50 + (type == MRI_FLOAT ? 0.3 : 0));
+  return (mri);
+}
+
+static int report(const char *name, int type, int ref_msec, int new_msec, MRI *ref, MRI *dst)
+{
+  int c, r, s, f;
+  double diff;
+
+  diff = MRImaxAbsDiff(ref, dst, &c, &r, &s, &f);
+  printf("%-14s type %d  getvox %5d ms  typed %5d ms  speedup %5.1f  maxdiff %g\n",
+         name,
+         type,
+         ref_msec,
+         new_msec,
+         new_msec > 0 ? (double)ref_msec / new_msec : 0.0,
+         diff);
+  return (diff != 0);
+}
+
+// sums all voxels through an MRIview
+struct SumVoxels {
+  double *sum;
+  explicit SumVoxels(double *sum) : sum(sum) {}
+  template <typename T>
+  void operator()(MRIview<T> v) const
+  {
+    for (int f = 0; f < v.nframes(); f++)
+      for (int s = 0; s < v.depth(); s++)
+        for (int r = 0; r < v.height(); r++) {
+          const T *p = v.row(r, s, f);
+          for (int c = 0; c < v.width(); c++) *sum += p[c];
+        }
+  }
+};
+
+static int check(int type)
+{
+  MRI *src, *mask, *ref, *dst;
+  MATRIX *Vt2s;
+  struct timeb then;
+  int c, r, s, f, ref_msec, new_msec, errs = 0;
+  double sum_ref, sum_new;
+
+  src = make_volume(type, 2);
+  mask = make_volume(MRI_UCHAR, 1);
+
+  // MRIscalarMul
+  ref = MRIclone(src, NULL);
+  TimerStart(&then);
+  for (f = 0; f < src->nframes; f++)
+    for (s = 0; s < src->depth; s++)
+      for (r = 0; r < src->height; r++)
+        for (c = 0; c < src->width; c++) MRIsetVoxVal(ref, c, r, s, f, MRIgetVoxVal(src, c, r, s, f) * 1.7f);
+  ref_msec = TimerStop(&then);
+  TimerStart(&then);
+  dst = MRIscalarMul(src, NULL, 1.7f);
+  new_msec = TimerStop(&then);
+  errs += report("MRIscalarMul", type, ref_msec, new_msec, ref, dst);
+  MRIfree(&dst);
+
+  // MRIbinarize
+  TimerStart(&then);
+  for (f = 0; f < src->nframes; f++)
+    for (s = 0; s < src->depth; s++)
+      for (r = 0; r < src->height; r++)
+        for (c = 0; c < src->width; c++)
+          MRIsetVoxVal(ref, c, r, s, f, MRIgetVoxVal(src, c, r, s, f) < 20 ? 0 : 1);
+  ref_msec = TimerStop(&then);
+  TimerStart(&then);
+  dst = MRIbinarize(src, NULL, 20, 0, 1);
+  new_msec = TimerStop(&then);
+  errs += report("MRIbinarize", type, ref_msec, new_msec, ref, dst);
+  MRIfree(&dst);
+
+  // MRImask
+  TimerStart(&then);
+  for (f = 0; f < src->nframes; f++)
+    for (s = 0; s < src->depth; s++)
+      for (r = 0; r < src->height; r++)
+        for (c = 0; c < src->width; c++)
+          MRIsetVoxVal(ref, c, r, s, f, (int)MRIgetVoxVal(mask, c, r, s, 0) == 10 ? 5 : MRIgetVoxVal(src, c, r, s, f));
+  ref_msec = TimerStop(&then);
+  TimerStart(&then);
+  dst = MRImask(src, mask, NULL, 10, 5);
+  new_msec = TimerStop(&then);
+  errs += report("MRImask", type, ref_msec, new_msec, ref, dst);
+  MRIfree(&dst);
+  MRIfree(&ref);
+
+  // MRIchangeType without scaling, to short
+  ref = MRIallocSequence(src->width, src->height, src->depth, MRI_SHORT, src->nframes);
+  MRIcopyHeader(src, ref);
+  TimerStart(&then);
+  for (f = 0; f < src->nframes; f++)
+    for (s = 0; s < src->depth; s++)
+      for (r = 0; r < src->height; r++)
+        for (c = 0; c < src->width; c++) MRIsetVoxVal(ref, c, r, s, f, MRIgetVoxVal(src, c, r, s, f));
+  ref_msec = TimerStop(&then);
+  TimerStart(&then);
+  dst = MRIchangeType(src, MRI_SHORT, 0, 0, 1);
+  new_msec = TimerStop(&then);
+  errs += report("MRIchangeType", type, ref_msec, new_msec, ref, dst);
+  MRIfree(&dst);
+  MRIfree(&ref);
+
+  // MRIcopyFrame into a float volume
+  ref = MRIallocSequence(src->width, src->height, src->depth, MRI_FLOAT, 1);
+  dst = MRIallocSequence(src->width, src->height, src->depth, MRI_FLOAT, 1);
+  TimerStart(&then);
+  for (s = 0; s < src->depth; s++)
+    for (r = 0; r < src->height; r++)
+      for (c = 0; c < src->width; c++) MRIsetVoxVal(ref, c, r, s, 0, MRIgetVoxVal(src, c, r, s, 1));
+  ref_msec = TimerStop(&then);
+  TimerStart(&then);
+  MRIcopyFrame(src, dst, 1, 0);
+  new_msec = TimerStop(&then);
+  errs += report("MRIcopyFrame", type, ref_msec, new_msec, ref, dst);
+  MRIfree(&dst);
+  MRIfree(&ref);
+
+  // MRIvol2Vol nearest neighbor, with a shift of a voxel and a half
+  Vt2s = MatrixIdentity(4, NULL);
+  Vt2s->rptr[1][4] = 1.5;
+  Vt2s->rptr[3][4] = -2.25;
+  ref = MRIclone(src, NULL);
+  dst = MRIclone(src, NULL);
+  TimerStart(&then);
+  for (s = 0; s < src->depth; s++)
+    for (r = 0; r < src->height; r++)
+      for (c = 0; c < src->width; c++) {
+        int ics = nint(c + 1.5f), iss = nint(s - 2.25f);
+        if (ics >= src->width || iss < 0) continue;
+        for (f = 0; f < src->nframes; f++) MRIsetVoxVal(ref, c, r, s, f, MRIgetVoxVal(src, ics, r, iss, f));
+      }
+  ref_msec = TimerStop(&then);
+  nprogress = 0;
+  SetProgressCallback(count_progress, 0, 100);
+  TimerStart(&then);
+  MRIvol2Vol(src, dst, Vt2s, SAMPLE_NEAREST, 0);
+  new_msec = TimerStop(&then);
+  SetProgressCallback(NULL, 0, 100);
+  errs += report("MRIvol2Vol", type, ref_msec, new_msec, ref, dst);
+  // progress is reported as for the other interpolation types
+  if (nprogress == 0) {
+    printf("MRIvol2Vol nearest did not report progress\n");
+    errs++;
+  }
+  MatrixFree(&Vt2s);
+  MRIfree(&dst);
+  MRIfree(&ref);
+
+  // a loop over an MRIview
+  sum_ref = sum_new = 0;
+  TimerStart(&then);
+  for (f = 0; f < src->nframes; f++)
+    for (s = 0; s < src->depth; s++)
+      for (r = 0; r < src->height; r++)
+        for (c = 0; c < src->width; c++) sum_ref += MRIgetVoxVal(src, c, r, s, f);
+  ref_msec = TimerStop(&then);
+  TimerStart(&then);
+  MRIvisit(src, SumVoxels(&sum_new));
+  new_msec = TimerStop(&then);
+  printf("%-14s type %d  getvox %5d ms  typed %5d ms  sums %g %g\n", "MRIview", type, ref_msec, new_msec, sum_ref, sum_new);
+  errs += (sum_ref != sum_new);
+
+  MRIfree(&mask);
+  MRIfree(&src);
+  return (errs);
+}
+
+int main(int argc, char *argv[])
+{
+  int types[] = {MRI_UCHAR, MRI_SHORT, MRI_INT, MRI_FLOAT};
+  int t, errs = 0;
+
+  for (t = 0; t < 4; t++) errs += check(types[t]);
+
+  if (errs) printf("test_mriview: %d failures\n", errs);
+  exit(errs ? 1 : 0);
+}
@@ -0,0 +1,121 @@
+/**
+ * @file  test_surfcluster.c
+ * @brief check that sclustMapSurfClusters() finds the connected components
+ *        of the supra-threshold vertices, on several surfaces at once on
+ *        OpenMP threads as mri_glmfit --sim runs it. Pass an icosahedron
+ *        .tri file (e.g. lib/bem/ic7.tri, 163842 vertices) for clusters
+ *        the size of a hemisphere; the default is the built-in ic2562.
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+#include "error.h"
+#include "icosahedron.h"
+#include "mrisurf.h"
+#include "surfcluster.h"
+#include "utils.h"
+#include "volcluster.h"
+
+const char *Progname = "test_surfcluster";
+
+#define NSURFS 4
+#define THRESH 1.0
+
+static int find_root(int *parent, int vno)
+{
+  while (parent[vno] != vno) vno = parent[vno] = parent[parent[vno]];
+  return (vno);
+}
+
+/* checks the cluster numbers in undefval against a union-find of the
+   supra-threshold vertices; returns the number of vertices in the
+   wrong cluster */
+static int check_clusters(MRIS *mris, int nclusters)
+{
+  int vno, nbr, root, ncomponents, nwrong, *parent, *clusterno;
+
+  parent = (int *)calloc(mris->nvertices, sizeof(int));
+  clusterno = (int *)calloc(mris->nvertices, sizeof(int));
+  for (vno = 0; vno < mris->nvertices; vno++) parent[vno] = vno;
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX const *v = &mris->vertices[vno];
+    if (!clustValueInRange(v->val, THRESH, -1, 0)) continue;
+    for (nbr = 0; nbr < v->vnum; nbr++)
+      if (clustValueInRange(mris->vertices[v->v[nbr]].val, THRESH, -1, 0))
+        parent[find_root(parent, v->v[nbr])] = find_root(parent, vno);
+  }
+
+  // each component has one cluster number and no two share one
+  for (ncomponents = nwrong = vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX const *v = &mris->vertices[vno];
+    if (!clustValueInRange(v->val, THRESH, -1, 0)) {
+      if (v->undefval != 0) nwrong++;
+      continue;
+    }
+    root = find_root(parent, vno);
+    if (root == vno) ncomponents++;
+    if (!clusterno[root]) clusterno[root] = v->undefval;
+    if (v->undefval <= 0 || v->undefval != clusterno[root]) nwrong++;
+  }
+  if (ncomponents != nclusters) {
+    printf("%d clusters, %d components\n", nclusters, ncomponents);
+    nwrong++;
+  }
+  free(clusterno);
+  free(parent);
+  return (nwrong);
+}
+
+int main(int argc, char *argv[])
+{
+  MRIS *mris[NSURFS];
+  SCS *scs;
+  int n, vno, nclusters[NSURFS], nwrong, errs = 0;
+
+  setRandomSeed(3);
+  for (n = 0; n < NSURFS; n++) {
+    mris[n] = argc > 1 ? ICOread(argv[1]) : ic2562_make_surface(0, 0);
+    if (!mris[n]) ErrorExit(ERROR_NOFILE, "%s: could not read %s", Progname, argv[1]);
+    MRIScomputeMetricProperties(mris[n]);
+    // the last surface is one cluster of every vertex, grown on a worker
+    // thread, whose stack may be only a few MB; the others are noise
+    for (vno = 0; vno < mris[n]->nvertices; vno++)
+      mris[n]->vertices[vno].val = n < NSURFS - 1 ? randomNumber(-2.0, 2.0) : 2.0;
+  }
+
+#ifdef HAVE_OPENMP
+  omp_set_num_threads(NSURFS);
+  #pragma omp parallel for schedule(static, 1) private(scs)
+#endif
+  for (n = 0; n < NSURFS; n++) {
+    scs = sclustMapSurfClusters(mris[n], THRESH, -1, 0, 0, &nclusters[n], NULL);
+    free(scs);
+  }
+
+  for (n = 0; n < NSURFS; n++) {
+    nwrong = check_clusters(mris[n], nclusters[n]);
+    printf("surface %d: %d clusters, %d vertices in the wrong cluster\n", n, nclusters[n], nwrong);
+    if (nwrong || (n == NSURFS - 1 && nclusters[n] != 1)) errs++;
+    MRISfree(&mris[n]);
+  }
+  exit(errs ? 1 : 0);
+}
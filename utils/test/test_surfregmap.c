@@ -0,0 +1,143 @@
+/**
+ * @file  test_surfregmap.c
+ * @brief check that MRISapplyReg() with its sparse map (MRISregMap) gives
+ *        what surf2surf_nnfr() and surf2surf_nnfr_jac() do, and that the
+ *        map comes back the same from the FS_SURFREG_CACHE directory
+ *
+ */
+/*
+ * Original Author: FreeSurfer developers
+ *
+ * Copyright © 2018 The General Hospital Corporation (Boston, MA) "MGH"
+ *
+ * Terms and conditions for use, reproduction, distribution and contribution
+ * are found in the 'FreeSurfer Software License Agreement' contained
+ * in the file 'LICENSE' found in the FreeSurfer distribution, and here:
+ *
+ * https://surfer.nmr.mgh.harvard.edu/fswiki/FreeSurferSoftwareLicense
+ *
+ * Reporting: freesurfer@nmr.mgh.harvard.edu
+ *
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "icosahedron.h"
+#include "mri.h"
+#include "mrisurf.h"
+#include "resample.h"
+#include "timer.h"
+#include "utils.h"
+
+const char *Progname = "test_surfregmap";
+
+#define NFRAMES 5
+
+/* turn the sphere a little so that the vertices do not line up */
+static void rotate(MRIS *mris, double angle)
+{
+  int vno;
+
+  for (vno = 0; vno < mris->nvertices; vno++) {
+    VERTEX *v = &mris->vertices[vno];
+    float x = v->x, y = v->y;
+    v->x = cos(angle) * x - sin(angle) * y;
+    v->y = sin(angle) * x + cos(angle) * y;
+  }
+}
+
+static double max_diff(MRI *mri1, MRI *mri2)
+{
+  double diff = 0;
+  int x, f;
+
+  for (f = 0; f < mri1->nframes; f++)
+    for (x = 0; x < mri1->width; x++)
+      diff = MAX(diff, fabs(MRIFseq_vox(mri1, x, 0, 0, f) - MRIFseq_vox(mri2, x, 0, 0, f)));
+  return (diff);
+}
+
+static int check(MRIS *src, MRIS *trg, int rev, int jac)
+{
+  MRIS *surfs[2] = {src, trg};
+  MRI *vals, *mri_old, *mri_new, *hits = NULL, *dist = NULL, *thits = NULL, *tdist = NULL;
+  int vno, f, errs = 0;
+  double diff;
+
+  vals = MRIallocSequence(src->nvertices, 1, 1, MRI_FLOAT, NFRAMES);
+  for (vno = 0; vno < src->nvertices; vno++)
+    for (f = 0; f < NFRAMES; f++) MRIFseq_vox(vals, vno, 0, 0, f) = randomNumber(0, 100);
+  if (jac)
+    mri_old = surf2surf_nnfr_jac(vals, src, trg, &hits, &dist, &thits, &tdist, rev, 1);
+  else
+    mri_old = surf2surf_nnfr(vals, src, trg, &hits, &dist, &thits, &tdist, rev, 1);
+  mri_new = MRISapplyReg(vals, surfs, 2, rev, jac, 1);
+  diff = max_diff(mri_old, mri_new);
+  printf("%d -> %d vertices, rev %d jac %d: max diff %g\n", src->nvertices, trg->nvertices, rev, jac, diff);
+  if (diff > 1e-4) errs++;
+
+  MRIfree(&mri_new);
+  MRIfree(&mri_old);
+  MRIfree(&hits);
+  MRIfree(&dist);
+  MRIfree(&thits);
+  MRIfree(&tdist);
+  MRIfree(&vals);
+  return (errs);
+}
+
+int main(int argc, char *argv[])
+{
+  MRIS *ico642, *ico2562, *surfs[4];
+  MRIS_REG_MAP *map, *map_cached;
+  char cachedir[STRLEN], cmd[STRLEN];
+  int rev, jac, errs = 0;
+
+  setRandomSeed(17);
+  ico642 = ic642_make_surface(0, 0);
+  ico2562 = ic2562_make_surface(0, 0);
+  rotate(ico642, 0.03);
+
+  // more sources than targets leaves some for the reverse loop
+  for (rev = 0; rev <= 1; rev++)
+    for (jac = 0; jac <= 1; jac++) {
+      errs += check(ico2562, ico642, rev, jac);
+      errs += check(ico642, ico2562, rev, jac);
+    }
+
+  // a chain of two regs through the cache, built once and then read
+  sprintf(cachedir, "surfregmap.%d", (int)getpid());
+  sprintf(cmd, "mkdir -p %s", cachedir);
+  if (system(cmd) != 0) errs++;
+  setenv("FS_SURFREG_CACHE", cachedir, 1);
+  surfs[0] = ico2562;
+  surfs[1] = ico642;
+  surfs[2] = ico642;
+  surfs[3] = ico2562;
+  map = MRISregMap(surfs, 4, 1, 0, 1);
+  map_cached = MRISregMap(surfs, 4, 1, 0, 1);
+  if (map == NULL || map_cached == NULL || map->nnz != map_cached->nnz ||
+      memcmp(map->row, map_cached->row, (map->ntrg + 1) * sizeof(int)) ||
+      memcmp(map->col, map_cached->col, map->nnz * sizeof(int)) || memcmp(map->w, map_cached->w, map->nnz * sizeof(float)))
+    errs++;
+  if (!MRISregMapMatches(map_cached, surfs, 4, 1, 0, 1) || MRISregMapMatches(map_cached, surfs, 4, 1, 1, 1)) errs++;
+  // the kd-tree map is saved apart from the hash one
+  if (MRISregMapMatches(map_cached, surfs, 4, 1, 0, 0)) errs++;
+  MRISregMapFree(&map_cached);
+  map_cached = MRISregMap(surfs, 4, 1, 0, 0);
+  if (map_cached == NULL || map_cached->UseHash || !MRISregMapMatches(map_cached, surfs, 4, 1, 0, 0)) errs++;
+  rotate(ico642, 0.01);
+  if (MRISregMapMatches(map_cached, surfs, 4, 1, 0, 0)) errs++;
+  MRISregMapFree(&map_cached);
+  MRISregMapFree(&map);
+  sprintf(cmd, "rm -rf %s", cachedir);
+  if (system(cmd) != 0) errs++;
+
+  if (errs) printf("test_surfregmap: %d failures\n", errs);
+  exit(errs ? 1 : 0);
+}
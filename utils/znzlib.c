@@ -43,9 +43,539 @@
 #endif
 #include "znzlib.h"
 
+#ifdef HAVE_ZLIB
+#include <unistd.h>
+#include "romp_support.h"
+#endif
+
+#ifdef HAVE_ZLIB
+/*-------------------------------------------------------------------------
+  Block-indexed gzip container
+
+  The uncompressed stream is cut into ZNZ_BLOCK_SIZE blocks, each one
+  written as a complete, independent gzip member. After the last data
+  block one or more empty gzip members are written whose FEXTRA header
+  field (subfield id 'F','Z') holds the file offsets of the data blocks:
+
+    "FSZI" version block_size nentries first_block usize data_end prev
+    offset[0] ... offset[nentries-1] self_offset "FSZI"
+
+  all integers little endian (u32 for version/block_size/nentries, u64
+  otherwise). prev is the offset of the previous index member (or ~0),
+  so arbitrarily many blocks can be indexed. The last 10 bytes of the
+  file are always the empty deflate stream plus a zero crc/isize, so the
+  last index member can be found by reading a fixed-size tail.
+
+  Because the blocks are independent, the writer deflates a batch of
+  blocks (one per omp thread) in parallel and large reads inflate all
+  whole blocks they cover in parallel. The output does not depend on the
+  number of threads.
+  -------------------------------------------------------------------------*/
+
+#define ZNZ_INDEX_MAGIC    "FSZI"
+#define ZNZ_INDEX_VERSION  1
+#define ZNZ_INDEX_MAX      8000  /* entries per index member (FEXTRA <= 64k) */
+#define ZNZ_INDEX_FIXED    (4 + 4 + 4 + 4 + 8 + 8 + 8 + 8)
+#define ZNZ_INDEX_TAIL     (8 + 4)
+#define ZNZ_GZ_TAIL        10
+
+static const unsigned char znz_gz_tail[ZNZ_GZ_TAIL] = {0x03, 0x00, 0, 0, 0, 0, 0, 0, 0, 0};
+
+struct znzblock
+{
+  FILE *fp;
+  int writing;
+  int level;
+  size_t block_size;
+  size_t nbatch;               /* blocks buffered by the writer */
+  unsigned long long *offsets; /* nblocks+1 entries, last is end of data */
+  size_t nblocks, nalloc;
+  unsigned long long usize;    /* total uncompressed size */
+  unsigned long long pos;      /* current uncompressed position */
+  unsigned char *ubuf;         /* reading: contents of block 'cur', writing: batch */
+  size_t ulen;
+  long cur;
+  unsigned char *cbuf;         /* compressed scratch, cbuf_size per batch block */
+  size_t cbuf_size;
+  size_t *csize;
+  int eof;
+};
+
+static void znz_put32(unsigned char *p, unsigned long v)
+{
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = (v >> 24) & 0xff;
+}
+
+static void znz_put64(unsigned char *p, unsigned long long v)
+{
+  znz_put32(p, (unsigned long)(v & 0xffffffffUL));
+  znz_put32(p + 4, (unsigned long)(v >> 32));
+}
+
+static unsigned long znz_get32(const unsigned char *p)
+{
+  return (unsigned long)p[0] | ((unsigned long)p[1] << 8) | ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static unsigned long long znz_get64(const unsigned char *p)
+{
+  return (unsigned long long)znz_get32(p) | ((unsigned long long)znz_get32(p + 4) << 32);
+}
+
+static void znzblock_free(struct znzblock *b)
+{
+  if (b == NULL) return;
+  if (b->fp) fclose(b->fp);
+  free(b->offsets);
+  free(b->ubuf);
+  free(b->cbuf);
+  free(b->csize);
+  free(b);
+}
+
+static int znzblock_add_offset(struct znzblock *b, unsigned long long off)
+{
+  if (b->nblocks + 1 >= b->nalloc) {
+    size_t nalloc = b->nalloc ? 2 * b->nalloc : 1024;
+    unsigned long long *offsets = (unsigned long long *)realloc(b->offsets, nalloc * sizeof(*offsets));
+    if (offsets == NULL) return -1;
+    b->offsets = offsets;
+    b->nalloc = nalloc;
+  }
+  b->offsets[b->nblocks++] = off;
+  return 0;
+}
+
+/* deflate len bytes of src as one gzip member into b->cbuf, returns
+   the compressed size or 0 on failure */
+static size_t znzblock_deflate(int level, const unsigned char *src, size_t len, unsigned char *dst, size_t dst_size)
+{
+  z_stream strm;
+  size_t csize;
+
+  memset(&strm, 0, sizeof(strm));
+  if (deflateInit2(&strm, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) return 0;
+  strm.next_in = (Bytef *)src;
+  strm.avail_in = (uInt)len;
+  strm.next_out = dst;
+  strm.avail_out = (uInt)dst_size;
+  if (deflate(&strm, Z_FINISH) != Z_STREAM_END) {
+    deflateEnd(&strm);
+    return 0;
+  }
+  csize = strm.total_out;
+  deflateEnd(&strm);
+  return csize;
+}
+
+/* inflate one gzip member of csize bytes into dst, returns the
+   uncompressed size or (size_t)-1 on failure */
+static size_t znzblock_inflate(const unsigned char *src, size_t csize, unsigned char *dst, size_t dst_size)
+{
+  z_stream strm;
+  size_t ulen;
+
+  memset(&strm, 0, sizeof(strm));
+  if (inflateInit2(&strm, 15 + 16) != Z_OK) return (size_t)-1;
+  strm.next_in = (Bytef *)src;
+  strm.avail_in = (uInt)csize;
+  strm.next_out = dst;
+  strm.avail_out = (uInt)dst_size;
+  if (inflate(&strm, Z_FINISH) != Z_STREAM_END) {
+    inflateEnd(&strm);
+    return (size_t)-1;
+  }
+  ulen = strm.total_out;
+  inflateEnd(&strm);
+  return ulen;
+}
+
+/* compress and write all buffered blocks */
+static int znzblock_flush_batch(struct znzblock *b)
+{
+  int nb, n, failed = 0;
+
+  if (b->ulen == 0) return 0;
+  nb = (int)((b->ulen + b->block_size - 1) / b->block_size);
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP2(nb > 1, shown_reproducible) reduction(+ : failed)
+#endif
+  for (n = 0; n < nb; n++) {
+    ROMP_PFLB_begin
+    size_t start = (size_t)n * b->block_size, len = b->ulen - start;
+    if (len > b->block_size) len = b->block_size;
+    b->csize[n] = znzblock_deflate(b->level, b->ubuf + start, len, b->cbuf + n * b->cbuf_size, b->cbuf_size);
+    if (b->csize[n] == 0) failed++;
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+  if (failed) return -1;
+
+  for (n = 0; n < nb; n++) {
+    if (znzblock_add_offset(b, (unsigned long long)ftell(b->fp)) != 0) return -1;
+    if (fwrite(b->cbuf + n * b->cbuf_size, 1, b->csize[n], b->fp) != b->csize[n]) return -1;
+  }
+  b->ulen = 0;
+  return 0;
+}
+
+static int znzblock_write_index(struct znzblock *b)
+{
+  unsigned long long data_end, prev = ~0ULL, self;
+  size_t first = 0, n, len, k;
+  unsigned char *hdr;
+
+  data_end = (unsigned long long)ftell(b->fp);
+  hdr = (unsigned char *)malloc(12 + 4 + ZNZ_INDEX_FIXED + 8 * ZNZ_INDEX_MAX + ZNZ_INDEX_TAIL);
+  if (hdr == NULL) return -1;
+
+  do {
+    unsigned char *p;
+
+    n = b->nblocks - first;
+    if (n > ZNZ_INDEX_MAX) n = ZNZ_INDEX_MAX;
+    len = ZNZ_INDEX_FIXED + 8 * n + ZNZ_INDEX_TAIL;
+    self = (unsigned long long)ftell(b->fp);
+
+    /* gzip member header with FEXTRA, mtime 0, OS unknown */
+    hdr[0] = 0x1f;
+    hdr[1] = 0x8b;
+    hdr[2] = 8;
+    hdr[3] = 4;
+    znz_put32(hdr + 4, 0);
+    hdr[8] = 0;
+    hdr[9] = 255;
+    hdr[10] = (len + 4) & 0xff;
+    hdr[11] = ((len + 4) >> 8) & 0xff;
+    hdr[12] = 'F';
+    hdr[13] = 'Z';
+    hdr[14] = len & 0xff;
+    hdr[15] = (len >> 8) & 0xff;
+
+    p = hdr + 16;
+    memcpy(p, ZNZ_INDEX_MAGIC, 4);
+    znz_put32(p + 4, ZNZ_INDEX_VERSION);
+    znz_put32(p + 8, (unsigned long)b->block_size);
+    znz_put32(p + 12, (unsigned long)n);
+    znz_put64(p + 16, first);
+    znz_put64(p + 24, b->usize);
+    znz_put64(p + 32, data_end);
+    znz_put64(p + 40, prev);
+    p += ZNZ_INDEX_FIXED;
+    for (k = 0; k < n; k++, p += 8) znz_put64(p, b->offsets[first + k]);
+    znz_put64(p, self);
+    memcpy(p + 8, ZNZ_INDEX_MAGIC, 4);
+
+    if (fwrite(hdr, 1, 16 + len, b->fp) != 16 + len || fwrite(znz_gz_tail, 1, ZNZ_GZ_TAIL, b->fp) != ZNZ_GZ_TAIL) {
+      free(hdr);
+      return -1;
+    }
+    prev = self;
+    first += n;
+  } while (first < b->nblocks);
+
+  free(hdr);
+  return 0;
+}
+
+/* parse the index member at offset 'off', filling the matching entries
+   of b->offsets. Returns the offset of the previous index member */
+static int znzblock_read_index(struct znzblock *b, unsigned long long off, unsigned long long *prev)
+{
+  unsigned char hdr[16], *data;
+  size_t len, n, k;
+  unsigned long long first;
+
+  if (fseek(b->fp, (long)off, SEEK_SET) != 0 || fread(hdr, 1, 16, b->fp) != 16) return -1;
+  if (hdr[0] != 0x1f || hdr[1] != 0x8b || !(hdr[3] & 4) || hdr[12] != 'F' || hdr[13] != 'Z') return -1;
+  len = hdr[14] | (hdr[15] << 8);
+  if (len < ZNZ_INDEX_FIXED + ZNZ_INDEX_TAIL) return -1;
+  data = (unsigned char *)malloc(len);
+  if (data == NULL) return -1;
+  if (fread(data, 1, len, b->fp) != len || memcmp(data, ZNZ_INDEX_MAGIC, 4) != 0 ||
+      znz_get32(data + 4) != ZNZ_INDEX_VERSION) {
+    free(data);
+    return -1;
+  }
+
+  n = znz_get32(data + 12);
+  first = znz_get64(data + 16);
+  if (b->offsets == NULL) {
+    /* last index member: it knows the total block count */
+    b->block_size = znz_get32(data + 8);
+    b->nblocks = first + n;
+    b->usize = znz_get64(data + 24);
+    b->nalloc = b->nblocks + 1;
+    b->offsets = (unsigned long long *)calloc(b->nalloc, sizeof(*b->offsets));
+    if (b->offsets == NULL || b->block_size == 0) {
+      free(data);
+      return -1;
+    }
+    b->offsets[b->nblocks] = znz_get64(data + 32);
+  }
+  if (first + n > b->nblocks || len != ZNZ_INDEX_FIXED + 8 * n + ZNZ_INDEX_TAIL) {
+    free(data);
+    return -1;
+  }
+  for (k = 0; k < n; k++) b->offsets[first + k] = znz_get64(data + ZNZ_INDEX_FIXED + 8 * k);
+  *prev = znz_get64(data + 40);
+  free(data);
+  return 0;
+}
+
+/* returns a reader if path is a block-indexed gzip container, else NULL */
+static struct znzblock *znzblock_open_read(const char *path)
+{
+  struct znzblock *b;
+  unsigned char tail[ZNZ_INDEX_TAIL + ZNZ_GZ_TAIL];
+  unsigned long long off, prev;
+  long fsize;
+  size_t k;
+
+  b = (struct znzblock *)calloc(1, sizeof(struct znzblock));
+  if (b == NULL) return NULL;
+  b->cur = -1;
+  if ((b->fp = fopen(path, "rb")) == NULL) {
+    znzblock_free(b);
+    return NULL;
+  }
+  if (fseek(b->fp, 0, SEEK_END) != 0 || (fsize = ftell(b->fp)) < (long)sizeof(tail) ||
+      fseek(b->fp, fsize - (long)sizeof(tail), SEEK_SET) != 0 || fread(tail, 1, sizeof(tail), b->fp) != sizeof(tail) ||
+      memcmp(tail + 8, ZNZ_INDEX_MAGIC, 4) != 0 || memcmp(tail + ZNZ_INDEX_TAIL, znz_gz_tail, ZNZ_GZ_TAIL) != 0) {
+    znzblock_free(b);
+    return NULL;
+  }
+
+  for (off = znz_get64(tail); off != ~0ULL; off = prev) {
+    if (off >= (unsigned long long)fsize || znzblock_read_index(b, off, &prev) != 0) {
+      fprintf(stderr, "** ERROR: znzopen: corrupt block index in %s\n", path);
+      znzblock_free(b);
+      return NULL;
+    }
+  }
+  for (k = 0; k < b->nblocks; k++) {
+    if (b->offsets[k] >= b->offsets[k + 1]) {
+      fprintf(stderr, "** ERROR: znzopen: corrupt block index in %s\n", path);
+      znzblock_free(b);
+      return NULL;
+    }
+  }
+
+  b->ubuf = (unsigned char *)malloc(b->block_size);
+  if (b->ubuf == NULL) {
+    znzblock_free(b);
+    return NULL;
+  }
+  return b;
+}
+
+static struct znzblock *znzblock_open_write(const char *path, const char *mode)
+{
+  struct znzblock *b;
+  const char *c;
+
+  b = (struct znzblock *)calloc(1, sizeof(struct znzblock));
+  if (b == NULL) return NULL;
+  b->writing = 1;
+  b->cur = -1;
+  b->level = Z_DEFAULT_COMPRESSION;
+  for (c = mode; *c; c++)
+    if (*c >= '0' && *c <= '9') b->level = *c - '0';
+  b->block_size = ZNZ_BLOCK_SIZE;
+  b->nbatch = 1;
+#ifdef HAVE_OPENMP
+  if (ROMP_if_parallel1(ROMP_level_shown_reproducible)) b->nbatch = omp_get_max_threads();
+#endif
+  b->cbuf_size = compressBound(b->block_size) + 64;
+  b->ubuf = (unsigned char *)malloc(b->nbatch * b->block_size);
+  b->cbuf = (unsigned char *)malloc(b->nbatch * b->cbuf_size);
+  b->csize = (size_t *)calloc(b->nbatch, sizeof(size_t));
+  if (b->ubuf == NULL || b->cbuf == NULL || b->csize == NULL || (b->fp = fopen(path, "wb")) == NULL) {
+    znzblock_free(b);
+    return NULL;
+  }
+  return b;
+}
+
+static int znzblock_close(struct znzblock *b)
+{
+  int retval = 0;
+
+  if (b->writing) {
+    if (znzblock_flush_batch(b) != 0 || znzblock_write_index(b) != 0) retval = -1;
+  }
+  if (fclose(b->fp) != 0) retval = -1;
+  b->fp = NULL;
+  znzblock_free(b);
+  return retval;
+}
+
+static int znzblock_load(struct znzblock *b, long k)
+{
+  size_t csize, expected;
+
+  if (b->cur == k) return 0;
+  csize = b->offsets[k + 1] - b->offsets[k];
+  if (csize > b->cbuf_size) {
+    free(b->cbuf);
+    b->cbuf_size = csize;
+    if ((b->cbuf = (unsigned char *)malloc(b->cbuf_size)) == NULL) {
+      b->cbuf_size = 0;
+      return -1;
+    }
+  }
+  b->cur = -1;
+  if (fseek(b->fp, (long)b->offsets[k], SEEK_SET) != 0 || fread(b->cbuf, 1, csize, b->fp) != csize) return -1;
+  expected = b->usize - (unsigned long long)k * b->block_size;
+  if (expected > b->block_size) expected = b->block_size;
+  if ((b->ulen = znzblock_inflate(b->cbuf, csize, b->ubuf, b->block_size)) != expected) {
+    fprintf(stderr, "** ERROR: znzread: corrupt compressed block %ld\n", k);
+    return -1;
+  }
+  b->cur = k;
+  return 0;
+}
+
+/* inflate the whole blocks k0..k1-1 straight into out, in parallel */
+static int znzblock_read_blocks(struct znzblock *b, long k0, long k1, unsigned char *out)
+{
+  int fd = fileno(b->fp), failed = 0;
+  long k;
+
+  ROMP_PF_begin
+#ifdef HAVE_OPENMP
+  #pragma omp parallel for if_ROMP(shown_reproducible) reduction(+ : failed)
+#endif
+  for (k = k0; k < k1; k++) {
+    ROMP_PFLB_begin
+    size_t csize = b->offsets[k + 1] - b->offsets[k], expected;
+    unsigned char *cbuf = (unsigned char *)malloc(csize);
+
+    expected = b->usize - (unsigned long long)k * b->block_size;
+    if (expected > b->block_size) expected = b->block_size;
+    if (cbuf == NULL || pread(fd, cbuf, csize, (off_t)b->offsets[k]) != (ssize_t)csize ||
+        znzblock_inflate(cbuf, csize, out + (size_t)(k - k0) * b->block_size, expected) != expected)
+      failed++;
+    free(cbuf);
+    ROMP_PFLB_end
+  }
+  ROMP_PF_end
+
+  if (failed) fprintf(stderr, "** ERROR: znzread: corrupt compressed block in %ld..%ld\n", k0, k1 - 1);
+  return failed ? -1 : 0;
+}
+
+static size_t znzblock_read(struct znzblock *b, void *buf, size_t nbytes)
+{
+  unsigned char *out = (unsigned char *)buf;
+  size_t done = 0;
+
+  while (done < nbytes) {
+    long k, k1;
+    size_t off, n;
+
+    if (b->pos >= b->usize) {
+      b->eof = 1;
+      break;
+    }
+    k = (long)(b->pos / b->block_size);
+    off = b->pos - (unsigned long long)k * b->block_size;
+
+    /* find the whole blocks covered by the rest of the request */
+    k1 = k;
+    if (off == 0) {
+      while (k1 < (long)b->nblocks) {
+        unsigned long long end = (unsigned long long)(k1 + 1) * b->block_size;
+        if (end > b->usize) end = b->usize;
+        if (end > b->pos + (nbytes - done)) break;
+        k1++;
+      }
+    }
+    if (k1 - k > 1) {
+      n = (size_t)((k1 == (long)b->nblocks ? b->usize : (unsigned long long)k1 * b->block_size) - b->pos);
+      if (znzblock_read_blocks(b, k, k1, out + done) != 0) break;
+      done += n;
+      b->pos += n;
+      continue;
+    }
+
+    if (znzblock_load(b, k) != 0) break;
+    n = b->ulen - off;
+    if (n > nbytes - done) n = nbytes - done;
+    memcpy(out + done, b->ubuf + off, n);
+    done += n;
+    b->pos += n;
+  }
+  return done;
+}
+
+static size_t znzblock_write(struct znzblock *b, const void *buf, size_t nbytes)
+{
+  const unsigned char *in = (const unsigned char *)buf;
+  size_t done = 0;
+
+  while (done < nbytes) {
+    size_t n = b->nbatch * b->block_size - b->ulen;
+    if (n > nbytes - done) n = nbytes - done;
+    memcpy(b->ubuf + b->ulen, in + done, n);
+    b->ulen += n;
+    done += n;
+    b->pos += n;
+    b->usize = b->pos;
+    if (b->ulen == b->nbatch * b->block_size && znzblock_flush_batch(b) != 0) {
+      fprintf(stderr, "** ERROR: znzwrite: failed to write compressed block\n");
+      return done - n;
+    }
+  }
+  return done;
+}
+
+static long znzblock_seek(struct znzblock *b, long offset, int whence)
+{
+  long long pos;
+
+  switch (whence) {
+    case SEEK_SET:
+      pos = offset;
+      break;
+    case SEEK_CUR:
+      pos = (long long)b->pos + offset;
+      break;
+    case SEEK_END:
+      if (b->writing) return -1;
+      pos = (long long)b->usize + offset;
+      break;
+    default:
+      return -1;
+  }
+  if (pos < 0) return -1;
+
+  if (b->writing) {
+    /* like gzseek, only forward seeks are allowed and fill with zeros */
+    static const unsigned char zeros[1024] = {0};
+    if ((unsigned long long)pos < b->pos) return -1;
+    while (b->pos < (unsigned long long)pos) {
+      size_t n = (size_t)((unsigned long long)pos - b->pos);
+      if (n > sizeof(zeros)) n = sizeof(zeros);
+      if (znzblock_write(b, zeros, n) != n) return -1;
+    }
+  }
+  b->pos = (unsigned long long)pos;
+  b->eof = 0;
+  return (long)b->pos;
+}
+#endif
+
+
 /* Note extra argument (use_compression) where
    use_compression==0 is no compression
    use_compression!=0 uses zlib (gzip) compression
+   use_compression==ZNZ_BLOCKED writes a block-indexed gzip container
 */
 
 znzFile znzopen(const char *path, const char *mode, int use_compression)
@@ -61,10 +591,20 @@ znzFile znzopen(const char *path, const char *mode, int use_compression)
 
 #ifdef HAVE_ZLIB
   file->zfptr = NULL;
+  file->blk = NULL;
 
   if (use_compression) {
     file->withz = 1;
-    if ((file->zfptr = gzopen(path, mode)) == NULL) {
+    if (strchr(mode, 'r')) {
+      file->blk = znzblock_open_read(path);
+    }
+    else if (use_compression == ZNZ_BLOCKED && strchr(mode, 'w') && getenv("FS_PLAIN_GZIP") == NULL) {
+      if ((file->blk = znzblock_open_write(path, mode)) == NULL) {
+        free(file);
+        return NULL;
+      }
+    }
+    if (file->blk == NULL && (file->zfptr = gzopen(path, mode)) == NULL) {
       free(file);
       file = NULL;
     }
@@ -94,6 +634,7 @@ znzFile znzdopen(int fd, const char *mode, int use_compression)
     return NULL;
   }
 #ifdef HAVE_ZLIB
+  file->blk = NULL;
   if (use_compression) {
     file->withz = 1;
     file->zfptr = gzdopen(fd, mode);
@@ -117,6 +658,9 @@ int Xznzclose(znzFile *file)
   int retval = 0;
   if (*file != NULL) {
 #ifdef HAVE_ZLIB
+    if ((*file)->blk != NULL) {
+      retval = znzblock_close((*file)->blk);
+    }
     if ((*file)->zfptr != NULL) {
       retval = gzclose((*file)->zfptr);
     }
@@ -137,6 +681,7 @@ size_t znzread(void *buf, size_t size, size_t nmemb, znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->blk != NULL) return znzblock_read(file->blk, buf, size * nmemb) / size;
   if (file->zfptr != NULL) return (size_t)(gzread(file->zfptr, buf, ((int)size) * ((int)nmemb)) / size);
 #endif
   return fread(buf, size, nmemb, file->nzfptr);
@@ -148,6 +693,7 @@ size_t znzwrite(void *buf, size_t size, size_t nmemb, znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->blk != NULL) return znzblock_write(file->blk, buf, size * nmemb) / size;
   if (file->zfptr != NULL) return (size_t)(gzwrite(file->zfptr, buf, size * nmemb) / size);
 #endif
   return fwrite(buf, size, nmemb, file->nzfptr);
@@ -159,6 +705,7 @@ long znzseek(znzFile file, long offset, int whence)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->blk != NULL) return znzblock_seek(file->blk, offset, whence);
   if (file->zfptr != NULL) return (long)gzseek(file->zfptr, offset, whence);
 #endif
   return fseek(file->nzfptr, offset, whence);
@@ -170,6 +717,7 @@ int znzrewind(znzFile stream)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (stream->blk != NULL) return (int)znzblock_seek(stream->blk, 0, SEEK_SET);
   if (stream->zfptr != NULL) return gzrewind(stream->zfptr);
 #endif
   rewind(stream->nzfptr);
@@ -182,6 +730,7 @@ long znztell(znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->blk != NULL) return (long)file->blk->pos;
   if (file->zfptr != NULL) return (long)gztell(file->zfptr);
 #endif
   return ftell(file->nzfptr);
@@ -193,6 +742,7 @@ int znzputs(char *str, znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->blk != NULL) return (int)znzblock_write(file->blk, str, strlen(str));
   if (file->zfptr != NULL) return gzputs(file->zfptr, str);
 #endif
   return fputs(str, file->nzfptr);
@@ -204,6 +754,16 @@ char *znzgets(char *str, int size, znzFile file)
     return NULL;
   }
 #ifdef HAVE_ZLIB
+  if (file->blk != NULL) {
+    int n = 0;
+    while (n < size - 1) {
+      if (znzblock_read(file->blk, str + n, 1) != 1) break;
+      if (str[n++] == '\n') break;
+    }
+    if (n == 0 || size < 1) return NULL;
+    str[n] = '\0';
+    return str;
+  }
   if (file->zfptr != NULL) return gzgets(file->zfptr, str, size);
 #endif
   return fgets(str, size, file->nzfptr);
@@ -215,6 +775,7 @@ int znzflush(znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->blk != NULL) return 0;
   if (file->zfptr != NULL) return gzflush(file->zfptr, Z_SYNC_FLUSH);
 #endif
   return fflush(file->nzfptr);
@@ -226,6 +787,7 @@ int znzeof(znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->blk != NULL) return file->blk->eof;
   if (file->zfptr != NULL) return gzeof(file->zfptr);
 #endif
   return feof(file->nzfptr);
@@ -237,6 +799,10 @@ int znzputc(int c, znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->blk != NULL) {
+    unsigned char uc = (unsigned char)c;
+    return znzblock_write(file->blk, &uc, 1) == 1 ? uc : -1;
+  }
   if (file->zfptr != NULL) return gzputc(file->zfptr, c);
 #endif
   return fputc(c, file->nzfptr);
@@ -248,11 +814,27 @@ int znzgetc(znzFile file)
     return 0;
   }
 #ifdef HAVE_ZLIB
+  if (file->blk != NULL) {
+    unsigned char uc;
+    return znzblock_read(file->blk, &uc, 1) == 1 ? uc : -1;
+  }
   if (file->zfptr != NULL) return gzgetc(file->zfptr);
 #endif
   return fgetc(file->nzfptr);
 }
 
+int znzcanseek(znzFile file)
+{
+  if (file == NULL) {
+    return 0;
+  }
+#ifdef HAVE_ZLIB
+  if (file->blk != NULL) return !file->blk->writing;
+  if (file->zfptr != NULL) return 0;
+#endif
+  return 1;
+}
+
 #if !defined(WIN32)
 int znzprintf(znzFile stream, const char *format, ...)
 {
@@ -266,7 +848,7 @@ int znzprintf(znzFile stream, const char *format, ...)
   }
   va_start(va, format);
 #ifdef HAVE_ZLIB
-  if (stream->zfptr != NULL) {
+  if (stream->zfptr != NULL || stream->blk != NULL) {
     int size;                        /* local to HAVE_ZLIB block */
     size = strlen(format) + 1000000; /* overkill I hope */
     tmpstr = (char *)calloc(1, size);
@@ -275,7 +857,10 @@ int znzprintf(znzFile stream, const char *format, ...)
       return retval;
     }
     vsprintf(tmpstr, format, va);
-    retval = gzprintf(stream->zfptr, "%s", tmpstr);
+    if (stream->blk != NULL)
+      retval = (int)znzblock_write(stream->blk, tmpstr, strlen(tmpstr));
+    else
+      retval = gzprintf(stream->zfptr, "%s", tmpstr);
     free(tmpstr);
   }
   else
@@ -791,6 +791,7 @@ void MRISinitSurface(MRIS *mris)
 {
   VERTEX *v;
 
+  MRISdetachNeighborArena(mris); // v->v is freed below
   for (int n = 0 ; n < mris->nvertices ; n++) {
     v=&mris->vertices[n];
     v->num=0;
@@ -991,6 +992,7 @@ MRIS * SurfaceToMRIS(Surface *surface, MRIS *mris)
                        surface->nfaces);
   }
   MRISreallocVerticesAndFaces(mris,surface->nvertices,surface->nfaces);
+  MRISdetachNeighborArena(mris); // vdst->v is freed below
 
   //Vertices
   for (int n = 0 ; n < surface->nvertices ; n++) {